@@ -1,16 +1,24 @@
 // ai_driver_test.c
-
+//
+// Benchmark harness for the AI kernel driver. Every thread opens its own
+// file descriptor, runs a warmup, then times each operation of a
+// configurable read/write/ioctl mix. A run is repeated for each thread count
+// so the output is a scaling curve: ops/sec, MB/s and latency percentiles
+// per thread count, as a table, CSV or JSON.
+
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <pthread.h>
-#include <math.h>
+#include <sched.h>
+#include <getopt.h>
 #include <sys/ioctl.h>
 #include <string.h>
 #include <errno.h>
 #include <time.h>
-#include <sys/sysinfo.h>
 
 // Define IOCTL commands
 #define AI_IOC_MAGIC 'a'
@@ -19,6 +27,14 @@
 #define AI_IOC_SEC_ENHANCE _IO(AI_IOC_MAGIC, 3)
 #define AI_IOC_PWR_MGMT _IO(AI_IOC_MAGIC, 4)
 #define AI_IOC_HW_ADAPT _IOW(AI_IOC_MAGIC, 5, struct hw_config)
+#define AI_IOC_GET_MODEL _IOR(AI_IOC_MAGIC, 12, struct ai_model_state)
+#define AI_IOC_BATCH _IOW(AI_IOC_MAGIC, 21, struct ai_batch)
+
+#define AI_OP_PERF_OPT 3
+#define AI_OP_PRED_MAINT 4
+#define AI_OP_SEC_ENHANCE 5
+#define AI_OP_PWR_MGMT 6
+#define AI_BATCH_MAX 8
 
 // Structure for hardware configuration parameters
 struct hw_config {
@@ -26,186 +42,561 @@ struct hw_config {
     unsigned int threshold;
 };
 
-// Number of I/O iterations
-#define IO_ITERATIONS 10000
+// Only threshold is used, to keep it when resizing the buffer
+struct ai_model_state {
+    uint64_t timestamp_ns;
+    uint64_t samples;
+    uint32_t period_ms;
+    uint32_t window;
+    uint32_t alpha_q16;
+    uint32_t beta_q16;
+    int64_t level_q16;
+    int64_t trend_q16;
+    int64_t ols_slope_q16;
+    int64_t ols_rate_q16;
+    uint64_t usage_count;
+    uint64_t threshold;
+    uint64_t forecast_usage;
+    uint64_t time_to_threshold_ms;
+};
+
+// AI_IOC_BATCH: commands in, one result per command out
+struct ai_batch_cmd {
+    uint8_t opcode;
+    uint8_t reserved[3];
+    uint32_t buffer_size;
+    uint32_t threshold;
+    uint32_t reserved2;
+};
 
-// Buffer size for read/write operations
-#define BUFFER_SIZE 4096  // 4 KB
+struct ai_batch_result {
+    int32_t res;
+    uint32_t power_state;
+    uint64_t predicted_usage;
+    uint32_t anomaly_score;
+    uint32_t buffer_size;
+};
 
-// Flag to enable or disable AI features
-int ai_features_enabled = 0;
+struct ai_batch {
+    uint32_t nr;
+    uint32_t flags;
+    uint64_t results;
+    struct ai_batch_cmd cmds[AI_BATCH_MAX];
+};
 
-// Mutex for synchronizing access to the device
-pthread_mutex_t device_mutex = PTHREAD_MUTEX_INITIALIZER;
+// Default device node exercised by the benchmark threads
+#define DEVICE_PATH "/dev/ai_driver"
+#define MAX_THREAD_COUNTS 64
+
+enum op_type { OP_READ, OP_WRITE, OP_IOCTL };
+enum out_format { FMT_TEXT, FMT_CSV, FMT_JSON };
+
+// AI ioctls that can be part of the mix
+static const struct {
+    const char *name;
+    unsigned long cmd;
+} ioctl_table[] = {
+    { "perf", AI_IOC_PERF_OPT },
+    { "pred", AI_IOC_PRED_MAINT },
+    { "sec", AI_IOC_SEC_ENHANCE },
+    { "pwr", AI_IOC_PWR_MGMT },
+    { "batch", AI_IOC_BATCH },
+};
+#define NR_IOCTLS (sizeof(ioctl_table) / sizeof(ioctl_table[0]))
+
+// Benchmark configuration
+static struct {
+    const char *device;
+    int thread_counts[MAX_THREAD_COUNTS];
+    int nr_thread_counts;
+    size_t size;
+    int read_pct;                    // Share of data operations that are reads
+    int ioctl_pct;                   // Share of all operations that are ioctls
+    unsigned long ioctls[NR_IOCTLS]; // Commands in the ioctl mix
+    int nr_ioctls;
+    long ops;                        // Timed operations per thread
+    long warmup;                     // Untimed operations per thread
+    int pin;
+    int enable_ai;
+    enum out_format format;
+    const char *output;
+} cfg = {
+    .device = DEVICE_PATH,
+    .size = 4096,
+    .read_pct = 50,
+    .ioctl_pct = 0,
+    .ops = 10000,
+    .warmup = 1000,
+    .format = FMT_TEXT,
+};
 
-// Dynamically get the number of CPU cores
-int get_num_cpu_cores() {
-    return sysconf(_SC_NPROCESSORS_ONLN);
+// One benchmark thread
+struct worker {
+    pthread_t thread;
+    int index;
+    pthread_barrier_t *start;
+    uint64_t *lat;                   // Latency of each timed operation in ns
+    long errors;
+    uint64_t bytes;
+    uint64_t t_start;                // When the timed loop started and ended
+    uint64_t t_end;
+    int failed;
+};
+
+// Result of one run at a given thread count
+struct result {
+    int threads;
+    long ops;
+    long errors;
+    double seconds;
+    double ops_per_sec;
+    double mb_per_sec;
+    double mean_ns;
+    uint64_t p50_ns;
+    uint64_t p90_ns;
+    uint64_t p99_ns;
+    uint64_t p999_ns;
+    uint64_t max_ns;
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
 }
 
-// Dynamically adjust computation iterations based on system load
-unsigned long get_computation_iterations() {
-    struct sysinfo info;
-    if (sysinfo(&info) == 0) {
-        return 100000000 * info.loads[0] / 1000000;  // Adjust iterations based on load
+// Per-thread xorshift so the mix is reproducible and costs nothing
+static uint32_t next_rand(uint64_t *state) {
+    uint64_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return (uint32_t)(x >> 32);
+}
+
+static enum op_type pick_op(uint64_t *rng) {
+    if (cfg.ioctl_pct && (int)(next_rand(rng) % 100) < cfg.ioctl_pct) {
+        return OP_IOCTL;
     }
-    return 100000000;  // Fallback to default
+    return (int)(next_rand(rng) % 100) < cfg.read_pct ? OP_READ : OP_WRITE;
 }
 
-void* computation_thread(void* arg) {
-    int thread_num = *((int*)arg);
+// perf, pred, sec and pwr in one AI_IOC_BATCH, as a control loop tick would
+static int run_batch(int fd) {
+    struct ai_batch_result results[4];
+    struct ai_batch batch = {
+        .nr = 4,
+        .results = (uintptr_t)results,
+        .cmds = {
+            { .opcode = AI_OP_PERF_OPT },
+            { .opcode = AI_OP_PRED_MAINT },
+            { .opcode = AI_OP_SEC_ENHANCE },
+            { .opcode = AI_OP_PWR_MGMT },
+        },
+    };
+
+    return ioctl(fd, AI_IOC_BATCH, &batch);
+}
 
-    // Get the computation iterations dynamically
-    unsigned long computation_iterations = get_computation_iterations();
+// Run one operation; returns the bytes moved or -1
+static ssize_t run_op(int fd, enum op_type op, char *buf, uint64_t *rng) {
+    unsigned long cmd;
+
+    switch (op) {
+        case OP_READ:
+            return pread(fd, buf, cfg.size, 0);
+        case OP_WRITE:
+            return pwrite(fd, buf, cfg.size, 0);
+        default:
+            cmd = cfg.ioctls[next_rand(rng) % cfg.nr_ioctls];
+            if (cmd == AI_IOC_BATCH) {
+                return run_batch(fd) < 0 ? -1 : 0;
+            }
+            return ioctl(fd, cmd) < 0 ? -1 : 0;
+    }
+}
+
+// Size the per-open buffer for the operation size, keeping the threshold
+static int setup_fd(int fd) {
+    struct ai_model_state model;
+    struct hw_config config;
 
-    // Heavy computational task
-    volatile double result = 0.0;
-    for (long i = 0; i < computation_iterations; i++) {
-        result += sin(i) * cos(i);
+    if (ioctl(fd, AI_IOC_GET_MODEL, &model) < 0) {
+        return -1;
     }
+    config.buffer_size = cfg.size;
+    config.threshold = model.threshold;
+    return ioctl(fd, AI_IOC_HW_ADAPT, &config);
+}
 
-    printf("Computation Thread %d completed computation. Result: %f\n", thread_num, result);
-    pthread_exit(NULL);
+// Issue each AI ioctl once, like the original stress test did
+static void invoke_ai_features(int fd) {
+    if (ioctl(fd, AI_IOC_PERF_OPT) < 0) {
+        perror("Failed to perform performance optimization");
+    }
+    if (ioctl(fd, AI_IOC_PRED_MAINT) < 0) {
+        perror("Failed to perform predictive maintenance");
+    }
+    if (ioctl(fd, AI_IOC_SEC_ENHANCE) < 0) {
+        perror("Failed to enhance security");
+    }
+    if (ioctl(fd, AI_IOC_PWR_MGMT) < 0) {
+        perror("Failed to manage power");
+    }
 }
 
-void* io_thread(void* arg) {
-    int thread_num = *((int*)arg);
-    int fd = *((int*)arg + 1);  // Get the file descriptor from arguments
+static void *worker_thread(void *arg) {
+    struct worker *w = arg;
+    uint64_t rng = 0x9e3779b97f4a7c15ULL * (w->index + 1);
+    char *buf;
+    int fd;
+    long i;
 
-    char *write_buffer = malloc(BUFFER_SIZE);
-    char *read_buffer = malloc(BUFFER_SIZE);
-    if (!write_buffer || !read_buffer) {
-        perror("Failed to allocate buffers");
-        pthread_exit(NULL);
+    if (cfg.pin) {
+        cpu_set_t set;
+
+        CPU_ZERO(&set);
+        CPU_SET(w->index % sysconf(_SC_NPROCESSORS_ONLN), &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
     }
-    memset(write_buffer, 'A', BUFFER_SIZE);
 
-    // Invoke AI features if enabled (only once per thread)
-    pthread_mutex_lock(&device_mutex);
-    if (ai_features_enabled) {
-        // Performance Optimization
-        if (ioctl(fd, AI_IOC_PERF_OPT) < 0) {
-            perror("Failed to perform performance optimization");
+    // Each thread opens its own context so threads don't contend on one fd
+    fd = open(cfg.device, O_RDWR);
+    buf = malloc(cfg.size);
+    if (fd < 0 || !buf || setup_fd(fd) < 0) {
+        perror("Failed to set up benchmark thread");
+        w->failed = 1;
+    } else {
+        memset(buf, 'A', cfg.size);
+        if (cfg.enable_ai) {
+            invoke_ai_features(fd);
         }
-
-        // Predictive Maintenance
-        if (ioctl(fd, AI_IOC_PRED_MAINT) < 0) {
-            perror("Failed to perform predictive maintenance");
+        for (i = 0; i < cfg.warmup; i++) {
+            run_op(fd, pick_op(&rng), buf, &rng);
         }
+    }
 
-        // Security Enhancements
-        if (ioctl(fd, AI_IOC_SEC_ENHANCE) < 0) {
-            perror("Failed to enhance security");
-        }
+    // Every thread starts timing together, failed ones included
+    pthread_barrier_wait(w->start);
+    if (w->failed) {
+        goto out;
+    }
 
-        // Power Management
-        if (ioctl(fd, AI_IOC_PWR_MGMT) < 0) {
-            perror("Failed to manage power");
+    w->t_start = now_ns();
+    for (i = 0; i < cfg.ops; i++) {
+        enum op_type op = pick_op(&rng);
+        uint64_t start = now_ns();
+        ssize_t ret = run_op(fd, op, buf, &rng);
+
+        w->lat[i] = now_ns() - start;
+        if (ret < 0) {
+            w->errors++;
+        } else {
+            w->bytes += ret;
         }
+    }
+    w->t_end = now_ns();
 
-        // Hardware Adaptation
-        struct hw_config config;
-        config.buffer_size = 8192;  // Increase buffer size
-        config.threshold = 10000;   // Set a new threshold
-        if (ioctl(fd, AI_IOC_HW_ADAPT, &config) < 0) {
-            perror("Failed to adapt hardware configuration");
-        }
+out:
+    free(buf);
+    if (fd >= 0) {
+        close(fd);
     }
-    pthread_mutex_unlock(&device_mutex);
+    return NULL;
+}
 
-    struct timespec start_time, end_time;
-    double total_time = 0.0;
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
 
-    // Perform I/O operations
-    for (long i = 0; i < IO_ITERATIONS; i++) {
-        clock_gettime(CLOCK_MONOTONIC, &start_time);
+    return x < y ? -1 : x > y;
+}
 
-        pthread_mutex_lock(&device_mutex);
+// Nearest-rank percentile of a sorted array
+static uint64_t percentile(const uint64_t *sorted, long n, double p) {
+    long rank = (long)(p * n + 0.999999);
 
-        // Write data
-        ssize_t bytes_written = write(fd, write_buffer, BUFFER_SIZE);
-        if (bytes_written < 0) {
-            perror("Write failed");
-            pthread_mutex_unlock(&device_mutex);
-            break;
+    if (rank < 1) {
+        rank = 1;
+    }
+    return sorted[(rank > n ? n : rank) - 1];
+}
+
+static int run_benchmark(int threads, struct result *res) {
+    struct worker *workers = calloc(threads, sizeof(*workers));
+    uint64_t *lat = malloc(sizeof(*lat) * threads * cfg.ops);
+    pthread_barrier_t start;
+    uint64_t t0 = UINT64_MAX, t1 = 0, bytes = 0;
+    double sum = 0;
+    long n = 0;
+    int i, ret = 0;
+
+    if (!workers || !lat) {
+        free(workers);
+        free(lat);
+        return -1;
+    }
+
+    // All threads finish their warmup before any of them starts timing
+    pthread_barrier_init(&start, NULL, threads);
+    for (i = 0; i < threads; i++) {
+        workers[i].index = i;
+        workers[i].start = &start;
+        workers[i].lat = lat + (size_t)i * cfg.ops;
+        if (pthread_create(&workers[i].thread, NULL, worker_thread, &workers[i]) != 0) {
+            perror("Failed to create benchmark thread");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (i = 0; i < threads; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    pthread_barrier_destroy(&start);
+
+    memset(res, 0, sizeof(*res));
+    res->threads = threads;
+    for (i = 0; i < threads; i++) {
+        if (workers[i].failed) {
+            ret = -1;
+            continue;
+        }
+        // Compact the successful threads' samples to the front
+        memmove(lat + n, workers[i].lat, sizeof(*lat) * cfg.ops);
+        n += cfg.ops;
+        res->errors += workers[i].errors;
+        bytes += workers[i].bytes;
+        // Throughput is measured from the first thread to start to the last to finish
+        if (workers[i].t_start < t0) {
+            t0 = workers[i].t_start;
+        }
+        if (workers[i].t_end > t1) {
+            t1 = workers[i].t_end;
         }
+    }
 
-        // Seek to beginning
-        lseek(fd, 0, SEEK_SET);
+    if (n) {
+        qsort(lat, n, sizeof(*lat), cmp_u64);
+        for (i = 0; i < n; i++) {
+            sum += lat[i];
+        }
+        res->ops = n;
+        res->seconds = (t1 - t0) / 1e9;
+        res->ops_per_sec = n / res->seconds;
+        res->mb_per_sec = bytes / res->seconds / 1e6;
+        res->mean_ns = sum / n;
+        res->p50_ns = percentile(lat, n, 0.50);
+        res->p90_ns = percentile(lat, n, 0.90);
+        res->p99_ns = percentile(lat, n, 0.99);
+        res->p999_ns = percentile(lat, n, 0.999);
+        res->max_ns = lat[n - 1];
+    }
+
+    free(workers);
+    free(lat);
+    return ret;
+}
 
-        // Read data
-        ssize_t bytes_read = read(fd, read_buffer, BUFFER_SIZE);
-        if (bytes_read < 0) {
-            perror("Read failed");
-            pthread_mutex_unlock(&device_mutex);
+static void print_results(FILE *out, const struct result *res, int count) {
+    int i;
+
+    switch (cfg.format) {
+        case FMT_CSV:
+            fprintf(out, "threads,ops,errors,seconds,ops_per_sec,mb_per_sec,mean_ns,p50_ns,p90_ns,p99_ns,p999_ns,max_ns\n");
+            for (i = 0; i < count; i++) {
+                fprintf(out, "%d,%ld,%ld,%.6f,%.1f,%.3f,%.1f,%llu,%llu,%llu,%llu,%llu\n",
+                        res[i].threads, res[i].ops, res[i].errors, res[i].seconds,
+                        res[i].ops_per_sec, res[i].mb_per_sec, res[i].mean_ns,
+                        (unsigned long long)res[i].p50_ns, (unsigned long long)res[i].p90_ns,
+                        (unsigned long long)res[i].p99_ns, (unsigned long long)res[i].p999_ns,
+                        (unsigned long long)res[i].max_ns);
+            }
             break;
+        case FMT_JSON:
+            fprintf(out, "{\n  \"device\": \"%s\",\n  \"size\": %zu,\n  \"read_pct\": %d,\n"
+                    "  \"ioctl_pct\": %d,\n  \"ops_per_thread\": %ld,\n  \"warmup\": %ld,\n  \"results\": [\n",
+                    cfg.device, cfg.size, cfg.read_pct, cfg.ioctl_pct, cfg.ops, cfg.warmup);
+            for (i = 0; i < count; i++) {
+                fprintf(out, "    {\"threads\": %d, \"ops\": %ld, \"errors\": %ld, \"seconds\": %.6f, "
+                        "\"ops_per_sec\": %.1f, \"mb_per_sec\": %.3f, \"mean_ns\": %.1f, "
+                        "\"p50_ns\": %llu, \"p90_ns\": %llu, \"p99_ns\": %llu, \"p999_ns\": %llu, \"max_ns\": %llu}%s\n",
+                        res[i].threads, res[i].ops, res[i].errors, res[i].seconds,
+                        res[i].ops_per_sec, res[i].mb_per_sec, res[i].mean_ns,
+                        (unsigned long long)res[i].p50_ns, (unsigned long long)res[i].p90_ns,
+                        (unsigned long long)res[i].p99_ns, (unsigned long long)res[i].p999_ns,
+                        (unsigned long long)res[i].max_ns, i + 1 < count ? "," : "");
+            }
+            fprintf(out, "  ]\n}\n");
+            break;
+        default:
+            fprintf(out, "device %s, %zu-byte ops, %d%% reads, %d%% ioctls, %ld ops/thread after %ld warmup\n",
+                    cfg.device, cfg.size, cfg.read_pct, cfg.ioctl_pct, cfg.ops, cfg.warmup);
+            fprintf(out, "%7s %12s %10s %9s %9s %9s %9s %9s %9s %7s\n",
+                    "threads", "ops/s", "MB/s", "mean_ns", "p50_ns", "p90_ns", "p99_ns", "p999_ns", "max_ns", "errors");
+            for (i = 0; i < count; i++) {
+                fprintf(out, "%7d %12.0f %10.2f %9.0f %9llu %9llu %9llu %9llu %9llu %7ld\n",
+                        res[i].threads, res[i].ops_per_sec, res[i].mb_per_sec, res[i].mean_ns,
+                        (unsigned long long)res[i].p50_ns, (unsigned long long)res[i].p90_ns,
+                        (unsigned long long)res[i].p99_ns, (unsigned long long)res[i].p999_ns,
+                        (unsigned long long)res[i].max_ns, res[i].errors);
+            }
+    }
+}
+
+// "1,2,4" or "max"; the default is powers of two up to the CPU count
+static int parse_threads(const char *arg) {
+    int ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    char *copy, *tok, *save;
+
+    cfg.nr_thread_counts = 0;
+    if (!arg) {
+        for (int t = 1; t < ncpu && cfg.nr_thread_counts < MAX_THREAD_COUNTS - 1; t *= 2) {
+            cfg.thread_counts[cfg.nr_thread_counts++] = t;
         }
+        cfg.thread_counts[cfg.nr_thread_counts++] = ncpu;
+        return 0;
+    }
 
-        pthread_mutex_unlock(&device_mutex);
+    copy = strdup(arg);
+    for (tok = strtok_r(copy, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        int t = strcmp(tok, "max") == 0 ? ncpu : atoi(tok);
 
-        clock_gettime(CLOCK_MONOTONIC, &end_time);
-        double elapsed_time = (end_time.tv_sec - start_time.tv_sec) +
-                              (end_time.tv_nsec - start_time.tv_nsec) / 1e9;
-        total_time += elapsed_time;
+        if (t < 1 || cfg.nr_thread_counts == MAX_THREAD_COUNTS) {
+            free(copy);
+            return -1;
+        }
+        cfg.thread_counts[cfg.nr_thread_counts++] = t;
     }
+    free(copy);
+    return cfg.nr_thread_counts ? 0 : -1;
+}
 
-    printf("I/O Thread %d completed I/O operations. Total time: %.6f seconds, Average time per operation: %.6f milliseconds\n",
-           thread_num, total_time, (total_time / IO_ITERATIONS) * 1000);
+// "pred,sec,pwr" selects which AI ioctls make up the ioctl share
+static int parse_ioctls(const char *arg) {
+    char *copy = strdup(arg), *tok, *save;
+    size_t i;
+
+    cfg.nr_ioctls = 0;
+    for (tok = strtok_r(copy, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        for (i = 0; i < NR_IOCTLS && cfg.nr_ioctls < (int)NR_IOCTLS; i++) {
+            if (strcmp(tok, ioctl_table[i].name) == 0) {
+                cfg.ioctls[cfg.nr_ioctls++] = ioctl_table[i].cmd;
+                break;
+            }
+        }
+        if (i >= NR_IOCTLS) {
+            free(copy);
+            return -1;
+        }
+    }
+    free(copy);
+    return cfg.nr_ioctls ? 0 : -1;
+}
 
-    free(write_buffer);
-    free(read_buffer);
-    pthread_exit(NULL);
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -d, --device PATH      device node (default " DEVICE_PATH ")\n"
+            "  -t, --threads LIST     thread counts, e.g. 1,2,4,max (default powers of two up to the CPU count)\n"
+            "  -s, --size BYTES       bytes per read/write (default 4096)\n"
+            "  -r, --read-pct N       percentage of data operations that are reads (default 50)\n"
+            "  -i, --ioctl-pct N      percentage of operations that are ioctls (default 0)\n"
+            "  -m, --ioctls LIST      ioctls in the mix: perf,pred,sec,pwr,batch (default pred,sec,pwr)\n"
+            "  -n, --ops N            timed operations per thread (default 10000)\n"
+            "  -w, --warmup N         untimed operations per thread first (default 1000)\n"
+            "  -p, --pin              pin thread i to CPU i\n"
+            "  -f, --format FMT       text, csv or json (default text)\n"
+            "  -o, --output FILE      write results to FILE instead of stdout\n"
+            "      --enable-ai        issue each AI ioctl once per thread before the warmup\n",
+            prog);
+    exit(EXIT_FAILURE);
 }
 
 int main(int argc, char *argv[]) {
-    // Check command-line arguments to enable or disable AI features
-    if (argc > 1 && strcmp(argv[1], "--enable-ai") == 0) {
-        ai_features_enabled = 1;
-        printf("AI features are enabled.\n");
-    } else {
-        printf("AI features are disabled.\n");
+    static const struct option longopts[] = {
+        { "device", required_argument, NULL, 'd' },
+        { "threads", required_argument, NULL, 't' },
+        { "size", required_argument, NULL, 's' },
+        { "read-pct", required_argument, NULL, 'r' },
+        { "ioctl-pct", required_argument, NULL, 'i' },
+        { "ioctls", required_argument, NULL, 'm' },
+        { "ops", required_argument, NULL, 'n' },
+        { "warmup", required_argument, NULL, 'w' },
+        { "pin", no_argument, NULL, 'p' },
+        { "format", required_argument, NULL, 'f' },
+        { "output", required_argument, NULL, 'o' },
+        { "enable-ai", no_argument, NULL, 'A' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+    struct result results[MAX_THREAD_COUNTS];
+    const char *threads_arg = NULL;
+    FILE *out = stdout;
+    int opt, i, status = EXIT_SUCCESS;
+
+    parse_ioctls("pred,sec,pwr");
+    while ((opt = getopt_long(argc, argv, "d:t:s:r:i:m:n:w:pf:o:h", longopts, NULL)) != -1) {
+        switch (opt) {
+            case 'd': cfg.device = optarg; break;
+            case 't': threads_arg = optarg; break;
+            case 's': cfg.size = strtoul(optarg, NULL, 0); break;
+            case 'r': cfg.read_pct = atoi(optarg); break;
+            case 'i': cfg.ioctl_pct = atoi(optarg); break;
+            case 'm':
+                if (parse_ioctls(optarg) < 0) {
+                    usage(argv[0]);
+                }
+                break;
+            case 'n': cfg.ops = atol(optarg); break;
+            case 'w': cfg.warmup = atol(optarg); break;
+            case 'p': cfg.pin = 1; break;
+            case 'f':
+                if (strcmp(optarg, "csv") == 0) {
+                    cfg.format = FMT_CSV;
+                } else if (strcmp(optarg, "json") == 0) {
+                    cfg.format = FMT_JSON;
+                } else if (strcmp(optarg, "text") == 0) {
+                    cfg.format = FMT_TEXT;
+                } else {
+                    usage(argv[0]);
+                }
+                break;
+            case 'o': cfg.output = optarg; break;
+            case 'A': cfg.enable_ai = 1; break;
+            default: usage(argv[0]);
+        }
+    }
+    if (parse_threads(threads_arg) < 0 || !cfg.size || cfg.ops < 1 || cfg.warmup < 0 ||
+        cfg.read_pct < 0 || cfg.read_pct > 100 || cfg.ioctl_pct < 0 || cfg.ioctl_pct > 100) {
+        usage(argv[0]);
     }
 
-    int fd = open("/dev/ai_driver", O_RDWR);
+    // Make sure the device is accessible before spawning threads
+    int fd = open(cfg.device, O_RDWR);
     if (fd < 0) {
-        perror("Failed to open /dev/ai_driver");
+        fprintf(stderr, "Failed to open %s: %s\n", cfg.device, strerror(errno));
         return EXIT_FAILURE;
     }
+    close(fd);
 
-    // Automatically determine number of threads based on CPU cores
-    int num_threads = get_num_cpu_cores();
-    printf("Number of threads: %d\n", num_threads);
-
-    pthread_t threads[num_threads * 2];
-    int thread_args[num_threads * 2][2];  // Each thread gets an array of two integers
-
-    // Create computation threads
-    for (int i = 0; i < num_threads; i++) {
-        thread_args[i][0] = i;  // Thread number
-        if (pthread_create(&threads[i], NULL, computation_thread, &thread_args[i][0]) != 0) {
-            perror("Failed to create computation thread");
-            close(fd);
-            return EXIT_FAILURE;
+    for (i = 0; i < cfg.nr_thread_counts; i++) {
+        if (run_benchmark(cfg.thread_counts[i], &results[i]) < 0) {
+            fprintf(stderr, "Some threads failed at %d threads\n", cfg.thread_counts[i]);
+            status = EXIT_FAILURE;
         }
     }
 
-    // Create I/O threads
-    for (int i = 0; i < num_threads; i++) {
-        thread_args[num_threads + i][0] = i;     // Thread number
-        thread_args[num_threads + i][1] = fd;    // File descriptor
-        if (pthread_create(&threads[num_threads + i], NULL, io_thread, thread_args[num_threads + i]) != 0) {
-            perror("Failed to create I/O thread");
-            close(fd);
+    if (cfg.output) {
+        out = fopen(cfg.output, "w");
+        if (!out) {
+            perror("Failed to open output file");
             return EXIT_FAILURE;
         }
     }
-
-    // Join threads
-    for (int i = 0; i < num_threads * 2; i++) {
-        pthread_join(threads[i], NULL);
+    print_results(out, results, cfg.nr_thread_counts);
+    if (out != stdout) {
+        fclose(out);
     }
-
-    close(fd);
-    printf("All threads have completed.\n");
-    return EXIT_SUCCESS;
+    return status;
 }
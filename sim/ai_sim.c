@@ -0,0 +1,261 @@
+/* ai_sim.c */
+// Builds the driver source as is against the kernel shim and wraps the
+// file operations in the ai_sim.h calls. Everything in the driver is
+// static, so it has to be compiled in this translation unit.
+#include "../src/ai_kernel_driver.c"
+#include "ai_sim.h"
+
+struct ai_sim_file {
+    struct inode inode;
+    struct file file;
+};
+
+#define AI_SIM_IOCTL(cmd, may_block) { cmd, #cmd, may_block }
+
+const struct ai_sim_ioctl ai_sim_ioctls[] = {
+    AI_SIM_IOCTL(AI_IOC_PERF_OPT, 0),
+    AI_SIM_IOCTL(AI_IOC_PRED_MAINT, 0),
+    AI_SIM_IOCTL(AI_IOC_SEC_ENHANCE, 0),
+    AI_SIM_IOCTL(AI_IOC_PWR_MGMT, 0),
+    AI_SIM_IOCTL(AI_IOC_HW_ADAPT, 0),
+    AI_SIM_IOCTL(AI_IOC_COMMIT, 0),
+    AI_SIM_IOCTL(AI_IOC_SET_CHANNEL, 0),
+    AI_SIM_IOCTL(AI_IOC_SETUP_QUEUE, 0),
+    AI_SIM_IOCTL(AI_IOC_QUEUE_ENTER, 1),    // Waits for completions only a mapping can submit
+    AI_SIM_IOCTL(AI_IOC_SET_EVENTFD, 0),
+    AI_SIM_IOCTL(AI_IOC_GET_ANALYTICS, 0),
+    AI_SIM_IOCTL(AI_IOC_GET_MODEL, 0),
+    AI_SIM_IOCTL(AI_IOC_GET_ANOMALIES, 0),
+    AI_SIM_IOCTL(AI_IOC_GET_FEATURES, 0),
+    AI_SIM_IOCTL(AI_IOC_GET_LIMITS, 0),
+    AI_SIM_IOCTL(AI_IOC_GET_STATS, 0),
+    AI_SIM_IOCTL(AI_IOC_GET_TUNER, 0),
+    AI_SIM_IOCTL(AI_IOC_GET_POWER, 0),
+    AI_SIM_IOCTL(AI_IOC_LOAD_INFER_MODEL, 0),
+    AI_SIM_IOCTL(AI_IOC_GET_INFERENCE, 0),
+    AI_SIM_IOCTL(AI_IOC_BATCH, 0),
+    AI_SIM_IOCTL(AI_IOC_GET_HISTORY, 0),
+    AI_SIM_IOCTL(AI_IOC_GET_STATUS, 0),
+};
+
+const unsigned int ai_sim_nr_ioctls = ARRAY_SIZE(ai_sim_ioctls);
+
+// Module parameter values before the first load; ai_driver_init() clamps
+// some of them in place
+static struct {
+    bool saved;
+    unsigned int num_devices;
+    unsigned int analytics_interval_ms;
+    unsigned int buffer_size_max;
+    unsigned int stream_size_max;
+    bool feature_extraction;
+    bool feature_simd;
+    bool autotune;
+} ai_sim_defaults;
+
+static bool ai_sim_loaded;
+
+int ai_sim_init(const struct ai_sim_params *params){
+    struct ai_sim_params p = { 0 };
+    int ret;
+
+    if (ai_sim_loaded){
+        return -EBUSY;
+    }
+    if (!ai_sim_defaults.saved){
+        ai_sim_defaults.num_devices = num_devices;
+        ai_sim_defaults.analytics_interval_ms = analytics_interval_ms;
+        ai_sim_defaults.buffer_size_max = buffer_size_max;
+        ai_sim_defaults.stream_size_max = stream_size_max;
+        ai_sim_defaults.feature_extraction = feature_extraction;
+        ai_sim_defaults.feature_simd = feature_simd;
+        ai_sim_defaults.autotune = autotune;
+        ai_sim_defaults.saved = true;
+    }
+    if (params){
+        p = *params;
+    }
+
+    num_devices = p.num_devices ? p.num_devices : ai_sim_defaults.num_devices;
+    analytics_interval_ms = p.analytics_interval_ms == AI_SIM_ON_DEMAND ? 0 :
+                            p.analytics_interval_ms ? p.analytics_interval_ms :
+                            ai_sim_defaults.analytics_interval_ms;
+    buffer_size_max = p.buffer_size_max ? p.buffer_size_max : ai_sim_defaults.buffer_size_max;
+    stream_size_max = p.stream_size_max ? p.stream_size_max : ai_sim_defaults.stream_size_max;
+    feature_extraction = p.feature_extraction ? true : ai_sim_defaults.feature_extraction;
+    feature_simd = p.no_simd ? false : ai_sim_defaults.feature_simd;
+    autotune = p.no_autotune ? false : ai_sim_defaults.autotune;
+    kshim_loglevel = p.loglevel ? p.loglevel : 4;
+    kshim_seed = p.seed ? p.seed : 1;
+
+    ret = ai_driver_init();
+    if (!ret){
+        ai_sim_loaded = true;
+    }
+    return ret;
+}
+
+void ai_sim_exit(void){
+    if (ai_sim_loaded){
+        ai_driver_exit();
+        ai_sim_loaded = false;
+    }
+}
+
+int ai_sim_open(unsigned int minor, unsigned int flags, struct ai_sim_file **filep){
+    struct ai_sim_file *f;
+    int ret;
+
+    if (!ai_sim_loaded || minor >= num_devices){
+        return -ENODEV;
+    }
+    f = calloc(1, sizeof(*f));
+    if (!f){
+        return -ENOMEM;
+    }
+    f->inode.i_cdev = &ai_devs[minor]->cdev;
+    f->file.f_flags = flags;
+
+    ret = fops.open(&f->inode, &f->file);
+    if (ret){
+        free(f);
+        return ret;
+    }
+    *filep = f;
+    return 0;
+}
+
+int ai_sim_release(struct ai_sim_file *f){
+    int ret = fops.release(&f->inode, &f->file);
+
+    free(f);
+    return ret;
+}
+
+// Every transfer goes through the driver's iov_iter entry points
+static ssize_t ai_sim_rw(struct ai_sim_file *f, const struct iovec *iov, int iovcnt, off_t *offset, bool write){
+    struct kiocb iocb = {
+        .ki_filp = &f->file,
+        .ki_pos = offset ? *offset : f->file.f_pos,
+    };
+    struct iov_iter iter;
+    size_t count = 0;
+    ssize_t ret;
+    int i;
+
+    if (iovcnt < 0){
+        return -EINVAL;
+    }
+    for (i = 0; i < iovcnt; i++){
+        count += iov[i].iov_len;
+    }
+    iov_iter_init(&iter, write ? WRITE : READ, iov, iovcnt, count < MAX_RW_COUNT ? count : MAX_RW_COUNT);
+    ret = write ? fops.write_iter(&iocb, &iter) : fops.read_iter(&iocb, &iter);
+
+    if (offset){
+        *offset = iocb.ki_pos;
+    } else {
+        f->file.f_pos = iocb.ki_pos;
+    }
+    return ret;
+}
+
+ssize_t ai_sim_read(struct ai_sim_file *f, void *buf, size_t len, off_t *offset){
+    struct iovec iov = { buf, len };
+
+    return ai_sim_rw(f, &iov, 1, offset, false);
+}
+
+ssize_t ai_sim_write(struct ai_sim_file *f, const void *buf, size_t len, off_t *offset){
+    struct iovec iov = { (void *)buf, len };
+
+    return ai_sim_rw(f, &iov, 1, offset, true);
+}
+
+ssize_t ai_sim_readv(struct ai_sim_file *f, const struct iovec *iov, int iovcnt, off_t *offset){
+    return ai_sim_rw(f, iov, iovcnt, offset, false);
+}
+
+ssize_t ai_sim_writev(struct ai_sim_file *f, const struct iovec *iov, int iovcnt, off_t *offset){
+    return ai_sim_rw(f, iov, iovcnt, offset, true);
+}
+
+off_t ai_sim_lseek(struct ai_sim_file *f, off_t offset, int whence){
+    return fops.llseek(&f->file, offset, whence);
+}
+
+long ai_sim_ioctl(struct ai_sim_file *f, unsigned int cmd, unsigned long arg){
+    long ret = fops.unlocked_ioctl(&f->file, cmd, arg);
+
+    // The VFS turns "not mine" into ENOTTY before user space sees it
+    return ret == -ENOIOCTLCMD ? -ENOTTY : ret;
+}
+
+unsigned int ai_sim_poll(struct ai_sim_file *f){
+    poll_table wait = { 0 };
+
+    return fops.poll(&f->file, &wait);
+}
+
+static struct device_attribute *ai_sim_attr(struct device *d, const char *name){
+    const struct attribute_group **group;
+    struct attribute **attr;
+
+    for (group = d->groups; group && *group; group++){
+        for (attr = (*group)->attrs; *attr; attr++){
+            if (!strcmp((*attr)->name, name)){
+                return container_of(*attr, struct device_attribute, attr);
+            }
+        }
+    }
+    return NULL;
+}
+
+ssize_t ai_sim_sysfs_read(unsigned int minor, const char *name, char *buf, size_t size){
+    struct device *d = kshim_device(minor);
+    struct device_attribute *attr;
+    char page[PAGE_SIZE];
+    ssize_t ret;
+
+    if (!d){
+        return -ENODEV;
+    }
+    attr = ai_sim_attr(d, name);
+    if (!attr || !attr->show){
+        return -ENOENT;
+    }
+    ret = attr->show(d, attr, page);
+    if (ret >= 0 && size){
+        ret = min_t(size_t, ret, size - 1);
+        memcpy(buf, page, ret);
+        buf[ret] = '\0';
+    }
+    return ret;
+}
+
+ssize_t ai_sim_sysfs_write(unsigned int minor, const char *name, const char *val){
+    struct device *d = kshim_device(minor);
+    struct device_attribute *attr;
+
+    if (!d){
+        return -ENODEV;
+    }
+    attr = ai_sim_attr(d, name);
+    if (!attr || !attr->store){
+        return -ENOENT;
+    }
+    return attr->store(d, attr, val, strlen(val));
+}
+
+int ai_sim_debugfs_read(unsigned int minor, const char *file, char *buf, size_t size){
+    struct device *d = kshim_device(minor);
+
+    if (!d){
+        return -ENODEV;
+    }
+    return kshim_debugfs_read(dev_name(d), file, buf, size);
+}
+
+void ai_sim_user_region(const void *start, size_t len){
+    kshim_user_region(start, len);
+}
@@ -0,0 +1,66 @@
+/* ai_sim.h */
+// User-space build of the AI kernel driver. libai_sim.a is the unchanged
+// src/ai_kernel_driver.c compiled against the kernel shim in kshim/; these
+// calls stand in for insmod, open(), read(), write(), ioctl() and close()
+// on /dev/ai_driver so the hot paths can be run under perf and sanitizers.
+#ifndef AI_SIM_H
+#define AI_SIM_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+// Module parameters for ai_sim_init(); zero fields keep the module's default
+struct ai_sim_params {
+    unsigned int num_devices;
+    unsigned int analytics_interval_ms;     // Use AI_SIM_ON_DEMAND for 0
+    unsigned int buffer_size_max;
+    unsigned int stream_size_max;
+    unsigned int feature_extraction;        // 1 to extract payload features
+    unsigned int no_simd;                   // 1 for the scalar feature kernel (feature_simd=0)
+    unsigned int no_autotune;               // 1 to keep the buffer size fixed (autotune=0)
+    int loglevel;                           // Highest printk level shown, default 4; negative for none
+    unsigned long long seed;                // get_random_bytes() seed, default 1
+};
+
+#define AI_SIM_ON_DEMAND (~0U)
+
+struct ai_sim_file;
+
+// The ioctl commands the driver handles
+struct ai_sim_ioctl {
+    unsigned int cmd;
+    const char *name;
+    int may_block;                          // Can wait forever with no other caller
+};
+
+extern const struct ai_sim_ioctl ai_sim_ioctls[];
+extern const unsigned int ai_sim_nr_ioctls;
+
+// Load and unload the driver; returns 0 or a negative errno
+int ai_sim_init(const struct ai_sim_params *params);
+void ai_sim_exit(void);
+
+// File operations; flags are open() flags, only O_NONBLOCK matters. A NULL
+// offset uses and advances the file position, as read() and write() do.
+int ai_sim_open(unsigned int minor, unsigned int flags, struct ai_sim_file **filep);
+int ai_sim_release(struct ai_sim_file *file);
+ssize_t ai_sim_read(struct ai_sim_file *file, void *buf, size_t len, off_t *offset);
+ssize_t ai_sim_write(struct ai_sim_file *file, const void *buf, size_t len, off_t *offset);
+ssize_t ai_sim_readv(struct ai_sim_file *file, const struct iovec *iov, int iovcnt, off_t *offset);
+ssize_t ai_sim_writev(struct ai_sim_file *file, const struct iovec *iov, int iovcnt, off_t *offset);
+off_t ai_sim_lseek(struct ai_sim_file *file, off_t offset, int whence);
+long ai_sim_ioctl(struct ai_sim_file *file, unsigned int cmd, unsigned long arg);
+unsigned int ai_sim_poll(struct ai_sim_file *file);
+
+// sysfs attributes and debugfs files of instance minor
+ssize_t ai_sim_sysfs_read(unsigned int minor, const char *attr, char *buf, size_t size);
+ssize_t ai_sim_sysfs_write(unsigned int minor, const char *attr, const char *val);
+int ai_sim_debugfs_read(unsigned int minor, const char *file, char *buf, size_t size);
+
+// Restrict the pointers the driver may copy to and from, like an address
+// space; copies outside every registered region fail with -EFAULT.
+// A zero len removes all regions and allows any pointer again.
+void ai_sim_user_region(const void *start, size_t len);
+
+#endif /* AI_SIM_H */
@@ -0,0 +1,526 @@
+// ai_sim_bench.c
+//
+// Microbenchmark of the driver hot paths, run in user space through
+// libai_sim.a. Each benchmark has every thread open its own file, warm
+// up, then time a loop of one operation; the result is ns per operation
+// and throughput. Run it under perf to profile the driver code directly:
+//
+//     perf record -g ./ai_sim_bench -b write -n 1000000
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include "ai_sim.h"
+
+// Define IOCTL commands
+#define AI_IOC_MAGIC 'a'
+#define AI_IOC_PERF_OPT _IO(AI_IOC_MAGIC, 1)
+#define AI_IOC_PRED_MAINT _IO(AI_IOC_MAGIC, 2)
+#define AI_IOC_SEC_ENHANCE _IO(AI_IOC_MAGIC, 3)
+#define AI_IOC_PWR_MGMT _IO(AI_IOC_MAGIC, 4)
+#define AI_IOC_HW_ADAPT _IOW(AI_IOC_MAGIC, 5, struct hw_config)
+#define AI_IOC_SET_CHANNEL _IO(AI_IOC_MAGIC, 7)
+#define AI_IOC_BATCH _IOW(AI_IOC_MAGIC, 21, struct ai_batch)
+
+#define AI_CHANNEL_STREAM 1
+
+#define AI_OP_PERF_OPT    3
+#define AI_OP_PRED_MAINT  4
+#define AI_OP_SEC_ENHANCE 5
+#define AI_OP_PWR_MGMT    6
+#define AI_OP_HW_ADAPT    7
+#define AI_BATCH_MAX      8
+
+// Structure for hardware configuration parameters
+struct hw_config {
+    unsigned int buffer_size;
+    unsigned int threshold;
+};
+
+struct ai_batch_cmd {
+    uint8_t opcode;
+    uint8_t reserved[3];
+    uint32_t buffer_size;
+    uint32_t threshold;
+    uint32_t reserved2;
+};
+
+struct ai_batch_result {
+    int32_t res;
+    uint32_t power_state;
+    uint64_t predicted_usage;
+    uint32_t anomaly_score;
+    uint32_t buffer_size;
+};
+
+struct ai_batch {
+    uint32_t nr;
+    uint32_t flags;
+    uint64_t results;
+    struct ai_batch_cmd cmds[AI_BATCH_MAX];
+};
+
+#define MAX_THREADS 64
+
+struct bench;
+
+// Per-thread state of a running benchmark
+struct worker {
+    pthread_t thread;
+    const struct bench *bench;
+    struct ai_sim_file *file;
+    char *buf;
+    long errors;
+    uint64_t bytes;
+    uint64_t t_start;
+    uint64_t t_end;
+};
+
+// One benchmark: op() runs a single operation and returns bytes moved or -errno
+struct bench {
+    const char *name;
+    const char *desc;
+    int io;                          // Report MB/s
+    int (*setup)(struct worker *w);
+    long (*op)(struct worker *w);
+};
+
+static struct {
+    int threads;
+    size_t size;
+    long ops;
+    long warmup;
+    int csv;
+    int verbose;
+    struct ai_sim_params params;
+} cfg = {
+    .threads = 1,
+    .size = 4096,
+    .ops = 100000,
+    .warmup = -1,
+};
+
+static pthread_barrier_t start_barrier;
+
+static uint64_t now_ns(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Size the private buffer for the benchmark's transfers
+static int setup_buffer(struct worker *w){
+    struct hw_config config = { .buffer_size = cfg.size, .threshold = 5000 };
+
+    return ai_sim_ioctl(w->file, AI_IOC_HW_ADAPT, (unsigned long)&config);
+}
+
+// Switch to the stream channel; the ring holds a record from every thread
+static int setup_stream(struct worker *w){
+    struct hw_config config = { .buffer_size = cfg.size * cfg.threads * 2, .threshold = 5000 };
+    long ret;
+
+    ret = ai_sim_ioctl(w->file, AI_IOC_SET_CHANNEL, AI_CHANNEL_STREAM);
+    if (ret){
+        return ret;
+    }
+    return ai_sim_ioctl(w->file, AI_IOC_HW_ADAPT, (unsigned long)&config);
+}
+
+static long op_read(struct worker *w){
+    off_t off = 0;
+
+    return ai_sim_read(w->file, w->buf, cfg.size, &off);
+}
+
+static long op_write(struct worker *w){
+    off_t off = 0;
+
+    return ai_sim_write(w->file, w->buf, cfg.size, &off);
+}
+
+// Write a record, then read back as many bytes; the records read may be
+// another thread's, but every thread reads what it wrote so none blocks
+static long op_stream(struct worker *w){
+    size_t done = 0;
+    long ret;
+
+    ret = ai_sim_write(w->file, w->buf, cfg.size, NULL);
+    if (ret < 0){
+        return ret;
+    }
+    while (done < cfg.size){
+        ret = ai_sim_read(w->file, w->buf, cfg.size - done, NULL);
+        if (ret < 0){
+            return ret;
+        }
+        done += ret;
+    }
+    return cfg.size * 2;
+}
+
+static long op_ioctl(struct worker *w, unsigned int cmd){
+    long ret = ai_sim_ioctl(w->file, cmd, 0);
+
+    return ret < 0 ? ret : 0;
+}
+
+static long op_perf_opt(struct worker *w){
+    return op_ioctl(w, AI_IOC_PERF_OPT);
+}
+
+static long op_pred_maint(struct worker *w){
+    return op_ioctl(w, AI_IOC_PRED_MAINT);
+}
+
+static long op_sec_enhance(struct worker *w){
+    return op_ioctl(w, AI_IOC_SEC_ENHANCE);
+}
+
+static long op_pwr_mgmt(struct worker *w){
+    return op_ioctl(w, AI_IOC_PWR_MGMT);
+}
+
+// Resize the buffer between two sizes, which remaps its chunks
+static long op_hw_adapt(struct worker *w){
+    static __thread int flip;
+    struct hw_config config = { .threshold = 5000 };
+    long ret;
+
+    config.buffer_size = (flip ^= 1) ? cfg.size : cfg.size * 2;
+    ret = ai_sim_ioctl(w->file, AI_IOC_HW_ADAPT, (unsigned long)&config);
+    return ret < 0 ? ret : 0;
+}
+
+// One control loop tick: every AI routine, each in its own ioctl
+static long op_tick(struct worker *w){
+    struct hw_config config = { .buffer_size = cfg.size, .threshold = 5000 };
+    static const unsigned int cmds[] = { AI_IOC_PERF_OPT, AI_IOC_PRED_MAINT, AI_IOC_SEC_ENHANCE, AI_IOC_PWR_MGMT };
+    unsigned int i;
+    long ret;
+
+    for (i = 0; i < sizeof(cmds) / sizeof(cmds[0]); i++){
+        ret = ai_sim_ioctl(w->file, cmds[i], 0);
+        if (ret < 0){
+            return ret;
+        }
+    }
+    ret = ai_sim_ioctl(w->file, AI_IOC_HW_ADAPT, (unsigned long)&config);
+    return ret < 0 ? ret : 0;
+}
+
+// The same tick as one AI_IOC_BATCH
+static long op_batch(struct worker *w){
+    static __thread struct ai_batch_result results[AI_BATCH_MAX];
+    struct ai_batch batch = {
+        .nr = 5,
+        .results = (uintptr_t)results,
+        .cmds = {
+            { .opcode = AI_OP_PERF_OPT },
+            { .opcode = AI_OP_PRED_MAINT },
+            { .opcode = AI_OP_SEC_ENHANCE },
+            { .opcode = AI_OP_PWR_MGMT },
+            { .opcode = AI_OP_HW_ADAPT, .buffer_size = cfg.size, .threshold = 5000 },
+        },
+    };
+    long ret = ai_sim_ioctl(w->file, AI_IOC_BATCH, (unsigned long)&batch);
+
+    return ret < 0 ? ret : results[4].res < 0 ? results[4].res : 0;
+}
+
+// Status queries, looked up by name so their structures needn't be copied here
+static unsigned int find_ioctl(const char *name){
+    unsigned int i;
+
+    for (i = 0; i < ai_sim_nr_ioctls; i++){
+        if (!strcmp(ai_sim_ioctls[i].name, name)){
+            return ai_sim_ioctls[i].cmd;
+        }
+    }
+    return 0;
+}
+
+static long op_query(struct worker *w, unsigned int cmd){
+    static __thread uint64_t out[512];
+    long ret = ai_sim_ioctl(w->file, cmd, (unsigned long)out);
+
+    return ret < 0 ? ret : 0;
+}
+
+static long op_analytics(struct worker *w){
+    static __thread unsigned int cmd;
+
+    if (!cmd){
+        cmd = find_ioctl("AI_IOC_GET_ANALYTICS");
+    }
+    return op_query(w, cmd);
+}
+
+static long op_status(struct worker *w){
+    static __thread unsigned int cmd;
+
+    if (!cmd){
+        cmd = find_ioctl("AI_IOC_GET_STATUS");
+    }
+    return op_query(w, cmd);
+}
+
+static const struct bench benches[] = {
+    { "write", "buffer channel write", 1, setup_buffer, op_write },
+    { "read", "buffer channel read", 1, setup_buffer, op_read },
+    { "stream", "stream channel write and read back", 1, setup_stream, op_stream },
+    { "perf_opt", "AI_IOC_PERF_OPT", 0, NULL, op_perf_opt },
+    { "pred_maint", "AI_IOC_PRED_MAINT", 0, NULL, op_pred_maint },
+    { "sec_enhance", "AI_IOC_SEC_ENHANCE", 0, NULL, op_sec_enhance },
+    { "pwr_mgmt", "AI_IOC_PWR_MGMT", 0, NULL, op_pwr_mgmt },
+    { "hw_adapt", "AI_IOC_HW_ADAPT resize", 0, setup_buffer, op_hw_adapt },
+    { "tick", "all five AI ioctls, one call each", 0, setup_buffer, op_tick },
+    { "batch", "all five AI commands in one AI_IOC_BATCH", 0, setup_buffer, op_batch },
+    { "analytics", "AI_IOC_GET_ANALYTICS", 0, NULL, op_analytics },
+    { "status", "AI_IOC_GET_STATUS lockless snapshot", 0, NULL, op_status },
+};
+#define NR_BENCHES (sizeof(benches) / sizeof(benches[0]))
+
+static void *worker_main(void *arg){
+    struct worker *w = arg;
+    const struct bench *b = w->bench;
+    long i, ret;
+
+    for (i = 0; i < cfg.warmup; i++){
+        b->op(w);
+    }
+    pthread_barrier_wait(&start_barrier);
+
+    w->t_start = now_ns();
+    for (i = 0; i < cfg.ops; i++){
+        ret = b->op(w);
+        if (ret < 0){
+            w->errors++;
+        } else {
+            w->bytes += ret;
+        }
+    }
+    w->t_end = now_ns();
+    return NULL;
+}
+
+// Returns 0, or -1 if a file could not be opened or set up
+static int run_bench(const struct bench *b){
+    struct worker workers[MAX_THREADS];
+    uint64_t start = UINT64_MAX, end = 0, bytes = 0;
+    long errors = 0;
+    double seconds, total;
+    int i, ret = 0;
+
+    memset(workers, 0, sizeof(workers));
+    for (i = 0; i < cfg.threads; i++){
+        struct worker *w = &workers[i];
+
+        w->bench = b;
+        w->buf = malloc(cfg.size);
+        if (!w->buf){
+            ret = -ENOMEM;
+            break;
+        }
+        memset(w->buf, 'A' + i % 26, cfg.size);
+        ret = ai_sim_open(0, 0, &w->file);
+        if (ret){
+            break;
+        }
+        if (b->setup){
+            ret = b->setup(w);
+            if (ret){
+                break;
+            }
+        }
+    }
+    if (ret){
+        fprintf(stderr, "%s: setup failed: %s\n", b->name, strerror(-ret));
+        cfg.threads = i + 1;
+        goto out;
+    }
+
+    pthread_barrier_init(&start_barrier, NULL, cfg.threads);
+    for (i = 0; i < cfg.threads; i++){
+        pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]);
+    }
+    for (i = 0; i < cfg.threads; i++){
+        struct worker *w = &workers[i];
+
+        pthread_join(w->thread, NULL);
+        if (w->t_start < start){
+            start = w->t_start;
+        }
+        if (w->t_end > end){
+            end = w->t_end;
+        }
+        errors += w->errors;
+        bytes += w->bytes;
+    }
+    pthread_barrier_destroy(&start_barrier);
+
+    total = (double)cfg.ops * cfg.threads;
+    seconds = (end - start) / 1e9;
+    if (cfg.csv){
+        printf("%s,%d,%zu,%.0f,%ld,%.1f,%.0f,%.1f\n", b->name, cfg.threads, cfg.size, total, errors,
+               (end - start) / total * cfg.threads, total / seconds,
+               b->io ? bytes / seconds / 1e6 : 0.0);
+    } else {
+        printf("%-12s %8.1f ns/op %12.0f ops/s", b->name,
+               (end - start) / total * cfg.threads, total / seconds);
+        if (b->io){
+            printf(" %10.1f MB/s", bytes / seconds / 1e6);
+        }
+        if (errors){
+            printf("  (%ld errors)", errors);
+        }
+        printf("\n");
+    }
+
+out:
+    for (i = 0; i < cfg.threads; i++){
+        if (workers[i].file){
+            ai_sim_release(workers[i].file);
+        }
+        free(workers[i].buf);
+    }
+    return ret ? -1 : 0;
+}
+
+static void print_driver_stats(void){
+    static char buf[16384];
+
+    if (!ai_sim_debugfs_read(0, "latency", buf, sizeof(buf))){
+        printf("\n# driver latency (debugfs latency)\n%s", buf);
+    }
+}
+
+static void usage(const char *prog){
+    size_t i;
+
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -b, --bench LIST     Benchmarks to run, comma separated (default: all)\n"
+            "  -t, --threads N      Threads, each with its own file (default 1)\n"
+            "  -s, --size BYTES     Bytes per read or write (default 4096)\n"
+            "  -n, --ops N          Timed operations per thread (default 100000)\n"
+            "  -w, --warmup N       Untimed operations per thread (default ops/10)\n"
+            "  -F, --features       Load with feature_extraction=1\n"
+            "  -S, --no-simd        Load with feature_simd=0\n"
+            "  -a, --analytics MS   Background analytics interval, 0 for on demand (default 1000)\n"
+            "  -c, --csv            CSV output\n"
+            "  -v, --verbose        Print the driver's own latency histograms afterwards\n"
+            "Benchmarks:\n", prog);
+    for (i = 0; i < NR_BENCHES; i++){
+        fprintf(stderr, "  %-12s %s\n", benches[i].name, benches[i].desc);
+    }
+}
+
+int main(int argc, char **argv){
+    static const struct option long_opts[] = {
+        { "bench", required_argument, NULL, 'b' },
+        { "threads", required_argument, NULL, 't' },
+        { "size", required_argument, NULL, 's' },
+        { "ops", required_argument, NULL, 'n' },
+        { "warmup", required_argument, NULL, 'w' },
+        { "features", no_argument, NULL, 'F' },
+        { "no-simd", no_argument, NULL, 'S' },
+        { "analytics", required_argument, NULL, 'a' },
+        { "csv", no_argument, NULL, 'c' },
+        { "verbose", no_argument, NULL, 'v' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+    const char *selected = NULL;
+    int threads;
+    size_t i;
+    int opt, ret;
+
+    while ((opt = getopt_long(argc, argv, "b:t:s:n:w:FSa:cvh", long_opts, NULL)) != -1){
+        switch (opt){
+            case 'b':
+                selected = optarg;
+                break;
+            case 't':
+                cfg.threads = atoi(optarg);
+                break;
+            case 's':
+                cfg.size = strtoul(optarg, NULL, 0);
+                break;
+            case 'n':
+                cfg.ops = atol(optarg);
+                break;
+            case 'w':
+                cfg.warmup = atol(optarg);
+                break;
+            case 'F':
+                cfg.params.feature_extraction = 1;
+                break;
+            case 'S':
+                cfg.params.no_simd = 1;
+                break;
+            case 'a':
+                cfg.params.analytics_interval_ms = atoi(optarg) ? (unsigned int)atoi(optarg) : AI_SIM_ON_DEMAND;
+                break;
+            case 'c':
+                cfg.csv = 1;
+                break;
+            case 'v':
+                cfg.verbose = 1;
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (cfg.threads < 1 || cfg.threads > MAX_THREADS || !cfg.size || cfg.ops < 1){
+        usage(argv[0]);
+        return 1;
+    }
+    if (cfg.warmup < 0){
+        cfg.warmup = cfg.ops / 10;
+    }
+
+    ret = ai_sim_init(&cfg.params);
+    if (ret){
+        fprintf(stderr, "ai_sim_init failed: %s\n", strerror(-ret));
+        return 1;
+    }
+
+    if (cfg.csv){
+        printf("bench,threads,size,ops,errors,ns_per_op,ops_per_sec,mb_per_sec\n");
+    }
+    threads = cfg.threads;
+    ret = 0;
+    for (i = 0; i < NR_BENCHES; i++){
+        const char *p = selected;
+        size_t len = strlen(benches[i].name);
+
+        // Match whole names in the comma separated list
+        while (p && (strncmp(p, benches[i].name, len) || (p[len] && p[len] != ','))){
+            p = strchr(p, ',');
+            p = p ? p + 1 : NULL;
+        }
+        if (selected && !p){
+            continue;
+        }
+        cfg.threads = threads;
+        if (run_bench(&benches[i])){
+            ret = 1;
+        }
+    }
+
+    if (cfg.verbose){
+        print_driver_stats();
+    }
+    ai_sim_exit();
+    return ret;
+}
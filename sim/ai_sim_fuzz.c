@@ -0,0 +1,358 @@
+// ai_sim_fuzz.c
+//
+// Fuzz driver for the AI kernel driver in user space. Each input is
+// decoded as a program of open, release, read, write, seek, ioctl, poll
+// and sysfs calls on a freshly loaded driver, so any input replays exactly.
+// Built against libai_sim.a it generates random inputs or replays files;
+// built with -DAI_SIM_LIBFUZZER (make libfuzzer) it is a libFuzzer target.
+//
+// All buffers handed to the driver live in one arena, the only memory
+// registered as user space, so stray user pointers fail with -EFAULT as
+// they would in the kernel instead of corrupting the process.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/ioctl.h>
+#include "ai_sim.h"
+
+#define MAX_FILES   8
+#define MAX_IO      (64 * 1024)
+#define ARENA_SIZE  (4 * MAX_IO)
+
+// A u64 in an ioctl argument whose top 16 bits are this tag is replaced by
+// a pointer to arena + its low 16 bits, so the fuzzer can build valid
+// embedded user pointers such as ai_anomaly_query.records
+#define PTR_TAG     0xa55aULL
+
+#define ARRAY_LEN(a) (sizeof(a) / sizeof((a)[0]))
+
+enum fuzz_op {
+    FUZZ_OPEN,
+    FUZZ_RELEASE,
+    FUZZ_READ,
+    FUZZ_WRITE,
+    FUZZ_IOCTL,
+    FUZZ_POLL,
+    FUZZ_SYSFS_WRITE,
+    FUZZ_SHOW,
+    FUZZ_SEEK,
+    FUZZ_NR_OPS,
+};
+
+static const char *const sysfs_attrs[] = {
+    "buffer_size", "threshold", "anomaly_threshold", "analytics_interval_ms", "power_mode",
+    "autotune", "infer_model",
+};
+
+static const char *const debugfs_files[] = {
+    "counters", "histograms", "latency", "model", "analytics",
+    "tuner", "power", "inference", "history",
+};
+
+static unsigned char arena[ARENA_SIZE] __attribute__((aligned(4096)));
+
+// Input cursor; reads past the end return zeros
+struct input {
+    const uint8_t *data;
+    size_t len;
+    size_t pos;
+};
+
+static uint8_t get_u8(struct input *in){
+    return in->pos < in->len ? in->data[in->pos++] : 0;
+}
+
+static uint16_t get_u16(struct input *in){
+    return get_u8(in) | get_u8(in) << 8;
+}
+
+static uint32_t get_u32(struct input *in){
+    return get_u16(in) | (uint32_t)get_u16(in) << 16;
+}
+
+static void get_bytes(struct input *in, void *buf, size_t len){
+    size_t n = in->pos < in->len ? in->len - in->pos : 0;
+
+    n = n < len ? n : len;
+    memcpy(buf, in->data + in->pos, n);
+    memset((char *)buf + n, 0, len - n);
+    in->pos += n;
+}
+
+static void check(int cond, const char *what, long ret){
+    if (!cond){
+        fprintf(stderr, "ai_sim_fuzz: %s (ret %ld)\n", what, ret);
+        abort();
+    }
+}
+
+// Errors must be small negative errnos, never a kernel-internal code
+static void check_ret(long ret, size_t max, const char *what){
+    check(ret >= -4095, what, ret);
+    check(ret < 0 || (size_t)ret <= max, what, ret);
+    check(ret != -512 && ret != -515, what, ret);     // ERESTARTSYS, ENOIOCTLCMD
+}
+
+// A user buffer of len bytes: in the arena, or straddling its end to get
+// -EFAULT. Kept 8-byte aligned like any real ioctl argument, so UBSan does
+// not flag the driver's member accesses on user pointers.
+static void *user_buf(struct input *in, size_t len){
+    uint8_t where = get_u8(in);
+
+    if (where == 0xff){
+        return arena + ARENA_SIZE - (len / 2 & ~(size_t)7);
+    }
+    return arena + (where % 16) * (ARENA_SIZE - MAX_IO) / 16;
+}
+
+static void fuzz_ioctl(struct input *in, struct ai_sim_file *file){
+    const struct ai_sim_ioctl *ioc = &ai_sim_ioctls[get_u8(in) % ai_sim_nr_ioctls];
+    size_t size = _IOC_SIZE(ioc->cmd);
+    unsigned long arg;
+    long ret;
+
+    if (ioc->may_block){
+        return;
+    }
+    if (_IOC_DIR(ioc->cmd) == _IOC_NONE){
+        // Plain integer argument: a channel, an eventfd or nothing
+        arg = (int8_t)get_u8(in);
+    } else {
+        unsigned char *p = user_buf(in, size);
+        size_t i;
+
+        if (p + size <= arena + ARENA_SIZE){
+            get_bytes(in, p, size);
+            for (i = 0; i + 8 <= size; i += 8){
+                uint64_t v;
+
+                memcpy(&v, p + i, 8);
+                if (v >> 48 == PTR_TAG){
+                    v = (uintptr_t)(arena + (v & 0xffff));
+                    memcpy(p + i, &v, 8);
+                }
+            }
+        }
+        arg = (unsigned long)p;
+    }
+    ret = ai_sim_ioctl(file, ioc->cmd, arg);
+    check_ret(ret, ~0UL >> 1, ioc->name);
+}
+
+static void run_input(const uint8_t *data, size_t len){
+    struct ai_sim_params params = { .analytics_interval_ms = AI_SIM_ON_DEMAND, .loglevel = -1 };
+    struct ai_sim_file *files[MAX_FILES] = { NULL };
+    struct input in = { data, len, 0 };
+    uint8_t flags = get_u8(&in);
+    int ops = 0;
+    int i, ret;
+
+    params.num_devices = 1 + (flags & 3);
+    params.feature_extraction = !!(flags & 4);
+    params.no_simd = !!(flags & 8);
+    params.no_autotune = !!(flags & 16);
+    params.seed = 1;
+    ret = ai_sim_init(&params);
+    check(ret == 0, "ai_sim_init", ret);
+    ai_sim_user_region(arena, sizeof(arena));
+
+    while (in.pos < in.len && ops++ < 1000){
+        uint8_t op = get_u8(&in);
+        int slot = (op >> 4) % MAX_FILES;
+        struct ai_sim_file *file = files[slot];
+        struct iovec iov[4];
+        int nr_iov;
+        off_t off;
+        size_t n;
+        void *buf;
+        long r;
+        char text[4096];
+
+        switch (op % FUZZ_NR_OPS){
+            case FUZZ_OPEN:
+                if (!file){
+                    r = ai_sim_open(get_u8(&in) % params.num_devices, O_NONBLOCK, &files[slot]);
+                    check_ret(r, 0, "open");
+                }
+                break;
+            case FUZZ_RELEASE:
+                if (file){
+                    ai_sim_release(file);
+                    files[slot] = NULL;
+                }
+                break;
+            case FUZZ_READ:
+            case FUZZ_WRITE:
+                if (!file){
+                    break;
+                }
+                n = get_u16(&in) % (MAX_IO + 1);
+                off = get_u32(&in) % (2 * 1024 * 1024);
+                buf = user_buf(&in, n);
+                if (op % FUZZ_NR_OPS == FUZZ_WRITE && (unsigned char *)buf + n <= arena + ARENA_SIZE){
+                    get_bytes(&in, buf, n < 256 ? n : 256);
+                }
+
+                // Split the transfer into up to four segments, empty ones included
+                nr_iov = 1 + get_u8(&in) % ARRAY_LEN(iov);
+                for (i = 0; i < nr_iov; i++){
+                    size_t seg = i == nr_iov - 1 ? n : get_u16(&in) % (n + 1);
+
+                    iov[i].iov_base = buf;
+                    iov[i].iov_len = seg;
+                    buf = (unsigned char *)buf + seg;
+                    n -= seg;
+                }
+                n = (unsigned char *)buf - (unsigned char *)iov[0].iov_base;
+                if (op % FUZZ_NR_OPS == FUZZ_READ){
+                    r = nr_iov == 1 ? ai_sim_read(file, iov[0].iov_base, n, &off) : ai_sim_readv(file, iov, nr_iov, &off);
+                    check_ret(r, n, "read");
+                } else {
+                    r = nr_iov == 1 ? ai_sim_write(file, iov[0].iov_base, n, &off) : ai_sim_writev(file, iov, nr_iov, &off);
+                    check_ret(r, n, "write");
+                }
+                break;
+            case FUZZ_SEEK:
+                if (file){
+                    i = get_u8(&in);
+                    r = ai_sim_lseek(file, (int32_t)get_u32(&in), i % 4);
+                    check_ret(r, ~0UL >> 1, "lseek");
+                }
+                break;
+            case FUZZ_IOCTL:
+                if (file){
+                    fuzz_ioctl(&in, file);
+                }
+                break;
+            case FUZZ_POLL:
+                if (file){
+                    ai_sim_poll(file);
+                }
+                break;
+            case FUZZ_SYSFS_WRITE:
+                snprintf(text, sizeof(text), "%u\n", get_u32(&in) % 100000);
+                r = ai_sim_sysfs_write(get_u8(&in) % params.num_devices,
+                                       sysfs_attrs[get_u8(&in) % ARRAY_LEN(sysfs_attrs)], text);
+                check_ret(r, strlen(text), "sysfs write");
+                break;
+            case FUZZ_SHOW:
+                i = get_u8(&in);
+                if (i & 1){
+                    r = ai_sim_sysfs_read(0, sysfs_attrs[(i >> 1) % ARRAY_LEN(sysfs_attrs)], text, sizeof(text));
+                } else {
+                    r = ai_sim_debugfs_read(0, debugfs_files[(i >> 1) % ARRAY_LEN(debugfs_files)], text, sizeof(text));
+                }
+                check_ret(r, sizeof(text), "show");
+                break;
+        }
+    }
+
+    for (i = 0; i < MAX_FILES; i++){
+        if (files[i]){
+            ai_sim_release(files[i]);
+        }
+    }
+    ai_sim_user_region(NULL, 0);
+    ai_sim_exit();
+}
+
+#ifdef AI_SIM_LIBFUZZER
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t len){
+    run_input(data, len);
+    return 0;
+}
+
+#else
+
+static uint64_t rng_state;
+
+static uint64_t rng(void){
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static int run_file(const char *path){
+    static uint8_t data[1 << 20];
+    FILE *f = fopen(path, "rb");
+    size_t len;
+
+    if (!f){
+        perror(path);
+        return 1;
+    }
+    len = fread(data, 1, sizeof(data), f);
+    fclose(f);
+    run_input(data, len);
+    return 0;
+}
+
+int main(int argc, char **argv){
+    static uint8_t data[8192];
+    long runs = 1000, run;
+    size_t max_len = 2048, len, i;
+    const char *save = NULL;
+    int opt, ret = 0;
+
+    rng_state = 0x9e3779b97f4a7c15ULL;
+    while ((opt = getopt(argc, argv, "r:s:l:o:h")) != -1){
+        switch (opt){
+            case 'r':
+                runs = atol(optarg);
+                break;
+            case 's':
+                rng_state = strtoull(optarg, NULL, 0) | 1;
+                break;
+            case 'l':
+                max_len = strtoul(optarg, NULL, 0);
+                if (max_len < 1 || max_len > sizeof(data)){
+                    max_len = sizeof(data);
+                }
+                break;
+            case 'o':
+                save = optarg;
+                break;
+            default:
+                fprintf(stderr,
+                        "Usage: %s [-r runs] [-s seed] [-l max_len] [-o file] [input...]\n"
+                        "  Replays the given inputs, or runs random ones. With -o every\n"
+                        "  random input is written to file before it runs, so the one\n"
+                        "  that crashed is left behind.\n", argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (optind < argc){
+        for (; optind < argc; optind++){
+            ret |= run_file(argv[optind]);
+        }
+        return ret;
+    }
+
+    for (run = 0; run < runs; run++){
+        len = 1 + rng() % max_len;
+        for (i = 0; i < len; i++){
+            data[i] = rng();
+        }
+        if (save){
+            FILE *f = fopen(save, "wb");
+
+            if (f){
+                fwrite(data, 1, len, f);
+                fclose(f);
+            }
+        }
+        run_input(data, len);
+    }
+    printf("ai_sim_fuzz: %ld inputs ok\n", runs);
+    return 0;
+}
+
+#endif
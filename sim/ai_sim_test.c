@@ -0,0 +1,125 @@
+// ai_sim_test.c
+//
+// Regression tests for driver behavior the fuzz driver can't judge, run
+// in user space through libai_sim.a. Each test loads the driver fresh,
+// drives it from one or more threads and checks what it reports back.
+//
+//     ./ai_sim_test              # every test
+//     ./ai_sim_test idle_reader  # just the named ones
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include "ai_sim.h"
+
+// Define IOCTL commands
+#define AI_IOC_MAGIC 'a'
+#define AI_IOC_SET_CHANNEL _IO(AI_IOC_MAGIC, 7)
+
+#define AI_CHANNEL_STREAM 1
+
+#define ARRAY_LEN(a) (sizeof(a) / sizeof((a)[0]))
+
+static char user_mem[2][4096];
+
+// Shared with the threads of the idle reader test
+static volatile int stop;
+static struct ai_sim_file *stream_file;
+
+static void *stream_reader(void *arg){
+    off_t off = 0;
+
+    while (!stop){
+        ai_sim_read(stream_file, user_mem[0], sizeof(user_mem[0]), &off);
+    }
+    return NULL;
+}
+
+// A trickle of small records, so the reader keeps going back to sleep
+static void *stream_writer(void *arg){
+    off_t off = 0;
+
+    while (!stop){
+        ai_sim_write(stream_file, user_mem[1], 8, &off);
+        usleep(20 * 1000);
+    }
+    return NULL;
+}
+
+// A reader blocked on an empty stream channel is idle. Its sleep must not
+// count as busy time, or the governor climbs out of the low power state.
+static int test_idle_reader(void){
+    struct ai_sim_params params = { .analytics_interval_ms = 50, .loglevel = -1 };
+    pthread_t reader, writer;
+    char mode[32] = "";
+    off_t off = 0;
+    int ret;
+
+    ret = ai_sim_init(&params);
+    if (ret){
+        fprintf(stderr, "ai_sim_init: %d\n", ret);
+        return 1;
+    }
+    ai_sim_user_region(user_mem, sizeof(user_mem));
+    if (ai_sim_open(0, 0, &stream_file) || ai_sim_ioctl(stream_file, AI_IOC_SET_CHANNEL, AI_CHANNEL_STREAM)){
+        fprintf(stderr, "cannot open the stream channel\n");
+        ai_sim_exit();
+        return 1;
+    }
+
+    // Two seconds is the minimum dwell in the normal state
+    stop = 0;
+    pthread_create(&reader, NULL, stream_reader, NULL);
+    pthread_create(&writer, NULL, stream_writer, NULL);
+    sleep(4);
+    ai_sim_sysfs_read(0, "power_mode", mode, sizeof(mode));
+
+    stop = 1;
+    pthread_join(writer, NULL);
+    ai_sim_write(stream_file, user_mem[1], 8, &off);   // Wakes the reader
+    pthread_join(reader, NULL);
+    ai_sim_release(stream_file);
+    ai_sim_exit();
+
+    if (strcmp(mode, "low\n")){
+        fprintf(stderr, "power_mode is %s with only a blocked reader, expected low\n",
+                mode[0] ? strtok(mode, "\n") : "unreadable");
+        return 1;
+    }
+    return 0;
+}
+
+static const struct {
+    const char *name;
+    int (*fn)(void);
+} tests[] = {
+    { "idle_reader", test_idle_reader },
+};
+
+int main(int argc, char **argv){
+    unsigned int i;
+    int failed = 0, ran = 0, j;
+
+    for (i = 0; i < ARRAY_LEN(tests); i++){
+        if (argc > 1){
+            for (j = 1; j < argc && strcmp(argv[j], tests[i].name); j++){
+            }
+            if (j == argc){
+                continue;
+            }
+        }
+        ran++;
+        if (tests[i].fn()){
+            printf("%-20s FAILED\n", tests[i].name);
+            failed++;
+        } else {
+            printf("%-20s ok\n", tests[i].name);
+        }
+    }
+    printf("ai_sim_test: %d of %d tests passed\n", ran - failed, ran);
+    return failed ? 1 : 0;
+}
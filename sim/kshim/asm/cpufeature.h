@@ -0,0 +1,2 @@
+/* cpufeature.h */
+#include "../kshim.h"
@@ -0,0 +1,2 @@
+/* api.h */
+#include "../../kshim.h"
@@ -0,0 +1,2 @@
+/* unaligned.h */
+#include "../kshim.h"
@@ -0,0 +1,739 @@
+/* kshim.c */
+// Out-of-line parts of the kernel shim: logging, user memory checks,
+// randomness, per-CPU slots, wait queues, delayed work, kthreads and the
+// device, sysfs and debugfs registries.
+#include "kshim.h"
+
+int kshim_loglevel = 4;         // KERN_WARNING and more severe
+u64 kshim_seed = 1;
+
+// Logging
+
+int printk(const char *fmt, ...){
+    va_list ap;
+    int level = 4;
+    int ret;
+
+    if (fmt[0] >= '0' && fmt[0] <= '7'){
+        level = fmt[0] - '0';
+        fmt++;
+    }
+    if (level > READ_ONCE(kshim_loglevel)){
+        return 0;
+    }
+    va_start(ap, fmt);
+    ret = vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    return ret;
+}
+
+// User memory. With no regions registered every pointer is accepted.
+
+#define KSHIM_USER_REGIONS 8
+
+static struct {
+    uintptr_t start;
+    uintptr_t end;
+} user_regions[KSHIM_USER_REGIONS];
+static int nr_user_regions;
+
+// Accept user pointers only inside [start, start + len), in addition to
+// any earlier regions; a zero len forgets all of them
+void kshim_user_region(const void *start, size_t len){
+    if (!len){
+        nr_user_regions = 0;
+        return;
+    }
+    if (nr_user_regions == KSHIM_USER_REGIONS){
+        fprintf(stderr, "kshim: too many user regions\n");
+        abort();
+    }
+    user_regions[nr_user_regions].start = (uintptr_t)start;
+    user_regions[nr_user_regions].end = (uintptr_t)start + len;
+    nr_user_regions++;
+}
+
+bool kshim_user_ok(const void *p, size_t len){
+    uintptr_t start = (uintptr_t)p;
+    int i;
+
+    if (!nr_user_regions){
+        return true;
+    }
+    if (start + len < start){
+        return false;
+    }
+    for (i = 0; i < nr_user_regions; i++){
+        if (start >= user_regions[i].start && start + len <= user_regions[i].end){
+            return true;
+        }
+    }
+    return false;
+}
+
+void iov_iter_init(struct iov_iter *i, unsigned int direction, const struct iovec *iov,
+                   unsigned long nr_segs, size_t count){
+    *i = (struct iov_iter){
+        .data_source = direction,
+        .iov = iov,
+        .nr_segs = nr_segs,
+        .count = count,
+    };
+}
+
+// Copy between addr and the iterator and advance it; returns the bytes copied
+static size_t iter_copy(void *addr, size_t bytes, struct iov_iter *i, bool to_iter){
+    size_t done = 0;
+    size_t n;
+    char *base;
+
+    bytes = bytes < i->count ? bytes : i->count;
+    while (done < bytes && i->nr_segs){
+        base = (char *)i->iov->iov_base + i->iov_offset;
+        n = i->iov->iov_len - i->iov_offset;
+        n = n < bytes - done ? n : bytes - done;
+        if (n && !kshim_user_ok(base, n)){
+            break;
+        }
+        if (to_iter){
+            memcpy(base, (char *)addr + done, n);
+        } else {
+            memcpy((char *)addr + done, base, n);
+        }
+        done += n;
+        i->count -= n;
+        i->iov_offset += n;
+        if (i->iov_offset == i->iov->iov_len){
+            i->iov++;
+            i->nr_segs--;
+            i->iov_offset = 0;
+        }
+    }
+    return done;
+}
+
+size_t copy_to_iter(const void *addr, size_t bytes, struct iov_iter *i){
+    return iter_copy((void *)addr, bytes, i, true);
+}
+
+size_t copy_from_iter(void *addr, size_t bytes, struct iov_iter *i){
+    return iter_copy(addr, bytes, i, false);
+}
+
+// Like access_ok(), only the length is checked; bad pointers fault on copy
+int import_single_range(int rw, void __user *buf, size_t len, struct iovec *iov, struct iov_iter *i){
+    iov->iov_base = buf;
+    iov->iov_len = len < MAX_RW_COUNT ? len : MAX_RW_COUNT;
+    iov_iter_init(i, rw, iov, 1, iov->iov_len);
+    return 0;
+}
+
+// Randomness, xorshift64* per thread so threads never share state
+
+static __thread u64 random_state;
+static u64 random_streams;
+
+void get_random_bytes(void *buf, int len){
+    u8 *p = buf;
+    u64 x;
+
+    if (!random_state){
+        u64 stream = __atomic_add_fetch(&random_streams, 1, __ATOMIC_RELAXED);
+
+        random_state = (kshim_seed ^ (stream * 0x9e3779b97f4a7c15ULL)) | 1;
+    }
+    while (len > 0){
+        random_state ^= random_state >> 12;
+        random_state ^= random_state << 25;
+        random_state ^= random_state >> 27;
+        x = random_state * 0x2545f4914f6cdd1dULL;
+        memcpy(p, &x, min(len, 8));
+        p += 8;
+        len -= 8;
+    }
+}
+
+// Time and per-CPU slots
+
+u64 ktime_get_ns(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int next_cpu;
+static __thread int this_cpu = -1;
+
+int kshim_cpu(void){
+    if (this_cpu < 0){
+        this_cpu = __atomic_fetch_add(&next_cpu, 1, __ATOMIC_RELAXED) % KSHIM_NR_CPUS;
+    }
+    return this_cpu;
+}
+
+// Page pool
+
+mempool_t *mempool_create_page_pool(int min_nr, int order){
+    mempool_t *pool = calloc(1, sizeof(*pool));
+
+    if (pool){
+        pool->min_nr = min_nr;
+    }
+    return pool;
+}
+
+void mempool_destroy(mempool_t *pool){
+    free(pool);
+}
+
+void *mempool_alloc(mempool_t *pool, int flags){
+    struct page *page = malloc(sizeof(*page));
+
+    if (!page){
+        return NULL;
+    }
+    if (posix_memalign(&page->addr, PAGE_SIZE, PAGE_SIZE)){
+        free(page);
+        return NULL;
+    }
+    memset(page->addr, 0xa5, PAGE_SIZE);
+    return page;
+}
+
+void mempool_free(void *element, mempool_t *pool){
+    struct page *page = element;
+
+    free(page->addr);
+    free(page);
+}
+
+// Wait queues
+
+void init_waitqueue_head(wait_queue_head_t *wq){
+    pthread_mutex_init(&wq->lock, NULL);
+    pthread_cond_init(&wq->cond, NULL);
+    wq->sleepers = 0;
+}
+
+// Called with wq->lock held
+void kshim_wait_timeout(wait_queue_head_t *wq){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_nsec += 2000000;
+    if (ts.tv_nsec >= 1000000000){
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(&wq->cond, &wq->lock, &ts);
+}
+
+void wake_up_interruptible(wait_queue_head_t *wq){
+    pthread_mutex_lock(&wq->lock);
+    pthread_cond_broadcast(&wq->cond);
+    pthread_mutex_unlock(&wq->lock);
+}
+
+// Delayed work. The thread is started on first queueing and sleeps until
+// the item is due, is requeued, or is cancelled.
+
+struct workqueue_struct {
+    int unused;
+};
+
+static struct workqueue_struct power_efficient_wq;
+struct workqueue_struct *system_power_efficient_wq = &power_efficient_wq;
+
+static void *delayed_work_thread(void *arg){
+    struct delayed_work *dwork = arg;
+    struct timespec ts;
+
+    pthread_mutex_lock(&dwork->lock);
+    while (!dwork->cancel){
+        if (!dwork->pending){
+            pthread_cond_wait(&dwork->cond, &dwork->lock);
+            continue;
+        }
+        if (ktime_get_ns() < dwork->due_ns){
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_sec += (dwork->due_ns - ktime_get_ns()) / 1000000000ULL;
+            ts.tv_nsec += (dwork->due_ns - ktime_get_ns()) % 1000000000ULL;
+            if (ts.tv_nsec >= 1000000000){
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000;
+            }
+            pthread_cond_timedwait(&dwork->cond, &dwork->lock, &ts);
+            continue;
+        }
+        dwork->pending = false;
+        pthread_mutex_unlock(&dwork->lock);
+        dwork->fn(&dwork->work);
+        pthread_mutex_lock(&dwork->lock);
+    }
+    pthread_mutex_unlock(&dwork->lock);
+    return NULL;
+}
+
+void kshim_init_delayed_work(struct delayed_work *dwork, void (*fn)(struct work_struct *)){
+    memset(dwork, 0, sizeof(*dwork));
+    dwork->fn = fn;
+    pthread_mutex_init(&dwork->lock, NULL);
+    pthread_cond_init(&dwork->cond, NULL);
+}
+
+static bool delayed_work_arm(struct delayed_work *dwork, unsigned long delay, bool modify){
+    bool was_pending;
+
+    pthread_mutex_lock(&dwork->lock);
+    was_pending = dwork->pending;
+    if (!was_pending || modify){
+        dwork->pending = true;
+        dwork->due_ns = ktime_get_ns() + (u64)delay * NSEC_PER_MSEC;
+    }
+    if (!dwork->started){
+        dwork->started = true;
+        dwork->cancel = false;
+        pthread_create(&dwork->thread, NULL, delayed_work_thread, dwork);
+    }
+    pthread_cond_signal(&dwork->cond);
+    pthread_mutex_unlock(&dwork->lock);
+    return modify ? was_pending : !was_pending;
+}
+
+bool queue_delayed_work(struct workqueue_struct *wq, struct delayed_work *dwork, unsigned long delay){
+    return delayed_work_arm(dwork, delay, false);
+}
+
+bool mod_delayed_work(struct workqueue_struct *wq, struct delayed_work *dwork, unsigned long delay){
+    return delayed_work_arm(dwork, delay, true);
+}
+
+// Waits for a running callback, which may requeue itself, then stops the thread
+bool cancel_delayed_work_sync(struct delayed_work *dwork){
+    bool was_pending;
+    bool started;
+
+    pthread_mutex_lock(&dwork->lock);
+    was_pending = dwork->pending;
+    started = dwork->started;
+    dwork->pending = false;
+    dwork->cancel = true;
+    dwork->started = false;
+    pthread_cond_signal(&dwork->cond);
+    pthread_mutex_unlock(&dwork->lock);
+
+    if (started && !pthread_equal(dwork->thread, pthread_self())){
+        pthread_join(dwork->thread, NULL);
+    }
+    return was_pending;
+}
+
+// Kernel threads
+
+static struct mm_struct kshim_mm;
+static __thread struct task_struct *this_task;
+static int next_pid = 1;
+
+struct task_struct *kshim_get_current(void){
+    if (!this_task){
+        // Freed with the thread's other resources at exit; never in use by then
+        static __thread struct task_struct task;
+
+        task.mm = &kshim_mm;
+        task.pid = __atomic_fetch_add(&next_pid, 1, __ATOMIC_RELAXED);
+        this_task = &task;
+    }
+    return this_task;
+}
+
+static void *kthread_main(void *arg){
+    struct task_struct *task = arg;
+    bool stop;
+
+    this_task = task;
+    pthread_mutex_lock(&task->lock);
+    while (!task->started){
+        pthread_cond_wait(&task->cond, &task->lock);
+    }
+    stop = task->stop;
+    pthread_mutex_unlock(&task->lock);
+
+    if (!stop){
+        task->fn(task->data);
+    }
+    return NULL;
+}
+
+struct task_struct *kthread_create(int (*fn)(void *), void *data, const char *fmt, ...){
+    struct task_struct *task = calloc(1, sizeof(*task));
+
+    if (!task){
+        return (struct task_struct *)(long)-ENOMEM;
+    }
+    task->fn = fn;
+    task->data = data;
+    task->pid = __atomic_fetch_add(&next_pid, 1, __ATOMIC_RELAXED);
+    pthread_mutex_init(&task->lock, NULL);
+    pthread_cond_init(&task->cond, NULL);
+    if (pthread_create(&task->thread, NULL, kthread_main, task)){
+        free(task);
+        return (struct task_struct *)(long)-EAGAIN;
+    }
+    return task;
+}
+
+int wake_up_process(struct task_struct *task){
+    pthread_mutex_lock(&task->lock);
+    task->started = true;
+    pthread_cond_signal(&task->cond);
+    pthread_mutex_unlock(&task->lock);
+    return 1;
+}
+
+int kthread_stop(struct task_struct *task){
+    pthread_mutex_lock(&task->lock);
+    task->stop = true;
+    task->started = true;
+    pthread_cond_signal(&task->cond);
+    pthread_mutex_unlock(&task->lock);
+
+    pthread_join(task->thread, NULL);
+    pthread_cond_destroy(&task->cond);
+    pthread_mutex_destroy(&task->lock);
+    free(task);
+    return 0;
+}
+
+bool kthread_should_stop(void){
+    return this_task && READ_ONCE(this_task->stop);
+}
+
+// Eventfds
+
+struct eventfd_ctx *eventfd_ctx_fdget(int fd){
+    struct eventfd_ctx *ctx;
+
+    if (fd < 0){
+        return (struct eventfd_ctx *)(long)-EBADF;
+    }
+    ctx = calloc(1, sizeof(*ctx));
+    if (!ctx){
+        return (struct eventfd_ctx *)(long)-ENOMEM;
+    }
+    ctx->fd = fd;
+    return ctx;
+}
+
+void eventfd_ctx_put(struct eventfd_ctx *ctx){
+    free(ctx);
+}
+
+// Devices and sysfs
+
+#define KSHIM_NR_DEVICES 64
+
+static struct class kshim_classes[4];
+static struct device kshim_devices[KSHIM_NR_DEVICES];
+
+struct class *kshim_class_create(const char *name){
+    static int nr_classes;
+    struct class *cls = &kshim_classes[nr_classes++ % ARRAY_SIZE(kshim_classes)];
+
+    cls->name = name;
+    return cls;
+}
+
+struct device *device_create_with_groups(struct class *cls, struct device *parent, dev_t devt,
+                                         void *drvdata, const struct attribute_group **groups,
+                                         const char *fmt, ...){
+    struct device *dev;
+    va_list ap;
+
+    if (MINOR(devt) >= KSHIM_NR_DEVICES){
+        return (struct device *)(long)-ENODEV;
+    }
+    dev = &kshim_devices[MINOR(devt)];
+    if (dev->live){
+        return (struct device *)(long)-EEXIST;
+    }
+    memset(dev, 0, sizeof(*dev));
+    va_start(ap, fmt);
+    vsnprintf(dev->name, sizeof(dev->name), fmt, ap);
+    va_end(ap);
+    dev->drvdata = drvdata;
+    dev->groups = groups;
+    dev->live = true;
+    return dev;
+}
+
+void device_destroy(struct class *cls, dev_t devt){
+    if (MINOR(devt) < KSHIM_NR_DEVICES){
+        kshim_devices[MINOR(devt)].live = false;
+    }
+}
+
+struct device *kshim_device(unsigned int minor){
+    if (minor >= KSHIM_NR_DEVICES || !kshim_devices[minor].live){
+        return NULL;
+    }
+    return &kshim_devices[minor];
+}
+
+int sysfs_emit(char *buf, const char *fmt, ...){
+    va_list ap;
+    int ret;
+
+    va_start(ap, fmt);
+    ret = vsnprintf(buf, PAGE_SIZE, fmt, ap);
+    va_end(ap);
+    return ret;
+}
+
+int kstrtouint(const char *s, unsigned int base, unsigned int *res){
+    unsigned long long val;
+    char *end;
+
+    if (*s == '-' || *s == '+' || *s == ' '){
+        return -EINVAL;
+    }
+    errno = 0;
+    val = strtoull(s, &end, base);
+    if (end == s || errno){
+        return errno == ERANGE ? -ERANGE : -EINVAL;
+    }
+    if (*end == '\n'){
+        end++;
+    }
+    if (*end){
+        return -EINVAL;
+    }
+    if (val > UINT_MAX){
+        return -ERANGE;
+    }
+    *res = val;
+    return 0;
+}
+
+// The kernel only looks at the first character (and the second of on/off)
+int kstrtobool(const char *s, bool *res){
+    switch (s[0]){
+        case 'y': case 'Y': case 't': case 'T': case '1':
+            *res = true;
+            return 0;
+        case 'n': case 'N': case 'f': case 'F': case '0':
+            *res = false;
+            return 0;
+        case 'o': case 'O':
+            if (s[1] == 'n' || s[1] == 'N'){
+                *res = true;
+                return 0;
+            }
+            if (s[1] == 'f' || s[1] == 'F'){
+                *res = false;
+                return 0;
+            }
+            break;
+    }
+    return -EINVAL;
+}
+
+char *strim(char *s){
+    size_t len = strlen(s);
+
+    while (len && (s[len - 1] == ' ' || s[len - 1] == '\t' || s[len - 1] == '\n')){
+        s[--len] = '\0';
+    }
+    while (*s == ' ' || *s == '\t' || *s == '\n'){
+        s++;
+    }
+    return s;
+}
+
+pthread_rwlock_t kshim_rcu_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+// Files
+
+loff_t generic_file_llseek_size(struct file *file, loff_t offset, int whence, loff_t maxsize, loff_t eof){
+    switch (whence){
+        case SEEK_SET:
+            break;
+        case SEEK_CUR:
+            offset += file->f_pos;
+            break;
+        case SEEK_END:
+            offset += eof;
+            break;
+        default:
+            return -EINVAL;
+    }
+    if (offset < 0 || offset > maxsize){
+        return -EINVAL;
+    }
+    file->f_pos = offset;
+    return offset;
+}
+
+int request_firmware(const struct firmware **fwp, const char *name, struct device *device){
+    const char *dir = getenv("KSHIM_FIRMWARE_PATH");
+    struct firmware *fw;
+    char path[4096];
+    FILE *f;
+    long len;
+    u8 *data;
+
+    if (strchr(name, '/') && strstr(name, "..")){
+        return -EINVAL;
+    }
+    snprintf(path, sizeof(path), "%s/%s", dir ? dir : ".", name);
+    f = fopen(path, "rb");
+    if (!f){
+        return -ENOENT;
+    }
+    if (fseek(f, 0, SEEK_END) || (len = ftell(f)) < 0 || fseek(f, 0, SEEK_SET)){
+        fclose(f);
+        return -EIO;
+    }
+    fw = malloc(sizeof(*fw));
+    data = malloc(len ? len : 1);
+    if (!fw || !data || fread(data, 1, len, f) != (size_t)len){
+        free(fw);
+        free(data);
+        fclose(f);
+        return -ENOMEM;
+    }
+    fclose(f);
+    fw->size = len;
+    fw->data = data;
+    *fwp = fw;
+    return 0;
+}
+
+void release_firmware(const struct firmware *fw){
+    if (fw){
+        free((void *)fw->data);
+        free((void *)fw);
+    }
+}
+
+// Reflected CRC-32, polynomial 0xedb88320, without the final inversion
+u32 crc32_le(u32 crc, const void *p, size_t len){
+    const u8 *b = p;
+    int i;
+
+    while (len--){
+        crc ^= *b++;
+        for (i = 0; i < 8; i++){
+            crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+        }
+    }
+    return crc;
+}
+
+// seq_file and debugfs
+
+void seq_printf(struct seq_file *m, const char *fmt, ...){
+    va_list ap;
+    int n;
+
+    if (m->count >= m->size){
+        return;
+    }
+    va_start(ap, fmt);
+    n = vsnprintf(m->buf + m->count, m->size - m->count, fmt, ap);
+    va_end(ap);
+    m->count = n < 0 ? m->size : min(m->count + n, m->size);
+}
+
+struct dentry {
+    char name[32];
+    struct dentry *parent;
+    struct dentry *next;            // All live dentries
+    void *data;
+    const struct file_operations *fops;
+};
+
+static struct dentry *dentries;
+static pthread_mutex_t dentries_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct dentry *debugfs_create(const char *name, struct dentry *parent,
+                                     void *data, const struct file_operations *fops){
+    struct dentry *d = calloc(1, sizeof(*d));
+
+    if (!d){
+        return (struct dentry *)(long)-ENOMEM;
+    }
+    snprintf(d->name, sizeof(d->name), "%s", name);
+    d->parent = IS_ERR(parent) ? NULL : parent;
+    d->data = data;
+    d->fops = fops;
+
+    pthread_mutex_lock(&dentries_lock);
+    d->next = dentries;
+    dentries = d;
+    pthread_mutex_unlock(&dentries_lock);
+    return d;
+}
+
+struct dentry *debugfs_create_dir(const char *name, struct dentry *parent){
+    return debugfs_create(name, parent, NULL, NULL);
+}
+
+struct dentry *debugfs_create_file(const char *name, unsigned short mode, struct dentry *parent,
+                                   void *data, const struct file_operations *fops){
+    return debugfs_create(name, parent, data, fops);
+}
+
+static bool dentry_below(const struct dentry *d, const struct dentry *root){
+    for (; d; d = d->parent){
+        if (d == root){
+            return true;
+        }
+    }
+    return false;
+}
+
+void debugfs_remove_recursive(struct dentry *dentry){
+    struct dentry **pp, *d, *removed = NULL;
+
+    if (!dentry || IS_ERR(dentry)){
+        return;
+    }
+    // Unlink the whole subtree first; children may sit on either side of it
+    pthread_mutex_lock(&dentries_lock);
+    pp = &dentries;
+    while ((d = *pp)){
+        if (dentry_below(d, dentry)){
+            *pp = d->next;
+            d->next = removed;
+            removed = d;
+        } else {
+            pp = &d->next;
+        }
+    }
+    pthread_mutex_unlock(&dentries_lock);
+
+    while ((d = removed)){
+        removed = d->next;
+        free(d);
+    }
+}
+
+// Runs the show function of <dir>/<file> into buf, NUL-terminated
+int kshim_debugfs_read(const char *dir, const char *file, char *buf, size_t size){
+    struct seq_file m = { .buf = buf, .size = size - 1 };
+    struct dentry *d;
+    int ret = -ENOENT;
+
+    pthread_mutex_lock(&dentries_lock);
+    for (d = dentries; d; d = d->next){
+        if (d->fops && d->parent && !strcmp(d->name, file) && !strcmp(d->parent->name, dir)){
+            m.private = d->data;
+            ret = d->fops->show(&m, NULL);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&dentries_lock);
+    buf[m.count] = '\0';
+    return ret;
+}
@@ -0,0 +1,898 @@
+/* kshim.h */
+// User-space stand-ins for the kernel APIs used by ai_kernel_driver.c, so
+// the unchanged driver source builds as an ordinary library. Every
+// <linux/...> and <asm/...> header the driver includes is a stub under
+// this directory that pulls in this file.
+//
+// Locks map to pthreads, allocations to libc, per-CPU data to per-thread
+// slots and the workqueue/kthread APIs to threads (see kshim.c). User
+// pointers are plain pointers; kshim_user_region() makes the copy helpers
+// fail with -EFAULT outside the registered ranges, as the fuzz driver wants.
+#ifndef KSHIM_H
+#define KSHIM_H
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+
+// Types and attributes
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef unsigned long long u64;          // As in the kernel, for the %llu formats
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef long long s64;
+typedef unsigned int __poll_t;
+
+#define __user
+#define __iomem
+#define __percpu
+#define __rcu
+#define __init
+#define __exit
+#define noinline                        __attribute__((noinline))
+#define __aligned(n)                    __attribute__((aligned(n)))
+#define ____cacheline_aligned_in_smp    __attribute__((aligned(SMP_CACHE_BYTES)))
+
+#define SMP_CACHE_BYTES 64
+#define PAGE_SHIFT      12
+#define PAGE_SIZE       (1UL << PAGE_SHIFT)
+#define PAGE_ALIGN(x)   (((x) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1))
+
+#define U16_MAX  0xffff
+#define U32_MAX  0xffffffffU
+#define U64_MAX  (~0ULL)
+#define S16_MAX  32767
+#define S16_MIN  (-32768)
+#define S32_MAX  0x7fffffff
+#define S32_MIN  (-S32_MAX - 1)
+
+#define NSEC_PER_USEC 1000ULL
+#define NSEC_PER_MSEC 1000000ULL
+#define NSEC_PER_SEC  1000000000ULL
+
+// Kernel-internal error codes that user space never sees
+#define ERESTARTSYS 512
+#define ENOIOCTLCMD 515
+
+// Module boilerplate; ai_sim.c calls the init and exit functions itself
+
+#define MODULE_LICENSE(x)
+#define MODULE_AUTHOR(x)
+#define MODULE_DESCRIPTION(x)
+#define MODULE_VERSION(x)
+#define MODULE_PARM_DESC(name, desc)
+#define module_param(name, type, perm)
+#define module_init(fn)
+#define module_exit(fn)
+#define THIS_MODULE NULL
+
+struct module;
+
+// Logging. The KERN_ level is the first character, as in the kernel;
+// printk() prints levels up to kshim_loglevel on stderr.
+
+#define KERN_EMERG   "0"
+#define KERN_ALERT   "1"
+#define KERN_CRIT    "2"
+#define KERN_ERR     "3"
+#define KERN_WARNING "4"
+#define KERN_NOTICE  "5"
+#define KERN_INFO    "6"
+#define KERN_DEBUG   "7"
+
+#ifndef pr_fmt
+#define pr_fmt(fmt) fmt
+#endif
+
+extern int kshim_loglevel;
+int printk(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+#define pr_info(fmt, ...)             printk(KERN_INFO pr_fmt(fmt), ##__VA_ARGS__)
+#define pr_err_ratelimited(fmt, ...)  printk(KERN_ERR pr_fmt(fmt), ##__VA_ARGS__)
+#define pr_warn_ratelimited(fmt, ...) printk(KERN_WARNING pr_fmt(fmt), ##__VA_ARGS__)
+#define pr_info_ratelimited(fmt, ...) printk(KERN_INFO pr_fmt(fmt), ##__VA_ARGS__)
+#define pr_debug(fmt, ...)            printk(KERN_DEBUG pr_fmt(fmt), ##__VA_ARGS__)
+
+// Helpers from kernel.h, minmax.h and friends
+
+#define ARRAY_SIZE(a)       (sizeof(a) / sizeof((a)[0]))
+#define BIT(n)              (1UL << (n))
+#define ALIGN(x, a)         (((x) + (a) - 1) & ~((__typeof__(x))(a) - 1))
+#define DIV_ROUND_UP(a, b)  (((a) + (b) - 1) / (b))
+#define DIV_ROUND_UP_ULL(a, b) DIV_ROUND_UP((unsigned long long)(a), (b))
+#define mult_frac(x, n, d) ({ typeof(x) q_ = (x) / (d), r_ = (x) % (d); q_ * (n) + r_ * (n) / (d); })
+#define container_of(ptr, type, member) ((type *)((char *)(ptr) - offsetof(type, member)))
+
+#define min(a, b)           ((a) < (b) ? (a) : (b))
+#define max(a, b)           ((a) > (b) ? (a) : (b))
+#define min_t(t, a, b)      ((t)(a) < (t)(b) ? (t)(a) : (t)(b))
+#define max_t(t, a, b)      ((t)(a) > (t)(b) ? (t)(a) : (t)(b))
+#define clamp_t(t, v, lo, hi) min_t(t, max_t(t, v, lo), hi)
+#undef abs
+#define abs(x)              ((x) < 0 ? -(x) : (x))
+
+#define READ_ONCE(x)        (*(volatile __typeof__(x) *)&(x))
+#define WRITE_ONCE(x, v)    (*(volatile __typeof__(x) *)&(x) = (v))
+
+#define IS_ERR(p)           ((unsigned long)(p) > (unsigned long)-4096)
+#define PTR_ERR(p)          ((long)(p))
+#define ERR_PTR(e)          ((void *)(long)(e))
+
+static inline unsigned long roundup_pow_of_two(unsigned long n){
+    return n <= 1 ? 1 : 1UL << (64 - __builtin_clzl(n - 1));
+}
+
+#define ilog2(n) (63 - __builtin_clzll((unsigned long long)(n)))
+
+static inline void prefetch_range(void *addr, size_t len){
+    char *p;
+
+    for (p = addr; p < (char *)addr + len; p += SMP_CACHE_BYTES){
+        __builtin_prefetch(p);
+    }
+}
+
+static inline u64 int_sqrt64(u64 x){
+    u64 r = 0, b = 1ULL << 62;
+
+    while (b > x){
+        b >>= 2;
+    }
+    while (b){
+        if (x >= r + b){
+            x -= r + b;
+            r = (r >> 1) + b;
+        } else {
+            r >>= 1;
+        }
+        b >>= 2;
+    }
+    return r;
+}
+
+// math64.h
+
+#define div64_u64(a, b) ((u64)(a) / (u64)(b))
+#define div64_s64(a, b) ((s64)(a) / (s64)(b))
+
+static inline u64 div_u64_rem(u64 a, u32 b, u32 *rem){
+    *rem = a % b;
+    return a / b;
+}
+
+static inline u64 mul_u64_u32_shr(u64 a, u32 mul, unsigned int shift){
+    return (u64)(((unsigned __int128)a * mul) >> shift);
+}
+
+static inline u64 mul_u64_u64_div_u64(u64 a, u64 b, u64 c){
+    return (u64)((unsigned __int128)a * b / c);
+}
+
+// unaligned.h; the driver only targets little-endian machines
+
+static inline u16 get_unaligned_le16(const void *p){
+    u16 v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline u32 get_unaligned_le32(const void *p){
+    u32 v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline u64 get_unaligned_le64(const void *p){
+    u64 v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+#define le16_to_cpu(x) (x)
+#define le32_to_cpu(x) (x)
+#define le64_to_cpu(x) (x)
+
+// Memory allocation
+
+typedef int gfp_t;
+
+#define GFP_KERNEL   0
+#define __GFP_ZERO   1
+#define GFP_NOWAIT   2
+#define __GFP_NOWARN 4
+#define NUMA_NO_NODE (-1)
+
+static inline void *kmalloc(size_t n, int flags){
+    return flags & __GFP_ZERO ? calloc(1, n ? n : 1) : malloc(n ? n : 1);
+}
+
+static inline void *kzalloc(size_t n, int flags){
+    return calloc(1, n ? n : 1);
+}
+
+static inline void *krealloc(const void *p, size_t n, int flags){
+    return realloc((void *)p, n ? n : 1);
+}
+
+static inline void kfree(const void *p){
+    free((void *)p);
+}
+
+#define kcalloc(n, size, flags)             calloc((n), (size))
+#define kzalloc_node(n, flags, node)        kzalloc((n), (flags))
+#define kcalloc_node(n, size, flags, node)  kcalloc((n), (size), (flags))
+#define kvmalloc_array(n, size, flags)      kmalloc((n) * (size), (flags))
+#define kvfree(p)                           kfree(p)
+
+static inline void *vmalloc_user(size_t n){
+    void *p;
+
+    if (posix_memalign(&p, PAGE_SIZE, n)){
+        return NULL;
+    }
+    return memset(p, 0, n);
+}
+
+#define vzalloc(n)              vmalloc_user(n)
+#define vzalloc_node(n, node)   vmalloc_user(n)
+
+static inline void vfree(const void *p){
+    free((void *)p);
+}
+
+struct kmem_cache {
+    size_t size;
+};
+
+static inline struct kmem_cache *kmem_cache_create(const char *name, size_t size, size_t align,
+                                                   unsigned long flags, void (*ctor)(void *)){
+    struct kmem_cache *cache = malloc(sizeof(*cache));
+
+    if (cache){
+        cache->size = size;
+    }
+    return cache;
+}
+
+static inline void kmem_cache_destroy(struct kmem_cache *cache){
+    free(cache);
+}
+
+static inline void *kmem_cache_zalloc(struct kmem_cache *cache, int flags){
+    return calloc(1, cache->size);
+}
+
+static inline void kmem_cache_free(struct kmem_cache *cache, void *p){
+    free(p);
+}
+
+// Pages are a descriptor holding a page-aligned allocation. The mempool
+// hands out fresh pages filled with a poison pattern, so code that reads
+// a chunk before writing it shows up in the fuzzer.
+
+struct page {
+    void *addr;
+};
+
+#define page_address(p) ((p)->addr)
+#define clear_page(a)   memset((a), 0, PAGE_SIZE)
+
+typedef struct {
+    int min_nr;
+} mempool_t;
+
+mempool_t *mempool_create_page_pool(int min_nr, int order);
+void mempool_destroy(mempool_t *pool);
+void *mempool_alloc(mempool_t *pool, int flags);
+void mempool_free(void *element, mempool_t *pool);
+
+// User memory
+
+void kshim_user_region(const void *start, size_t len);
+bool kshim_user_ok(const void *p, size_t len);
+
+static inline unsigned long copy_to_user(void __user *to, const void *from, unsigned long n){
+    if (!kshim_user_ok(to, n)){
+        return n;
+    }
+    memcpy(to, from, n);
+    return 0;
+}
+
+static inline unsigned long copy_from_user(void *to, const void __user *from, unsigned long n){
+    if (!kshim_user_ok(from, n)){
+        return n;
+    }
+    memcpy(to, from, n);
+    return 0;
+}
+
+#define get_user(x, ptr) ({                                                     \
+    __typeof__(*(ptr)) __v;                                                     \
+    int __r = copy_from_user(&__v, (ptr), sizeof(__v)) ? -EFAULT : 0;           \
+    (x) = __r ? 0 : __v;                                                        \
+    __r;                                                                        \
+})
+
+#define u64_to_user_ptr(x) ((void __user *)(uintptr_t)(x))
+
+static inline void *memdup_user(const void __user *src, size_t len){
+    void *p = malloc(len ? len : 1);
+
+    if (!p){
+        return ERR_PTR(-ENOMEM);
+    }
+    if (copy_from_user(p, src, len)){
+        free(p);
+        return ERR_PTR(-EFAULT);
+    }
+    return p;
+}
+
+// Vectored user memory. Only user iovecs exist here, and a copy stops at
+// the first piece outside the user regions, as a fault would stop it.
+
+#define READ            0               // Data is copied into the iterator
+#define WRITE           1               // Data is copied out of it
+#define MAX_RW_COUNT    (INT_MAX & ~(PAGE_SIZE - 1))
+
+struct iov_iter {
+    unsigned int data_source;
+    const struct iovec *iov;
+    unsigned long nr_segs;
+    size_t iov_offset;
+    size_t count;
+};
+
+static inline size_t iov_iter_count(const struct iov_iter *i){
+    return i->count;
+}
+
+void iov_iter_init(struct iov_iter *i, unsigned int direction, const struct iovec *iov,
+                   unsigned long nr_segs, size_t count);
+size_t copy_to_iter(const void *addr, size_t bytes, struct iov_iter *i);
+size_t copy_from_iter(void *addr, size_t bytes, struct iov_iter *i);
+int import_single_range(int rw, void __user *buf, size_t len, struct iovec *iov, struct iov_iter *i);
+
+// Every caller is privileged
+#define CAP_SYS_ADMIN 21
+#define capable(cap)  true
+
+// Randomness, from a per-thread generator seeded by kshim_seed
+
+extern u64 kshim_seed;
+void get_random_bytes(void *buf, int len);
+
+// Atomics and memory ordering
+
+typedef struct { int counter; } atomic_t;
+typedef struct { long long counter; } atomic64_t;
+typedef struct { long counter; } atomic_long_t;
+
+#define atomic_read(a)          __atomic_load_n(&(a)->counter, __ATOMIC_SEQ_CST)
+#define atomic_set(a, v)        __atomic_store_n(&(a)->counter, (v), __ATOMIC_SEQ_CST)
+#define atomic_add(i, a)        ((void)__atomic_add_fetch(&(a)->counter, (i), __ATOMIC_SEQ_CST))
+#define atomic_inc(a)           atomic_add(1, a)
+#define atomic_dec(a)           atomic_add(-1, a)
+#define atomic_inc_return(a)    __atomic_add_fetch(&(a)->counter, 1, __ATOMIC_SEQ_CST)
+#define atomic_dec_return(a)    __atomic_sub_fetch(&(a)->counter, 1, __ATOMIC_SEQ_CST)
+#define atomic_xchg(a, v)       __atomic_exchange_n(&(a)->counter, (v), __ATOMIC_SEQ_CST)
+#define atomic64_read(a)        __atomic_load_n(&(a)->counter, __ATOMIC_SEQ_CST)
+#define atomic64_set(a, v)      __atomic_store_n(&(a)->counter, (v), __ATOMIC_SEQ_CST)
+#define atomic64_xchg(a, v)     __atomic_exchange_n(&(a)->counter, (v), __ATOMIC_SEQ_CST)
+#define atomic64_add(i, a)      ((void)__atomic_add_fetch(&(a)->counter, (i), __ATOMIC_SEQ_CST))
+#define atomic_long_read(a)     __atomic_load_n(&(a)->counter, __ATOMIC_SEQ_CST)
+#define atomic_long_set(a, v)   __atomic_store_n(&(a)->counter, (v), __ATOMIC_SEQ_CST)
+#define atomic_long_cmpxchg(a, o, n) ({                                         \
+    long __old = (o);                                                           \
+    __atomic_compare_exchange_n(&(a)->counter, &__old, (n), 0,                  \
+                                __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);            \
+    __old;                                                                      \
+})
+
+#define smp_mb()                __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define smp_wmb()               __atomic_thread_fence(__ATOMIC_RELEASE)
+#define smp_rmb()               __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define cpu_relax()             sched_yield()
+#define smp_load_acquire(p)     __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define smp_store_release(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+// Locks
+
+struct mutex {
+    pthread_mutex_t m;
+};
+
+#define mutex_init(l)                   pthread_mutex_init(&(l)->m, NULL)
+#define mutex_destroy(l)                pthread_mutex_destroy(&(l)->m)
+#define mutex_lock(l)                   pthread_mutex_lock(&(l)->m)
+#define mutex_lock_interruptible(l)     (pthread_mutex_lock(&(l)->m), 0)
+#define mutex_trylock(l)                (pthread_mutex_trylock(&(l)->m) == 0)
+#define mutex_unlock(l)                 pthread_mutex_unlock(&(l)->m)
+
+typedef struct {
+    pthread_spinlock_t s;
+} spinlock_t;
+
+#define spin_lock_init(l)   pthread_spin_init(&(l)->s, PTHREAD_PROCESS_PRIVATE)
+#define spin_lock(l)        pthread_spin_lock(&(l)->s)
+#define spin_trylock(l)     (pthread_spin_trylock(&(l)->s) == 0)
+#define spin_unlock(l)      pthread_spin_unlock(&(l)->s)
+
+#define lockdep_is_held(l)  1
+
+// RCU and SRCU. Readers take a read lock, so synchronize_srcu() waits for
+// the readers in flight just like the real thing.
+
+#define rcu_access_pointer(p)           __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+#define rcu_dereference_protected(p, c) (p)
+#define rcu_assign_pointer(p, v)        __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+#define RCU_INIT_POINTER(p, v)          ((p) = (v))
+
+// Classic RCU is a global read-write lock: readers share it, and a grace
+// period is taking it once for writing. kfree_rcu() waits for one.
+struct rcu_head {
+    void *unused;
+};
+
+extern pthread_rwlock_t kshim_rcu_lock;
+
+#define rcu_read_lock()                 pthread_rwlock_rdlock(&kshim_rcu_lock)
+#define rcu_read_unlock()               pthread_rwlock_unlock(&kshim_rcu_lock)
+#define rcu_dereference(p)              __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+#define rcu_replace_pointer(p, v, c)    __atomic_exchange_n(&(p), (v), __ATOMIC_ACQ_REL)
+#define rcu_barrier()                   do { } while (0)
+
+static inline void synchronize_rcu(void){
+    pthread_rwlock_wrlock(&kshim_rcu_lock);
+    pthread_rwlock_unlock(&kshim_rcu_lock);
+}
+
+#define kfree_rcu(p, field)             do { synchronize_rcu(); kfree(p); } while (0)
+
+struct srcu_struct {
+    pthread_rwlock_t lock;
+};
+
+#define init_srcu_struct(s)     pthread_rwlock_init(&(s)->lock, NULL)
+#define cleanup_srcu_struct(s)  pthread_rwlock_destroy(&(s)->lock)
+#define srcu_dereference(p, s)  __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+
+static inline int srcu_read_lock(struct srcu_struct *s){
+    pthread_rwlock_rdlock(&s->lock);
+    return 0;
+}
+
+static inline void srcu_read_unlock(struct srcu_struct *s, int idx){
+    pthread_rwlock_unlock(&s->lock);
+}
+
+static inline void synchronize_srcu(struct srcu_struct *s){
+    pthread_rwlock_wrlock(&s->lock);
+    pthread_rwlock_unlock(&s->lock);
+}
+
+// Lists
+
+struct list_head {
+    struct list_head *next, *prev;
+};
+
+#define INIT_LIST_HEAD(l) do { (l)->next = (l); (l)->prev = (l); } while (0)
+#define list_entry(p, type, member) container_of(p, type, member)
+#define list_for_each_entry(pos, head, member)                                      \
+    for (pos = list_entry((head)->next, __typeof__(*pos), member);                  \
+         &pos->member != (head);                                                    \
+         pos = list_entry(pos->member.next, __typeof__(*pos), member))
+
+static inline void list_add_tail(struct list_head *n, struct list_head *head){
+    n->prev = head->prev;
+    n->next = head;
+    head->prev->next = n;
+    head->prev = n;
+}
+
+static inline void list_del_init(struct list_head *n){
+    n->prev->next = n->next;
+    n->next->prev = n->prev;
+    INIT_LIST_HEAD(n);
+}
+
+// Per-CPU data. Each thread gets its own slot the first time it asks, so
+// threads in the benchmark behave like tasks running on separate CPUs.
+
+#define KSHIM_NR_CPUS 64
+
+int kshim_cpu(void);
+
+#define alloc_percpu(type)          ((type *)calloc(KSHIM_NR_CPUS, sizeof(type)))
+#define free_percpu(p)              free(p)
+#define per_cpu_ptr(p, cpu)         (&(p)[cpu])
+#define get_cpu_ptr(p)              (&(p)[kshim_cpu()])
+#define put_cpu_ptr(p)              ((void)(p))
+#define preempt_disable()           do { } while (0)
+#define preempt_enable()            do { } while (0)
+#define for_each_possible_cpu(cpu)  for ((cpu) = 0; (cpu) < KSHIM_NR_CPUS; (cpu)++)
+
+// Slots are only written by their own thread, so the counters need no
+// retry loop in user space
+struct u64_stats_sync {
+    int unused;
+};
+
+#define u64_stats_init(s)               ((void)(s))
+#define u64_stats_update_begin(s)       ((void)(s))
+#define u64_stats_update_end(s)         ((void)(s))
+#define u64_stats_fetch_begin(s)        ((void)(s), 0)
+#define u64_stats_fetch_retry(s, start) ((void)(s), (void)(start), 0)
+
+// Two fake NUMA nodes, so instance placement is exercised
+
+#define KSHIM_NR_NODES 2
+#define num_online_nodes()          KSHIM_NR_NODES
+#define for_each_online_node(node)  for ((node) = 0; (node) < KSHIM_NR_NODES; (node)++)
+
+// x86 feature detection and FPU sections
+
+#if defined(__x86_64__) && !defined(KSHIM_NO_SIMD)
+#define CONFIG_X86_64 1
+#endif
+#define X86_FEATURE_XMM2    "sse2"
+#define X86_FEATURE_AVX     "avx"
+#define X86_FEATURE_AVX2    "avx2"
+#define boot_cpu_has(f)     __builtin_cpu_supports(f)
+#define kernel_fpu_begin()  do { } while (0)
+#define kernel_fpu_end()    do { } while (0)
+
+// Time; jiffies are milliseconds
+
+#define HZ 1000
+
+u64 ktime_get_ns(void);
+#define jiffies                 ((unsigned long)(ktime_get_ns() / NSEC_PER_MSEC))
+#define msecs_to_jiffies(m)     ((unsigned long)(m))
+#define time_before(a, b)       ((long)((a) - (b)) < 0)
+#define time_after(a, b)        time_before(b, a)
+#define cond_resched()          sched_yield()
+
+// Wait queues. Waiters also wake every 2 ms to recheck the condition, so
+// a wakeup the driver skips shows up as latency instead of a hang.
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int sleepers;
+} wait_queue_head_t;
+
+void init_waitqueue_head(wait_queue_head_t *wq);
+void kshim_wait_timeout(wait_queue_head_t *wq);
+void wake_up_interruptible(wait_queue_head_t *wq);
+
+#define wq_has_sleeper(wq) (smp_mb(), __atomic_load_n(&(wq)->sleepers, __ATOMIC_RELAXED) > 0)
+#define wait_event_interruptible(wq, condition) ({                              \
+    pthread_mutex_lock(&(wq).lock);                                             \
+    (wq).sleepers++;                                                            \
+    while (!(condition)){                                                       \
+        kshim_wait_timeout(&(wq));                                              \
+    }                                                                           \
+    (wq).sleepers--;                                                            \
+    pthread_mutex_unlock(&(wq).lock);                                           \
+    0;                                                                          \
+})
+
+// Delayed work, run by one thread per work item
+
+struct work_struct {
+    int unused;
+};
+
+struct delayed_work {
+    struct work_struct work;
+    void (*fn)(struct work_struct *);
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool started;
+    bool pending;
+    bool cancel;
+    u64 due_ns;
+};
+
+struct workqueue_struct;
+extern struct workqueue_struct *system_power_efficient_wq;
+
+#define INIT_DELAYED_WORK(d, f) kshim_init_delayed_work((d), (f))
+#define to_delayed_work(w)      container_of(w, struct delayed_work, work)
+
+void kshim_init_delayed_work(struct delayed_work *dwork, void (*fn)(struct work_struct *));
+bool queue_delayed_work(struct workqueue_struct *wq, struct delayed_work *dwork, unsigned long delay);
+bool mod_delayed_work(struct workqueue_struct *wq, struct delayed_work *dwork, unsigned long delay);
+bool cancel_delayed_work_sync(struct delayed_work *dwork);
+
+// Kernel threads. There is only one address space, so the mm calls are no-ops.
+
+struct mm_struct {
+    int unused;
+};
+
+struct task_struct {
+    pthread_t thread;
+    int (*fn)(void *);
+    void *data;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool started;
+    bool stop;
+    struct mm_struct *mm;
+    int pid;
+};
+
+// Threads that aren't kthreads get a task the first time they ask
+struct task_struct *kshim_get_current(void);
+#define current kshim_get_current()
+
+struct task_struct *kthread_create(int (*fn)(void *), void *data, const char *fmt, ...);
+int wake_up_process(struct task_struct *task);
+int kthread_stop(struct task_struct *task);
+bool kthread_should_stop(void);
+
+#define task_pid_nr(t)          ((t)->pid)
+#define task_tgid_nr(t)         ((t)->pid)
+#define mmgrab(mm)              ((void)(mm))
+#define mmdrop(mm)              ((void)(mm))
+#define mmget_not_zero(mm)      ((void)(mm), true)
+#define mmput(mm)               ((void)(mm))
+#define kthread_use_mm(mm)      ((void)(mm))
+#define kthread_unuse_mm(mm)    ((void)(mm))
+
+// Eventfds count signals instead of writing to the descriptor
+
+struct eventfd_ctx {
+    int fd;
+    u64 count;
+};
+
+struct eventfd_ctx *eventfd_ctx_fdget(int fd);
+void eventfd_ctx_put(struct eventfd_ctx *ctx);
+
+static inline void eventfd_signal(struct eventfd_ctx *ctx, u64 n){
+    __atomic_add_fetch(&ctx->count, n, __ATOMIC_SEQ_CST);
+}
+
+// Files and character devices
+
+#define MAJOR(dev)      ((unsigned int)((dev) >> 20))
+#define MINOR(dev)      ((unsigned int)((dev) & 0xfffff))
+#define MKDEV(ma, mi)   (((dev_t)(ma) << 20) | (mi))
+
+struct inode {
+    void *i_cdev;
+};
+
+struct file {
+    void *private_data;
+    loff_t f_pos;
+    unsigned int f_flags;
+};
+
+struct kiocb {
+    struct file *ki_filp;
+    loff_t ki_pos;
+    int ki_flags;
+};
+
+#define IOCB_NOWAIT (1 << 7)
+
+loff_t generic_file_llseek_size(struct file *file, loff_t offset, int whence, loff_t maxsize, loff_t eof);
+
+// Pipes are not simulated
+struct pipe_inode_info;
+#define generic_file_splice_read    NULL
+#define iter_file_splice_write      NULL
+
+typedef struct poll_table_struct {
+    int unused;
+} poll_table;
+
+#define poll_wait(filep, wq, wait)  ((void)(wq))
+#define EPOLLIN     POLLIN
+#define EPOLLOUT    POLLOUT
+#define EPOLLPRI    POLLPRI
+#define EPOLLRDNORM POLLRDNORM
+#define EPOLLWRNORM POLLWRNORM
+
+struct vm_area_struct;
+struct seq_file;
+
+struct file_operations {
+    struct module *owner;
+    int (*open)(struct inode *, struct file *);
+    int (*release)(struct inode *, struct file *);
+    loff_t (*llseek)(struct file *, loff_t, int);
+    ssize_t (*read_iter)(struct kiocb *, struct iov_iter *);
+    ssize_t (*write_iter)(struct kiocb *, struct iov_iter *);
+    ssize_t (*splice_read)(struct file *, loff_t *, struct pipe_inode_info *, size_t, unsigned int);
+    ssize_t (*splice_write)(struct pipe_inode_info *, struct file *, loff_t *, size_t, unsigned int);
+    long (*unlocked_ioctl)(struct file *, unsigned int, unsigned long);
+    int (*mmap)(struct file *, struct vm_area_struct *);
+    __poll_t (*poll)(struct file *, poll_table *);
+    int (*show)(struct seq_file *, void *);     // DEFINE_SHOW_ATTRIBUTE
+};
+
+struct cdev {
+    struct module *owner;
+    const struct file_operations *ops;
+};
+
+static inline void cdev_init(struct cdev *cdev, const struct file_operations *fops){
+    cdev->ops = fops;
+}
+
+#define cdev_add(cdev, dev, count)  ((void)(cdev), 0)
+#define cdev_del(cdev)              ((void)(cdev))
+
+#define alloc_chrdev_region(dev, first, count, name) (*(dev) = MKDEV(240, (first)), 0)
+#define unregister_chrdev_region(dev, count)         ((void)(dev))
+
+// Memory mappings. Nothing is mapped; vm_insert_page() and
+// remap_vmalloc_range() only check the bounds.
+
+#define VM_WRITE        0x00000002
+#define VM_SHARED       0x00000008
+#define VM_MAYWRITE     0x00000020
+#define VM_DONTEXPAND   0x00040000
+#define VM_DONTDUMP     0x04000000
+
+struct vm_operations_struct {
+    void (*open)(struct vm_area_struct *);
+    void (*close)(struct vm_area_struct *);
+};
+
+struct vm_area_struct {
+    unsigned long vm_start, vm_end, vm_pgoff, vm_flags;
+    void *vm_private_data;
+    const struct vm_operations_struct *vm_ops;
+};
+
+static inline unsigned long vma_pages(struct vm_area_struct *vma){
+    return (vma->vm_end - vma->vm_start) >> PAGE_SHIFT;
+}
+
+static inline int vm_insert_page(struct vm_area_struct *vma, unsigned long addr, struct page *page){
+    return addr >= vma->vm_start && addr < vma->vm_end ? 0 : -EFAULT;
+}
+
+static inline int remap_vmalloc_range(struct vm_area_struct *vma, void *addr, unsigned long pgoff){
+    return 0;
+}
+
+// Devices and sysfs. Devices are slots indexed by minor; kshim_device()
+// finds one so its attributes can be read and written.
+
+struct attribute {
+    const char *name;
+    unsigned short mode;
+};
+
+struct attribute_group {
+    struct attribute **attrs;
+};
+
+struct class {
+    const char *name;
+};
+
+struct device {
+    void *drvdata;
+    const struct attribute_group **groups;
+    char name[32];
+    bool live;
+};
+
+struct device_attribute {
+    struct attribute attr;
+    ssize_t (*show)(struct device *, struct device_attribute *, char *);
+    ssize_t (*store)(struct device *, struct device_attribute *, const char *, size_t);
+};
+
+struct class *kshim_class_create(const char *name);
+#define class_create(owner, name)   kshim_class_create(name)
+#define class_destroy(cls)          ((void)(cls))
+
+struct device *device_create_with_groups(struct class *cls, struct device *parent, dev_t devt,
+                                         void *drvdata, const struct attribute_group **groups,
+                                         const char *fmt, ...);
+#define device_create(cls, parent, devt, drvdata, ...) \
+    device_create_with_groups(cls, parent, devt, drvdata, NULL, __VA_ARGS__)
+void device_destroy(struct class *cls, dev_t devt);
+struct device *kshim_device(unsigned int minor);
+
+#define dev_get_drvdata(d)  ((d)->drvdata)
+#define dev_name(d)         ((const char *)(d)->name)
+
+#define __ATTR(_name, _mode, _show, _store) \
+    { .attr = { .name = #_name, .mode = _mode }, .show = _show, .store = _store }
+#define DEVICE_ATTR_RW(_name) \
+    struct device_attribute dev_attr_##_name = __ATTR(_name, 0644, _name##_show, _name##_store)
+#define DEVICE_ATTR_RO(_name) \
+    struct device_attribute dev_attr_##_name = __ATTR(_name, 0444, _name##_show, NULL)
+#define ATTRIBUTE_GROUPS(_name)                                                     \
+    static const struct attribute_group _name##_group = { .attrs = _name##_attrs }; \
+    static const struct attribute_group *_name##_groups[] = { &_name##_group, NULL }
+
+int sysfs_emit(char *buf, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+int kstrtouint(const char *s, unsigned int base, unsigned int *res);
+int kstrtobool(const char *s, bool *res);
+char *strim(char *s);
+
+// Firmware files are read from $KSHIM_FIRMWARE_PATH, or the current directory
+
+struct firmware {
+    size_t size;
+    const u8 *data;
+};
+
+int request_firmware(const struct firmware **fw, const char *name, struct device *device);
+void release_firmware(const struct firmware *fw);
+
+u32 crc32_le(u32 crc, const void *p, size_t len);
+
+// seq_file and debugfs. Files are kept in a list so kshim_debugfs_read()
+// can run their show function into a buffer.
+
+struct seq_file {
+    char *buf;
+    size_t size;
+    size_t count;
+    void *private;
+};
+
+void seq_printf(struct seq_file *m, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+#define seq_puts(m, s)  seq_printf((m), "%s", (s))
+#define seq_putc(m, c)  seq_printf((m), "%c", (c))
+
+#define DEFINE_SHOW_ATTRIBUTE(__name) \
+    static const struct file_operations __name##_fops = { .show = __name##_show }
+
+struct dentry;
+
+struct dentry *debugfs_create_dir(const char *name, struct dentry *parent);
+struct dentry *debugfs_create_file(const char *name, unsigned short mode, struct dentry *parent,
+                                   void *data, const struct file_operations *fops);
+void debugfs_remove_recursive(struct dentry *dentry);
+int kshim_debugfs_read(const char *dir, const char *file, char *buf, size_t size);
+
+// Tracepoints are compiled out; the arguments are still evaluated
+
+#define TP_PROTO(...)   (__VA_ARGS__)
+#define TP_ARGS(...)    __VA_ARGS__
+#define KSHIM_TRACE(name, proto)                                                \
+    static inline bool trace_##name##_enabled(void){ return false; }            \
+    static inline void trace_##name proto { }
+#define DECLARE_EVENT_CLASS(...)
+#define DEFINE_EVENT(template, name, proto, args) KSHIM_TRACE(name, proto)
+#define TRACE_EVENT(name, proto, args, tstruct, assign, print) KSHIM_TRACE(name, proto)
+
+#endif /* KSHIM_H */
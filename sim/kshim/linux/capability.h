@@ -0,0 +1,2 @@
+/* capability.h */
+#include "../kshim.h"
@@ -0,0 +1,2 @@
+/* cdev.h */
+#include "../kshim.h"
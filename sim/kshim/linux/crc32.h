@@ -0,0 +1,2 @@
+/* crc32.h */
+#include "../kshim.h"
@@ -0,0 +1,2 @@
+/* debugfs.h */
+#include "../kshim.h"
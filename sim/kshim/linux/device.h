@@ -0,0 +1,2 @@
+/* device.h */
+#include "../kshim.h"
@@ -0,0 +1,4 @@
+/* errno.h */
+// Also reached from the C library's <errno.h>, so it must provide the codes itself
+#include <asm/errno.h>
+#include "../kshim.h"
@@ -0,0 +1,2 @@
+/* eventfd.h */
+#include "../kshim.h"
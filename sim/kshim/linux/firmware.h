@@ -0,0 +1,2 @@
+/* firmware.h */
+#include "../kshim.h"
@@ -0,0 +1,2 @@
+/* fs.h */
+#include "../kshim.h"
@@ -0,0 +1,2 @@
+/* init.h */
+#include "../kshim.h"
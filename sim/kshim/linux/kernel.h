@@ -0,0 +1,2 @@
+/* kernel.h */
+#include "../kshim.h"
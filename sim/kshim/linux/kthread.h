@@ -0,0 +1,2 @@
+/* kthread.h */
+#include "../kshim.h"
@@ -0,0 +1,2 @@
+/* mempool.h */
+#include "../kshim.h"
@@ -0,0 +1,2 @@
+/* mm.h */
+#include "../kshim.h"
@@ -0,0 +1,2 @@
+/* mutex.h */
+#include "../kshim.h"
@@ -0,0 +1,2 @@
+/* percpu.h */
+#include "../kshim.h"
@@ -0,0 +1,2 @@
+/* poll.h */
+#include "../kshim.h"
@@ -0,0 +1,2 @@
+/* prefetch.h */
+#include "../kshim.h"
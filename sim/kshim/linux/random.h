@@ -0,0 +1,2 @@
+/* random.h */
+#include "../kshim.h"
@@ -0,0 +1,2 @@
+/* rcupdate.h */
+#include "../kshim.h"
@@ -0,0 +1,2 @@
+/* seq_file.h */
+#include "../kshim.h"
@@ -0,0 +1,2 @@
+/* slab.h */
+#include "../kshim.h"
@@ -0,0 +1,2 @@
+/* splice.h */
+#include "../kshim.h"
@@ -0,0 +1,2 @@
+/* srcu.h */
+#include "../kshim.h"
@@ -0,0 +1,2 @@
+/* string.h */
+#include "../kshim.h"
@@ -0,0 +1,2 @@
+/* timer.h */
+#include "../kshim.h"
@@ -0,0 +1,2 @@
+/* tracepoint.h */
+#include "../kshim.h"
@@ -0,0 +1,2 @@
+/* u64_stats_sync.h */
+#include "../kshim.h"
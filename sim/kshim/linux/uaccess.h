@@ -0,0 +1,2 @@
+/* uaccess.h */
+#include "../kshim.h"
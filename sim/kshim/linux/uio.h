@@ -0,0 +1,2 @@
+/* uio.h */
+#include "../kshim.h"
@@ -0,0 +1,2 @@
+/* vmalloc.h */
+#include "../kshim.h"
@@ -0,0 +1,2 @@
+/* wait.h */
+#include "../kshim.h"
@@ -0,0 +1,2 @@
+/* workqueue.h */
+#include "../kshim.h"
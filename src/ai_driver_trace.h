@@ -0,0 +1,229 @@
+/* ai_driver_trace.h */
+// Tracepoints for the AI kernel driver. They replace the per-operation
+// kernel log messages: disabled they cost a patched-out branch, enabled
+// they show up under /sys/kernel/tracing/events/ai_driver/ and in perf.
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM ai_driver
+
+#if !defined(_AI_DRIVER_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _AI_DRIVER_TRACE_H
+
+#include <linux/tracepoint.h>
+
+// Open and release of a file on a device instance
+DECLARE_EVENT_CLASS(ai_file,
+    TP_PROTO(unsigned int minor, int open_count),
+    TP_ARGS(minor, open_count),
+
+    TP_STRUCT__entry(
+        __field(unsigned int, minor)
+        __field(int, open_count)
+    ),
+
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->open_count = open_count;
+    ),
+
+    TP_printk("minor=%u open_count=%d", __entry->minor, __entry->open_count)
+);
+
+DEFINE_EVENT(ai_file, ai_open,
+    TP_PROTO(unsigned int minor, int open_count),
+    TP_ARGS(minor, open_count)
+);
+
+DEFINE_EVENT(ai_file, ai_release,
+    TP_PROTO(unsigned int minor, int open_count),
+    TP_ARGS(minor, open_count)
+);
+
+// One read() or write(); ret is the byte count or a negative errno
+DECLARE_EVENT_CLASS(ai_io,
+    TP_PROTO(unsigned int minor, unsigned int channel, size_t len, loff_t offset, ssize_t ret, u64 latency_ns),
+    TP_ARGS(minor, channel, len, offset, ret, latency_ns),
+
+    TP_STRUCT__entry(
+        __field(unsigned int, minor)
+        __field(unsigned int, channel)
+        __field(size_t, len)
+        __field(loff_t, offset)
+        __field(ssize_t, ret)
+        __field(u64, latency_ns)
+    ),
+
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->channel = channel;
+        __entry->len = len;
+        __entry->offset = offset;
+        __entry->ret = ret;
+        __entry->latency_ns = latency_ns;
+    ),
+
+    TP_printk("minor=%u channel=%u len=%zu offset=%lld ret=%zd latency_ns=%llu",
+              __entry->minor, __entry->channel, __entry->len, __entry->offset,
+              __entry->ret, __entry->latency_ns)
+);
+
+DEFINE_EVENT(ai_io, ai_read,
+    TP_PROTO(unsigned int minor, unsigned int channel, size_t len, loff_t offset, ssize_t ret, u64 latency_ns),
+    TP_ARGS(minor, channel, len, offset, ret, latency_ns)
+);
+
+DEFINE_EVENT(ai_io, ai_write,
+    TP_PROTO(unsigned int minor, unsigned int channel, size_t len, loff_t offset, ssize_t ret, u64 latency_ns),
+    TP_ARGS(minor, channel, len, offset, ret, latency_ns)
+);
+
+// One ioctl; nr is the command number within AI_IOC_MAGIC
+TRACE_EVENT(ai_ioctl,
+    TP_PROTO(unsigned int minor, unsigned int cmd, long ret, u64 latency_ns),
+    TP_ARGS(minor, cmd, ret, latency_ns),
+
+    TP_STRUCT__entry(
+        __field(unsigned int, minor)
+        __field(unsigned int, nr)
+        __field(long, ret)
+        __field(u64, latency_ns)
+    ),
+
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->nr = _IOC_NR(cmd);
+        __entry->ret = ret;
+        __entry->latency_ns = latency_ns;
+    ),
+
+    TP_printk("minor=%u nr=%u ret=%ld latency_ns=%llu",
+              __entry->minor, __entry->nr, __entry->ret, __entry->latency_ns)
+);
+
+// Decisions of one analytics pass
+TRACE_EVENT(ai_analytics,
+    TP_PROTO(unsigned int minor, u64 usage_count, u64 predicted_usage, u64 time_to_threshold_ms,
+             u32 anomaly_score, bool maintenance_due, bool anomaly_detected, bool low_power_mode),
+    TP_ARGS(minor, usage_count, predicted_usage, time_to_threshold_ms,
+            anomaly_score, maintenance_due, anomaly_detected, low_power_mode),
+
+    TP_STRUCT__entry(
+        __field(unsigned int, minor)
+        __field(u64, usage_count)
+        __field(u64, predicted_usage)
+        __field(u64, time_to_threshold_ms)
+        __field(u32, anomaly_score)
+        __field(bool, maintenance_due)
+        __field(bool, anomaly_detected)
+        __field(bool, low_power_mode)
+    ),
+
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->usage_count = usage_count;
+        __entry->predicted_usage = predicted_usage;
+        __entry->time_to_threshold_ms = time_to_threshold_ms;
+        __entry->anomaly_score = anomaly_score;
+        __entry->maintenance_due = maintenance_due;
+        __entry->anomaly_detected = anomaly_detected;
+        __entry->low_power_mode = low_power_mode;
+    ),
+
+    TP_printk("minor=%u usage=%llu predicted=%llu time_to_threshold_ms=%llu score=%u maintenance=%d anomaly=%d low_power=%d",
+              __entry->minor, __entry->usage_count, __entry->predicted_usage,
+              __entry->time_to_threshold_ms, __entry->anomaly_score,
+              __entry->maintenance_due, __entry->anomaly_detected, __entry->low_power_mode)
+);
+
+// A write flagged by the streaming anomaly detector
+TRACE_EVENT(ai_anomaly,
+    TP_PROTO(unsigned int minor, u64 seq, size_t len, u64 interval_us, u32 sensor, u32 score, u32 features),
+    TP_ARGS(minor, seq, len, interval_us, sensor, score, features),
+
+    TP_STRUCT__entry(
+        __field(unsigned int, minor)
+        __field(u64, seq)
+        __field(size_t, len)
+        __field(u64, interval_us)
+        __field(u32, sensor)
+        __field(u32, score)
+        __field(u32, features)
+    ),
+
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->seq = seq;
+        __entry->len = len;
+        __entry->interval_us = interval_us;
+        __entry->sensor = sensor;
+        __entry->score = score;
+        __entry->features = features;
+    ),
+
+    TP_printk("minor=%u seq=%llu len=%zu interval_us=%llu sensor=%u score=%u features=%#x",
+              __entry->minor, __entry->seq, __entry->len, __entry->interval_us,
+              __entry->sensor, __entry->score, __entry->features)
+);
+
+// A buffer size change by the autotuner
+TRACE_EVENT(ai_tune,
+    TP_PROTO(unsigned int minor, unsigned int old_size, unsigned int new_size, u32 reason,
+             u64 bytes_per_sec, u64 p99_extent),
+    TP_ARGS(minor, old_size, new_size, reason, bytes_per_sec, p99_extent),
+
+    TP_STRUCT__entry(
+        __field(unsigned int, minor)
+        __field(unsigned int, old_size)
+        __field(unsigned int, new_size)
+        __field(u32, reason)
+        __field(u64, bytes_per_sec)
+        __field(u64, p99_extent)
+    ),
+
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->old_size = old_size;
+        __entry->new_size = new_size;
+        __entry->reason = reason;
+        __entry->bytes_per_sec = bytes_per_sec;
+        __entry->p99_extent = p99_extent;
+    ),
+
+    TP_printk("minor=%u old_size=%u new_size=%u reason=%u bytes_per_sec=%llu p99_extent=%llu",
+              __entry->minor, __entry->old_size, __entry->new_size, __entry->reason,
+              __entry->bytes_per_sec, __entry->p99_extent)
+);
+
+// A performance state change by the power governor
+TRACE_EVENT(ai_pstate,
+    TP_PROTO(unsigned int minor, unsigned int old_state, unsigned int new_state, u32 load_permille, u32 util_permille),
+    TP_ARGS(minor, old_state, new_state, load_permille, util_permille),
+
+    TP_STRUCT__entry(
+        __field(unsigned int, minor)
+        __field(unsigned int, old_state)
+        __field(unsigned int, new_state)
+        __field(u32, load_permille)
+        __field(u32, util_permille)
+    ),
+
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->old_state = old_state;
+        __entry->new_state = new_state;
+        __entry->load_permille = load_permille;
+        __entry->util_permille = util_permille;
+    ),
+
+    TP_printk("minor=%u old_state=%u new_state=%u load=%u util=%u",
+              __entry->minor, __entry->old_state, __entry->new_state,
+              __entry->load_permille, __entry->util_permille)
+);
+
+#endif /* _AI_DRIVER_TRACE_H */
+
+// The header lives next to the driver rather than in include/trace/events
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE ai_driver_trace
+#include <trace/define_trace.h>
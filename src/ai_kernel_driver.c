@@ -1,26 +1,117 @@
 /* ai_kernel_driver.c */
+// Prefix for the pr_* messages, matching the printk ones
+#define pr_fmt(fmt) "AI_DRIVER: " fmt
+
 #include <linux/module.h>
 #include <linux/kernel.h>
 #include <linux/init.h>
 #include <linux/fs.h>           // For file operations
 #include <linux/uaccess.h>      // For copy_to_user, copy_from_user
+#include <linux/uio.h>          // For iov_iter
+#include <linux/splice.h>       // For splice and sendfile
 #include <linux/mutex.h>        // For mutexes
+#include <linux/spinlock.h>     // For spinlocks
+#include <linux/atomic.h>       // For atomic counters
 #include <linux/device.h>       // For device_create, class_create, etc.
 #include <linux/cdev.h>         // For cdev utilities
 #include <linux/slab.h>         // For kmalloc and kfree
+#include <linux/mm.h>           // For mmap support
+#include <linux/vmalloc.h>      // For vmalloc_user and remap_vmalloc_range
+#include <linux/mempool.h>      // For the buffer chunk reserve
 #include <linux/timer.h>        // For kernel timers
 #include <linux/workqueue.h>    // For workqueues
+#include <linux/wait.h>         // For wait queues
+#include <linux/srcu.h>         // For sleepable RCU
+#include <linux/log2.h>         // For roundup_pow_of_two
+#include <linux/prefetch.h>     // For the buffer read-ahead
+#include <linux/kthread.h>      // For the submission queue worker
+#include <linux/sched/mm.h>     // For mmgrab/mmget_not_zero
+#include <linux/poll.h>         // For poll/epoll support
+#include <linux/eventfd.h>      // For eventfd notification
+#include <linux/ktime.h>        // For event timestamps
+#include <linux/percpu.h>       // For per-CPU statistics
+#include <linux/u64_stats_sync.h> // For consistent 64-bit per-CPU reads
+#include <linux/math64.h>       // For div64_u64
+#include <linux/nodemask.h>     // For spreading instances over NUMA nodes
+#include <linux/debugfs.h>      // For the telemetry files
+#include <linux/seq_file.h>     // For debugfs show functions
+#include <asm/unaligned.h>      // For get_unaligned_le*
+#ifdef CONFIG_X86_64
+#include <asm/cpufeature.h>     // For boot_cpu_has
+#include <asm/fpu/api.h>        // For kernel_fpu_begin/end
+#endif
 #include <linux/errno.h>        // For error codes
 #include <linux/random.h>       // For random numbers
+#include <linux/firmware.h>     // For request_firmware
+#include <linux/crc32.h>        // For checking model blobs
+#include <linux/rcupdate.h>     // For swapping inference models
+#include <linux/capability.h>   // For capable
+#include <linux/string.h>       // For strim
+
+#define CREATE_TRACE_POINTS
+#include "ai_driver_trace.h"    // For the I/O, ioctl and model tracepoints
 
 #define DEVICE_NAME "ai_driver"
 #define CLASS_NAME  "ai"
+#define AI_MAX_DEVICES 64
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Waleed Ajmal");
 MODULE_DESCRIPTION("A Kernel Driver with AI Features");
 MODULE_VERSION("0.1");
 
+// Number of independent device instances. A single instance keeps the
+// /dev/ai_driver name; more are created as /dev/ai_driver0..N-1.
+static unsigned int num_devices = 1;
+module_param(num_devices, uint, 0444);
+MODULE_PARM_DESC(num_devices, "Number of device instances (1-64)");
+
+// Size limits enforced by AI_IOC_HW_ADAPT, and how many buffer chunks are
+// kept in reserve so buffers can still grow under memory pressure
+static unsigned int buffer_size_max = 1024 * 1024;
+module_param(buffer_size_max, uint, 0444);
+MODULE_PARM_DESC(buffer_size_max, "Largest per-open buffer in bytes");
+static unsigned int stream_size_max = 16 * 1024 * 1024;
+module_param(stream_size_max, uint, 0444);
+MODULE_PARM_DESC(stream_size_max, "Largest stream ring in bytes");
+static unsigned int chunk_reserve = 64;
+module_param(chunk_reserve, uint, 0444);
+MODULE_PARM_DESC(chunk_reserve, "Buffer chunks kept in reserve");
+
+// Interval of the background analytics pass; 0 runs it on demand from the ioctls.
+// This is the default for new instances; each one can be retuned through sysfs.
+static unsigned int analytics_interval_ms = 1000;
+module_param(analytics_interval_ms, uint, 0444);
+MODULE_PARM_DESC(analytics_interval_ms, "Background analytics interval in ms (0 = on demand)");
+
+// Per-request anomaly detection: z-score (x1000) that flags a write, and how
+// many flagged writes are kept for AI_IOC_GET_ANOMALIES. The threshold is the
+// default for new instances, retuned per instance through sysfs.
+static unsigned int anomaly_threshold = 5000;
+module_param(anomaly_threshold, uint, 0444);
+MODULE_PARM_DESC(anomaly_threshold, "Anomaly z-score threshold x1000");
+static unsigned int anomaly_log_size = 64;
+module_param(anomaly_log_size, uint, 0444);
+MODULE_PARM_DESC(anomaly_log_size, "Number of recent anomalous writes kept");
+
+// Payload feature extraction on written data, and whether it may use SIMD
+static bool feature_extraction;
+module_param(feature_extraction, bool, 0644);
+MODULE_PARM_DESC(feature_extraction, "Extract payload features from written data");
+static bool feature_simd = true;
+module_param(feature_simd, bool, 0444);
+MODULE_PARM_DESC(feature_simd, "Use SSE2/AVX2 feature kernels when the CPU has them");
+
+// Buffer autotuner default for new instances, switched per instance through sysfs
+static bool autotune = true;
+module_param(autotune, bool, 0444);
+MODULE_PARM_DESC(autotune, "Adapt the default buffer size to the observed write extents");
+
+// Inference model loaded into every instance at init, see load_infer_model()
+static char *infer_model;
+module_param(infer_model, charp, 0444);
+MODULE_PARM_DESC(infer_model, "Firmware file with an inference model (default: built-in rules)");
+
 // Define IOCTL commands
 #define AI_IOC_MAGIC 'a'
 #define AI_IOC_PERF_OPT _IO(AI_IOC_MAGIC, 1)
@@ -28,6 +119,199 @@ MODULE_VERSION("0.1");
 #define AI_IOC_SEC_ENHANCE _IO(AI_IOC_MAGIC, 3)
 #define AI_IOC_PWR_MGMT _IO(AI_IOC_MAGIC, 4)
 #define AI_IOC_HW_ADAPT _IOW(AI_IOC_MAGIC, 5, struct hw_config)
+#define AI_IOC_COMMIT _IOW(AI_IOC_MAGIC, 6, struct ai_range)
+#define AI_IOC_SET_CHANNEL _IO(AI_IOC_MAGIC, 7)
+#define AI_IOC_SETUP_QUEUE _IOWR(AI_IOC_MAGIC, 8, struct ai_queue_params)
+#define AI_IOC_QUEUE_ENTER _IOW(AI_IOC_MAGIC, 9, struct ai_queue_enter)
+#define AI_IOC_SET_EVENTFD _IO(AI_IOC_MAGIC, 10)
+#define AI_IOC_GET_ANALYTICS _IOR(AI_IOC_MAGIC, 11, struct ai_analytics)
+#define AI_IOC_GET_MODEL _IOR(AI_IOC_MAGIC, 12, struct ai_model_state)
+#define AI_IOC_GET_ANOMALIES _IOWR(AI_IOC_MAGIC, 13, struct ai_anomaly_query)
+#define AI_IOC_GET_FEATURES _IOR(AI_IOC_MAGIC, 14, struct ai_features)
+#define AI_IOC_GET_LIMITS _IOR(AI_IOC_MAGIC, 15, struct ai_limits)
+#define AI_IOC_GET_STATS _IOWR(AI_IOC_MAGIC, 16, struct ai_stats)
+#define AI_IOC_GET_TUNER _IOR(AI_IOC_MAGIC, 17, struct ai_tuner_state)
+#define AI_IOC_GET_POWER _IOR(AI_IOC_MAGIC, 18, struct ai_power_state)
+#define AI_IOC_LOAD_INFER_MODEL _IOW(AI_IOC_MAGIC, 19, struct ai_infer_load)
+#define AI_IOC_GET_INFERENCE _IOR(AI_IOC_MAGIC, 20, struct ai_inference)
+#define AI_IOC_BATCH _IOW(AI_IOC_MAGIC, 21, struct ai_batch)
+#define AI_IOC_GET_HISTORY _IOWR(AI_IOC_MAGIC, 22, struct ai_history_query)
+#define AI_IOC_GET_STATUS _IOR(AI_IOC_MAGIC, 23, struct ai_status)
+
+// mmap offsets of the per-open regions
+#define AI_MMAP_OFF_BUFFER 0
+#define AI_MMAP_OFF_QUEUE  0x100000000ULL
+#define AI_MMAP_OFF_HISTORY 0x200000000ULL     // Read-only, shared by every file of the instance
+#define AI_MMAP_OFF_STATUS  0x300000000ULL     // Read-only page, shared by every file of the instance
+
+// Channels selectable per open file with AI_IOC_SET_CHANNEL
+#define AI_CHANNEL_BUFFER 0     // Private random-access buffer (default)
+#define AI_CHANNEL_STREAM 1     // Shared FIFO record stream
+#define AI_CHANNEL_EVENTS 2     // Anomaly, maintenance and power events
+
+// Stream ring geometry
+#define AI_STREAM_DEFAULT_SIZE (64 * 1024)
+#define AI_STREAM_MIN_SIZE 4096
+
+// Per-open buffers are tables of page-sized chunks
+#define AI_CHUNK_SIZE      PAGE_SIZE
+#define AI_CHUNK_SHIFT     PAGE_SHIFT
+#define AI_BUFFER_SIZE_LIMIT (64 * 1024 * 1024)  // Upper bound for buffer_size_max
+#define AI_BUFFER_DEFAULT_SIZE 1024                  // Initial size, and the autotuner's floor
+#define AI_REC_ALIGN 8
+#define AI_REC_READY 1
+
+// Event types reported on the events channel
+#define AI_EVENT_ANOMALY     1  // Anomaly score over its threshold
+#define AI_EVENT_MAINTENANCE 2  // Predicted usage over threshold
+#define AI_EVENT_POWER       3  // Power mode transition; value is the new low_power_mode
+#define AI_EVENT_LOG_SIZE    256
+
+// Streaming anomaly detector features (bits of ai_anomaly.features)
+#define AI_FEATURE_SIZE     0       // Write size in bytes
+#define AI_FEATURE_INTERVAL 1       // Time since the previous write on the CPU, in us
+#define AI_FEATURE_SENSOR   2       // Simulated sensor value
+#define AI_FEATURE_ENTROPY  3       // Payload entropy, only with feature_extraction
+#define AI_FEATURES         4
+#define AI_FEATURE_MAX      (1ULL << 24)  // Larger values are clamped
+#define AI_FEATURE_FRAC     4       // Fraction bits of the running mean
+#define AI_EWMA_WEIGHT      16      // EWMA alpha = 1/16
+#define AI_ANOMALY_WARMUP   32      // Samples per CPU before anything is flagged
+
+// Payload feature extraction kernels (ai_features.impl)
+#define AI_SCAN_SCALAR      0
+#define AI_SCAN_SSE2        1
+#define AI_SCAN_AVX2        2
+#define AI_SCAN_CHUNK       4096    // Bytes per kernel_fpu_begin() section
+#define AI_SCAN_SIMD_MIN    64      // Shorter payloads aren't worth saving the FPU state
+#define AI_F32_SUM_MAX      (1LL << 47)   // Float sums saturate at +-2^31 per chunk (Q16.16)
+
+// Predictive maintenance model (Q16.16 fixed point)
+#define AI_Q16_SHIFT       16
+#define AI_MODEL_PERIOD_MS 100        // Write rate sample period
+#define AI_MODEL_WINDOW    32         // Samples in the least-squares window
+#define AI_MODEL_HORIZON   10         // Periods ahead used for predicted_usage
+#define AI_MODEL_ALPHA     19661      // Level smoothing, 0.3 in Q16.16
+#define AI_MODEL_BETA      6554       // Trend smoothing, 0.1 in Q16.16
+#define AI_MODEL_MAX_GAP   64         // Idle periods replayed after a pause
+#define AI_MODEL_MAX_RATE  (1ULL << 40)   // Clamp on bytes per period
+#define AI_MODEL_NEVER     U64_MAX    // time_to_threshold_ms when not reached
+
+// Per-CPU I/O histograms; bucket n counts values in [2^n, 2^(n+1)). Reads
+// and writes have size and latency histograms, the AI ioctls latency only.
+#define AI_STAT_READ        0
+#define AI_STAT_WRITE       1
+#define AI_STAT_DIRS        2
+#define AI_STAT_PERF_OPT    2
+#define AI_STAT_PRED_MAINT  3
+#define AI_STAT_SEC_ENHANCE 4
+#define AI_STAT_PWR_MGMT    5
+#define AI_STAT_HW_ADAPT    6
+#define AI_STAT_OPS         7
+#define AI_HIST_BUCKETS     32
+#define AI_STATS_VERSION    1
+
+// Buffer autotuner, run with every analytics pass. It sizes the buffer to
+// hold AI_TUNE_PERMILLE of the recent write extents (offset + length).
+#define AI_TUNE_PERMILLE      990
+#define AI_TUNE_MIN_SAMPLES   64     // Fewer recent writes count as no load
+#define AI_TUNE_SHRINK_PASSES 3      // Passes a size of half or less must hold before shrinking
+#define AI_TUNE_REGRESS_PCT   20     // Throughput drop after a change that reverts it
+#define AI_TUNE_HOLD_PASSES   8      // Passes without changes after a revert
+
+// It also picks the queue batch depth, between AI_QUEUE_BATCH and
+// AI_TUNE_BATCH_MAX, and a read-ahead window for sequential buffer readers
+#define AI_TUNE_BATCH_MAX     (8 * AI_QUEUE_BATCH)
+#define AI_TUNE_RA_PERMILLE   750    // Share of sequential reads that turns read-ahead on
+#define AI_TUNE_RA_MAX        (64 * 1024)
+
+// Reasons for a tuner decision
+#define AI_TUNE_NONE   0
+#define AI_TUNE_GROW   1             // Writes ran past the end of the buffer
+#define AI_TUNE_SHRINK 2             // Writes stayed within half the buffer
+#define AI_TUNE_IDLE   3             // The load went away; back to the default size
+#define AI_TUNE_REVERT 4             // Throughput fell after the previous change
+
+// Performance states of the power governor, lowest first
+#define AI_PSTATE_LOW    0
+#define AI_PSTATE_NORMAL 1
+#define AI_PSTATE_HIGH   2
+#define AI_PSTATES       3
+
+// Loadable inference models. A blob is a struct ai_infer_hdr followed by
+// the sections of its type, little-endian and packed:
+//   AI_INFER_TREES: u16 roots[nr_units], struct ai_tree_node nodes[nr_nodes]
+//   AI_INFER_MLP:   s8 w1[nr_units][nr_inputs], s32 b1[nr_units],
+//                   s8 w2[nr_outputs][nr_units], s32 b2[nr_outputs]
+#define AI_INFER_MAGIC      0x4c444d41  // "AMDL"
+#define AI_INFER_VERSION    1
+#define AI_INFER_TREES      1           // int16 decision tree ensemble, leaves summed per output
+#define AI_INFER_MLP        2           // int8 MLP with one ReLU hidden layer
+#define AI_INFER_MAX_SIZE   (64 * 1024)
+#define AI_INFER_MAX_TREES  64
+#define AI_INFER_MAX_NODES  4096
+#define AI_INFER_MAX_DEPTH  16
+#define AI_INFER_MAX_HIDDEN 64
+
+// Inputs fed to a model, all s16. Counters and rates are log2(1 + x) in
+// Q8 so they span their whole range in 14 bits.
+#define AI_IN_USAGE         0           // Bytes written
+#define AI_IN_ERRORS        1
+#define AI_IN_SENSOR        2           // Mean sensor reading since the previous pass
+#define AI_IN_WRITE_RATE    3           // Modelled bytes per sample period
+#define AI_IN_WRITE_SIZE    4           // p50 write extent
+#define AI_IN_LOAD          5           // Governor load x1000, not log2
+#define AI_IN_SCORE         6           // Highest anomaly z-score x1000 since the previous pass, not log2
+#define AI_IN_HEADROOM      7           // Modelled ms until usage reaches the threshold
+#define AI_INFER_INPUTS     8
+
+// Outputs that replace the built-in rules; positive means yes. Outputs
+// past these are only reported.
+#define AI_OUT_MAINTENANCE  0
+#define AI_OUT_ANOMALY      1
+#define AI_INFER_OUTPUTS    4
+
+// Telemetry history: one ring of samples per resolution, filled from the
+// analytics passes. Slot n of a level covers [n, n + 1) * period seconds of
+// CLOCK_MONOTONIC time and lives at samples[n % entries].
+#define AI_HISTORY_SECONDS  0
+#define AI_HISTORY_MINUTES  1
+#define AI_HISTORY_HOURS    2
+#define AI_HISTORY_LEVELS   3
+#define AI_HISTORY_VERSION  1
+
+// Flags of a history sample
+#define AI_HISTORY_VALID       (1U << 0)    // An analytics pass ran in the slot
+#define AI_HISTORY_MAINTENANCE (1U << 1)    // Maintenance was due at some pass
+#define AI_HISTORY_ANOMALY     (1U << 2)    // An anomaly was detected at some pass
+#define AI_HISTORY_LOW_POWER   (1U << 3)    // Low power mode at some pass
+
+// Status snapshot readable without locks, and its flags
+#define AI_STATUS_VERSION      1
+#define AI_STATUS_MAINTENANCE  (1U << 0)    // Maintenance is due
+#define AI_STATUS_ANOMALY      (1U << 1)    // An anomaly was detected at the last pass
+#define AI_STATUS_LOW_POWER    (1U << 2)    // low_power_mode
+#define AI_STATUS_AUTOTUNE     (1U << 3)    // The buffer autotuner is on
+
+// Submission queue opcodes
+#define AI_OP_NOP         0
+#define AI_OP_WRITE       1
+#define AI_OP_READ        2
+#define AI_OP_PERF_OPT    3
+#define AI_OP_PRED_MAINT  4
+#define AI_OP_SEC_ENHANCE 5
+#define AI_OP_PWR_MGMT    6
+#define AI_OP_HW_ADAPT    7
+
+// Submission queue setup flags and limits
+#define AI_QUEUE_SQPOLL       (1U << 0)  // Worker polls the SQ instead of waiting for the doorbell
+#define AI_SQ_NEED_WAKEUP     (1U << 0)  // sq_flags: polling worker is asleep, ring the doorbell
+#define AI_QUEUE_MAX_ENTRIES  4096
+#define AI_QUEUE_BATCH        64         // SQEs handled between completion publishes
+#define AI_QUEUE_DEFAULT_IDLE 10         // ms a polling worker spins before sleeping
+
+// Commands in one AI_IOC_BATCH call
+#define AI_BATCH_MAX 8
 
 // Structure for hardware configuration parameters
 struct hw_config {
@@ -36,365 +320,5539 @@ struct hw_config {
     // Add more parameters as needed
 };
 
+// Results of the latest analytics pass, returned by AI_IOC_GET_ANALYTICS
+struct ai_analytics {
+    u64 timestamp_ns;                // CLOCK_MONOTONIC time of the pass
+    u64 runs;                        // Passes completed since load
+    u64 usage_count;                 // Counter snapshot the pass worked on
+    u64 error_count;
+    u32 sensor_data;
+    u32 interval_ms;                 // Current pass interval, 0 if on demand
+    u64 predicted_usage;
+    u32 anomaly_score;
+    u32 maintenance_due;
+    u32 anomaly_detected;
+    u32 low_power_mode;
+    u64 time_to_threshold_ms;        // Model estimate, AI_MODEL_NEVER if not reached
+};
+
+// Power governor state, returned by AI_IOC_GET_POWER. Loads are the busy
+// fraction x1000: time spent inside reads, writes and AI ioctls, summed
+// over CPUs and capped at the window length.
+struct ai_power_state {
+    u32 pstate;                      // AI_PSTATE_*
+    u32 nr_pstates;                  // AI_PSTATES
+    u32 load_permille;               // Decaying estimate the governor decides on
+    u32 util_permille;               // Last window alone
+    u64 state_since_ns;              // CLOCK_MONOTONIC time of the last transition
+    u64 busy_ns;                     // Since load
+    u64 idle_ns;
+    u64 transitions;
+    u64 time_in_state_ns[AI_PSTATES];
+    u64 trans_table[AI_PSTATES][AI_PSTATES];    // Transitions [from][to]
+};
+
+// Anomalous write recorded by the streaming detector
+struct ai_anomaly {
+    u64 seq;                         // Position in the anomaly history
+    u64 timestamp_ns;
+    u64 size;
+    u64 interval_us;
+    u32 sensor;
+    u32 score;                       // Highest z-score x1000 over the features
+    u32 features;                    // Bit n set if feature n was an outlier
+    u32 pid;                         // Thread group of the writer, or of the queue submitter
+    u32 entropy;                     // Payload entropy in Q8 bits per byte, 0 if not extracted
+    u32 reserved;
+};
+
+// Inference model blob header, 32 bytes, little-endian. crc32 is the zlib
+// CRC-32 of the whole blob with the crc32 field zeroed.
+struct ai_infer_hdr {
+    u32 magic;                       // AI_INFER_MAGIC
+    u16 version;                     // AI_INFER_VERSION
+    u16 type;                        // AI_INFER_*
+    u32 size;                        // Whole blob, header included
+    u32 crc32;
+    u32 id;                          // Chosen by the model's author, reported back
+    u16 nr_inputs;                   // 1..AI_INFER_INPUTS, the first inputs in AI_IN_* order
+    u16 nr_outputs;                  // 1..AI_INFER_OUTPUTS
+    u16 nr_units;                    // Trees, or hidden units for an MLP
+    u16 nr_nodes;                    // Tree nodes, 0 for an MLP
+    u8 shift[2];                     // MLP: right shift after the hidden and output layers
+    u8 reserved[2];
+};
+
+// Tree node. Splits go left when input[feature] < value; leaves add value
+// to output[feature]. Children always follow their parent, so trees have
+// no cycles.
+struct ai_tree_node {
+    u8 feature;
+    u8 leaf;
+    s16 value;
+    u16 left;
+    u16 right;
+};
+
+// AI_IOC_LOAD_INFER_MODEL argument; size 0 goes back to the built-in rules
+struct ai_infer_load {
+    u64 data;                        // User pointer to the blob
+    u32 size;
+    u32 reserved;
+};
+
+// Latest model evaluation, returned by AI_IOC_GET_INFERENCE
+struct ai_inference {
+    u32 model_id;                    // 0 with the built-in rules
+    u32 model_type;                  // AI_INFER_*, 0 with the built-in rules
+    u32 nr_outputs;
+    u32 reserved;
+    u64 loaded_ns;                   // CLOCK_MONOTONIC time the model was loaded
+    u64 runs;                        // Evaluations of the current model
+    u64 eval_ns;                     // Time the latest evaluation took
+    s16 inputs[AI_INFER_INPUTS];
+    s32 outputs[AI_INFER_OUTPUTS];
+};
+
+// Configuration limits, returned by AI_IOC_GET_LIMITS. AI_IOC_HW_ADAPT
+// rejects sizes outside them with -EINVAL.
+struct ai_limits {
+    u32 buffer_size_min;
+    u32 buffer_size_max;
+    u32 stream_size_min;             // Smaller ring sizes are rounded up to this
+    u32 stream_size_max;
+    u32 chunk_size;                  // Buffers grow and are mapped a chunk at a time
+    u32 chunk_reserve;
+};
+
+// Latency of one operation type. Percentiles are interpolated within the
+// log2 bucket that holds them, so they are exact to within a factor of two.
+struct ai_op_stats {
+    u64 count;
+    u64 p50_ns;
+    u64 p99_ns;
+    u64 p999_ns;
+    u64 max_ns;                      // Upper bound of the highest non-empty bucket
+    u64 hist[AI_HIST_BUCKETS];       // Bucket n counts latencies in [2^n, 2^(n+1)) ns
+};
+
+// AI_IOC_GET_STATS reply, indexed by AI_STAT_*. Callers set size to
+// sizeof(struct ai_stats) as they know it; the driver fills version and
+// copies at most that many bytes so older and newer layouts both work.
+struct ai_stats {
+    u32 version;                     // Out: AI_STATS_VERSION
+    u32 size;                        // In: caller's struct size, out: bytes filled
+    u32 nr_ops;                      // Out: entries in ops
+    u32 nr_buckets;                  // Out: AI_HIST_BUCKETS
+    struct ai_op_stats ops[AI_STAT_OPS];
+};
+
+// Buffer autotuner state, returned by AI_IOC_GET_TUNER. The window is the
+// time between the last two tuner passes.
+struct ai_tuner_state {
+    u32 enabled;
+    u32 buffer_size;                 // Size for new opens, applied by AI_IOC_PERF_OPT
+    u32 target_size;                 // Size the last pass asked for
+    u32 last_reason;                 // AI_TUNE_* of the last change
+    u64 decisions;                   // Size changes since load, reverts included
+    u64 reverts;
+    u64 last_change_ns;
+    u64 window_ns;
+    u64 requests;                    // Buffer writes in the window
+    u64 clipped;                     // Of which cut short at buffer_size_max
+    u64 bytes_per_sec;               // Buffer reads and writes in the window
+    u64 p50_extent;                  // Over the recent writes, older passes weighted less
+    u64 p99_extent;
+    u32 queue_batch;                 // SQEs per completion publish, before the power state's multiple
+    u32 readahead;                   // Bytes prefetched after a sequential buffer read, 0 if off
+};
+
+// Payload features of everything written while feature_extraction was on,
+// returned by AI_IOC_GET_FEATURES
+struct ai_features {
+    u32 enabled;                     // Current feature_extraction setting
+    u32 impl;                        // AI_SCAN_* kernel in use
+    u64 writes;
+    u64 bytes;
+    u64 byte_sum;                    // Sum of all bytes
+    u64 checksum;                    // XOR of the 64-bit little-endian words of each write
+    u32 entropy_q8;                  // Shannon entropy of byte_hist, Q8 bits per byte
+    u32 reserved;
+    u64 i16_count;                   // Payloads read as little-endian int16
+    s64 i16_mean_q16;
+    s32 i16_min;
+    s32 i16_max;
+    u64 f32_count;                   // Finite values of payloads read as float32
+    s64 f32_mean_q16;
+    u32 f32_min;                     // IEEE 754 bits; NaNs are ignored
+    u32 f32_max;
+    u64 byte_hist[256];
+};
+
+// AI_IOC_GET_ANOMALIES request; returns the oldest kept anomalies at or after seq
+struct ai_anomaly_query {
+    u64 seq;                         // In: first sequence wanted
+    u64 records;                     // In: user pointer to struct ai_anomaly[count]
+    u32 count;                       // In: capacity, out: records returned
+    u32 threshold;                   // Out: current anomaly_threshold
+    u64 total;                       // Out: anomalies flagged since load
+};
+
+// Full predictive model state, returned by AI_IOC_GET_MODEL. Rates are in
+// bytes per sample period and all _q16 fields are Q16.16 fixed point.
+struct ai_model_state {
+    u64 timestamp_ns;                // Start of the current sample period
+    u64 samples;                     // Periods folded into the model
+    u32 period_ms;
+    u32 window;                      // Samples in the least-squares window
+    u32 alpha_q16;
+    u32 beta_q16;
+    s64 level_q16;                   // Holt smoothed write rate
+    s64 trend_q16;                   // Holt trend of the write rate per period
+    s64 ols_slope_q16;               // Least-squares slope of the rate over the window
+    s64 ols_rate_q16;                // Least-squares fitted rate at the newest sample
+    u64 usage_count;                 // Bytes written at timestamp_ns
+    u64 threshold;
+    u64 forecast_usage;              // Usage AI_MODEL_HORIZON periods ahead
+    u64 time_to_threshold_ms;        // AI_MODEL_NEVER if the forecast never gets there
+};
+
+// Byte range of the mapped buffer published with AI_IOC_COMMIT
+struct ai_range {
+    unsigned long long offset;
+    unsigned long long length;
+};
+
+// Submission queue entry
+struct ai_sqe {
+    u8 opcode;                       // AI_OP_*
+    u8 flags;
+    u16 reserved;
+    u32 len;                         // READ/WRITE length
+    u64 off;                         // READ/WRITE buffer offset
+    u64 addr;                        // READ/WRITE user buffer
+    u64 user_data;                   // Returned in the completion
+    u32 buffer_size;                 // HW_ADAPT parameters
+    u32 threshold;
+};
+
+// Completion queue entry
+struct ai_cqe {
+    u64 user_data;
+    s32 res;                         // Bytes transferred or -errno
+    u32 flags;
+};
+
+// AI_IOC_SETUP_QUEUE parameters; offsets are bytes into the region mapped at AI_MMAP_OFF_QUEUE
+struct ai_queue_params {
+    u32 sq_entries;                  // In: requested SQ size, out: rounded size
+    u32 cq_entries;                  // In: 0 for twice the SQ size, out: rounded size
+    u32 flags;                       // AI_QUEUE_*
+    u32 sq_idle_ms;                  // Polling worker idle time before it sleeps
+    u32 region_size;                 // Out: bytes to mmap
+    u32 sq_head_off;
+    u32 sq_tail_off;
+    u32 sq_flags_off;
+    u32 sqes_off;
+    u32 cq_head_off;
+    u32 cq_tail_off;
+    u32 cqes_off;
+};
+
+// AI_IOC_QUEUE_ENTER doorbell
+struct ai_queue_enter {
+    u32 min_complete;                // Wait until this many CQEs are ready
+    u32 flags;
+};
+
+// AI_IOC_BATCH command, one of the AI_OP_* analytics and configuration ops
+struct ai_batch_cmd {
+    u8 opcode;                       // AI_OP_NOP or AI_OP_PERF_OPT..AI_OP_HW_ADAPT
+    u8 reserved[3];
+    u32 buffer_size;                 // HW_ADAPT parameters
+    u32 threshold;
+    u32 reserved2;
+};
+
+// Result of one batch command, with the state right after it ran
+struct ai_batch_result {
+    s32 res;                         // -errno, or the verdict (0 or 1) as on the submission queue
+    u32 power_state;                 // AI_PSTATE_*
+    u64 predicted_usage;
+    u32 anomaly_score;
+    u32 buffer_size;                 // The calling file's buffer size
+};
+
+// AI_IOC_BATCH argument, copied in whole; results are written to user
+// memory once, after the last command
+struct ai_batch {
+    u32 nr;                          // 1..AI_BATCH_MAX
+    u32 flags;                       // Must be 0
+    u64 results;                     // User pointer to nr struct ai_batch_result
+    struct ai_batch_cmd cmds[AI_BATCH_MAX];
+};
+
+// One slot of telemetry history. Counters are deltas over the slot, so an
+// absolute series is rebuilt backwards from the level's newest counters;
+// a slot without a pass is all zeros.
+struct ai_history_sample {
+    u64 usage;                       // usage_count delta
+    u32 errors;                      // error_count delta
+    u32 forecast;                    // predicted_usage - usage_count at the last pass, saturated
+    u16 sensor;                      // Mean sensor reading
+    u16 anomaly_score;               // Highest score x1000, saturated
+    u16 load_permille;               // Mean governor load
+    u8 pstate;                       // Highest AI_PSTATE_* seen
+    u8 flags;                        // AI_HISTORY_*
+};
+
+// One resolution of the history, in the region header and returned by
+// AI_IOC_GET_HISTORY
+struct ai_history_level {
+    u32 period_s;
+    u32 nr_entries;
+    u32 offset;                      // Bytes from the start of the region to samples[0]
+    u32 reserved;
+    u64 newest_slot;                 // Last closed slot; the slot being filled is not visible
+    u64 usage_count;                 // Counters at the end of newest_slot
+    u64 error_count;
+};
+
+// Start of the region mapped at AI_MMAP_OFF_HISTORY. seq is odd while the
+// driver writes; readers copy what they need and retry if seq was odd or
+// changed, like a seqcount.
+struct ai_history_header {
+    u32 seq;
+    u32 version;                     // AI_HISTORY_VERSION
+    u32 nr_levels;                   // AI_HISTORY_LEVELS
+    u32 sample_size;                 // sizeof(struct ai_history_sample)
+    struct ai_history_level levels[AI_HISTORY_LEVELS];
+};
+
+// AI_IOC_GET_HISTORY argument: the newest samples of one level, oldest first
+struct ai_history_query {
+    u32 level;                       // In: AI_HISTORY_SECONDS, MINUTES or HOURS
+    u32 nr_samples;                  // In: room at samples, out: samples copied
+    u64 samples;                     // User pointer to struct ai_history_sample[nr_samples]
+    struct ai_history_level info;    // Out: the level as of the copy
+};
+
+// Derived state of an instance, returned by AI_IOC_GET_STATUS and mapped
+// at AI_MMAP_OFF_STATUS. The driver republishes it after every analytics
+// pass and configuration change; seq works as for the history header.
+// Counters and decisions are those of the last pass.
+struct ai_status {
+    u32 seq;
+    u32 version;                     // AI_STATUS_VERSION
+    u64 timestamp_ns;                // CLOCK_MONOTONIC time of the update
+    u64 analytics_runs;
+    u64 usage_count;
+    u64 error_count;
+    u64 predicted_usage;
+    u64 time_to_threshold_ms;
+    u64 anomalies;                   // Writes flagged since load
+    u32 threshold;
+    u32 anomaly_threshold;
+    u32 buffer_size;                 // Size for newly opened files
+    u32 anomaly_score;
+    u32 sensor_data;
+    u32 pstate;                      // AI_PSTATE_*
+    u32 load_permille;
+    u32 flags;                       // AI_STATUS_*
+};
+
+// Shared ring indices; entries follow in the same mapping
+struct ai_queue_rings {
+    u32 sq_head ____cacheline_aligned_in_smp;   // Written by the driver
+    u32 sq_tail ____cacheline_aligned_in_smp;   // Written by user space
+    u32 cq_head ____cacheline_aligned_in_smp;   // Written by user space
+    u32 cq_tail ____cacheline_aligned_in_smp;   // Written by the driver
+    u32 sq_flags;
+};
+
+// Per-open submission/completion queue pair drained by a kernel worker
+struct ai_queue {
+    struct ai_queue_rings *rings;    // vmalloc_user backed, mapped by user space
+    struct ai_sqe *sqes;
+    struct ai_cqe *cqes;
+    u32 sq_entries;
+    u32 cq_entries;
+    u32 sq_head;                     // Indices the driver owns, kept private and only
+    u32 cq_tail;                     // published to the rings user space can write
+    size_t region_size;
+    bool sqpoll;
+    unsigned int idle_ms;
+    struct task_struct *worker;
+    struct mm_struct *mm;            // Address space SQE buffers live in; the only one that may submit
+    pid_t tgid;                      // Last task to set up or ring the doorbell
+    pid_t submitter;                 // tgid taken when the current SQE was pulled; worker only
+    wait_queue_head_t worker_wait;   // Doorbell
+    wait_queue_head_t cq_wait;       // Completion waiters
+    atomic_t doorbell;
+};
+
+// Event record returned by read() on the events channel; a gap in seq
+// means older events were overwritten before the reader got to them
+struct ai_event {
+    u64 seq;
+    u64 timestamp_ns;
+    u32 type;                        // AI_EVENT_*
+    u32 reserved;
+    u64 value;
+    u64 threshold;
+};
+
+// Record header in the stream ring; payload follows, padded to AI_REC_ALIGN
+struct ai_rec_hdr {
+    u32 len;
+    u32 state;                       // AI_REC_READY once the payload is complete
+};
+
+// Multi-producer ring: producers reserve space with a cmpxchg on head and
+// commit each record by publishing its header; a single reader (serialized
+// by stream_read_lock) consumes committed records in order from tail.
+struct ai_ring {
+    char *data;
+    unsigned long size;              // Power of two
+    atomic_long_t head ____cacheline_aligned_in_smp;
+    unsigned long tail ____cacheline_aligned_in_smp;
+    unsigned int rec_off;            // Bytes of the tail record already read
+};
+
+// Exponentially weighted running mean (Q.4) and variance (Q.8) of a feature
+struct ai_feature {
+    s64 mean;
+    u64 var;
+};
+
+// Anomaly detector state; each CPU learns from the writes it runs
+struct ai_detector {
+    struct ai_feature features[AI_FEATURES];
+    u64 samples;
+    u64 last_ns;                     // Time of the previous write
+};
+
+// Features of one write, built up segment by segment by scan_payload()
+struct ai_scan {
+    u64 bytes;
+    u64 byte_sum;
+    u64 xor;
+    s64 i16_sum;
+    u64 i16_count;
+    s32 i16_min;
+    s32 i16_max;
+    s64 f32_sum;                     // Q16.16
+    u64 f32_count;
+    u32 f32_min;                     // Ordered keys, see f32_key()
+    u32 f32_max;
+    u32 entropy;                     // Q8 bits per byte, set by extract_features()
+    u32 hist[256];
+};
+
+// Lane accumulators stored by the SIMD kernels; SSE2 fills half of each
+struct ai_simd_acc {
+    u64 byte_sum[4];
+    u64 xor[4];
+    s16 i16_min[16];
+    s16 i16_max[16];
+    s32 i16_sum[8];
+    u32 f32_min[8];
+    u32 f32_max[8];
+    u32 nonfinite[8];
+    s64 f32_sum;                     // Q16.16, saturated
+};
+
+// Feature extraction kernel, chosen once at module load
+struct ai_scan_impl {
+    const char *name;
+    u32 id;                          // AI_SCAN_*
+    unsigned int width;              // Bytes per vector; 0 for scalar only
+    void (*chunk)(struct ai_scan *scan, const u8 *p, size_t len);
+};
+
+// Running totals of the extracted payload features
+struct ai_payload_stats {
+    u64 writes;
+    u64 bytes;
+    u64 byte_sum;
+    u64 checksum;
+    s64 i16_sum;
+    u64 i16_count;
+    s64 f32_sum;                     // Q16.16
+    u64 f32_count;
+    s32 i16_min;
+    s32 i16_max;
+    u32 f32_min;                     // Ordered keys
+    u32 f32_max;
+};
+
+// Statistics kept per CPU so the I/O path never writes a shared cache line.
+// Readers fold all CPUs with fold_stats().
+struct ai_pcpu_stats {
+    u64 usage_count;                 // Bytes written
+    u64 error_count;
+    u64 sensor_sum;                  // Sum of simulated sensor samples
+    u64 sensor_samples;
+    u64 size_hist[AI_STAT_DIRS][AI_HIST_BUCKETS];    // Transfer sizes in bytes
+    u64 lat_hist[AI_STAT_OPS][AI_HIST_BUCKETS];      // Operation latency in ns
+    struct ai_payload_stats payload; // Only updated while feature_extraction is on
+    u64 byte_hist[256];
+    u64 busy_ns;                     // Time inside reads, writes and AI ioctls
+    u64 buffer_bytes;                // Bytes read or written on the buffer channel
+    u64 clipped;                     // Buffer writes cut short at buffer_size_max
+    u64 extent_hist[AI_HIST_BUCKETS];    // Buffer writes by offset + length - 1
+    u64 queue_sqes;                  // SQEs the queue workers completed
+    u64 queue_rounds;                // Queue drains that completed any
+    u64 queue_backlog;               // Of which stopped at the batch depth with SQEs left
+    u64 buffer_reads;
+    u64 seq_reads;                   // Buffer reads starting where the file's previous one ended
+    u64 seq_read_bytes;
+
+    struct u64_stats_sync syncp;
+    struct ai_detector detector;     // Only touched by the owning CPU
+    u64 model_seen;                  // usage_count already handed to the model
+    u64 model_next_ns;               // When this CPU next hands its writes over
+};
+
+// Sum of the per-CPU statistics
+struct ai_stats_snapshot {
+    u64 usage_count;
+    u64 error_count;
+    u64 sensor_sum;
+    u64 sensor_samples;
+    u64 busy_ns;
+    u64 size_hist[AI_STAT_DIRS][AI_HIST_BUCKETS];
+    u64 lat_hist[AI_STAT_OPS][AI_HIST_BUCKETS];
+};
+
+// Online write rate model: Holt double exponential smoothing plus a sliding
+// least-squares fit, both updated in O(1) once per sample period
+struct ai_model {
+    atomic64_t pending;              // Bytes handed over by the CPUs since the last sample
+    u64 last_ns;                     // Start of the current sample period
+    u64 last_usage;                  // Bytes folded into the model by last_ns
+    u64 samples;
+    s64 level;                       // Q16.16
+    s64 trend;                       // Q16.16
+    u64 window[AI_MODEL_WINDOW];     // Recent per-period rates, oldest at win_head
+    unsigned int win_head;
+    unsigned int win_count;
+    s64 sum_y;                       // Sum of the window
+    s64 sum_xy;                      // Sum of index * rate, oldest sample at index 0
+};
+
+// Per-CPU counters the autotuner folds on each pass
+struct ai_tune_counters {
+    u64 bytes;
+    u64 clipped;
+    u64 sqes;
+    u64 rounds;
+    u64 backlog;
+    u64 reads;
+    u64 seq_reads;
+    u64 seq_bytes;
+};
+
+// Buffer autotuner, protected by the device mutex_lock
+struct ai_tuner {
+    u64 last_ns;                     // Time of the previous pass
+    struct ai_tune_counters seen;    // Counters at last_ns
+    u64 extent_seen[AI_HIST_BUCKETS];
+    u64 extent[AI_HIST_BUCKETS];     // Recent write extents, halved every pass
+    u64 judge_bps;                   // Throughput before the change under review, 0 if none
+    u64 judge_requests;
+    unsigned int prev_size;          // Size a regressing change returns to
+    unsigned int shrink_passes;
+    unsigned int hold;
+
+    // Queue batch depth, judged like the size by the SQE rate
+    u64 batch_judge_rate;            // SQEs/s before the change under review, 0 if none
+    unsigned int prev_batch;
+    unsigned int batch_passes;       // Passes in a row without a backlog
+    unsigned int batch_hold;
+
+    // Recent buffer reads, halved every pass
+    u64 reads;
+    u64 seq_reads;
+    u64 seq_bytes;
+    struct ai_tuner_state state;
+};
+
+// What each performance state does. The governor steps one state at a
+// time: up when the load estimate passes up_permille, down when it drops
+// under down_permille, and never before min_dwell_ms in the state. The gap
+// between a state's up and the next state's down threshold is the
+// hysteresis.
+struct ai_pstate {
+    const char *name;
+    unsigned int up_permille;        // 0 in the highest state
+    unsigned int down_permille;      // 0 in the lowest state
+    unsigned int min_dwell_ms;
+    unsigned int interval_pct;       // Background analytics interval, % of analytics_interval_ms
+    unsigned int queue_batch_mult;   // Multiple of the tuned queue batch depth
+    bool queue_spin;                 // Polling queue workers spin for sq_idle_ms before sleeping
+};
+
+static const struct ai_pstate ai_pstates[AI_PSTATES] = {
+    [AI_PSTATE_LOW]    = { "low",    50,  0,   1000, 400, 1, false },
+    [AI_PSTATE_NORMAL] = { "normal", 600, 20,  2000, 100, 1, true },
+    [AI_PSTATE_HIGH]   = { "high",   0,   300, 2000, 50,  4, true },
+};
+
+// Power governor, protected by the device mutex_lock except pstate, which
+// the queue workers read locklessly
+struct ai_governor {
+    unsigned int pstate;             // AI_PSTATE_*
+    u32 load;                        // Busy fraction x1000, decayed by a quarter per pass
+    u32 util;                        // Busy fraction x1000 of the last window
+    u64 last_ns;                     // Time of the previous pass
+    u64 busy_seen;                   // busy_ns at last_ns
+    u64 state_since;
+    u64 busy_ns;
+    u64 idle_ns;
+    u64 transitions;
+    u64 time_in_state[AI_PSTATES];
+    u64 trans_table[AI_PSTATES][AI_PSTATES];
+};
+
+// Validated inference model. Every section is copied into data, aligned
+// and in evaluation order, so an evaluation walks one allocation.
+struct ai_infer_model {
+    struct rcu_head rcu;
+    u64 loaded_ns;
+    u32 id;
+    u16 type;
+    u16 nr_inputs;
+    u16 nr_outputs;
+    u16 nr_units;
+    u8 shift[2];
+    const u16 *roots;
+    const struct ai_tree_node *nodes;
+    const s8 *w1;
+    const s32 *b1;
+    const s8 *w2;
+    const s32 *b2;
+    u8 data[] __aligned(8);
+};
+
+// History slot being filled at one level, published when its slot closes
+struct ai_history_acc {
+    u64 slot;
+    u64 usage;
+    u64 errors;
+    u64 usage_end;                   // Counters at the latest pass in the slot
+    u64 errors_end;
+    u64 sensor_sum;
+    u64 load_sum;
+    u32 passes;
+    u32 anomaly_max;
+    u32 forecast;
+    u8 pstate;
+    u8 flags;
+};
+
+// Period and length of each history level
+static const struct {
+    const char *name;
+    u32 period_s;
+    u32 nr_entries;
+} ai_history_geometry[AI_HISTORY_LEVELS] = {
+    [AI_HISTORY_SECONDS] = { "seconds", 1,    3600 },   // An hour
+    [AI_HISTORY_MINUTES] = { "minutes", 60,   1440 },   // A day
+    [AI_HISTORY_HOURS]   = { "hours",   3600, 720 },    // 30 days
+};
+
+// Telemetry history, written by the analytics passes under mutex_lock
+struct ai_history {
+    struct ai_history_header *hdr;   // vmalloc_user backed, mapped read-only by user space
+    struct ai_history_acc acc[AI_HISTORY_LEVELS];
+    u64 usage_seen;                  // Counters at the previous pass
+    u64 errors_seen;
+};
+
+// Copies of the pass state the debugfs files show, refreshed with the
+// status snapshot so scraping never waits for mutex_lock
+struct ai_telemetry {
+    struct ai_tuner_state tuner;
+    struct ai_governor gov;
+    struct ai_inference inference;
+};
+
 // Device structure
 struct ai_device {
     struct cdev cdev;
-    struct class *class;
     struct device *device;
     dev_t dev_number;
-    struct mutex mutex_lock;         // Mutex for synchronization
+    unsigned int index;              // Minor number
+    int node;                        // NUMA node the instance's state lives on
+    struct mutex mutex_lock;         // Protects configuration and serializes analytics passes
+    atomic_t open_count;             // Number of open file contexts
 
-    // Buffer management
-    char *buffer;
+    // Buffer management (size applied to newly opened contexts)
     unsigned int buffer_size;
     unsigned int threshold;
 
-    // Predictive maintenance
-    unsigned int usage_count;
-    unsigned int error_count;
+    // Set by the autotuner, read locklessly by the queue workers and reads
+    unsigned int queue_batch;        // SQEs per completion publish
+    unsigned int readahead;          // Bytes prefetched after a sequential buffer read
+
+    // Tunables, also exposed through sysfs
+    unsigned int anomaly_threshold;
+    unsigned int analytics_interval_ms;
+    bool autotune;
+    struct mutex tune_lock;          // Serializes analytics interval updates
+    struct dentry *debugfs;          // Per-instance telemetry directory
+
+    // Usage, error and sensor statistics, updated per CPU from the I/O path
+    struct ai_pcpu_stats __percpu *stats;
+
+    // Sensor totals at the previous analytics pass, protected by mutex_lock
+    u64 sensor_sum_seen;
+    u64 sensor_samples_seen;
+
+    // Background analytics engine and its cached results
+    struct delayed_work analytics_work;
+    spinlock_t analytics_lock;       // Protects analytics
+    struct ai_analytics analytics;
+
+    // Recent anomalous writes
+    spinlock_t anomaly_lock;         // Protects the anomaly log and counters
+    struct ai_anomaly *anomalies;    // anomaly_log_size entries, indexed by seq
+    u64 anomaly_seq;                 // Anomalies flagged since load
+    u64 anomaly_seq_seen;            // anomaly_seq at the previous analytics pass
+    u32 anomaly_pass_max;            // Highest score since the previous pass
+
+    // Predictive maintenance model, sampled from the write path
+    spinlock_t model_lock;           // Protects model
+    struct ai_model model;
+
+    // Buffer autotuner, power governor and telemetry history, run with
+    // the analytics passes
+    struct ai_tuner tuner;
+    struct ai_governor gov;
+    struct ai_history history;
+    struct ai_status *status;        // vmalloc_user page, published under mutex_lock
+
+    // Loaded inference model, swapped under infer_lock and freed after a
+    // grace period; NULL runs the built-in rules
+    struct ai_infer_model __rcu *infer;
+    spinlock_t infer_lock;           // Serializes model swaps
+    struct ai_inference inference;   // Latest evaluation, protected by mutex_lock
+    spinlock_t telemetry_lock;       // Protects telemetry
+    struct ai_telemetry telemetry;
 
-    // Security enhancement
-    unsigned int anomaly_score;
+    // Stream channel; writers append under SRCU, resizes swap in a new ring
+    struct ai_ring __rcu *stream;
+    struct ai_ring __rcu *stream_old;    // Retired ring still being drained
+    struct srcu_struct stream_srcu;
+    struct mutex stream_read_lock;       // Single consumer; also serializes resizes
+    wait_queue_head_t stream_readq;
+    wait_queue_head_t stream_writeq;
 
-    // Power management state
-    bool low_power_mode;
+    // Event log shared by all readers of the events channel
+    spinlock_t event_lock;           // Protects the log, event_seq and eventfd list
+    struct ai_event events[AI_EVENT_LOG_SIZE];
+    u64 event_seq;                   // Sequence number of the next event
+    wait_queue_head_t event_wq;
+    struct list_head eventfd_list;   // Files with a registered eventfd
+};
+
+// Per-open context, stored in filep->private_data
+struct ai_file_ctx {
+    struct ai_device *dev;
+    struct mutex lock;               // Serializes threads sharing this file descriptor
+
+    // Private buffer, a table of page-sized chunks so it grows without
+    // copying and can be mapped chunk by chunk
+    struct page **chunks;            // ai_chunk_map_cache object
+    unsigned int nr_chunks;
+    unsigned int buffer_size;
+    struct mutex map_lock;           // Serializes mmap() against buffer resizes
+    atomic_t map_count;              // Number of live mappings of the buffer
 
-    // Simulated sensor data
-    unsigned int sensor_data;
+    unsigned int channel;            // AI_CHANNEL_*
+    struct ai_queue *queue;          // Set once by AI_IOC_SETUP_QUEUE
+    loff_t read_next;                // End of the previous buffer read, under lock
+
+    // Events channel state, protected by dev->event_lock
+    u64 event_cursor;                // Next event sequence to return
+    struct eventfd_ctx *eventfd;
+    struct list_head eventfd_node;
+
+    // Per-open counters
+    atomic64_t bytes_read;
+    atomic64_t bytes_written;
+    atomic_t error_count;
 };
 
-static struct ai_device ai_dev;
+// Device instances, each allocated on its own NUMA node
+static struct ai_device *ai_devs[AI_MAX_DEVICES];
+static struct class *ai_class;
+static dev_t ai_dev_base;
+static struct dentry *ai_debugfs_root;
+
+// Buffer chunks are whole pages so they can be mapped. The mempool keeps a
+// reserve of them, and every chunk table is one fixed-size object sized for
+// buffer_size_max.
+static mempool_t *ai_chunk_pool;
+static struct kmem_cache *ai_chunk_map_cache;
 
 // Function prototypes
 static int dev_open(struct inode *, struct file *);
 static int dev_release(struct inode *, struct file *);
-static ssize_t dev_read(struct file *, char __user *, size_t, loff_t *);
-static ssize_t dev_write(struct file *, const char __user *, size_t, loff_t *);
+static ssize_t dev_read_iter(struct kiocb *, struct iov_iter *);
+static ssize_t dev_write_iter(struct kiocb *, struct iov_iter *);
+static loff_t dev_llseek(struct file *, loff_t, int);
 static long dev_ioctl(struct file *, unsigned int, unsigned long);
+static long dispatch_ioctl(struct ai_file_ctx *, unsigned int, unsigned long);
+static int dev_mmap(struct file *, struct vm_area_struct *);
+static __poll_t dev_poll(struct file *, poll_table *);
 
 // Helper functions for AI algorithms
-static void perform_predictive_maintenance(void);
-static void enhance_security(void);
-static void manage_power(void);
-static void optimize_performance(void);
-static void adapt_hardware(struct hw_config *config);
+static void perform_predictive_maintenance(struct ai_device *dev, struct ai_analytics *res);
+static void enhance_security(struct ai_device *dev, struct ai_analytics *res);
+static void manage_power(struct ai_device *dev, struct ai_analytics *res, u64 busy_ns);
+static void get_power(struct ai_device *dev, struct ai_power_state *out);
+static void run_inference(struct ai_device *dev, const struct ai_stats_snapshot *snap, u32 sensor);
+static int load_infer_model(struct ai_device *dev, const u8 *blob, size_t size);
+static int load_infer_firmware(struct ai_device *dev, const char *name);
+static long set_infer_model(struct ai_device *dev, struct ai_infer_load __user *uload);
+static void get_inference(struct ai_device *dev, struct ai_inference *out);
+static int history_init(struct ai_device *dev);
+static struct ai_history_sample *history_samples(struct ai_history *h, unsigned int level);
+static u32 history_index(const struct ai_history_level *lvl, u64 slot);
+static void record_history(struct ai_device *dev, const struct ai_analytics *res);
+static void publish_status(struct ai_device *dev);
+static void get_status(struct ai_device *dev, struct ai_status *out);
+static long get_history(struct ai_device *dev, struct ai_history_query __user *uquery);
+static u32 history_copy(struct ai_history *h, unsigned int level, struct ai_history_sample *buf,
+                        u32 n, struct ai_history_level *info);
+static void run_analytics(struct ai_device *dev);
+static void analytics_work_fn(struct work_struct *work);
+static void get_analytics(struct ai_device *dev, struct ai_analytics *res);
+static void model_sample(struct ai_device *dev, u64 now);
+static void detect_anomaly(struct ai_device *dev, struct ai_detector *det, size_t len, u32 sensor, const struct ai_scan *scan, u64 now, pid_t pid);
+static void select_scan_impl(void);
+static void get_features(struct ai_device *dev, struct ai_features *out);
+static long get_anomalies(struct ai_device *dev, struct ai_anomaly_query __user *uquery);
+static void get_model_state(struct ai_device *dev, struct ai_model_state *out);
+static void tune_buffer(struct ai_device *dev);
+static void get_tuner(struct ai_device *dev, struct ai_tuner_state *out);
+static bool optimize_performance(struct ai_file_ctx *ctx);
+static int adapt_hardware(struct ai_file_ctx *ctx, struct hw_config *config);
+static long run_batch(struct ai_file_ctx *ctx, struct ai_batch __user *ubatch);
+static int resize_ctx_buffer(struct ai_file_ctx *ctx, unsigned int size);
+static int set_buffer_chunks(struct ai_file_ctx *ctx, unsigned int size, gfp_t gfp);
+static void free_buffer_chunks(struct ai_file_ctx *ctx);
+static int grow_ctx_buffer(struct ai_file_ctx *ctx, unsigned int size);
+static size_t buffer_copy_to_iter(struct ai_file_ctx *ctx, size_t off, size_t len, struct iov_iter *to);
+static void buffer_prefetch(struct ai_file_ctx *ctx, size_t off, size_t len);
+static size_t buffer_copy_from_iter(struct ai_file_ctx *ctx, size_t off, size_t len, struct iov_iter *from);
+static int map_buffer(struct ai_file_ctx *ctx, struct vm_area_struct *vma);
+static void account_write(struct ai_file_ctx *ctx, size_t len, const struct ai_scan *scan);
+static void account_payload(struct ai_file_ctx *ctx, const void *seg0, size_t len0, const void *seg1, size_t len1);
+static void account_buffer(struct ai_file_ctx *ctx, size_t off, size_t len);
+static void account_io(struct ai_device *dev, int dir, size_t len, u64 ns);
+static void account_tune(struct ai_device *dev, loff_t pos, size_t len, size_t done, bool write, bool seq);
+static void account_queue(struct ai_device *dev, unsigned int done, bool backlog);
+static void account_latency(struct ai_device *dev, int op, u64 ns);
+static int ioctl_stat_op(unsigned int cmd);
+static int get_stats(struct ai_device *dev, struct ai_stats *out);
+static void fold_stats(struct ai_device *dev, struct ai_stats_snapshot *snap, bool histograms);
+static ssize_t buffer_read(struct ai_file_ctx *ctx, struct iov_iter *to, loff_t *offset);
+static ssize_t buffer_write(struct ai_file_ctx *ctx, struct iov_iter *from, loff_t *offset);
+static long ctx_ioctl(struct ai_file_ctx *ctx, unsigned int cmd, unsigned long arg);
+
+// Stream channel helpers
+static struct ai_ring *ai_ring_alloc(unsigned int size, int node);
+static void ai_ring_free(struct ai_ring *ring);
+static ssize_t stream_read(struct ai_file_ctx *ctx, struct iov_iter *to, bool nonblock, u64 *waited);
+static ssize_t stream_write(struct ai_file_ctx *ctx, struct iov_iter *from, bool nonblock, u64 *waited);
+static int resize_stream(struct ai_device *dev, unsigned int size);
+static bool stream_readable(struct ai_device *dev);
+static bool stream_writable(struct ai_device *dev, size_t len);
+
+// Submission queue helpers
+static long queue_setup(struct ai_file_ctx *ctx, struct ai_queue_params __user *uparams);
+static long queue_enter(struct ai_file_ctx *ctx, struct ai_queue_enter __user *uenter);
+static void queue_destroy(struct ai_queue *q);
+
+// Event notification helpers
+static void emit_event(struct ai_device *dev, u32 type, u64 value, u64 threshold);
+static ssize_t event_read(struct ai_file_ctx *ctx, struct iov_iter *to, bool nonblock);
+static long set_eventfd(struct ai_file_ctx *ctx, int fd);
 
 // File operations structure
 static struct file_operations fops =
 {
     .owner = THIS_MODULE,
     .open = dev_open,
-    .read = dev_read,
-    .write = dev_write,
+    .llseek = dev_llseek,
+    .read_iter = dev_read_iter,
+    .write_iter = dev_write_iter,
+    .splice_read = generic_file_splice_read,
+    .splice_write = iter_file_splice_write,
     .unlocked_ioctl = dev_ioctl,
+    .mmap = dev_mmap,
+    .poll = dev_poll,
     .release = dev_release,
 };
 
-// Initialization function
-static int __init ai_driver_init(void){
+// Buffer mapping reference tracking
+static void ai_vma_open(struct vm_area_struct *vma){
+    struct ai_file_ctx *ctx = vma->vm_private_data;
+    atomic_inc(&ctx->map_count);
+}
+
+static void ai_vma_close(struct vm_area_struct *vma){
+    struct ai_file_ctx *ctx = vma->vm_private_data;
+    atomic_dec(&ctx->map_count);
+}
+
+static const struct vm_operations_struct ai_vm_ops = {
+    .open = ai_vma_open,
+    .close = ai_vma_close,
+};
+
+// Sysfs attributes on the class device, for tuning without opening the node
+
+static ssize_t buffer_size_show(struct device *d, struct device_attribute *attr, char *buf){
+    struct ai_device *dev = dev_get_drvdata(d);
+
+    return sysfs_emit(buf, "%u\n", READ_ONCE(dev->buffer_size));
+}
+
+// Applies to contexts opened afterwards, like AI_IOC_HW_ADAPT
+static ssize_t buffer_size_store(struct device *d, struct device_attribute *attr, const char *buf, size_t count){
+    struct ai_device *dev = dev_get_drvdata(d);
+    unsigned int val;
     int ret;
-    dev_t dev_no;
 
-    printk(KERN_INFO "AI_DRIVER: Initializing the AI kernel driver\n");
+    ret = kstrtouint(buf, 0, &val);
+    if (ret){
+        return ret;
+    }
+    if (!val || val > buffer_size_max){
+        return -EINVAL;
+    }
+    mutex_lock(&dev->mutex_lock);
+    WRITE_ONCE(dev->buffer_size, val);
+    publish_status(dev);
+    mutex_unlock(&dev->mutex_lock);
+    return count;
+}
+static DEVICE_ATTR_RW(buffer_size);
 
-    // Allocate a major number dynamically
-    ret = alloc_chrdev_region(&dev_no, 0, 1, DEVICE_NAME);
-    if (ret < 0){
-        printk(KERN_ALERT "AI_DRIVER: Failed to allocate a major number\n");
+static ssize_t threshold_show(struct device *d, struct device_attribute *attr, char *buf){
+    struct ai_device *dev = dev_get_drvdata(d);
+
+    return sysfs_emit(buf, "%u\n", READ_ONCE(dev->threshold));
+}
+
+static ssize_t threshold_store(struct device *d, struct device_attribute *attr, const char *buf, size_t count){
+    struct ai_device *dev = dev_get_drvdata(d);
+    unsigned int val;
+    int ret;
+
+    ret = kstrtouint(buf, 0, &val);
+    if (ret){
         return ret;
     }
-    ai_dev.dev_number = dev_no;
-    printk(KERN_INFO "AI_DRIVER: registered correctly with major number %d\n", MAJOR(dev_no));
+    // Taken so the update never lands in the middle of an analytics pass
+    mutex_lock(&dev->mutex_lock);
+    WRITE_ONCE(dev->threshold, val);
+    publish_status(dev);
+    mutex_unlock(&dev->mutex_lock);
+    return count;
+}
+static DEVICE_ATTR_RW(threshold);
 
-    // Initialize cdev
-    cdev_init(&ai_dev.cdev, &fops);
-    ai_dev.cdev.owner = THIS_MODULE;
+static ssize_t anomaly_threshold_show(struct device *d, struct device_attribute *attr, char *buf){
+    struct ai_device *dev = dev_get_drvdata(d);
 
-    // Add cdev to the system
-    ret = cdev_add(&ai_dev.cdev, ai_dev.dev_number, 1);
-    if (ret < 0){
-        unregister_chrdev_region(ai_dev.dev_number, 1);
-        printk(KERN_ALERT "AI_DRIVER: Failed to add cdev\n");
+    return sysfs_emit(buf, "%u\n", READ_ONCE(dev->anomaly_threshold));
+}
+
+static ssize_t anomaly_threshold_store(struct device *d, struct device_attribute *attr, const char *buf, size_t count){
+    struct ai_device *dev = dev_get_drvdata(d);
+    unsigned int val;
+    int ret;
+
+    ret = kstrtouint(buf, 0, &val);
+    if (ret){
         return ret;
     }
+    // The write path reads it locklessly; the mutex only orders the
+    // status update
+    mutex_lock(&dev->mutex_lock);
+    WRITE_ONCE(dev->anomaly_threshold, val);
+    publish_status(dev);
+    mutex_unlock(&dev->mutex_lock);
+    return count;
+}
+static DEVICE_ATTR_RW(anomaly_threshold);
 
-    // Create device class
-    ai_dev.class = class_create(THIS_MODULE, CLASS_NAME);
-    if (IS_ERR(ai_dev.class)){
-        cdev_del(&ai_dev.cdev);
-        unregister_chrdev_region(ai_dev.dev_number, 1);
-        printk(KERN_ALERT "AI_DRIVER: Failed to create device class\n");
-        return PTR_ERR(ai_dev.class);
+static ssize_t analytics_interval_ms_show(struct device *d, struct device_attribute *attr, char *buf){
+    struct ai_device *dev = dev_get_drvdata(d);
+
+    return sysfs_emit(buf, "%u\n", READ_ONCE(dev->analytics_interval_ms));
+}
+
+// A new interval takes effect immediately; 0 stops the background engine
+// and the analytics run on demand from the ioctls again
+static ssize_t analytics_interval_ms_store(struct device *d, struct device_attribute *attr, const char *buf, size_t count){
+    struct ai_device *dev = dev_get_drvdata(d);
+    unsigned int val;
+    int ret;
+
+    ret = kstrtouint(buf, 0, &val);
+    if (ret){
+        return ret;
     }
-    printk(KERN_INFO "AI_DRIVER: device class registered correctly\n");
 
-    // Create the device
-    ai_dev.device = device_create(ai_dev.class, NULL, ai_dev.dev_number, NULL, DEVICE_NAME);
-    if (IS_ERR(ai_dev.device)){
-        class_destroy(ai_dev.class);
-        cdev_del(&ai_dev.cdev);
-        unregister_chrdev_region(ai_dev.dev_number, 1);
-        printk(KERN_ALERT "AI_DRIVER: Failed to create the device\n");
-        return PTR_ERR(ai_dev.device);
-    }
-    printk(KERN_INFO "AI_DRIVER: device created correctly\n");
-
-    // Initialize mutex
-    mutex_init(&ai_dev.mutex_lock);
-
-    // Initialize buffer
-    ai_dev.buffer_size = 1024; // Default buffer size
-    ai_dev.buffer = kmalloc(ai_dev.buffer_size, GFP_KERNEL);
-    if (!ai_dev.buffer){
-        printk(KERN_ALERT "AI_DRIVER: Failed to allocate memory for buffer\n");
-        device_destroy(ai_dev.class, ai_dev.dev_number);
-        class_unregister(ai_dev.class);
-        class_destroy(ai_dev.class);
-        cdev_del(&ai_dev.cdev);
-        unregister_chrdev_region(ai_dev.dev_number, 1);
-        return -ENOMEM;
+    // Not under mutex_lock: cancelling waits for a pass that takes it
+    mutex_lock(&dev->tune_lock);
+    WRITE_ONCE(dev->analytics_interval_ms, val);
+    if (val){
+        mod_delayed_work(system_power_efficient_wq, &dev->analytics_work, msecs_to_jiffies(val));
+    } else {
+        cancel_delayed_work_sync(&dev->analytics_work);
     }
-    memset(ai_dev.buffer, 0, ai_dev.buffer_size);
+    mutex_unlock(&dev->tune_lock);
+    return count;
+}
+static DEVICE_ATTR_RW(analytics_interval_ms);
 
-    // Initialize usage count and error count
-    ai_dev.usage_count = 0;
-    ai_dev.error_count = 0;
+static ssize_t autotune_show(struct device *d, struct device_attribute *attr, char *buf){
+    struct ai_device *dev = dev_get_drvdata(d);
 
-    // Initialize anomaly score
-    ai_dev.anomaly_score = 0;
+    return sysfs_emit(buf, "%d\n", READ_ONCE(dev->autotune));
+}
 
-    // Initialize power state
-    ai_dev.low_power_mode = false;
+// Off pins buffer_size at whatever it is, or is written next
+static ssize_t autotune_store(struct device *d, struct device_attribute *attr, const char *buf, size_t count){
+    struct ai_device *dev = dev_get_drvdata(d);
+    bool val;
+    int ret;
 
-    // Initialize sensor data
-    ai_dev.sensor_data = 0;
+    ret = kstrtobool(buf, &val);
+    if (ret){
+        return ret;
+    }
+    mutex_lock(&dev->mutex_lock);
+    WRITE_ONCE(dev->autotune, val);
+    publish_status(dev);
+    mutex_unlock(&dev->mutex_lock);
+    return count;
+}
+static DEVICE_ATTR_RW(autotune);
 
-    // Set default threshold
-    ai_dev.threshold = 5000;
+// Id of the loaded inference model, or "builtin"
+static ssize_t infer_model_show(struct device *d, struct device_attribute *attr, char *buf){
+    struct ai_device *dev = dev_get_drvdata(d);
+    struct ai_infer_model *m;
+    ssize_t ret;
 
-    printk(KERN_INFO "AI_DRIVER: Initialization complete\n");
-    return 0;
+    rcu_read_lock();
+    m = rcu_dereference(dev->infer);
+    ret = m ? sysfs_emit(buf, "%#x\n", m->id) : sysfs_emit(buf, "builtin\n");
+    rcu_read_unlock();
+    return ret;
 }
 
-// Cleanup function
-static void __exit ai_driver_exit(void){
-    // Free buffer
-    kfree(ai_dev.buffer);
-
-    // Destroy device and class
-    device_destroy(ai_dev.class, ai_dev.dev_number);
-    class_unregister(ai_dev.class);
-    class_destroy(ai_dev.class);
+// Load a model from a firmware file; "builtin" goes back to the fixed rules
+static ssize_t infer_model_store(struct device *d, struct device_attribute *attr, const char *buf, size_t count){
+    struct ai_device *dev = dev_get_drvdata(d);
+    char name[64];
+    int ret;
 
-    // Delete cdev and unregister major number
-    cdev_del(&ai_dev.cdev);
-    unregister_chrdev_region(ai_dev.dev_number, 1);
+    if (count >= sizeof(name)){
+        return -EINVAL;
+    }
+    memcpy(name, buf, count);
+    name[count] = '\0';
+    strim(name);
+    if (!*name){
+        return -EINVAL;
+    }
+    if (!strcmp(name, "builtin")){
+        ret = load_infer_model(dev, NULL, 0);
+    } else {
+        ret = load_infer_firmware(dev, name);
+    }
+    return ret ? ret : count;
+}
+static DEVICE_ATTR_RW(infer_model);
 
-    // Destroy mutex
-    mutex_destroy(&ai_dev.mutex_lock);
+// Performance state the power governor picked in the latest analytics pass
+static ssize_t power_mode_show(struct device *d, struct device_attribute *attr, char *buf){
+    struct ai_device *dev = dev_get_drvdata(d);
 
-    printk(KERN_INFO "AI_DRIVER: Goodbye from the AI kernel driver!\n");
+    return sysfs_emit(buf, "%s\n", ai_pstates[READ_ONCE(dev->gov.pstate)].name);
 }
+static DEVICE_ATTR_RO(power_mode);
 
-// Open function
-static int dev_open(struct inode *inodep, struct file *filep){
-    if(!mutex_trylock(&ai_dev.mutex_lock)){
-        printk(KERN_ALERT "AI_DRIVER: Device in use by another process");
-        return -EBUSY;
-    }
-    printk(KERN_INFO "AI_DRIVER: Device has been opened\n");
+static struct attribute *ai_dev_attrs[] = {
+    &dev_attr_buffer_size.attr,
+    &dev_attr_threshold.attr,
+    &dev_attr_anomaly_threshold.attr,
+    &dev_attr_analytics_interval_ms.attr,
+    &dev_attr_power_mode.attr,
+    &dev_attr_autotune.attr,
+    &dev_attr_infer_model.attr,
+    NULL,
+};
+ATTRIBUTE_GROUPS(ai_dev);
+
+// Debugfs telemetry under <debugfs>/ai_driver/<device>/, one "name value"
+// pair per line so scrapers can parse it without knowing the structs.
+// None of the files takes mutex_lock: pass state is read from the copies
+// published with the status snapshot, and history under its sequence.
+
+static int ai_counters_show(struct seq_file *m, void *v){
+    struct ai_device *dev = m->private;
+    struct ai_stats_snapshot snap;
+    u64 anomalies, events;
+
+    fold_stats(dev, &snap, false);
+
+    spin_lock(&dev->anomaly_lock);
+    anomalies = dev->anomaly_seq;
+    spin_unlock(&dev->anomaly_lock);
+    spin_lock(&dev->event_lock);
+    events = dev->event_seq;
+    spin_unlock(&dev->event_lock);
+
+    seq_printf(m, "usage_count %llu\n", snap.usage_count);
+    seq_printf(m, "error_count %llu\n", snap.error_count);
+    seq_printf(m, "sensor_sum %llu\n", snap.sensor_sum);
+    seq_printf(m, "sensor_samples %llu\n", snap.sensor_samples);
+    seq_printf(m, "open_count %d\n", atomic_read(&dev->open_count));
+    seq_printf(m, "anomalies %llu\n", anomalies);
+    seq_printf(m, "events %llu\n", events);
     return 0;
 }
+DEFINE_SHOW_ATTRIBUTE(ai_counters);
 
-// Read function
-static ssize_t dev_read(struct file *filep, char __user *buffer, size_t len, loff_t *offset){
-    ssize_t bytes_read;
+// Operation names used by the telemetry files, indexed by AI_STAT_*
+static const char * const ai_stat_names[AI_STAT_OPS] = {
+    "read", "write", "perf_opt", "pred_maint", "sec_enhance", "pwr_mgmt", "hw_adapt",
+};
 
-    if (*offset >= ai_dev.buffer_size){
-        mutex_unlock(&ai_dev.mutex_lock);
-        return 0;
+// One line per histogram: name, then AI_HIST_BUCKETS counts where bucket i
+// holds values in [2^i, 2^(i+1)) and the last one everything above
+static void show_hist(struct seq_file *m, const char *name, const char *unit, const u64 *hist){
+    int i;
+
+    seq_printf(m, "%s_%s", name, unit);
+    for (i = 0; i < AI_HIST_BUCKETS; i++){
+        seq_printf(m, " %llu", hist[i]);
     }
+    seq_putc(m, '\n');
+}
 
-    if (len > ai_dev.buffer_size - *offset){
-        len = ai_dev.buffer_size - *offset;
+static int ai_histograms_show(struct seq_file *m, void *v){
+    struct ai_device *dev = m->private;
+    struct ai_stats_snapshot *snap;
+    int op;
+
+    // Too big for the stack with the histograms
+    snap = kmalloc(sizeof(*snap), GFP_KERNEL);
+    if (!snap){
+        return -ENOMEM;
     }
+    fold_stats(dev, snap, true);
 
-    bytes_read = copy_to_user(buffer, ai_dev.buffer + *offset, len);
-    if (bytes_read){
-        mutex_unlock(&ai_dev.mutex_lock);
-        return -EFAULT;
+    for (op = 0; op < AI_STAT_DIRS; op++){
+        show_hist(m, ai_stat_names[op], "size_bytes", snap->size_hist[op]);
+    }
+    for (op = 0; op < AI_STAT_OPS; op++){
+        show_hist(m, ai_stat_names[op], "latency_ns", snap->lat_hist[op]);
     }
 
-    *offset += len;
-    printk(KERN_INFO "AI_DRIVER: Read %zu bytes from buffer\n", len);
-    mutex_unlock(&ai_dev.mutex_lock);
-    return len;
+    kfree(snap);
+    return 0;
 }
+DEFINE_SHOW_ATTRIBUTE(ai_histograms);
 
-// Write function
-static ssize_t dev_write(struct file *filep, const char __user *buffer, size_t len, loff_t *offset){
-    ssize_t bytes_written;
+// Per-operation latency percentiles, the same numbers as AI_IOC_GET_STATS
+static int ai_latency_show(struct seq_file *m, void *v){
+    struct ai_device *dev = m->private;
+    struct ai_stats *stats;
+    int op, ret;
 
-    if (len > ai_dev.buffer_size - *offset){
-        len = ai_dev.buffer_size - *offset;
+    stats = kmalloc(sizeof(*stats), GFP_KERNEL);
+    if (!stats){
+        return -ENOMEM;
     }
-
-    bytes_written = copy_from_user(ai_dev.buffer + *offset, buffer, len);
-    if (bytes_written){
-        mutex_unlock(&ai_dev.mutex_lock);
-        return -EFAULT;
+    ret = get_stats(dev, stats);
+    if (ret){
+        kfree(stats);
+        return ret;
     }
 
-    *offset += len;
-    printk(KERN_INFO "AI_DRIVER: Wrote %zu bytes to buffer\n", len);
+    for (op = 0; op < AI_STAT_OPS; op++){
+        const struct ai_op_stats *st = &stats->ops[op];
+        const char *name = ai_stat_names[op];
 
-    // Update usage count for predictive maintenance
-    ai_dev.usage_count += len;
-
-    // Simulate error count
-    if (len > 1000) { // Arbitrary condition for errors
-        ai_dev.error_count++;
+        seq_printf(m, "%s_count %llu\n", name, st->count);
+        seq_printf(m, "%s_p50_ns %llu\n", name, st->p50_ns);
+        seq_printf(m, "%s_p99_ns %llu\n", name, st->p99_ns);
+        seq_printf(m, "%s_p999_ns %llu\n", name, st->p999_ns);
+        seq_printf(m, "%s_max_ns %llu\n", name, st->max_ns);
     }
 
-    // Simulate sensor data update
-    get_random_bytes(&ai_dev.sensor_data, sizeof(ai_dev.sensor_data));
-    ai_dev.sensor_data %= 100; // Simulate sensor data between 0-99
+    kfree(stats);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(ai_latency);
 
-    mutex_unlock(&ai_dev.mutex_lock);
-    return len;
+static int ai_model_show(struct seq_file *m, void *v){
+    struct ai_device *dev = m->private;
+    struct ai_model_state st;
+
+    get_model_state(dev, &st);
+
+    seq_printf(m, "timestamp_ns %llu\n", st.timestamp_ns);
+    seq_printf(m, "samples %llu\n", st.samples);
+    seq_printf(m, "period_ms %u\n", st.period_ms);
+    seq_printf(m, "window %u\n", st.window);
+    seq_printf(m, "alpha_q16 %u\n", st.alpha_q16);
+    seq_printf(m, "beta_q16 %u\n", st.beta_q16);
+    seq_printf(m, "level_q16 %lld\n", st.level_q16);
+    seq_printf(m, "trend_q16 %lld\n", st.trend_q16);
+    seq_printf(m, "ols_slope_q16 %lld\n", st.ols_slope_q16);
+    seq_printf(m, "ols_rate_q16 %lld\n", st.ols_rate_q16);
+    seq_printf(m, "usage_count %llu\n", st.usage_count);
+    seq_printf(m, "threshold %llu\n", st.threshold);
+    seq_printf(m, "forecast_usage %llu\n", st.forecast_usage);
+    seq_printf(m, "time_to_threshold_ms %llu\n", st.time_to_threshold_ms);
+    return 0;
 }
+DEFINE_SHOW_ATTRIBUTE(ai_model);
 
-// IOCTL function
-static long dev_ioctl(struct file *filep, unsigned int cmd, unsigned long arg){
-    long ret = 0;
+// Cached results only; reading this never runs an analytics pass
+static int ai_analytics_show(struct seq_file *m, void *v){
+    struct ai_device *dev = m->private;
+    struct ai_analytics res;
+
+    spin_lock(&dev->analytics_lock);
+    res = dev->analytics;
+    spin_unlock(&dev->analytics_lock);
+
+    seq_printf(m, "timestamp_ns %llu\n", res.timestamp_ns);
+    seq_printf(m, "runs %llu\n", res.runs);
+    seq_printf(m, "usage_count %llu\n", res.usage_count);
+    seq_printf(m, "error_count %llu\n", res.error_count);
+    seq_printf(m, "sensor_data %u\n", res.sensor_data);
+    seq_printf(m, "interval_ms %u\n", res.interval_ms);
+    seq_printf(m, "predicted_usage %llu\n", res.predicted_usage);
+    seq_printf(m, "anomaly_score %u\n", res.anomaly_score);
+    seq_printf(m, "maintenance_due %u\n", res.maintenance_due);
+    seq_printf(m, "anomaly_detected %u\n", res.anomaly_detected);
+    seq_printf(m, "low_power_mode %u\n", res.low_power_mode);
+    seq_printf(m, "time_to_threshold_ms %llu\n", res.time_to_threshold_ms);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(ai_analytics);
+
+// Tuner state as of the latest pass; reading this never runs one
+static int ai_tuner_show(struct seq_file *m, void *v){
+    struct ai_device *dev = m->private;
+    struct ai_tuner_state st;
+
+    spin_lock(&dev->telemetry_lock);
+    st = dev->telemetry.tuner;
+    spin_unlock(&dev->telemetry_lock);
+
+    seq_printf(m, "enabled %u\n", st.enabled);
+    seq_printf(m, "buffer_size %u\n", st.buffer_size);
+    seq_printf(m, "target_size %u\n", st.target_size);
+    seq_printf(m, "last_reason %u\n", st.last_reason);
+    seq_printf(m, "decisions %llu\n", st.decisions);
+    seq_printf(m, "reverts %llu\n", st.reverts);
+    seq_printf(m, "last_change_ns %llu\n", st.last_change_ns);
+    seq_printf(m, "window_ns %llu\n", st.window_ns);
+    seq_printf(m, "requests %llu\n", st.requests);
+    seq_printf(m, "clipped %llu\n", st.clipped);
+    seq_printf(m, "bytes_per_sec %llu\n", st.bytes_per_sec);
+    seq_printf(m, "p50_extent %llu\n", st.p50_extent);
+    seq_printf(m, "p99_extent %llu\n", st.p99_extent);
+    seq_printf(m, "queue_batch %u\n", st.queue_batch);
+    seq_printf(m, "readahead %u\n", st.readahead);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(ai_tuner);
+
+// Governor state as of the latest pass; reading this never runs one
+static int ai_power_show(struct seq_file *m, void *v){
+    struct ai_device *dev = m->private;
+    struct ai_governor gov;
+    int i, j;
+
+    spin_lock(&dev->telemetry_lock);
+    gov = dev->telemetry.gov;
+    spin_unlock(&dev->telemetry_lock);
+
+    seq_printf(m, "pstate %s\n", ai_pstates[gov.pstate].name);
+    seq_printf(m, "load_permille %u\n", gov.load);
+    seq_printf(m, "util_permille %u\n", gov.util);
+    seq_printf(m, "state_since_ns %llu\n", gov.state_since);
+    seq_printf(m, "busy_ns %llu\n", gov.busy_ns);
+    seq_printf(m, "idle_ns %llu\n", gov.idle_ns);
+    seq_printf(m, "transitions %llu\n", gov.transitions);
+    for (i = 0; i < AI_PSTATES; i++){
+        seq_printf(m, "time_in_%s_ns %llu\n", ai_pstates[i].name, gov.time_in_state[i]);
+    }
+    for (i = 0; i < AI_PSTATES; i++){
+        for (j = 0; j < AI_PSTATES; j++){
+            if (i != j){
+                seq_printf(m, "%s_to_%s %llu\n", ai_pstates[i].name, ai_pstates[j].name,
+                           gov.trans_table[i][j]);
+            }
+        }
+    }
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(ai_power);
+
+// Newest sample of each history level
+static int ai_history_show(struct seq_file *m, void *v){
+    struct ai_device *dev = m->private;
+    struct ai_history_level lvl[AI_HISTORY_LEVELS];
+    struct ai_history_sample last[AI_HISTORY_LEVELS];
+    int i;
+
+    for (i = 0; i < AI_HISTORY_LEVELS; i++){
+        history_copy(&dev->history, i, &last[i], 1, &lvl[i]);
+    }
+
+    for (i = 0; i < AI_HISTORY_LEVELS; i++){
+        const char *name = ai_history_geometry[i].name;
+
+        seq_printf(m, "%s_period_s %u\n", name, lvl[i].period_s);
+        seq_printf(m, "%s_entries %u\n", name, lvl[i].nr_entries);
+        seq_printf(m, "%s_newest_slot %llu\n", name, lvl[i].newest_slot);
+        seq_printf(m, "%s_usage_count %llu\n", name, lvl[i].usage_count);
+        seq_printf(m, "%s_error_count %llu\n", name, lvl[i].error_count);
+        seq_printf(m, "%s_last_usage %llu\n", name, last[i].usage);
+        seq_printf(m, "%s_last_errors %u\n", name, last[i].errors);
+        seq_printf(m, "%s_last_sensor %u\n", name, last[i].sensor);
+        seq_printf(m, "%s_last_anomaly_score %u\n", name, last[i].anomaly_score);
+        seq_printf(m, "%s_last_load_permille %u\n", name, last[i].load_permille);
+        seq_printf(m, "%s_last_flags %#x\n", name, last[i].flags);
+    }
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(ai_history);
+
+// Latest model evaluation; reading this never runs a pass
+static int ai_inference_show(struct seq_file *m, void *v){
+    struct ai_device *dev = m->private;
+    struct ai_inference inf;
+    int i;
+
+    spin_lock(&dev->telemetry_lock);
+    inf = dev->telemetry.inference;
+    spin_unlock(&dev->telemetry_lock);
+
+    seq_printf(m, "model_id %#x\n", inf.model_id);
+    seq_printf(m, "model_type %u\n", inf.model_type);
+    seq_printf(m, "loaded_ns %llu\n", inf.loaded_ns);
+    seq_printf(m, "runs %llu\n", inf.runs);
+    seq_printf(m, "eval_ns %llu\n", inf.eval_ns);
+    for (i = 0; i < AI_INFER_INPUTS; i++){
+        seq_printf(m, "input%d %d\n", i, inf.inputs[i]);
+    }
+    for (i = 0; i < inf.nr_outputs; i++){
+        seq_printf(m, "output%d %d\n", i, inf.outputs[i]);
+    }
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(ai_inference);
+
+static void create_debugfs(struct ai_device *dev){
+    dev->debugfs = debugfs_create_dir(dev_name(dev->device), ai_debugfs_root);
+    debugfs_create_file("counters", 0444, dev->debugfs, dev, &ai_counters_fops);
+    debugfs_create_file("histograms", 0444, dev->debugfs, dev, &ai_histograms_fops);
+    debugfs_create_file("latency", 0444, dev->debugfs, dev, &ai_latency_fops);
+    debugfs_create_file("model", 0444, dev->debugfs, dev, &ai_model_fops);
+    debugfs_create_file("analytics", 0444, dev->debugfs, dev, &ai_analytics_fops);
+    debugfs_create_file("tuner", 0444, dev->debugfs, dev, &ai_tuner_fops);
+    debugfs_create_file("power", 0444, dev->debugfs, dev, &ai_power_fops);
+    debugfs_create_file("inference", 0444, dev->debugfs, dev, &ai_inference_fops);
+    debugfs_create_file("history", 0444, dev->debugfs, dev, &ai_history_fops);
+}
+
+// NUMA node for instance idx; instances are spread round-robin over the
+// online nodes
+static int instance_node(unsigned int idx){
+    int node, n = idx % num_online_nodes();
+
+    for_each_online_node(node){
+        if (n-- == 0){
+            return node;
+        }
+    }
+    return NUMA_NO_NODE;
+}
+
+// Allocate and register one device instance
+static int ai_device_create(unsigned int idx){
+    struct ai_device *dev;
+    int node = instance_node(idx);
+    int ret;
+    int cpu;
+
+    dev = kzalloc_node(sizeof(*dev), GFP_KERNEL, node);
+    if (!dev){
+        printk(KERN_ALERT "AI_DRIVER: Failed to allocate device %u\n", idx);
+        return -ENOMEM;
+    }
+    dev->index = idx;
+    dev->node = node;
+    dev->dev_number = MKDEV(MAJOR(ai_dev_base), MINOR(ai_dev_base) + idx);
+
+    // Initialize locks
+    mutex_init(&dev->mutex_lock);
+    atomic_set(&dev->open_count, 0);
+
+    // Default buffer size for each open context
+    dev->buffer_size = AI_BUFFER_DEFAULT_SIZE;
+
+    // Initialize the per-CPU usage, error and sensor statistics
+    dev->stats = alloc_percpu(struct ai_pcpu_stats);
+    if (!dev->stats){
+        kfree(dev);
+        printk(KERN_ALERT "AI_DRIVER: Failed to allocate statistics\n");
+        return -ENOMEM;
+    }
+    for_each_possible_cpu(cpu){
+        struct ai_pcpu_stats *stats = per_cpu_ptr(dev->stats, cpu);
+
+        u64_stats_init(&stats->syncp);
+        stats->payload.i16_min = S16_MAX;
+        stats->payload.i16_max = S16_MIN;
+        stats->payload.f32_min = U32_MAX;
+    }
+
+    // Allocate the anomaly log
+    spin_lock_init(&dev->anomaly_lock);
+    dev->anomalies = kcalloc_node(anomaly_log_size, sizeof(*dev->anomalies), GFP_KERNEL, node);
+    if (!dev->anomalies){
+        free_percpu(dev->stats);
+        kfree(dev);
+        printk(KERN_ALERT "AI_DRIVER: Failed to allocate anomaly log\n");
+        return -ENOMEM;
+    }
+
+    // Allocate the telemetry history
+    ret = history_init(dev);
+    if (ret){
+        kfree(dev->anomalies);
+        free_percpu(dev->stats);
+        kfree(dev);
+        printk(KERN_ALERT "AI_DRIVER: Failed to allocate telemetry history\n");
+        return ret;
+    }
+    dev->status = vmalloc_user(PAGE_SIZE);
+    if (!dev->status){
+        vfree(dev->history.hdr);
+        kfree(dev->anomalies);
+        free_percpu(dev->stats);
+        kfree(dev);
+        printk(KERN_ALERT "AI_DRIVER: Failed to allocate status page\n");
+        return -ENOMEM;
+    }
+    dev->status->version = AI_STATUS_VERSION;
+
+    // Start the predictive model from an empty history
+    spin_lock_init(&dev->model_lock);
+    atomic64_set(&dev->model.pending, 0);
+    dev->model.last_ns = ktime_get_ns();
+
+    // Initialize the analytics results; power state starts out normal
+    spin_lock_init(&dev->analytics_lock);
+    INIT_DELAYED_WORK(&dev->analytics_work, analytics_work_fn);
+
+    // Set default threshold and the tunables from the module parameters
+    dev->threshold = 5000;
+    dev->anomaly_threshold = anomaly_threshold;
+    dev->analytics_interval_ms = analytics_interval_ms;
+    dev->autotune = autotune;
+    dev->tuner.last_ns = ktime_get_ns();
+    dev->tuner.state.enabled = autotune;
+    dev->tuner.state.buffer_size = dev->buffer_size;
+    dev->tuner.state.target_size = dev->buffer_size;
+    dev->queue_batch = AI_QUEUE_BATCH;
+    dev->tuner.prev_batch = AI_QUEUE_BATCH;
+    dev->tuner.state.queue_batch = AI_QUEUE_BATCH;
+    dev->gov.pstate = AI_PSTATE_NORMAL;
+    dev->gov.last_ns = dev->tuner.last_ns;
+    dev->gov.state_since = dev->tuner.last_ns;
+    spin_lock_init(&dev->infer_lock);
+    spin_lock_init(&dev->telemetry_lock);
+    mutex_init(&dev->tune_lock);
+    publish_status(dev);
+
+    // Initialize the stream channel
+    mutex_init(&dev->stream_read_lock);
+    init_waitqueue_head(&dev->stream_readq);
+    init_waitqueue_head(&dev->stream_writeq);
+    ret = init_srcu_struct(&dev->stream_srcu);
+    if (ret){
+        vfree(dev->status);
+        vfree(dev->history.hdr);
+        kfree(dev->anomalies);
+        free_percpu(dev->stats);
+        kfree(dev);
+        printk(KERN_ALERT "AI_DRIVER: Failed to initialize stream SRCU\n");
+        return ret;
+    }
+    RCU_INIT_POINTER(dev->stream, ai_ring_alloc(AI_STREAM_DEFAULT_SIZE, node));
+    if (!rcu_access_pointer(dev->stream)){
+        cleanup_srcu_struct(&dev->stream_srcu);
+        vfree(dev->status);
+        vfree(dev->history.hdr);
+        kfree(dev->anomalies);
+        free_percpu(dev->stats);
+        kfree(dev);
+        printk(KERN_ALERT "AI_DRIVER: Failed to allocate stream ring\n");
+        return -ENOMEM;
+    }
+
+    // Initialize the event log
+    spin_lock_init(&dev->event_lock);
+    init_waitqueue_head(&dev->event_wq);
+    INIT_LIST_HEAD(&dev->eventfd_list);
+
+    // Initialize cdev
+    cdev_init(&dev->cdev, &fops);
+    dev->cdev.owner = THIS_MODULE;
+
+    // Add cdev to the system
+    ret = cdev_add(&dev->cdev, dev->dev_number, 1);
+    if (ret < 0){
+        ai_ring_free(rcu_dereference_protected(dev->stream, 1));
+        cleanup_srcu_struct(&dev->stream_srcu);
+        vfree(dev->status);
+        vfree(dev->history.hdr);
+        kfree(dev->anomalies);
+        free_percpu(dev->stats);
+        kfree(dev);
+        printk(KERN_ALERT "AI_DRIVER: Failed to add cdev\n");
+        return ret;
+    }
+
+    // Create the device along with its sysfs attributes
+    if (num_devices == 1){
+        dev->device = device_create_with_groups(ai_class, NULL, dev->dev_number, dev,
+                                                ai_dev_groups, DEVICE_NAME);
+    } else {
+        dev->device = device_create_with_groups(ai_class, NULL, dev->dev_number, dev,
+                                                ai_dev_groups, DEVICE_NAME "%u", idx);
+    }
+    if (IS_ERR(dev->device)){
+        ret = PTR_ERR(dev->device);
+        cdev_del(&dev->cdev);
+        ai_ring_free(rcu_dereference_protected(dev->stream, 1));
+        cleanup_srcu_struct(&dev->stream_srcu);
+        vfree(dev->status);
+        vfree(dev->history.hdr);
+        kfree(dev->anomalies);
+        free_percpu(dev->stats);
+        kfree(dev);
+        printk(KERN_ALERT "AI_DRIVER: Failed to create the device\n");
+        return ret;
+    }
+
+    create_debugfs(dev);
+
+    // A missing or bad model leaves the built-in rules in charge
+    if (infer_model && *infer_model){
+        load_infer_firmware(dev, infer_model);
+    }
+
+    // Start the background analytics engine
+    if (dev->analytics_interval_ms){
+        queue_delayed_work(system_power_efficient_wq, &dev->analytics_work,
+                           msecs_to_jiffies(dev->analytics_interval_ms));
+    }
+
+    ai_devs[idx] = dev;
+    printk(KERN_INFO "AI_DRIVER: device %u created correctly on node %d\n", idx, node);
+    return 0;
+}
+
+static void ai_device_destroy(struct ai_device *dev){
+    debugfs_remove_recursive(dev->debugfs);
+
+    // Destroy the device first so a sysfs store can no longer requeue the
+    // analytics engine, then stop it before the state it reads goes away
+    device_destroy(ai_class, dev->dev_number);
+    cancel_delayed_work_sync(&dev->analytics_work);
+    cdev_del(&dev->cdev);
+    kfree(rcu_dereference_protected(dev->infer, 1));
+
+    // Free the stream rings
+    ai_ring_free(rcu_dereference_protected(dev->stream_old, 1));
+    ai_ring_free(rcu_dereference_protected(dev->stream, 1));
+    cleanup_srcu_struct(&dev->stream_srcu);
+
+    vfree(dev->status);
+    vfree(dev->history.hdr);
+    kfree(dev->anomalies);
+    free_percpu(dev->stats);
+
+    // Destroy mutex
+    mutex_destroy(&dev->stream_read_lock);
+    mutex_destroy(&dev->tune_lock);
+    mutex_destroy(&dev->mutex_lock);
+
+    ai_devs[dev->index] = NULL;
+    kfree(dev);
+}
+
+// Initialization function
+static int __init ai_driver_init(void){
+    int ret;
+    unsigned int i;
+
+    printk(KERN_INFO "AI_DRIVER: Initializing the AI kernel driver\n");
+
+    if (num_devices < 1 || num_devices > AI_MAX_DEVICES){
+        printk(KERN_ALERT "AI_DRIVER: num_devices must be between 1 and %d\n", AI_MAX_DEVICES);
+        return -EINVAL;
+    }
+    anomaly_log_size = max(anomaly_log_size, 1U);
+    buffer_size_max = clamp_t(unsigned int, buffer_size_max, AI_CHUNK_SIZE, AI_BUFFER_SIZE_LIMIT);
+    stream_size_max = max_t(unsigned int, stream_size_max, AI_STREAM_MIN_SIZE);
+    select_scan_impl();
+
+    // Chunk tables and the chunk reserve are shared by all instances
+    ai_chunk_map_cache = kmem_cache_create("ai_chunk_map",
+                                           DIV_ROUND_UP(buffer_size_max, AI_CHUNK_SIZE) * sizeof(struct page *),
+                                           0, 0, NULL);
+    if (!ai_chunk_map_cache){
+        printk(KERN_ALERT "AI_DRIVER: Failed to create chunk map cache\n");
+        return -ENOMEM;
+    }
+    ai_chunk_pool = mempool_create_page_pool(chunk_reserve, 0);
+    if (!ai_chunk_pool){
+        kmem_cache_destroy(ai_chunk_map_cache);
+        printk(KERN_ALERT "AI_DRIVER: Failed to create chunk pool\n");
+        return -ENOMEM;
+    }
+
+    // Allocate a major number dynamically, with one minor per instance
+    ret = alloc_chrdev_region(&ai_dev_base, 0, num_devices, DEVICE_NAME);
+    if (ret < 0){
+        mempool_destroy(ai_chunk_pool);
+        kmem_cache_destroy(ai_chunk_map_cache);
+        printk(KERN_ALERT "AI_DRIVER: Failed to allocate a major number\n");
+        return ret;
+    }
+    printk(KERN_INFO "AI_DRIVER: registered correctly with major number %d\n", MAJOR(ai_dev_base));
+
+    // Create device class
+    ai_class = class_create(THIS_MODULE, CLASS_NAME);
+    if (IS_ERR(ai_class)){
+        unregister_chrdev_region(ai_dev_base, num_devices);
+        mempool_destroy(ai_chunk_pool);
+        kmem_cache_destroy(ai_chunk_map_cache);
+        printk(KERN_ALERT "AI_DRIVER: Failed to create device class\n");
+        return PTR_ERR(ai_class);
+    }
+    printk(KERN_INFO "AI_DRIVER: device class registered correctly\n");
+
+    // Telemetry is optional; debugfs failures are not fatal
+    ai_debugfs_root = debugfs_create_dir(DEVICE_NAME, NULL);
+
+    for (i = 0; i < num_devices; i++){
+        ret = ai_device_create(i);
+        if (ret){
+            while (i--){
+                ai_device_destroy(ai_devs[i]);
+            }
+            debugfs_remove_recursive(ai_debugfs_root);
+            class_destroy(ai_class);
+            unregister_chrdev_region(ai_dev_base, num_devices);
+            mempool_destroy(ai_chunk_pool);
+            kmem_cache_destroy(ai_chunk_map_cache);
+            return ret;
+        }
+    }
+
+    printk(KERN_INFO "AI_DRIVER: Initialization complete\n");
+    return 0;
+}
+
+// Cleanup function
+static void __exit ai_driver_exit(void){
+    unsigned int i;
+
+    for (i = 0; i < num_devices; i++){
+        ai_device_destroy(ai_devs[i]);
+    }
+    debugfs_remove_recursive(ai_debugfs_root);
+
+    // Inference models replaced at runtime are freed after a grace period
+    rcu_barrier();
+
+    // Destroy class and unregister the major number; class_destroy also unregisters it
+    class_destroy(ai_class);
+    unregister_chrdev_region(ai_dev_base, num_devices);
+
+    mempool_destroy(ai_chunk_pool);
+    kmem_cache_destroy(ai_chunk_map_cache);
+
+    printk(KERN_INFO "AI_DRIVER: Goodbye from the AI kernel driver!\n");
+}
+
+// Open function
+static int dev_open(struct inode *inodep, struct file *filep){
+    struct ai_device *dev = container_of(inodep->i_cdev, struct ai_device, cdev);
+    struct ai_file_ctx *ctx;
+
+    ctx = kzalloc_node(sizeof(*ctx), GFP_KERNEL, dev->node);
+    if (!ctx){
+        pr_err_ratelimited("Failed to allocate open context\n");
+        return -ENOMEM;
+    }
+
+    ctx->dev = dev;
+    INIT_LIST_HEAD(&ctx->eventfd_node);
+    mutex_init(&ctx->lock);
+    mutex_init(&ctx->map_lock);
+    atomic_set(&ctx->map_count, 0);
+
+    // Each open gets its own buffer so concurrent users never contend on it
+    ctx->buffer_size = READ_ONCE(dev->buffer_size);
+    ctx->chunks = kmem_cache_zalloc(ai_chunk_map_cache, GFP_KERNEL);
+    if (!ctx->chunks || set_buffer_chunks(ctx, ctx->buffer_size, GFP_KERNEL)){
+        pr_err_ratelimited("Failed to allocate memory for buffer\n");
+        free_buffer_chunks(ctx);
+        kfree(ctx);
+        return -ENOMEM;
+    }
+
+    filep->private_data = ctx;
+    trace_ai_open(dev->index, atomic_inc_return(&dev->open_count));
+    return 0;
+}
+
+// Read function. Every read path lands here through the iov_iter: read,
+// readv, preadv2, io_uring and splice.
+static ssize_t dev_read_iter(struct kiocb *iocb, struct iov_iter *to){
+    struct file *filep = iocb->ki_filp;
+    struct ai_file_ctx *ctx = filep->private_data;
+    struct ai_device *dev = ctx->dev;
+    unsigned int channel = READ_ONCE(ctx->channel);
+    bool nonblock = (filep->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT);
+    size_t len = iov_iter_count(to);
+    loff_t pos = iocb->ki_pos;
+    u64 start = ktime_get_ns();
+    u64 waited = 0;
+    u64 ns;
+    ssize_t ret;
+
+    switch (channel){
+        case AI_CHANNEL_STREAM:
+            ret = stream_read(ctx, to, nonblock, &waited);
+            break;
+        case AI_CHANNEL_EVENTS:
+            ret = event_read(ctx, to, nonblock);
+            break;
+        default:
+            ret = buffer_read(ctx, to, &iocb->ki_pos);
+    }
+
+    // Time asleep on an empty stream ring is idle, not work
+    ns = ktime_get_ns() - start - waited;
+    if (ret >= 0 && channel != AI_CHANNEL_EVENTS){
+        account_io(dev, AI_STAT_READ, ret, ns);
+    }
+    trace_ai_read(dev->index, channel, len, pos, ret, ns);
+    return ret;
+}
+
+static ssize_t buffer_read(struct ai_file_ctx *ctx, struct iov_iter *to, loff_t *offset){
+    size_t len = iov_iter_count(to);
+    unsigned int ra;
+    size_t done;
+    bool seq;
+
+    // Queue entries carry raw offsets, the VFS has not checked them
+    if (*offset < 0){
+        return -EINVAL;
+    }
+
+    mutex_lock(&ctx->lock);
+
+    if (*offset >= ctx->buffer_size){
+        mutex_unlock(&ctx->lock);
+        return 0;
+    }
+
+    if (len > ctx->buffer_size - *offset){
+        len = ctx->buffer_size - *offset;
+    }
+
+    done = buffer_copy_to_iter(ctx, *offset, len, to);
+    if (!done && len){
+        mutex_unlock(&ctx->lock);
+        return -EFAULT;
+    }
+
+    seq = *offset == ctx->read_next;
+    account_tune(ctx->dev, *offset, len, done, false, seq);
+    *offset += done;
+    ctx->read_next = *offset;
+
+    // A sequential reader finds the next window already in the cache
+    ra = READ_ONCE(ctx->dev->readahead);
+    if (seq && ra){
+        buffer_prefetch(ctx, *offset, ra);
+    }
+    atomic64_add(done, &ctx->bytes_read);
+    mutex_unlock(&ctx->lock);
+    return done;
+}
+
+// Write function, the counterpart of dev_read_iter()
+static ssize_t dev_write_iter(struct kiocb *iocb, struct iov_iter *from){
+    struct file *filep = iocb->ki_filp;
+    struct ai_file_ctx *ctx = filep->private_data;
+    struct ai_device *dev = ctx->dev;
+    unsigned int channel = READ_ONCE(ctx->channel);
+    bool nonblock = (filep->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT);
+    size_t len = iov_iter_count(from);
+    loff_t pos = iocb->ki_pos;
+    u64 start = ktime_get_ns();
+    u64 waited = 0;
+    u64 ns;
+    ssize_t ret;
+
+    switch (channel){
+        case AI_CHANNEL_STREAM:
+            ret = stream_write(ctx, from, nonblock, &waited);
+            break;
+        case AI_CHANNEL_EVENTS:
+            ret = -EINVAL;
+            break;
+        default:
+            ret = buffer_write(ctx, from, &iocb->ki_pos);
+    }
+
+    // Nor is time asleep waiting for room in it
+    ns = ktime_get_ns() - start - waited;
+    if (ret >= 0){
+        account_io(dev, AI_STAT_WRITE, ret, ns);
+    }
+    trace_ai_write(dev->index, channel, len, pos, ret, ns);
+    return ret;
+}
+
+// Writes past the end grow the buffer up to buffer_size_max instead of
+// being cut short, so a large writev or splice lands in one call
+static ssize_t buffer_write(struct ai_file_ctx *ctx, struct iov_iter *from, loff_t *offset){
+    size_t want = iov_iter_count(from);
+    size_t len = want;
+    size_t done;
+
+    if (*offset < 0){
+        return -EINVAL;
+    }
+
+    mutex_lock(&ctx->lock);
+
+    // A grow that runs out of chunks stops short, and the write is clipped there
+    if (*offset + len > ctx->buffer_size && *offset < buffer_size_max){
+        grow_ctx_buffer(ctx, min_t(u64, *offset + len, buffer_size_max));
+    }
+
+    // Clipped writes still tell the autotuner how much buffer was wanted
+    if (*offset >= ctx->buffer_size){
+        account_tune(ctx->dev, *offset, want, 0, true, false);
+        mutex_unlock(&ctx->lock);
+        return -ENOSPC;
+    }
+
+    if (len > ctx->buffer_size - *offset){
+        len = ctx->buffer_size - *offset;
+    }
+
+    done = buffer_copy_from_iter(ctx, *offset, len, from);
+    if (!done && len){
+        mutex_unlock(&ctx->lock);
+        return -EFAULT;
+    }
+
+    account_tune(ctx->dev, *offset, want, done, true, false);
+    account_buffer(ctx, *offset, done);
+    *offset += done;
+    mutex_unlock(&ctx->lock);
+    return done;
+}
+
+// Seek within the buffer channel; SEEK_END is relative to the current
+// buffer size. The stream and event channels are FIFOs.
+static loff_t dev_llseek(struct file *filep, loff_t offset, int whence){
+    struct ai_file_ctx *ctx = filep->private_data;
+
+    if (READ_ONCE(ctx->channel) != AI_CHANNEL_BUFFER){
+        return -ESPIPE;
+    }
+    return generic_file_llseek_size(filep, offset, whence, buffer_size_max, READ_ONCE(ctx->buffer_size));
+}
+
+// Map a region the driver publishes for user space to read
+static int map_readonly(struct vm_area_struct *vma, void *addr, unsigned long pgoff){
+    if (vma->vm_flags & VM_WRITE){
+        return -EPERM;
+    }
+    vma->vm_flags &= ~VM_MAYWRITE;
+    return remap_vmalloc_range(vma, addr, pgoff);
+}
+
+// Mmap function: maps the per-open buffer or queue rings for zero-copy
+// access, or the instance's telemetry history and status read-only
+static int dev_mmap(struct file *filep, struct vm_area_struct *vma){
+    struct ai_file_ctx *ctx = filep->private_data;
+    int ret;
+
+    if (vma->vm_pgoff >= (AI_MMAP_OFF_STATUS >> PAGE_SHIFT)){
+        return map_readonly(vma, ctx->dev->status, vma->vm_pgoff - (AI_MMAP_OFF_STATUS >> PAGE_SHIFT));
+    }
+    if (vma->vm_pgoff >= (AI_MMAP_OFF_HISTORY >> PAGE_SHIFT)){
+        return map_readonly(vma, ctx->dev->history.hdr, vma->vm_pgoff - (AI_MMAP_OFF_HISTORY >> PAGE_SHIFT));
+    }
+
+    // Writes through a private mapping would never reach the buffer
+    if (!(vma->vm_flags & VM_SHARED)){
+        return -EINVAL;
+    }
+
+    if (vma->vm_pgoff >= (AI_MMAP_OFF_QUEUE >> PAGE_SHIFT)){
+        struct ai_queue *q = smp_load_acquire(&ctx->queue);
+
+        if (!q){
+            return -EINVAL;
+        }
+        // A polling worker takes SQEs without a doorbell, so the rings are
+        // only handed to the address space their buffers are read from
+        if (current->mm != q->mm){
+            return -EPERM;
+        }
+        return remap_vmalloc_range(vma, q->rings, vma->vm_pgoff - (AI_MMAP_OFF_QUEUE >> PAGE_SHIFT));
+    }
+
+    mutex_lock(&ctx->map_lock);
+    ret = map_buffer(ctx, vma);
+    if (ret){
+        mutex_unlock(&ctx->map_lock);
+        return ret;
+    }
+    vma->vm_private_data = ctx;
+    vma->vm_ops = &ai_vm_ops;
+    atomic_inc(&ctx->map_count);
+    mutex_unlock(&ctx->map_lock);
+
+    pr_debug("Buffer mapped into user space\n");
+    return 0;
+}
+
+// Poll function
+static __poll_t dev_poll(struct file *filep, poll_table *wait){
+    struct ai_file_ctx *ctx = filep->private_data;
+    struct ai_device *dev = ctx->dev;
+    __poll_t mask = 0;
+    bool pending;
+
+    poll_wait(filep, &dev->event_wq, wait);
+    spin_lock(&dev->event_lock);
+    pending = ctx->event_cursor < dev->event_seq;
+    spin_unlock(&dev->event_lock);
+
+    switch (READ_ONCE(ctx->channel)){
+        case AI_CHANNEL_EVENTS:
+            if (pending){
+                mask |= EPOLLIN | EPOLLRDNORM;
+            }
+            break;
+        case AI_CHANNEL_STREAM:
+            poll_wait(filep, &dev->stream_readq, wait);
+            poll_wait(filep, &dev->stream_writeq, wait);
+            if (stream_readable(dev)){
+                mask |= EPOLLIN | EPOLLRDNORM;
+            }
+            if (stream_writable(dev, 1)){
+                mask |= EPOLLOUT | EPOLLWRNORM;
+            }
+            break;
+        default:
+            // The private buffer never blocks
+            mask |= EPOLLIN | EPOLLRDNORM | EPOLLOUT | EPOLLWRNORM;
+    }
+
+    // Data channels report pending events as priority data
+    if (pending && READ_ONCE(ctx->channel) != AI_CHANNEL_EVENTS){
+        mask |= EPOLLPRI;
+    }
+    return mask;
+}
+
+// IOCTL function
+static long dev_ioctl(struct file *filep, unsigned int cmd, unsigned long arg){
+    struct ai_file_ctx *ctx = filep->private_data;
+    int op = ioctl_stat_op(cmd);
+    u64 start = 0, ns = 0;
+    long ret;
+
+    // Only the AI commands are timed unless the tracepoint wants them all
+    if (op >= 0 || trace_ai_ioctl_enabled()){
+        start = ktime_get_ns();
+    }
+    ret = dispatch_ioctl(ctx, cmd, arg);
+    if (start){
+        ns = ktime_get_ns() - start;
+    }
+    if (op >= 0){
+        account_latency(ctx->dev, op, ns);
+    }
+    trace_ai_ioctl(ctx->dev->index, cmd, ret, ns);
+    return ret;
+}
+
+static long dispatch_ioctl(struct ai_file_ctx *ctx, unsigned int cmd, unsigned long arg){
+    struct ai_device *dev = ctx->dev;
+    long ret = 0;
 
     // Validate magic number
     if(_IOC_TYPE(cmd) != AI_IOC_MAGIC){
-        printk(KERN_WARNING "AI_DRIVER: Invalid IOCTL magic number\n");
+        pr_warn_ratelimited("Invalid IOCTL magic number\n");
         return -ENOTTY;
     }
 
-    mutex_lock(&ai_dev.mutex_lock);
+    // Per-file commands don't touch shared AI state
+    ret = ctx_ioctl(ctx, cmd, arg);
+    if (ret != -ENOIOCTLCMD){
+        return ret;
+    }
+    ret = 0;
+
+    // Analytics commands report the cached results of the background engine;
+    // only configuration changes take the device mutex
+    switch(cmd){
+        case AI_IOC_PERF_OPT:
+            pr_debug("Performing performance optimization\n");
+            mutex_lock(&dev->mutex_lock);
+            optimize_performance(ctx);
+            mutex_unlock(&dev->mutex_lock);
+            break;
+        case AI_IOC_PRED_MAINT:
+        {
+            struct ai_analytics res;
+            get_analytics(dev, &res);
+            pr_debug("Predicted future usage: %llu%s\n", res.predicted_usage,
+                     res.maintenance_due ? " (maintenance required soon)" : "");
+            break;
+        }
+        case AI_IOC_SEC_ENHANCE:
+        {
+            struct ai_analytics res;
+            get_analytics(dev, &res);
+            pr_debug("Calculated anomaly score: %u%s\n", res.anomaly_score,
+                     res.anomaly_detected ? " (anomaly detected)" : "");
+            break;
+        }
+        case AI_IOC_PWR_MGMT:
+        {
+            struct ai_analytics res;
+            get_analytics(dev, &res);
+            pr_debug("Power mode: %s\n", ai_pstates[READ_ONCE(dev->gov.pstate)].name);
+            break;
+        }
+        case AI_IOC_HW_ADAPT:
+        {
+            struct hw_config config;
+            if (copy_from_user(&config, (struct hw_config __user *)arg, sizeof(struct hw_config))){
+                pr_warn_ratelimited("Failed to copy hardware config from user\n");
+                ret = -EFAULT;
+                break;
+            }
+            pr_debug("Adapting hardware configurations\n");
+            mutex_lock(&dev->mutex_lock);
+            ret = adapt_hardware(ctx, &config);
+            mutex_unlock(&dev->mutex_lock);
+            break;
+        }
+        case AI_IOC_GET_LIMITS:
+        {
+            struct ai_limits limits = {
+                .buffer_size_min = 1,
+                .buffer_size_max = buffer_size_max,
+                .stream_size_min = AI_STREAM_MIN_SIZE,
+                .stream_size_max = stream_size_max,
+                .chunk_size = AI_CHUNK_SIZE,
+                .chunk_reserve = chunk_reserve,
+            };
+            if (copy_to_user((struct ai_limits __user *)arg, &limits, sizeof(limits))){
+                ret = -EFAULT;
+            }
+            break;
+        }
+        case AI_IOC_GET_STATS:
+        {
+            struct ai_stats *stats;
+            u32 size;
+
+            if (get_user(size, &((struct ai_stats __user *)arg)->size)){
+                ret = -EFAULT;
+                break;
+            }
+            if (size < offsetof(struct ai_stats, ops)){
+                ret = -EINVAL;
+                break;
+            }
+            // Too big for the stack with its histograms
+            stats = kmalloc(sizeof(*stats), GFP_KERNEL);
+            if (!stats){
+                ret = -ENOMEM;
+                break;
+            }
+            ret = get_stats(dev, stats);
+            if (!ret){
+                stats->size = min_t(u32, size, sizeof(*stats));
+                if (copy_to_user((void __user *)arg, stats, stats->size)){
+                    ret = -EFAULT;
+                }
+            }
+            kfree(stats);
+            break;
+        }
+        case AI_IOC_GET_TUNER:
+        {
+            struct ai_tuner_state state;
+            get_tuner(dev, &state);
+            if (copy_to_user((struct ai_tuner_state __user *)arg, &state, sizeof(state))){
+                ret = -EFAULT;
+            }
+            break;
+        }
+        case AI_IOC_GET_POWER:
+        {
+            struct ai_power_state state;
+            get_power(dev, &state);
+            if (copy_to_user((struct ai_power_state __user *)arg, &state, sizeof(state))){
+                ret = -EFAULT;
+            }
+            break;
+        }
+        case AI_IOC_LOAD_INFER_MODEL:
+            ret = set_infer_model(dev, (struct ai_infer_load __user *)arg);
+            break;
+        case AI_IOC_GET_INFERENCE:
+        {
+            struct ai_inference inf;
+            get_inference(dev, &inf);
+            if (copy_to_user((struct ai_inference __user *)arg, &inf, sizeof(inf))){
+                ret = -EFAULT;
+            }
+            break;
+        }
+        case AI_IOC_GET_ANOMALIES:
+            ret = get_anomalies(dev, (struct ai_anomaly_query __user *)arg);
+            break;
+        case AI_IOC_BATCH:
+            ret = run_batch(ctx, (struct ai_batch __user *)arg);
+            break;
+        case AI_IOC_GET_HISTORY:
+            ret = get_history(dev, (struct ai_history_query __user *)arg);
+            break;
+        case AI_IOC_GET_STATUS:
+        {
+            struct ai_status status;
+            get_status(dev, &status);
+            if (copy_to_user((struct ai_status __user *)arg, &status, sizeof(status))){
+                ret = -EFAULT;
+            }
+            break;
+        }
+        case AI_IOC_GET_FEATURES:
+        {
+            struct ai_features *features;
+
+            // Too big for the stack with its histogram
+            features = kmalloc(sizeof(*features), GFP_KERNEL);
+            if (!features){
+                ret = -ENOMEM;
+                break;
+            }
+            get_features(dev, features);
+            if (copy_to_user((struct ai_features __user *)arg, features, sizeof(*features))){
+                ret = -EFAULT;
+            }
+            kfree(features);
+            break;
+        }
+        case AI_IOC_GET_MODEL:
+        {
+            struct ai_model_state state;
+            get_model_state(dev, &state);
+            if (copy_to_user((struct ai_model_state __user *)arg, &state, sizeof(state))){
+                ret = -EFAULT;
+            }
+            break;
+        }
+        case AI_IOC_GET_ANALYTICS:
+        {
+            struct ai_analytics res;
+            get_analytics(dev, &res);
+            if (copy_to_user((struct ai_analytics __user *)arg, &res, sizeof(res))){
+                ret = -EFAULT;
+            }
+            break;
+        }
+        default:
+            pr_warn_ratelimited("Unknown IOCTL command %u\n", cmd);
+            ret = -EINVAL;
+    }
+
+    return ret;
+}
+
+static long ctx_ioctl(struct ai_file_ctx *ctx, unsigned int cmd, unsigned long arg){
+    struct ai_device *dev = ctx->dev;
+    long ret = 0;
+
+    switch(cmd){
+        case AI_IOC_COMMIT:
+        {
+            struct ai_range range;
+            if (copy_from_user(&range, (struct ai_range __user *)arg, sizeof(struct ai_range))){
+                ret = -EFAULT;
+                break;
+            }
+            // Publish bytes written through the mapping without copying them
+            mutex_lock(&ctx->lock);
+            if (range.offset > ctx->buffer_size || range.length > ctx->buffer_size - range.offset){
+                mutex_unlock(&ctx->lock);
+                ret = -EINVAL;
+                break;
+            }
+            account_buffer(ctx, range.offset, range.length);
+            mutex_unlock(&ctx->lock);
+            break;
+        }
+        case AI_IOC_SET_CHANNEL:
+            if (arg != AI_CHANNEL_BUFFER && arg != AI_CHANNEL_STREAM && arg != AI_CHANNEL_EVENTS){
+                ret = -EINVAL;
+                break;
+            }
+            // Event readers only see events raised after they subscribe
+            if (arg == AI_CHANNEL_EVENTS && READ_ONCE(ctx->channel) != AI_CHANNEL_EVENTS){
+                spin_lock(&dev->event_lock);
+                ctx->event_cursor = dev->event_seq;
+                spin_unlock(&dev->event_lock);
+            }
+            WRITE_ONCE(ctx->channel, arg);
+            pr_debug("Switched to %s channel\n",
+                     arg == AI_CHANNEL_STREAM ? "stream" : arg == AI_CHANNEL_EVENTS ? "events" : "buffer");
+            break;
+        case AI_IOC_SETUP_QUEUE:
+            ret = queue_setup(ctx, (struct ai_queue_params __user *)arg);
+            break;
+        case AI_IOC_QUEUE_ENTER:
+            ret = queue_enter(ctx, (struct ai_queue_enter __user *)arg);
+            break;
+        case AI_IOC_SET_EVENTFD:
+            ret = set_eventfd(ctx, (int)arg);
+            break;
+        default:
+            ret = -ENOIOCTLCMD;
+    }
+    return ret;
+}
+
+// Release function
+static int dev_release(struct inode *inodep, struct file *filep){
+    struct ai_file_ctx *ctx = filep->private_data;
+    struct ai_device *dev = ctx->dev;
+
+    // Stop the queue worker before tearing down what it uses
+    if (ctx->queue){
+        queue_destroy(ctx->queue);
+    }
+    set_eventfd(ctx, -1);
+
+    trace_ai_release(dev->index, atomic_dec_return(&dev->open_count));
+    mutex_destroy(&ctx->map_lock);
+    mutex_destroy(&ctx->lock);
+    free_buffer_chunks(ctx);
+    kfree(ctx);
+    return 0;
+}
+
+// Helper function implementations
+
+// Chunked buffer implementation
+
+static inline void *chunk_addr(struct ai_file_ctx *ctx, size_t off){
+    return page_address(ctx->chunks[off >> AI_CHUNK_SHIFT]) + (off & (AI_CHUNK_SIZE - 1));
+}
+
+// Bytes from off to the end of its chunk, at most len
+static inline size_t chunk_span(size_t off, size_t len){
+    return min_t(size_t, len, AI_CHUNK_SIZE - (off & (AI_CHUNK_SIZE - 1)));
+}
+
+// Copy between an iov_iter and the buffer; returns the bytes copied,
+// short if the iterator faults
+static size_t buffer_copy_to_iter(struct ai_file_ctx *ctx, size_t off, size_t len, struct iov_iter *to){
+    size_t done = 0;
+    size_t n, copied;
+
+    while (done < len){
+        n = chunk_span(off + done, len - done);
+        copied = copy_to_iter(chunk_addr(ctx, off + done), n, to);
+        done += copied;
+        if (copied < n){
+            break;
+        }
+    }
+    return done;
+}
+
+static size_t buffer_copy_from_iter(struct ai_file_ctx *ctx, size_t off, size_t len, struct iov_iter *from){
+    size_t done = 0;
+    size_t n, copied;
+
+    while (done < len){
+        n = chunk_span(off + done, len - done);
+        copied = copy_from_iter(chunk_addr(ctx, off + done), n, from);
+        done += copied;
+        if (copied < n){
+            break;
+        }
+    }
+    return done;
+}
+
+static void buffer_zero(struct ai_file_ctx *ctx, size_t off, size_t len){
+    size_t n;
+
+    while (len){
+        n = chunk_span(off, len);
+        memset(chunk_addr(ctx, off), 0, n);
+        off += n;
+        len -= n;
+    }
+}
+
+// Pull up to len bytes from off into the cache; called with ctx->lock held
+static void buffer_prefetch(struct ai_file_ctx *ctx, size_t off, size_t len){
+    size_t n;
+
+    if (off >= ctx->buffer_size){
+        return;
+    }
+    len = min_t(size_t, len, ctx->buffer_size - off);
+    while (len){
+        n = chunk_span(off, len);
+        prefetch_range(chunk_addr(ctx, off), n);
+        off += n;
+        len -= n;
+    }
+}
+
+// Add or drop chunks until the buffer can hold size bytes. Growth never
+// copies; new chunks come from the pool, which falls back to its reserve
+// when the page allocator can't keep up, and are zeroed. With GFP_KERNEL
+// the pool waits for a chunk to come back and never fails; with
+// GFP_NOWAIT it fails once the reserve is empty, keeping the chunks it got.
+static int set_buffer_chunks(struct ai_file_ctx *ctx, unsigned int size, gfp_t gfp){
+    unsigned int want = DIV_ROUND_UP(max(size, 1U), AI_CHUNK_SIZE);
+    struct page *page;
+
+    while (ctx->nr_chunks < want){
+        page = mempool_alloc(ai_chunk_pool, gfp);
+        if (!page){
+            return -ENOMEM;
+        }
+        clear_page(page_address(page));
+        ctx->chunks[ctx->nr_chunks++] = page;
+    }
+    while (ctx->nr_chunks > want){
+        mempool_free(ctx->chunks[--ctx->nr_chunks], ai_chunk_pool);
+    }
+    return 0;
+}
+
+static void free_buffer_chunks(struct ai_file_ctx *ctx){
+    if (!ctx->chunks){
+        return;
+    }
+    while (ctx->nr_chunks){
+        mempool_free(ctx->chunks[--ctx->nr_chunks], ai_chunk_pool);
+    }
+    kmem_cache_free(ai_chunk_map_cache, ctx->chunks);
+    ctx->chunks = NULL;
+}
+
+// Map the chunks starting at vm_pgoff; called with map_lock held
+static int map_buffer(struct ai_file_ctx *ctx, struct vm_area_struct *vma){
+    unsigned long first = vma->vm_pgoff - AI_MMAP_OFF_BUFFER;
+    unsigned long pages = vma_pages(vma);
+    unsigned long i;
+    int ret;
+
+    if (first > ctx->nr_chunks || pages > ctx->nr_chunks - first){
+        return -EINVAL;
+    }
+    vma->vm_flags |= VM_DONTEXPAND | VM_DONTDUMP;
+    for (i = 0; i < pages; i++){
+        ret = vm_insert_page(vma, vma->vm_start + i * PAGE_SIZE, ctx->chunks[first + i]);
+        if (ret){
+            return ret;
+        }
+    }
+    return 0;
+}
+
+// Grow or shrink the buffer. Chunks are only dropped while nothing maps
+// them, but growing is fine: existing mappings keep their chunks.
+static int resize_ctx_buffer(struct ai_file_ctx *ctx, unsigned int size){
+    unsigned int want = DIV_ROUND_UP(max(size, 1U), AI_CHUNK_SIZE);
+    int ret = 0;
+
+    mutex_lock(&ctx->lock);
+    mutex_lock(&ctx->map_lock);
+
+    if (want < ctx->nr_chunks && atomic_read(&ctx->map_count)){
+        ret = -EBUSY;
+        goto out;
+    }
+
+    // Clear anything beyond the new size so it reads back as zeros later
+    if (size < ctx->buffer_size){
+        buffer_zero(ctx, size, min_t(size_t, ctx->buffer_size, (size_t)want * AI_CHUNK_SIZE) - size);
+    }
+    ret = set_buffer_chunks(ctx, size, GFP_KERNEL);
+    if (ret){
+        goto out;
+    }
+    ctx->buffer_size = size;
+out:
+    mutex_unlock(&ctx->map_lock);
+    mutex_unlock(&ctx->lock);
+    return ret;
+}
+
+// Grow the buffer for a write past its end. Called with ctx->lock held, so
+// it never waits for memory: when the pool runs dry the buffer only grows
+// as far as the chunks it got, and the write is clipped there. New chunks
+// come zeroed, and existing mappings keep theirs.
+static int grow_ctx_buffer(struct ai_file_ctx *ctx, unsigned int size){
+    int ret;
+
+    mutex_lock(&ctx->map_lock);
+    ret = set_buffer_chunks(ctx, size, GFP_NOWAIT | __GFP_NOWARN);
+    size = min_t(u64, size, (u64)ctx->nr_chunks * AI_CHUNK_SIZE);
+    if (size > ctx->buffer_size){
+        ctx->buffer_size = size;
+    }
+    mutex_unlock(&ctx->map_lock);
+    return ret;
+}
+
+// Thread group a write is done for. The queue worker runs SQEs on behalf
+// of whoever rang the doorbell, not as itself.
+static pid_t submitter_tgid(struct ai_file_ctx *ctx){
+    struct ai_queue *q = smp_load_acquire(&ctx->queue);
+
+    if (q && current == q->worker){
+        return q->submitter;
+    }
+    return task_tgid_nr(current);
+}
+
+static void account_write(struct ai_file_ctx *ctx, size_t len, const struct ai_scan *scan){
+    struct ai_device *dev = ctx->dev;
+    struct ai_pcpu_stats *stats;
+    unsigned int sensor;
+    u64 now = ktime_get_ns();
+
+    atomic64_add(len, &ctx->bytes_written);
+    if (len > 1000) { // Arbitrary condition for errors
+        atomic_inc(&ctx->error_count);
+    }
+
+    // Simulate sensor data update
+    get_random_bytes(&sensor, sizeof(sensor));
+
+    // Update this CPU's share of the statistics the analytics engine samples
+    stats = get_cpu_ptr(dev->stats);
+    u64_stats_update_begin(&stats->syncp);
+    stats->usage_count += len;
+    if (len > 1000) {
+        stats->error_count++;
+    }
+    sensor %= 100; // Simulate sensor data between 0-99
+    stats->sensor_sum += sensor;
+    stats->sensor_samples++;
+    if (scan){
+        struct ai_payload_stats *payload = &stats->payload;
+        int i;
+
+        payload->writes++;
+        payload->bytes += scan->bytes;
+        payload->byte_sum += scan->byte_sum;
+        payload->checksum ^= scan->xor;
+        payload->i16_sum += scan->i16_sum;
+        payload->i16_count += scan->i16_count;
+        payload->i16_min = min(payload->i16_min, scan->i16_min);
+        payload->i16_max = max(payload->i16_max, scan->i16_max);
+        payload->f32_sum += scan->f32_sum;
+        payload->f32_count += scan->f32_count;
+        payload->f32_min = min(payload->f32_min, scan->f32_min);
+        payload->f32_max = max(payload->f32_max, scan->f32_max);
+        for (i = 0; i < 256; i++){
+            stats->byte_hist[i] += scan->hist[i];
+        }
+    }
+    u64_stats_update_end(&stats->syncp);
+    detect_anomaly(dev, &stats->detector, len, sensor, scan, now, submitter_tgid(ctx));
+
+    // Hand this CPU's writes to the model once per sample period, so
+    // sampling never has to sum the other CPUs' counters
+    if (now >= stats->model_next_ns){
+        atomic64_add(stats->usage_count - stats->model_seen, &dev->model.pending);
+        stats->model_seen = stats->usage_count;
+        stats->model_next_ns = READ_ONCE(dev->model.last_ns) + AI_MODEL_PERIOD_MS * NSEC_PER_MSEC;
+    }
+    put_cpu_ptr(dev->stats);
+
+    model_sample(dev, now);
+}
+
+// Record one completed read or write in this CPU's histograms
+static void account_io(struct ai_device *dev, int dir, size_t len, u64 ns){
+    struct ai_pcpu_stats *stats;
+
+    stats = get_cpu_ptr(dev->stats);
+    u64_stats_update_begin(&stats->syncp);
+    stats->size_hist[dir][min_t(unsigned int, ilog2(len | 1), AI_HIST_BUCKETS - 1)]++;
+    stats->lat_hist[dir][min_t(unsigned int, ilog2(ns | 1), AI_HIST_BUCKETS - 1)]++;
+    stats->busy_ns += ns;
+    u64_stats_update_end(&stats->syncp);
+    put_cpu_ptr(dev->stats);
+}
+
+// Record one buffer channel transfer for the autotuner. Only writes feed the
+// extent histogram: reads are routinely issued larger than the data (cat,
+// stdio) and would grow the buffer without bound. Reads feed the read-ahead
+// window instead, with seq set when they start where the previous one ended.
+static void account_tune(struct ai_device *dev, loff_t pos, size_t len, size_t done, bool write, bool seq){
+    struct ai_pcpu_stats *stats;
+    u64 end = (u64)pos + len;
+
+    stats = get_cpu_ptr(dev->stats);
+    u64_stats_update_begin(&stats->syncp);
+    stats->buffer_bytes += done;
+    if (write && len){
+        stats->extent_hist[min_t(unsigned int, ilog2((end - 1) | 1), AI_HIST_BUCKETS - 1)]++;
+        if (done < len){
+            stats->clipped++;
+        }
+    } else if (!write){
+        stats->buffer_reads++;
+        if (seq){
+            stats->seq_reads++;
+            stats->seq_read_bytes += done;
+        }
+    }
+    u64_stats_update_end(&stats->syncp);
+    put_cpu_ptr(dev->stats);
+}
+
+// Record one queue drain that completed done SQEs for the autotuner
+static void account_queue(struct ai_device *dev, unsigned int done, bool backlog){
+    struct ai_pcpu_stats *stats;
+
+    stats = get_cpu_ptr(dev->stats);
+    u64_stats_update_begin(&stats->syncp);
+    stats->queue_sqes += done;
+    stats->queue_rounds++;
+    if (backlog){
+        stats->queue_backlog++;
+    }
+    u64_stats_update_end(&stats->syncp);
+    put_cpu_ptr(dev->stats);
+}
+
+// Record the latency of one AI ioctl
+static void account_latency(struct ai_device *dev, int op, u64 ns){
+    struct ai_pcpu_stats *stats;
+
+    stats = get_cpu_ptr(dev->stats);
+    u64_stats_update_begin(&stats->syncp);
+    stats->lat_hist[op][min_t(unsigned int, ilog2(ns | 1), AI_HIST_BUCKETS - 1)]++;
+    stats->busy_ns += ns;
+    u64_stats_update_end(&stats->syncp);
+    put_cpu_ptr(dev->stats);
+}
+
+// Latency histogram of an ioctl command, or -1 if it has none
+static int ioctl_stat_op(unsigned int cmd){
+    switch (cmd){
+        case AI_IOC_PERF_OPT:
+            return AI_STAT_PERF_OPT;
+        case AI_IOC_PRED_MAINT:
+            return AI_STAT_PRED_MAINT;
+        case AI_IOC_SEC_ENHANCE:
+            return AI_STAT_SEC_ENHANCE;
+        case AI_IOC_PWR_MGMT:
+            return AI_STAT_PWR_MGMT;
+        case AI_IOC_HW_ADAPT:
+            return AI_STAT_HW_ADAPT;
+        default:
+            return -1;
+    }
+}
+
+// Sum the per-CPU statistics; the histograms are only copied when asked for
+static void fold_stats(struct ai_device *dev, struct ai_stats_snapshot *snap, bool histograms){
+    struct ai_pcpu_stats *stats;
+    u64 usage, errors, sensor_sum, sensor_samples, busy;
+    unsigned int start;
+    int cpu, op, i;
+
+    memset(snap, 0, sizeof(*snap));
+    for_each_possible_cpu(cpu){
+        stats = per_cpu_ptr(dev->stats, cpu);
+        do {
+            start = u64_stats_fetch_begin(&stats->syncp);
+            usage = stats->usage_count;
+            errors = stats->error_count;
+            sensor_sum = stats->sensor_sum;
+            sensor_samples = stats->sensor_samples;
+            busy = stats->busy_ns;
+        } while (u64_stats_fetch_retry(&stats->syncp, start));
+
+        snap->usage_count += usage;
+        snap->error_count += errors;
+        snap->sensor_sum += sensor_sum;
+        snap->sensor_samples += sensor_samples;
+        snap->busy_ns += busy;
+
+        if (!histograms){
+            continue;
+        }
+        for (op = 0; op < AI_STAT_OPS; op++){
+            for (i = 0; i < AI_HIST_BUCKETS; i++){
+                u64 size = 0, lat;
+
+                do {
+                    start = u64_stats_fetch_begin(&stats->syncp);
+                    if (op < AI_STAT_DIRS){
+                        size = stats->size_hist[op][i];
+                    }
+                    lat = stats->lat_hist[op][i];
+                } while (u64_stats_fetch_retry(&stats->syncp, start));
+                if (op < AI_STAT_DIRS){
+                    snap->size_hist[op][i] += size;
+                }
+                snap->lat_hist[op][i] += lat;
+            }
+        }
+    }
+}
+
+// Latency below which permille/1000 of the samples fall. The bucket holding
+// that rank is assumed to be filled evenly, like Prometheus does; the last
+// bucket is open-ended and treated as ending at 2^AI_HIST_BUCKETS.
+static u64 hist_percentile(const u64 *hist, u64 count, unsigned int permille){
+    u64 rank, seen = 0, lo, hi;
+    int i;
+
+    if (!count){
+        return 0;
+    }
+    // ceil(count * permille / 1000) without overflowing
+    rank = count - mul_u64_u64_div_u64(count, 1000 - permille, 1000);
+    for (i = 0; i < AI_HIST_BUCKETS; i++){
+        if (hist[i] && seen + hist[i] >= rank){
+            lo = i ? 1ULL << i : 0;
+            hi = 1ULL << (i + 1);
+            return lo + mul_u64_u64_div_u64(hi - lo, rank - seen, hist[i]);
+        }
+        seen += hist[i];
+    }
+    return 1ULL << AI_HIST_BUCKETS;
+}
+
+// Fill the latency statistics of every operation type
+static int get_stats(struct ai_device *dev, struct ai_stats *out){
+    struct ai_stats_snapshot *snap;
+    int op, i;
+
+    // Too big for the stack with the histograms
+    snap = kmalloc(sizeof(*snap), GFP_KERNEL);
+    if (!snap){
+        return -ENOMEM;
+    }
+    fold_stats(dev, snap, true);
+
+    memset(out, 0, sizeof(*out));
+    out->version = AI_STATS_VERSION;
+    out->size = sizeof(*out);
+    out->nr_ops = AI_STAT_OPS;
+    out->nr_buckets = AI_HIST_BUCKETS;
+    for (op = 0; op < AI_STAT_OPS; op++){
+        struct ai_op_stats *st = &out->ops[op];
+
+        for (i = 0; i < AI_HIST_BUCKETS; i++){
+            st->hist[i] = snap->lat_hist[op][i];
+            st->count += st->hist[i];
+            if (st->hist[i]){
+                st->max_ns = 1ULL << (i + 1);
+            }
+        }
+        st->p50_ns = hist_percentile(st->hist, st->count, 500);
+        st->p99_ns = hist_percentile(st->hist, st->count, 990);
+        st->p999_ns = hist_percentile(st->hist, st->count, 999);
+    }
+
+    kfree(snap);
+    return 0;
+}
+
+// Verdict of the loaded model for output, or the built-in rule's when no
+// model provides that output
+static bool infer_verdict(struct ai_device *dev, unsigned int output, bool rule){
+    return output < dev->inference.nr_outputs ? dev->inference.outputs[output] > 0 : rule;
+}
+
+// The analytics stages work on the counter snapshot in res and compare
+// against the previous pass, so warnings and events fire on transitions
+// instead of on every pass. Called with dev->mutex_lock held.
+static void perform_predictive_maintenance(struct ai_device *dev, struct ai_analytics *res){
+    struct ai_model_state state;
+    bool due;
+
+    // Forecast usage from the online write rate model
+    get_model_state(dev, &state);
+    res->predicted_usage = res->usage_count + (state.forecast_usage - state.usage_count);
+    res->time_to_threshold_ms = state.time_to_threshold_ms;
+    due = infer_verdict(dev, AI_OUT_MAINTENANCE, res->predicted_usage > dev->threshold);
+
+    if (due && !res->maintenance_due){
+        pr_warn_ratelimited("Maintenance required soon. Predicted usage exceeds threshold.\n");
+        emit_event(dev, AI_EVENT_MAINTENANCE, res->predicted_usage, dev->threshold);
+    }
+    res->maintenance_due = due;
+}
+
+static void enhance_security(struct ai_device *dev, struct ai_analytics *res){
+    bool detected;
+
+    // Summarize the writes the streaming detector flagged since the last pass
+    spin_lock(&dev->anomaly_lock);
+    detected = dev->anomaly_seq != dev->anomaly_seq_seen;
+    res->anomaly_score = dev->anomaly_pass_max;
+    dev->anomaly_seq_seen = dev->anomaly_seq;
+    dev->anomaly_pass_max = 0;
+    spin_unlock(&dev->anomaly_lock);
+    detected = infer_verdict(dev, AI_OUT_ANOMALY, detected);
+
+    if (detected && !res->anomaly_detected){
+        pr_warn_ratelimited("Anomaly detected! Potential security threat.\n");
+        emit_event(dev, AI_EVENT_ANOMALY, res->anomaly_score, READ_ONCE(dev->anomaly_threshold));
+    }
+    res->anomaly_detected = detected;
+}
+
+// Power governor, one O(1) step per analytics pass in the manner of the
+// devfreq simple_ondemand governor. The load estimate is the busy fraction
+// of each window, so an idle device drops to low power however much it was
+// used before.
+static void manage_power(struct ai_device *dev, struct ai_analytics *res, u64 busy_ns){
+    struct ai_governor *gov = &dev->gov;
+    const struct ai_pstate *ps = &ai_pstates[gov->pstate];
+    unsigned int cur = gov->pstate, next = cur;
+    u64 now = ktime_get_ns();
+    u64 window = now - gov->last_ns;
+    u64 busy = min(busy_ns - gov->busy_seen, window);
+    bool low;
+
+    gov->busy_seen = busy_ns;
+    gov->last_ns = now;
+    gov->busy_ns += busy;
+    gov->idle_ns += window - busy;
+    gov->time_in_state[cur] += window;
+    gov->util = window ? div64_u64(busy * 1000, window) : 0;
+    gov->load = (gov->load * 3 + gov->util) / 4;
+
+    if (now - gov->state_since >= ps->min_dwell_ms * NSEC_PER_MSEC){
+        if (ps->up_permille && gov->load > ps->up_permille){
+            next = cur + 1;
+        } else if (ps->down_permille && gov->load < ps->down_permille){
+            next = cur - 1;
+        }
+    }
+    if (next != cur){
+        trace_ai_pstate(dev->index, cur, next, gov->load, gov->util);
+        pr_debug("Power state %s -> %s (load %u)\n", ps->name, ai_pstates[next].name, gov->load);
+        WRITE_ONCE(gov->pstate, next);
+        gov->state_since = now;
+        gov->transitions++;
+        gov->trans_table[cur][next]++;
+    }
+
+    // Entering and leaving the lowest state is what AI_IOC_PWR_MGMT reports
+    low = gov->pstate == AI_PSTATE_LOW;
+    if (low && !res->low_power_mode){
+        pr_info_ratelimited("Switching to low power mode.\n");
+        emit_event(dev, AI_EVENT_POWER, 1, ai_pstates[AI_PSTATE_NORMAL].down_permille);
+    } else if (!low && res->low_power_mode){
+        pr_info_ratelimited("Exiting low power mode.\n");
+        emit_event(dev, AI_EVENT_POWER, 0, ai_pstates[AI_PSTATE_LOW].up_permille);
+    }
+    res->low_power_mode = low;
+}
+
+// Copy out the governor state. Without the background engine the pass runs
+// here, on the caller.
+static void get_power(struct ai_device *dev, struct ai_power_state *out){
+    struct ai_governor *gov = &dev->gov;
+
+    mutex_lock(&dev->mutex_lock);
+    if (!READ_ONCE(dev->analytics_interval_ms)){
+        run_analytics(dev);
+    }
+    memset(out, 0, sizeof(*out));
+    out->pstate = gov->pstate;
+    out->nr_pstates = AI_PSTATES;
+    out->load_permille = gov->load;
+    out->util_permille = gov->util;
+    out->state_since_ns = gov->state_since;
+    out->busy_ns = gov->busy_ns;
+    out->idle_ns = gov->idle_ns;
+    out->transitions = gov->transitions;
+    memcpy(out->time_in_state_ns, gov->time_in_state, sizeof(out->time_in_state_ns));
+    memcpy(out->trans_table, gov->trans_table, sizeof(out->trans_table));
+    mutex_unlock(&dev->mutex_lock);
+}
+
+// One analytics pass over a snapshot of the counters. Called with
+// dev->mutex_lock held so passes never interleave with each other or
+// with a threshold update.
+static void run_analytics(struct ai_device *dev){
+    struct ai_analytics res;
+    struct ai_stats_snapshot snap;
+
+    spin_lock(&dev->analytics_lock);
+    res = dev->analytics;
+    spin_unlock(&dev->analytics_lock);
+
+    fold_stats(dev, &snap, false);
+    res.usage_count = snap.usage_count;
+    res.error_count = snap.error_count;
+
+    // The sensor reading is the mean of the samples since the previous pass
+    if (snap.sensor_samples != dev->sensor_samples_seen){
+        res.sensor_data = div64_u64(snap.sensor_sum - dev->sensor_sum_seen,
+                                    snap.sensor_samples - dev->sensor_samples_seen);
+        dev->sensor_sum_seen = snap.sensor_sum;
+        dev->sensor_samples_seen = snap.sensor_samples;
+    }
+    res.interval_ms = READ_ONCE(dev->analytics_interval_ms);
+
+    // Before the stages, which take its verdicts over the built-in rules
+    run_inference(dev, &snap, res.sensor_data);
+
+    perform_predictive_maintenance(dev, &res);
+    enhance_security(dev, &res);
+    manage_power(dev, &res, snap.busy_ns);
+    tune_buffer(dev);
+
+    res.timestamp_ns = ktime_get_ns();
+    res.runs++;
+    trace_ai_analytics(dev->index, res.usage_count, res.predicted_usage, res.time_to_threshold_ms,
+                       res.anomaly_score, res.maintenance_due, res.anomaly_detected, res.low_power_mode);
+    record_history(dev, &res);
+
+    spin_lock(&dev->analytics_lock);
+    dev->analytics = res;
+    spin_unlock(&dev->analytics_lock);
+    publish_status(dev);
+}
+
+static void analytics_work_fn(struct work_struct *work){
+    struct ai_device *dev = container_of(to_delayed_work(work), struct ai_device, analytics_work);
+    unsigned int interval;
+
+    mutex_lock(&dev->mutex_lock);
+    run_analytics(dev);
+    mutex_unlock(&dev->mutex_lock);
+
+    // The interval may have been changed (or set to 0) through sysfs; the
+    // power state stretches or shortens it
+    interval = READ_ONCE(dev->analytics_interval_ms);
+    if (interval){
+        interval = mult_frac(interval, ai_pstates[READ_ONCE(dev->gov.pstate)].interval_pct, 100);
+        queue_delayed_work(system_power_efficient_wq, &dev->analytics_work,
+                           msecs_to_jiffies(max(interval, 1U)));
+    }
+}
+
+// Copy out the latest analytics results. Without the background engine the
+// pass runs here, on the caller.
+static void get_analytics(struct ai_device *dev, struct ai_analytics *res){
+    if (!READ_ONCE(dev->analytics_interval_ms)){
+        mutex_lock(&dev->mutex_lock);
+        run_analytics(dev);
+        mutex_unlock(&dev->mutex_lock);
+    }
+
+    spin_lock(&dev->analytics_lock);
+    *res = dev->analytics;
+    spin_unlock(&dev->analytics_lock);
+}
+
+// Snapshots shared with user space. A seqcount_t can't live in memory that
+// user space maps, so these regions start with a bare u32 sequence that
+// follows the same protocol: odd while a writer is inside. Writers are
+// serialized by dev->mutex_lock and run with preemption off, as
+// write_seqcount_begin() requires, so an in-kernel reader spinning on an
+// odd sequence never waits for a writer that was scheduled out. Nothing
+// between begin and end may sleep.
+
+static void ai_seq_write_begin(u32 *seq){
+    preempt_disable();
+    WRITE_ONCE(*seq, *seq + 1);
+    smp_wmb();
+}
+
+static void ai_seq_write_end(u32 *seq){
+    smp_wmb();
+    WRITE_ONCE(*seq, *seq + 1);
+    preempt_enable();
+}
+
+static u32 ai_seq_read_begin(const u32 *seq){
+    u32 ret;
+
+    while ((ret = READ_ONCE(*seq)) & 1){
+        cpu_relax();
+    }
+    smp_rmb();
+    return ret;
+}
+
+static bool ai_seq_read_retry(const u32 *seq, u32 start){
+    smp_rmb();
+    return READ_ONCE(*seq) != start;
+}
+
+// Republish the status snapshot and the telemetry copies. Called with
+// dev->mutex_lock held, which serializes the writers.
+static void publish_status(struct ai_device *dev){
+    struct ai_status *st = dev->status;
+    struct ai_analytics res;
+    u64 anomalies;
+
+    spin_lock(&dev->telemetry_lock);
+    dev->telemetry.tuner = dev->tuner.state;
+    dev->telemetry.gov = dev->gov;
+    dev->telemetry.inference = dev->inference;
+    spin_unlock(&dev->telemetry_lock);
+
+    spin_lock(&dev->analytics_lock);
+    res = dev->analytics;
+    spin_unlock(&dev->analytics_lock);
+    spin_lock(&dev->anomaly_lock);
+    anomalies = dev->anomaly_seq;
+    spin_unlock(&dev->anomaly_lock);
+
+    ai_seq_write_begin(&st->seq);
+    st->timestamp_ns = ktime_get_ns();
+    st->analytics_runs = res.runs;
+    st->usage_count = res.usage_count;
+    st->error_count = res.error_count;
+    st->predicted_usage = res.predicted_usage;
+    st->time_to_threshold_ms = res.time_to_threshold_ms;
+    st->anomalies = anomalies;
+    st->threshold = dev->threshold;
+    st->anomaly_threshold = READ_ONCE(dev->anomaly_threshold);
+    st->buffer_size = dev->buffer_size;
+    st->anomaly_score = res.anomaly_score;
+    st->sensor_data = res.sensor_data;
+    st->pstate = dev->gov.pstate;
+    st->load_permille = dev->gov.load;
+    st->flags = (res.maintenance_due ? AI_STATUS_MAINTENANCE : 0) |
+                (res.anomaly_detected ? AI_STATUS_ANOMALY : 0) |
+                (res.low_power_mode ? AI_STATUS_LOW_POWER : 0) |
+                (dev->autotune ? AI_STATUS_AUTOTUNE : 0);
+    ai_seq_write_end(&st->seq);
+}
+
+// Copy the status snapshot without taking any lock; retried only if a
+// writer was publishing at the same time. Never runs an analytics pass.
+static void get_status(struct ai_device *dev, struct ai_status *out){
+    const struct ai_status *st = dev->status;
+    u32 seq;
+
+    do {
+        seq = ai_seq_read_begin(&st->seq);
+        *out = *st;
+    } while (ai_seq_read_retry(&st->seq, seq));
+    out->seq = seq;
+}
+
+// Telemetry history
+
+static struct ai_history_sample *history_samples(struct ai_history *h, unsigned int level){
+    return (void *)h->hdr + h->hdr->levels[level].offset;
+}
+
+// Ring index of a slot
+static u32 history_index(const struct ai_history_level *lvl, u64 slot){
+    u32 idx;
+
+    div_u64_rem(slot, lvl->nr_entries, &idx);
+    return idx;
+}
+
+// Allocate the history region: the header, then each level's ring. All
+// levels start out empty, with the current slot open.
+static int history_init(struct ai_device *dev){
+    struct ai_history *h = &dev->history;
+    u64 now_s = div64_u64(ktime_get_ns(), NSEC_PER_SEC);
+    size_t off = ALIGN(sizeof(*h->hdr), SMP_CACHE_BYTES);
+    unsigned int i;
+
+    for (i = 0; i < AI_HISTORY_LEVELS; i++){
+        off += ai_history_geometry[i].nr_entries * sizeof(struct ai_history_sample);
+    }
+    h->hdr = vmalloc_user(PAGE_ALIGN(off));
+    if (!h->hdr){
+        return -ENOMEM;
+    }
+
+    h->hdr->version = AI_HISTORY_VERSION;
+    h->hdr->nr_levels = AI_HISTORY_LEVELS;
+    h->hdr->sample_size = sizeof(struct ai_history_sample);
+    off = ALIGN(sizeof(*h->hdr), SMP_CACHE_BYTES);
+    for (i = 0; i < AI_HISTORY_LEVELS; i++){
+        struct ai_history_level *lvl = &h->hdr->levels[i];
+
+        lvl->period_s = ai_history_geometry[i].period_s;
+        lvl->nr_entries = ai_history_geometry[i].nr_entries;
+        lvl->offset = off;
+        lvl->newest_slot = div64_u64(now_s, lvl->period_s);
+        h->acc[i].slot = lvl->newest_slot;
+        off += lvl->nr_entries * sizeof(struct ai_history_sample);
+    }
+    return 0;
+}
+
+// Publish the accumulated slot of a level. Slots skipped since the newest
+// one had no pass and are cleared.
+static void history_flush(struct ai_history *h, unsigned int level){
+    struct ai_history_level *lvl = &h->hdr->levels[level];
+    struct ai_history_sample *samples = history_samples(h, level);
+    struct ai_history_acc *acc = &h->acc[level];
+    struct ai_history_sample *sample;
+    u64 slot;
+
+    for (slot = lvl->newest_slot + 1; slot < acc->slot && slot - lvl->newest_slot <= lvl->nr_entries; slot++){
+        memset(&samples[history_index(lvl, slot)], 0, sizeof(*samples));
+    }
+
+    sample = &samples[history_index(lvl, acc->slot)];
+    sample->usage = acc->usage;
+    sample->errors = min_t(u64, acc->errors, U32_MAX);
+    sample->forecast = acc->forecast;
+    sample->sensor = div64_u64(acc->sensor_sum, acc->passes);
+    sample->anomaly_score = min_t(u32, acc->anomaly_max, U16_MAX);
+    sample->load_permille = div64_u64(acc->load_sum, acc->passes);
+    sample->pstate = acc->pstate;
+    sample->flags = acc->flags | AI_HISTORY_VALID;
+    lvl->newest_slot = acc->slot;
+    lvl->usage_count = acc->usage_end;
+    lvl->error_count = acc->errors_end;
+}
+
+// Add an analytics pass to the open slot of every level, publishing the
+// slots that closed since the previous pass. Called with dev->mutex_lock held.
+static void record_history(struct ai_device *dev, const struct ai_analytics *res){
+    struct ai_history *h = &dev->history;
+    u64 now_s = div64_u64(res->timestamp_ns, NSEC_PER_SEC);
+    u64 forecast = res->predicted_usage > res->usage_count ? res->predicted_usage - res->usage_count : 0;
+    bool writing = false;
+    unsigned int i;
+
+    for (i = 0; i < AI_HISTORY_LEVELS; i++){
+        struct ai_history_acc *acc = &h->acc[i];
+        u64 slot = div64_u64(now_s, ai_history_geometry[i].period_s);
+
+        if (slot != acc->slot){
+            if (acc->passes){
+                // Mapped readers and history_copy() retry while seq is
+                // odd; the section must not sleep
+                if (!writing){
+                    ai_seq_write_begin(&h->hdr->seq);
+                    writing = true;
+                }
+                history_flush(h, i);
+            }
+            memset(acc, 0, sizeof(*acc));
+            acc->slot = slot;
+        }
+
+        acc->usage += res->usage_count - h->usage_seen;
+        acc->errors += res->error_count - h->errors_seen;
+        acc->usage_end = res->usage_count;
+        acc->errors_end = res->error_count;
+        acc->sensor_sum += res->sensor_data;
+        acc->load_sum += dev->gov.load;
+        acc->passes++;
+        acc->anomaly_max = max(acc->anomaly_max, res->anomaly_score);
+        acc->forecast = min_t(u64, forecast, U32_MAX);
+        acc->pstate = max_t(u8, acc->pstate, dev->gov.pstate);
+        acc->flags |= (res->maintenance_due ? AI_HISTORY_MAINTENANCE : 0) |
+                      (res->anomaly_detected ? AI_HISTORY_ANOMALY : 0) |
+                      (res->low_power_mode ? AI_HISTORY_LOW_POWER : 0);
+    }
+    h->usage_seen = res->usage_count;
+    h->errors_seen = res->error_count;
+
+    if (writing){
+        ai_seq_write_end(&h->hdr->seq);
+    }
+}
+
+// Copy the level header and up to n of its newest samples, oldest first,
+// without taking any lock; retried only if record_history() published a
+// slot at the same time. Returns the number of samples copied.
+static u32 history_copy(struct ai_history *h, unsigned int level, struct ai_history_sample *buf,
+                        u32 n, struct ai_history_level *info){
+    const struct ai_history_level *lvl = &h->hdr->levels[level];
+    const struct ai_history_sample *samples = history_samples(h, level);
+    u64 first;
+    u32 seq, i, copied;
+
+    do {
+        seq = ai_seq_read_begin(&h->hdr->seq);
+        *info = *lvl;
+        copied = min_t(u64, n, info->newest_slot + 1);
+        first = info->newest_slot + 1 - copied;
+        for (i = 0; i < copied; i++){
+            buf[i] = samples[history_index(info, first + i)];
+        }
+    } while (ai_seq_read_retry(&h->hdr->seq, seq));
+    return copied;
+}
+
+// Copy out the newest samples of one level in a single call. Without the
+// background engine the pass runs here, on the caller.
+static long get_history(struct ai_device *dev, struct ai_history_query __user *uquery){
+    struct ai_history_query query;
+    struct ai_history_sample *buf;
+    u32 n;
+    long ret = 0;
+
+    if (copy_from_user(&query, uquery, sizeof(query))){
+        return -EFAULT;
+    }
+    if (query.level >= AI_HISTORY_LEVELS){
+        return -EINVAL;
+    }
+    n = min(query.nr_samples, ai_history_geometry[query.level].nr_entries);
+
+    // Copied out first so user page faults don't hold up the analytics
+    // passes; only an on-demand pass takes the mutex
+    buf = kvmalloc_array(max(n, 1U), sizeof(*buf), GFP_KERNEL);
+    if (!buf){
+        return -ENOMEM;
+    }
+
+    if (!READ_ONCE(dev->analytics_interval_ms)){
+        mutex_lock(&dev->mutex_lock);
+        run_analytics(dev);
+        mutex_unlock(&dev->mutex_lock);
+    }
+    n = history_copy(&dev->history, query.level, buf, n, &query.info);
+    query.nr_samples = n;
+
+    if (copy_to_user(u64_to_user_ptr(query.samples), buf, n * sizeof(*buf)) ||
+        copy_to_user(uquery, &query, sizeof(query))){
+        ret = -EFAULT;
+    }
+    kvfree(buf);
+    return ret;
+}
+
+// Buffer autotuner
+
+// Change the size for new opens and report why
+static void tune_set(struct ai_device *dev, unsigned int size, u32 reason, u64 now){
+    struct ai_tuner *t = &dev->tuner;
+
+    trace_ai_tune(dev->index, dev->buffer_size, size, reason, t->state.bytes_per_sec, t->state.p99_extent);
+    pr_debug("Autotuner: buffer size %u -> %u (%s)\n", dev->buffer_size, size,
+             reason == AI_TUNE_GROW ? "grow" : reason == AI_TUNE_SHRINK ? "shrink" :
+             reason == AI_TUNE_IDLE ? "idle" : "revert");
+    t->prev_size = dev->buffer_size;
+    WRITE_ONCE(dev->buffer_size, size);
+    t->shrink_passes = 0;
+    t->state.decisions++;
+    t->state.last_reason = reason;
+    t->state.last_change_ns = now;
+}
+
+// Pick the queue batch depth: the SQEs a worker completes before it
+// publishes the CQ tail and wakes the reaper. When most drains stop at the
+// depth with SQEs left, doubling it halves the publishes per SQE. After
+// AI_TUNE_SHRINK_PASSES passes without a backlog it steps back down, since
+// a deeper batch then only delays the first completions. A deeper batch
+// that loses AI_TUNE_REGRESS_PCT of the SQE rate while the backlog stays
+// is reverted, and the depth holds for AI_TUNE_HOLD_PASSES passes.
+static void tune_queue(struct ai_device *dev, const struct ai_tune_counters *delta){
+    struct ai_tuner *t = &dev->tuner;
+    unsigned int cur = dev->queue_batch, next = cur;
+    bool backlog = delta->rounds >= AI_TUNE_MIN_SAMPLES && delta->backlog * 2 > delta->rounds;
+    u64 rate = t->state.window_ns ?
+        mul_u64_u64_div_u64(delta->sqes, NSEC_PER_SEC, t->state.window_ns) : 0;
+
+    if (t->batch_judge_rate){
+        bool regressed = rate * 100 < t->batch_judge_rate * (100 - AI_TUNE_REGRESS_PCT);
+
+        t->batch_judge_rate = 0;
+        if (backlog && regressed && t->prev_batch != cur){
+            next = t->prev_batch;
+            t->batch_hold = AI_TUNE_HOLD_PASSES;
+            goto set;
+        }
+    }
+    if (t->batch_hold){
+        t->batch_hold--;
+        return;
+    }
+
+    if (backlog){
+        next = min_t(unsigned int, cur * 2, AI_TUNE_BATCH_MAX);
+        t->batch_passes = 0;
+    } else if (delta->backlog){
+        t->batch_passes = 0;
+    } else if (++t->batch_passes >= AI_TUNE_SHRINK_PASSES){
+        next = max_t(unsigned int, cur / 2, AI_QUEUE_BATCH);
+    }
+    if (next == cur){
+        return;
+    }
+    t->batch_judge_rate = rate;
+set:
+    pr_debug("Autotuner: queue batch %u -> %u\n", cur, next);
+    t->prev_batch = cur;
+    t->batch_passes = 0;
+    WRITE_ONCE(dev->queue_batch, next);
+    t->state.queue_batch = next;
+}
+
+// Pick the read-ahead window: after a buffer read that starts where the
+// file's previous one ended, the next window of the buffer is prefetched
+// so the following read finds it in the cache. The window is the mean
+// sequential read, rounded up to a power of two, and is off unless
+// AI_TUNE_RA_PERMILLE of the recent reads were sequential.
+static void tune_readahead(struct ai_device *dev, const struct ai_tune_counters *delta){
+    struct ai_tuner *t = &dev->tuner;
+    unsigned int next = 0;
+
+    t->reads = t->reads / 2 + delta->reads;
+    t->seq_reads = t->seq_reads / 2 + delta->seq_reads;
+    t->seq_bytes = t->seq_bytes / 2 + delta->seq_bytes;
+    if (!t->state.enabled){
+        return;
+    }
+
+    if (t->reads >= AI_TUNE_MIN_SAMPLES && t->seq_reads * 1000 >= t->reads * AI_TUNE_RA_PERMILLE){
+        next = min_t(u64, roundup_pow_of_two(max_t(u64, div64_u64(t->seq_bytes, t->seq_reads), 1)),
+                     AI_TUNE_RA_MAX);
+    }
+    if (next != dev->readahead){
+        pr_debug("Autotuner: read-ahead %u -> %u\n", dev->readahead, next);
+        WRITE_ONCE(dev->readahead, next);
+    }
+    t->state.readahead = next;
+}
+
+// One tuner pass, called from run_analytics() with dev->mutex_lock held.
+// The target size is the smallest power of two that holds AI_TUNE_PERMILLE
+// of the recent write extents. Growing happens at once, since every write
+// past the size grows its file's buffer on the write path; shrinking waits
+// for AI_TUNE_SHRINK_PASSES passes in a row. A change is judged by the next
+// pass: if the request rate held but throughput fell by AI_TUNE_REGRESS_PCT,
+// the old size comes back and the tuner stays put for AI_TUNE_HOLD_PASSES
+// passes. The same counters then set the queue batch depth and the
+// read-ahead window.
+static void tune_buffer(struct ai_device *dev){
+    struct ai_tuner *t = &dev->tuner;
+    struct ai_pcpu_stats *stats;
+    struct ai_tune_counters sum = { 0 }, delta;
+    u64 hist[AI_HIST_BUCKETS] = { 0 };
+    u64 now = ktime_get_ns();
+    u64 requests = 0, weight = 0, want;
+    unsigned int cur = dev->buffer_size, target, start;
+    int cpu, i;
+
+    for_each_possible_cpu(cpu){
+        struct ai_tune_counters c;
+        u64 b;
+
+        stats = per_cpu_ptr(dev->stats, cpu);
+        do {
+            start = u64_stats_fetch_begin(&stats->syncp);
+            c.bytes = stats->buffer_bytes;
+            c.clipped = stats->clipped;
+            c.sqes = stats->queue_sqes;
+            c.rounds = stats->queue_rounds;
+            c.backlog = stats->queue_backlog;
+            c.reads = stats->buffer_reads;
+            c.seq_reads = stats->seq_reads;
+            c.seq_bytes = stats->seq_read_bytes;
+        } while (u64_stats_fetch_retry(&stats->syncp, start));
+        sum.bytes += c.bytes;
+        sum.clipped += c.clipped;
+        sum.sqes += c.sqes;
+        sum.rounds += c.rounds;
+        sum.backlog += c.backlog;
+        sum.reads += c.reads;
+        sum.seq_reads += c.seq_reads;
+        sum.seq_bytes += c.seq_bytes;
+        for (i = 0; i < AI_HIST_BUCKETS; i++){
+            do {
+                start = u64_stats_fetch_begin(&stats->syncp);
+                b = stats->extent_hist[i];
+            } while (u64_stats_fetch_retry(&stats->syncp, start));
+            hist[i] += b;
+        }
+    }
+    delta.bytes = sum.bytes - t->seen.bytes;
+    delta.clipped = sum.clipped - t->seen.clipped;
+    delta.sqes = sum.sqes - t->seen.sqes;
+    delta.rounds = sum.rounds - t->seen.rounds;
+    delta.backlog = sum.backlog - t->seen.backlog;
+    delta.reads = sum.reads - t->seen.reads;
+    delta.seq_reads = sum.seq_reads - t->seen.seq_reads;
+    delta.seq_bytes = sum.seq_bytes - t->seen.seq_bytes;
+    t->seen = sum;
+
+    // Fold this window into the decaying history
+    for (i = 0; i < AI_HIST_BUCKETS; i++){
+        u64 d = hist[i] - t->extent_seen[i];
+
+        t->extent_seen[i] = hist[i];
+        t->extent[i] = t->extent[i] / 2 + d;
+        requests += d;
+        weight += t->extent[i];
+    }
+    t->state.window_ns = now - t->last_ns;
+    t->state.requests = requests;
+    t->state.clipped = delta.clipped;
+    t->state.bytes_per_sec = t->state.window_ns ?
+        mul_u64_u64_div_u64(delta.bytes, NSEC_PER_SEC, t->state.window_ns) : 0;
+    t->state.p50_extent = hist_percentile(t->extent, weight, 500);
+    t->state.p99_extent = hist_percentile(t->extent, weight, AI_TUNE_PERMILLE);
+    t->last_ns = now;
+
+    // Too little recent load to size for: settle back to the default
+    if (weight < AI_TUNE_MIN_SAMPLES){
+        want = AI_BUFFER_DEFAULT_SIZE;
+    } else {
+        want = max_t(u64, roundup_pow_of_two(max_t(u64, t->state.p99_extent, 1)), AI_BUFFER_DEFAULT_SIZE);
+    }
+    target = min_t(u64, want, buffer_size_max);
+    t->state.target_size = target;
+    t->state.enabled = READ_ONCE(dev->autotune);
+    t->state.buffer_size = cur;
+    tune_readahead(dev, &delta);
+
+    if (!t->state.enabled){
+        t->judge_bps = 0;
+        t->batch_judge_rate = 0;
+        t->shrink_passes = 0;
+        return;
+    }
+    tune_queue(dev, &delta);
+
+    // Judge the previous change now that it has had a window to show.
+    // Changes made without traffic have nothing to be compared with.
+    if (t->judge_bps){
+        bool same_load = requests * 100 >= t->judge_requests * (100 - AI_TUNE_REGRESS_PCT);
+        bool regressed = t->state.bytes_per_sec * 100 < t->judge_bps * (100 - AI_TUNE_REGRESS_PCT);
+
+        t->judge_bps = 0;
+        if (same_load && regressed && t->prev_size != cur){
+            tune_set(dev, t->prev_size, AI_TUNE_REVERT, now);
+            t->state.reverts++;
+            t->state.buffer_size = dev->buffer_size;
+            t->hold = AI_TUNE_HOLD_PASSES;
+            return;
+        }
+    }
+    if (t->hold){
+        t->hold--;
+        return;
+    }
+
+    if (target > cur){
+        tune_set(dev, target, AI_TUNE_GROW, now);
+    } else if (target <= cur / 2 && ++t->shrink_passes >= AI_TUNE_SHRINK_PASSES){
+        tune_set(dev, target, weight < AI_TUNE_MIN_SAMPLES ? AI_TUNE_IDLE : AI_TUNE_SHRINK, now);
+    } else {
+        if (target > cur / 2){
+            t->shrink_passes = 0;
+        }
+        return;
+    }
+    t->judge_bps = t->state.bytes_per_sec;
+    t->judge_requests = requests;
+    t->state.buffer_size = dev->buffer_size;
+}
+
+// Copy out the tuner state. Without the background engine the pass runs
+// here, on the caller.
+static void get_tuner(struct ai_device *dev, struct ai_tuner_state *out){
+    mutex_lock(&dev->mutex_lock);
+    if (!READ_ONCE(dev->analytics_interval_ms)){
+        run_analytics(dev);
+    }
+    *out = dev->tuner.state;
+    mutex_unlock(&dev->mutex_lock);
+}
+
+// Streaming anomaly detector
+
+// Score x against the feature's history, then fold it in. Returns the
+// z-score x1000, or 0 for anything within two standard deviations; the
+// square root is only taken for samples past that cheap check.
+static u32 feature_update(struct ai_feature *f, u64 x, bool warm){
+    s64 diff, incr;
+    u64 diff_sq, var, floor, t;
+    u32 score = 0;
+
+    x = min_t(u64, x, AI_FEATURE_MAX) << AI_FEATURE_FRAC;
+    diff = (s64)x - f->mean;
+    diff_sq = (u64)(diff * diff);
+
+    // Keep constant streams from flagging tiny changes: the standard
+    // deviation is at least one unit and an eighth of the mean
+    floor = max_t(u64, 1ULL << (2 * AI_FEATURE_FRAC), (u64)(f->mean / 8) * (u64)(f->mean / 8));
+    var = max(f->var, floor);
+    if (warm && diff_sq > 4 * var){
+        score = min_t(u64, div64_u64(abs(diff) * 1000, int_sqrt64(var)), U32_MAX);
+    }
+
+    // EWMA mean and variance: var = (1 - a)(var + diff * a * diff)
+    incr = diff / AI_EWMA_WEIGHT;
+    f->mean += incr;
+    t = f->var + (u64)(diff * incr);
+    f->var = t - t / AI_EWMA_WEIGHT;
+    return score;
+}
+
+// Index of an anomaly sequence number in the log
+static inline u32 anomaly_slot(u64 seq){
+    u32 slot;
+
+    div_u64_rem(seq, anomaly_log_size, &slot);
+    return slot;
+}
+
+// Check one write against this CPU's detector. Runs with preemption
+// disabled on the write path, so it is O(1) and only takes a lock to log
+// a write it flags.
+static void detect_anomaly(struct ai_device *dev, struct ai_detector *det, size_t len, u32 sensor, const struct ai_scan *scan, u64 now, pid_t pid){
+    u32 threshold = READ_ONCE(dev->anomaly_threshold);
+    bool warm = det->samples >= AI_ANOMALY_WARMUP;
+    u32 score, max_score = 0, features = 0;
+    u64 interval_us = 0;
+    struct ai_anomaly *rec;
+    u64 seq;
+
+    score = feature_update(&det->features[AI_FEATURE_SIZE], len, warm);
+    if (score > threshold){
+        features |= BIT(AI_FEATURE_SIZE);
+    }
+    max_score = max(max_score, score);
+
+    if (det->last_ns){
+        interval_us = div64_u64(now - det->last_ns, NSEC_PER_USEC);
+        score = feature_update(&det->features[AI_FEATURE_INTERVAL], interval_us, warm);
+        if (score > threshold){
+            features |= BIT(AI_FEATURE_INTERVAL);
+        }
+        max_score = max(max_score, score);
+    }
+    det->last_ns = now;
+
+    score = feature_update(&det->features[AI_FEATURE_SENSOR], sensor, warm);
+    if (score > threshold){
+        features |= BIT(AI_FEATURE_SENSOR);
+    }
+    max_score = max(max_score, score);
+
+    if (scan){
+        score = feature_update(&det->features[AI_FEATURE_ENTROPY], scan->entropy, warm);
+        if (score > threshold){
+            features |= BIT(AI_FEATURE_ENTROPY);
+        }
+        max_score = max(max_score, score);
+    }
+    det->samples++;
+
+    if (!features){
+        return;
+    }
+
+    spin_lock(&dev->anomaly_lock);
+    seq = dev->anomaly_seq++;
+    rec = &dev->anomalies[anomaly_slot(seq)];
+    rec->seq = seq;
+    rec->timestamp_ns = now;
+    rec->size = len;
+    rec->interval_us = interval_us;
+    rec->sensor = sensor;
+    rec->score = max_score;
+    rec->features = features;
+    rec->pid = pid;
+    rec->entropy = scan ? scan->entropy : 0;
+    dev->anomaly_pass_max = max(dev->anomaly_pass_max, max_score);
+    spin_unlock(&dev->anomaly_lock);
+
+    trace_ai_anomaly(dev->index, seq, len, interval_us, sensor, max_score, features);
+}
+
+static long get_anomalies(struct ai_device *dev, struct ai_anomaly_query __user *uquery){
+    struct ai_anomaly_query query;
+    struct ai_anomaly __user *urecs;
+    struct ai_anomaly rec;
+    u64 seq, end;
+    u32 copied = 0;
+
+    if (copy_from_user(&query, uquery, sizeof(query))){
+        return -EFAULT;
+    }
+    urecs = u64_to_user_ptr(query.records);
+
+    // Copy one record at a time; the log may move on between copies, so
+    // each record is revalidated against the current sequence
+    spin_lock(&dev->anomaly_lock);
+    end = dev->anomaly_seq;
+    seq = max_t(u64, query.seq, end > anomaly_log_size ? end - anomaly_log_size : 0);
+    while (copied < query.count && seq < dev->anomaly_seq){
+        if (dev->anomaly_seq - seq > anomaly_log_size){
+            seq = dev->anomaly_seq - anomaly_log_size;
+        }
+        rec = dev->anomalies[anomaly_slot(seq)];
+        spin_unlock(&dev->anomaly_lock);
+
+        if (copy_to_user(&urecs[copied], &rec, sizeof(rec))){
+            return -EFAULT;
+        }
+        copied++;
+        seq++;
+        spin_lock(&dev->anomaly_lock);
+    }
+    query.total = dev->anomaly_seq;
+    spin_unlock(&dev->anomaly_lock);
+
+    query.count = copied;
+    query.threshold = READ_ONCE(dev->anomaly_threshold);
+    if (copy_to_user(uquery, &query, sizeof(query))){
+        return -EFAULT;
+    }
+    return 0;
+}
+
+// Payload feature extraction
+
+// log2(1 + i/256) in Q0.16, filled in at module load
+static u16 ai_log2_frac[256];
+
+static void init_log2_table(void){
+    unsigned int i, bit;
+    u64 y;
+    u16 r;
+
+    // Each squaring of the mantissa yields the next binary digit of its log
+    for (i = 0; i < 256; i++){
+        y = (u64)(256 + i) << 8;
+        r = 0;
+        for (bit = 16; bit-- > 0;){
+            y = (y * y) >> 16;
+            if (y >= (2 << 16)){
+                y >>= 1;
+                r |= 1 << bit;
+            }
+        }
+        ai_log2_frac[i] = r;
+    }
+}
+
+// log2(x) in Q16.16 from the top nine bits of x; x must be non-zero
+static inline u64 log2_q16(u64 x){
+    unsigned int l = ilog2(x);
+    u32 idx = l >= 8 ? (x >> (l - 8)) & 0xff : (x << (8 - l)) & 0xff;
+
+    return ((u64)l << 16) + ai_log2_frac[idx];
+}
+
+// Shannon entropy log2(n) - sum(c * log2(c)) / n in Q8 bits per byte.
+// Counts are shifted down until the total fits in 32 bits, so the products
+// fit in 64 bits.
+static u32 hist_entropy(const u32 *hist32, const u64 *hist64){
+    u64 n = 0, sum = 0, total = 0, c;
+    unsigned int shift = 0;
+    int i;
+
+    if (hist64){
+        for (i = 0; i < 256; i++){
+            total += hist64[i];
+        }
+        if (total >> 32){
+            shift = ilog2(total >> 32) + 1;
+        }
+    }
+    for (i = 0; i < 256; i++){
+        c = hist64 ? hist64[i] >> shift : hist32[i];
+        if (c){
+            n += c;
+            sum += c * log2_q16(c);
+        }
+    }
+    if (n < 2){
+        return 0;
+    }
+    return (u32)(div64_u64(n * log2_q16(n) - sum, n) >> 8);
+}
+
+// Map float bits to keys that order like the floats they encode
+static inline u32 f32_key(u32 bits){
+    return (bits & 0x80000000) ? ~bits : bits | 0x80000000;
+}
+
+static inline u32 f32_unkey(u32 key){
+    return (key & 0x80000000) ? key & 0x7fffffff : ~key;
+}
+
+// Finite float bits to Q16.16, saturating at +-2^31
+static s64 f32_to_q16(u32 bits){
+    int exp = (bits >> 23) & 0xff;
+    u64 mant = (bits & 0x7fffff) | (exp ? 0x800000 : 0);
+    s64 v;
+
+    // value = mant * 2^(exp - 150); Q16.16 shifts that by 16
+    exp = (exp ? exp : 1) - 134;
+    if (exp >= 24){
+        v = 1LL << 47;
+    } else if (exp >= 0){
+        v = min_t(s64, mant << exp, 1LL << 47);
+    } else if (exp > -24){
+        v = mant >> -exp;
+    } else {
+        v = 0;
+    }
+    return (bits & 0x80000000) ? -v : v;
+}
+
+static void scan_init(struct ai_scan *scan){
+    memset(scan, 0, sizeof(*scan));
+    scan->i16_min = S16_MAX;
+    scan->i16_max = S16_MIN;
+    scan->f32_min = U32_MAX;
+}
+
+// Scalar kernel. Also covers the tails the SIMD kernels leave, and matches
+// them exactly: float sums saturate per AI_SCAN_CHUNK and NaNs are skipped.
+static void scan_chunk_scalar(struct ai_scan *scan, const u8 *p, size_t len){
+    size_t i, chunk, end;
+    u64 tail = 0;
+    s64 fsum;
+
+    for (i = 0; i + 8 <= len; i += 8){
+        scan->xor ^= get_unaligned_le64(p + i);
+    }
+    if (i < len){
+        memcpy(&tail, p + i, len - i);
+        scan->xor ^= le64_to_cpu(tail);
+    }
+    for (i = 0; i < len; i++){
+        scan->byte_sum += p[i];
+    }
+    for (i = 0; i + 2 <= len; i += 2){
+        s16 v = (s16)get_unaligned_le16(p + i);
+
+        scan->i16_sum += v;
+        scan->i16_min = min_t(s32, scan->i16_min, v);
+        scan->i16_max = max_t(s32, scan->i16_max, v);
+    }
+    scan->i16_count += len / 2;
+
+    for (chunk = 0; chunk < len; chunk += AI_SCAN_CHUNK){
+        end = min_t(size_t, len, chunk + AI_SCAN_CHUNK);
+        fsum = 0;
+        for (i = chunk; i + 4 <= end; i += 4){
+            u32 bits = get_unaligned_le32(p + i);
+
+            if ((bits & 0x7f800000) == 0x7f800000){
+                if (bits & 0x7fffff){
+                    continue;
+                }
+            } else {
+                fsum += f32_to_q16(bits);
+                scan->f32_count++;
+            }
+            scan->f32_min = min(scan->f32_min, f32_key(bits));
+            scan->f32_max = max(scan->f32_max, f32_key(bits));
+        }
+        scan->f32_sum += clamp_t(s64, fsum, -AI_F32_SUM_MAX, AI_F32_SUM_MAX);
+    }
+}
+
+#ifdef CONFIG_X86_64
+// Constants loaded by the SIMD kernels
+static const struct {
+    u16 ones[16];
+    s16 i16_max[16];
+    s16 i16_min[16];
+    u32 f32_pinf[8];                 // Also the exponent mask
+    u32 f32_ninf[8];
+    u64 f64_sum_max;                 // +2^31
+    u64 f64_sum_min;                 // -2^31
+    u64 f64_q16;                     // 65536.0
+} __aligned(32) ai_simd_const = {
+    .ones = { [0 ... 15] = 1 },
+    .i16_max = { [0 ... 15] = S16_MAX },
+    .i16_min = { [0 ... 15] = S16_MIN },
+    .f32_pinf = { [0 ... 7] = 0x7f800000 },
+    .f32_ninf = { [0 ... 7] = 0xff800000 },
+    .f64_sum_max = 0x41e0000000000000ULL,
+    .f64_sum_min = 0xc1e0000000000000ULL,
+    .f64_q16 = 0x40f0000000000000ULL,
+};
+
+#define AI_SIMD_OPERANDS(ptr)                                                   \
+    [acc] "r" (ptr), [k] "r" (&ai_simd_const),                                  \
+    [k_ones] "i" (offsetof(typeof(ai_simd_const), ones)),                       \
+    [k_i16max] "i" (offsetof(typeof(ai_simd_const), i16_max)),                  \
+    [k_i16min] "i" (offsetof(typeof(ai_simd_const), i16_min)),                  \
+    [k_pinf] "i" (offsetof(typeof(ai_simd_const), f32_pinf)),                   \
+    [k_ninf] "i" (offsetof(typeof(ai_simd_const), f32_ninf)),                   \
+    [k_smax] "i" (offsetof(typeof(ai_simd_const), f64_sum_max)),                \
+    [k_smin] "i" (offsetof(typeof(ai_simd_const), f64_sum_min)),                \
+    [k_q16] "i" (offsetof(typeof(ai_simd_const), f64_q16)),                     \
+    [a_bsum] "i" (offsetof(struct ai_simd_acc, byte_sum)),                      \
+    [a_xor] "i" (offsetof(struct ai_simd_acc, xor)),                            \
+    [a_i16min] "i" (offsetof(struct ai_simd_acc, i16_min)),                     \
+    [a_i16max] "i" (offsetof(struct ai_simd_acc, i16_max)),                     \
+    [a_i16sum] "i" (offsetof(struct ai_simd_acc, i16_sum)),                     \
+    [a_fmin] "i" (offsetof(struct ai_simd_acc, f32_min)),                       \
+    [a_fmax] "i" (offsetof(struct ai_simd_acc, f32_max)),                       \
+    [a_nonfinite] "i" (offsetof(struct ai_simd_acc, nonfinite)),                \
+    [a_fsum] "i" (offsetof(struct ai_simd_acc, f32_sum))
+
+// Registers the SIMD kernels overwrite. The kernel build never gives the
+// compiler vector registers, but the user-space simulation does, so they
+// must be declared like any other clobber; the xmm names cover the ymm ones.
+#define AI_SIMD_CLOBBERS                                                        \
+    "rax", "cc", "memory",                                                      \
+    "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7",             \
+    "xmm8", "xmm9", "xmm10", "xmm11", "xmm13", "xmm14", "xmm15"
+
+// Fold the lanes a SIMD kernel stored for len bytes into the scan
+static void scan_merge_simd(struct ai_scan *scan, const struct ai_simd_acc *acc, unsigned int width, size_t len){
+    u64 nonfinite = 0;
+    unsigned int i;
+
+    for (i = 0; i < width / 8; i++){
+        scan->byte_sum += acc->byte_sum[i];
+        scan->xor ^= acc->xor[i];
+    }
+    for (i = 0; i < width / 2; i++){
+        scan->i16_min = min_t(s32, scan->i16_min, acc->i16_min[i]);
+        scan->i16_max = max_t(s32, scan->i16_max, acc->i16_max[i]);
+    }
+    for (i = 0; i < width / 4; i++){
+        scan->i16_sum += acc->i16_sum[i];
+        nonfinite += acc->nonfinite[i];
+        // Lanes that only saw NaNs still hold the +-inf they started with
+        scan->f32_min = min(scan->f32_min, f32_key(acc->f32_min[i]));
+        scan->f32_max = max(scan->f32_max, f32_key(acc->f32_max[i]));
+    }
+    scan->i16_count += len / 2;
+    scan->f32_count += len / 4 - nonfinite;
+    scan->f32_sum += acc->f32_sum;
+}
+
+// The SIMD kernels run one asm loop over a chunk of at most AI_SCAN_CHUNK
+// bytes, a multiple of the vector width, inside kernel_fpu_begin(). Every
+// statistic lives in its own register:
+//   xmm0 zero          xmm1 int16 ones       xmm2 byte sums (psadbw)
+//   xmm3 XOR checksum  xmm4/5 int16 min/max  xmm6 int16 sums (pmaddwd)
+//   xmm7/8 float min/max; minps/maxps keep the accumulator for NaN lanes
+//   xmm9/10 float sums as doubles with non-finite lanes zeroed
+//   xmm11 exponent mask  xmm13 non-finite counts  xmm14/15 scratch
+// A 4 KB chunk can't overflow the 32-bit int16 lanes, and the double sums
+// are saturated to +-2^31 before converting to Q16.16.
+static void scan_chunk_sse2(struct ai_scan *scan, const u8 *p, size_t len){
+    struct ai_simd_acc acc;
+    struct ai_simd_acc *accp = &acc;
+    const u8 *end = p + len;
+
+    asm volatile(
+        "pxor      %%xmm0, %%xmm0\n\t"
+        "movdqa    %c[k_ones](%[k]), %%xmm1\n\t"
+        "pxor      %%xmm2, %%xmm2\n\t"
+        "pxor      %%xmm3, %%xmm3\n\t"
+        "movdqa    %c[k_i16max](%[k]), %%xmm4\n\t"
+        "movdqa    %c[k_i16min](%[k]), %%xmm5\n\t"
+        "pxor      %%xmm6, %%xmm6\n\t"
+        "movaps    %c[k_pinf](%[k]), %%xmm7\n\t"
+        "movaps    %c[k_ninf](%[k]), %%xmm8\n\t"
+        "xorpd     %%xmm9, %%xmm9\n\t"
+        "xorpd     %%xmm10, %%xmm10\n\t"
+        "movdqa    %c[k_pinf](%[k]), %%xmm11\n\t"
+        "pxor      %%xmm13, %%xmm13\n\t"
+        "1:\n\t"
+        "movdqu    (%[p]), %%xmm14\n\t"
+        "movdqa    %%xmm14, %%xmm15\n\t"
+        "psadbw    %%xmm0, %%xmm15\n\t"
+        "paddq     %%xmm15, %%xmm2\n\t"
+        "pxor      %%xmm14, %%xmm3\n\t"
+        "pminsw    %%xmm14, %%xmm4\n\t"
+        "pmaxsw    %%xmm14, %%xmm5\n\t"
+        "movdqa    %%xmm14, %%xmm15\n\t"
+        "pmaddwd   %%xmm1, %%xmm15\n\t"
+        "paddd     %%xmm15, %%xmm6\n\t"
+        "movaps    %%xmm14, %%xmm15\n\t"
+        "minps     %%xmm7, %%xmm15\n\t"
+        "movaps    %%xmm15, %%xmm7\n\t"
+        "movaps    %%xmm14, %%xmm15\n\t"
+        "maxps     %%xmm8, %%xmm15\n\t"
+        "movaps    %%xmm15, %%xmm8\n\t"
+        "movdqa    %%xmm14, %%xmm15\n\t"
+        "pand      %%xmm11, %%xmm15\n\t"
+        "pcmpeqd   %%xmm11, %%xmm15\n\t"
+        "psubd     %%xmm15, %%xmm13\n\t"
+        "andnps    %%xmm14, %%xmm15\n\t"
+        "cvtps2pd  %%xmm15, %%xmm14\n\t"
+        "addpd     %%xmm14, %%xmm9\n\t"
+        "movhlps   %%xmm15, %%xmm15\n\t"
+        "cvtps2pd  %%xmm15, %%xmm15\n\t"
+        "addpd     %%xmm15, %%xmm10\n\t"
+        "add       $16, %[p]\n\t"
+        "cmp       %[end], %[p]\n\t"
+        "jb        1b\n\t"
+        "movdqu    %%xmm2, %c[a_bsum](%[acc])\n\t"
+        "movdqu    %%xmm3, %c[a_xor](%[acc])\n\t"
+        "movdqu    %%xmm4, %c[a_i16min](%[acc])\n\t"
+        "movdqu    %%xmm5, %c[a_i16max](%[acc])\n\t"
+        "movdqu    %%xmm6, %c[a_i16sum](%[acc])\n\t"
+        "movups    %%xmm7, %c[a_fmin](%[acc])\n\t"
+        "movups    %%xmm8, %c[a_fmax](%[acc])\n\t"
+        "movdqu    %%xmm13, %c[a_nonfinite](%[acc])\n\t"
+        "addpd     %%xmm10, %%xmm9\n\t"
+        "movapd    %%xmm9, %%xmm10\n\t"
+        "unpckhpd  %%xmm10, %%xmm10\n\t"
+        "addsd     %%xmm10, %%xmm9\n\t"
+        "minsd     %c[k_smax](%[k]), %%xmm9\n\t"
+        "maxsd     %c[k_smin](%[k]), %%xmm9\n\t"
+        "mulsd     %c[k_q16](%[k]), %%xmm9\n\t"
+        "cvttsd2si %%xmm9, %%rax\n\t"
+        "mov       %%rax, %c[a_fsum](%[acc])\n\t"
+        : [p] "+r" (p)
+        : [end] "r" (end), AI_SIMD_OPERANDS(accp)
+        : AI_SIMD_CLOBBERS);
+    scan_merge_simd(scan, &acc, 16, len);
+}
+
+static void scan_chunk_avx2(struct ai_scan *scan, const u8 *p, size_t len){
+    struct ai_simd_acc acc;
+    struct ai_simd_acc *accp = &acc;
+    const u8 *end = p + len;
+
+    asm volatile(
+        "vpxor     %%ymm0, %%ymm0, %%ymm0\n\t"
+        "vmovdqa   %c[k_ones](%[k]), %%ymm1\n\t"
+        "vpxor     %%ymm2, %%ymm2, %%ymm2\n\t"
+        "vpxor     %%ymm3, %%ymm3, %%ymm3\n\t"
+        "vmovdqa   %c[k_i16max](%[k]), %%ymm4\n\t"
+        "vmovdqa   %c[k_i16min](%[k]), %%ymm5\n\t"
+        "vpxor     %%ymm6, %%ymm6, %%ymm6\n\t"
+        "vmovaps   %c[k_pinf](%[k]), %%ymm7\n\t"
+        "vmovaps   %c[k_ninf](%[k]), %%ymm8\n\t"
+        "vxorpd    %%ymm9, %%ymm9, %%ymm9\n\t"
+        "vxorpd    %%ymm10, %%ymm10, %%ymm10\n\t"
+        "vmovdqa   %c[k_pinf](%[k]), %%ymm11\n\t"
+        "vpxor     %%ymm13, %%ymm13, %%ymm13\n\t"
+        "1:\n\t"
+        "vmovdqu   (%[p]), %%ymm14\n\t"
+        "vpsadbw   %%ymm0, %%ymm14, %%ymm15\n\t"
+        "vpaddq    %%ymm15, %%ymm2, %%ymm2\n\t"
+        "vpxor     %%ymm14, %%ymm3, %%ymm3\n\t"
+        "vpminsw   %%ymm14, %%ymm4, %%ymm4\n\t"
+        "vpmaxsw   %%ymm14, %%ymm5, %%ymm5\n\t"
+        "vpmaddwd  %%ymm1, %%ymm14, %%ymm15\n\t"
+        "vpaddd    %%ymm15, %%ymm6, %%ymm6\n\t"
+        "vminps    %%ymm7, %%ymm14, %%ymm7\n\t"
+        "vmaxps    %%ymm8, %%ymm14, %%ymm8\n\t"
+        "vpand     %%ymm11, %%ymm14, %%ymm15\n\t"
+        "vpcmpeqd  %%ymm11, %%ymm15, %%ymm15\n\t"
+        "vpsubd    %%ymm15, %%ymm13, %%ymm13\n\t"
+        "vandnps   %%ymm14, %%ymm15, %%ymm15\n\t"
+        "vcvtps2pd %%xmm15, %%ymm14\n\t"
+        "vaddpd    %%ymm14, %%ymm9, %%ymm9\n\t"
+        "vextractf128 $1, %%ymm15, %%xmm15\n\t"
+        "vcvtps2pd %%xmm15, %%ymm15\n\t"
+        "vaddpd    %%ymm15, %%ymm10, %%ymm10\n\t"
+        "add       $32, %[p]\n\t"
+        "cmp       %[end], %[p]\n\t"
+        "jb        1b\n\t"
+        "vmovdqu   %%ymm2, %c[a_bsum](%[acc])\n\t"
+        "vmovdqu   %%ymm3, %c[a_xor](%[acc])\n\t"
+        "vmovdqu   %%ymm4, %c[a_i16min](%[acc])\n\t"
+        "vmovdqu   %%ymm5, %c[a_i16max](%[acc])\n\t"
+        "vmovdqu   %%ymm6, %c[a_i16sum](%[acc])\n\t"
+        "vmovups   %%ymm7, %c[a_fmin](%[acc])\n\t"
+        "vmovups   %%ymm8, %c[a_fmax](%[acc])\n\t"
+        "vmovdqu   %%ymm13, %c[a_nonfinite](%[acc])\n\t"
+        "vaddpd    %%ymm10, %%ymm9, %%ymm9\n\t"
+        "vextractf128 $1, %%ymm9, %%xmm10\n\t"
+        "vaddpd    %%xmm10, %%xmm9, %%xmm9\n\t"
+        "vunpckhpd %%xmm9, %%xmm9, %%xmm10\n\t"
+        "vaddsd    %%xmm10, %%xmm9, %%xmm9\n\t"
+        "vminsd    %c[k_smax](%[k]), %%xmm9, %%xmm9\n\t"
+        "vmaxsd    %c[k_smin](%[k]), %%xmm9, %%xmm9\n\t"
+        "vmulsd    %c[k_q16](%[k]), %%xmm9, %%xmm9\n\t"
+        "vcvttsd2si %%xmm9, %%rax\n\t"
+        "mov       %%rax, %c[a_fsum](%[acc])\n\t"
+        "vzeroupper\n\t"
+        : [p] "+r" (p)
+        : [end] "r" (end), AI_SIMD_OPERANDS(accp)
+        : AI_SIMD_CLOBBERS);
+    scan_merge_simd(scan, &acc, 32, len);
+}
+#endif
+
+static const struct ai_scan_impl ai_scan_impls[] = {
+    { "scalar", AI_SCAN_SCALAR, 0, NULL },
+#ifdef CONFIG_X86_64
+    { "sse2", AI_SCAN_SSE2, 16, scan_chunk_sse2 },
+    { "avx2", AI_SCAN_AVX2, 32, scan_chunk_avx2 },
+#endif
+};
+
+static const struct ai_scan_impl *ai_scan_impl = &ai_scan_impls[0];
+
+// Pick the widest kernel the CPU supports, unless feature_simd is off
+static void select_scan_impl(void){
+    init_log2_table();
+#ifdef CONFIG_X86_64
+    if (feature_simd && boot_cpu_has(X86_FEATURE_AVX2) && boot_cpu_has(X86_FEATURE_AVX)){
+        ai_scan_impl = &ai_scan_impls[AI_SCAN_AVX2];
+    } else if (feature_simd && boot_cpu_has(X86_FEATURE_XMM2)){
+        ai_scan_impl = &ai_scan_impls[AI_SCAN_SSE2];
+    }
+#endif
+    pr_info("Using %s feature extraction\n", ai_scan_impl->name);
+}
+
+// Scan one contiguous segment of a write. The byte histogram is a scatter
+// the vector units can't speed up, so it stays scalar; the rest goes through
+// the SIMD kernel a chunk at a time, so preemption is never held off for
+// more than AI_SCAN_CHUNK bytes.
+static void scan_payload(struct ai_scan *scan, const u8 *p, size_t len){
+    size_t vec = 0, off, n, i;
+
+    for (i = 0; i < len; i++){
+        scan->hist[p[i]]++;
+    }
+    scan->bytes += len;
+
+    if (ai_scan_impl->chunk && len >= AI_SCAN_SIMD_MIN){
+        vec = len & ~(size_t)(ai_scan_impl->width - 1);
+        for (off = 0; off < vec; off += n){
+            n = min_t(size_t, vec - off, AI_SCAN_CHUNK);
+            kernel_fpu_begin();
+            ai_scan_impl->chunk(scan, p + off, n);
+            kernel_fpu_end();
+        }
+    }
+    scan_chunk_scalar(scan, p + vec, len - vec);
+}
+
+// Out of line so the scan state only takes up stack while extraction is on
+static noinline void extract_features(struct ai_file_ctx *ctx, const void *seg0, size_t len0, const void *seg1, size_t len1){
+    struct ai_scan scan;
+
+    scan_init(&scan);
+    scan_payload(&scan, seg0, len0);
+    scan_payload(&scan, seg1, len1);
+    scan.entropy = hist_entropy(scan.hist, NULL);
+    account_write(ctx, len0 + len1, &scan);
+}
+
+// Account a write whose data is seg0 followed by seg1 (a record that wraps
+// around the stream ring), extracting its features first when enabled
+static void account_payload(struct ai_file_ctx *ctx, const void *seg0, size_t len0, const void *seg1, size_t len1){
+    if (READ_ONCE(feature_extraction)){
+        extract_features(ctx, seg0, len0, seg1, len1);
+    } else {
+        account_write(ctx, len0 + len1, NULL);
+    }
+}
+
+// Mean of n values summing to sum, in Q16.16
+static s64 q16_mean(s64 sum, u64 n){
+    s64 q = div64_s64(sum, (s64)n);
+
+    return q * 65536 + div64_s64((sum - q * (s64)n) * 65536, (s64)n);
+}
+
+// Buffer writes may span chunks, so they are scanned a chunk at a time
+static noinline void extract_buffer_features(struct ai_file_ctx *ctx, size_t off, size_t len){
+    struct ai_scan scan;
+    size_t n;
+
+    scan_init(&scan);
+    while (len){
+        n = chunk_span(off, len);
+        scan_payload(&scan, chunk_addr(ctx, off), n);
+        off += n;
+        len -= n;
+    }
+    scan.entropy = hist_entropy(scan.hist, NULL);
+    account_write(ctx, scan.bytes, &scan);
+}
+
+// Account a write of len bytes at off in the buffer; called with ctx->lock held
+static void account_buffer(struct ai_file_ctx *ctx, size_t off, size_t len){
+    if (READ_ONCE(feature_extraction)){
+        extract_buffer_features(ctx, off, len);
+    } else {
+        account_write(ctx, len, NULL);
+    }
+}
+
+// Sum the per-CPU payload features for AI_IOC_GET_FEATURES
+static void get_features(struct ai_device *dev, struct ai_features *out){
+    struct ai_pcpu_stats *stats;
+    struct ai_payload_stats copy, total = {
+        .i16_min = S16_MAX,
+        .i16_max = S16_MIN,
+        .f32_min = U32_MAX,
+    };
+    unsigned int start;
+    int cpu, i;
+
+    memset(out, 0, sizeof(*out));
+    for_each_possible_cpu(cpu){
+        stats = per_cpu_ptr(dev->stats, cpu);
+        do {
+            start = u64_stats_fetch_begin(&stats->syncp);
+            copy = stats->payload;
+        } while (u64_stats_fetch_retry(&stats->syncp, start));
+
+        total.writes += copy.writes;
+        total.bytes += copy.bytes;
+        total.byte_sum += copy.byte_sum;
+        total.checksum ^= copy.checksum;
+        total.i16_sum += copy.i16_sum;
+        total.i16_count += copy.i16_count;
+        total.i16_min = min(total.i16_min, copy.i16_min);
+        total.i16_max = max(total.i16_max, copy.i16_max);
+        total.f32_sum += copy.f32_sum;
+        total.f32_count += copy.f32_count;
+        total.f32_min = min(total.f32_min, copy.f32_min);
+        total.f32_max = max(total.f32_max, copy.f32_max);
+
+        for (i = 0; i < 256; i++){
+            u64 count;
+
+            do {
+                start = u64_stats_fetch_begin(&stats->syncp);
+                count = stats->byte_hist[i];
+            } while (u64_stats_fetch_retry(&stats->syncp, start));
+            out->byte_hist[i] += count;
+        }
+    }
+
+    out->enabled = READ_ONCE(feature_extraction);
+    out->impl = ai_scan_impl->id;
+    out->writes = total.writes;
+    out->bytes = total.bytes;
+    out->byte_sum = total.byte_sum;
+    out->checksum = total.checksum;
+    out->entropy_q8 = hist_entropy(NULL, out->byte_hist);
+    out->i16_count = total.i16_count;
+    if (total.i16_count){
+        out->i16_mean_q16 = q16_mean(total.i16_sum, total.i16_count);
+        out->i16_min = total.i16_min;
+        out->i16_max = total.i16_max;
+    }
+    out->f32_count = total.f32_count;
+    if (total.f32_count){
+        out->f32_mean_q16 = div64_s64(total.f32_sum, (s64)total.f32_count);
+    }
+    // Infinities count towards min and max but not towards the mean
+    if (total.f32_min <= total.f32_max){
+        out->f32_min = f32_unkey(total.f32_min);
+        out->f32_max = f32_unkey(total.f32_max);
+    }
+}
+
+// Predictive model implementation
+
+// Multiply a Q16.16 value by an unsigned Q16.16 factor without overflowing
+static inline s64 q16_mul(s64 a, u32 b){
+    if (a < 0){
+        return -(s64)mul_u64_u32_shr(-a, b, AI_Q16_SHIFT);
+    }
+    return mul_u64_u32_shr(a, b, AI_Q16_SHIFT);
+}
+
+// Fold one period's write rate (bytes) into the model
+static void model_step(struct ai_model *m, u64 y){
+    s64 y_q16, prev, prev_level;
+
+    y = min_t(u64, y, AI_MODEL_MAX_RATE);
+    y_q16 = (s64)y << AI_Q16_SHIFT;
+
+    // Holt: level tracks the rate, trend tracks its change per period
+    if (!m->samples){
+        m->level = y_q16;
+        m->trend = 0;
+    } else {
+        prev_level = m->level;
+        prev = m->level + m->trend;
+        m->level = prev + q16_mul(y_q16 - prev, AI_MODEL_ALPHA);
+        m->trend += q16_mul((m->level - prev_level) - m->trend, AI_MODEL_BETA);
+        // A falling trend can overshoot, but a write rate is never negative
+        if (m->level < 0){
+            m->level = 0;
+        }
+    }
+
+    // Sliding window sums with the oldest sample at x = 0. Dropping the
+    // oldest sample shifts every x down by one, which takes sum_y off sum_xy.
+    if (m->win_count < AI_MODEL_WINDOW){
+        m->window[(m->win_head + m->win_count) % AI_MODEL_WINDOW] = y;
+        m->sum_xy += (s64)m->win_count * y;
+        m->sum_y += y;
+        m->win_count++;
+    } else {
+        u64 old = m->window[m->win_head];
+
+        m->window[m->win_head] = y;
+        m->win_head = (m->win_head + 1) % AI_MODEL_WINDOW;
+        m->sum_xy += (s64)(AI_MODEL_WINDOW - 1) * y - (m->sum_y - old);
+        m->sum_y += y - old;
+    }
+    m->samples++;
+}
+
+// Feed the model every period that ended before now. Bytes the CPUs handed
+// over since the last sample count towards the first of them; the rest of a
+// pause reads as idle. A CPU hands over on its first write of a period, so
+// what it wrote late in one period can land in the next sample; over a
+// steady load the rate is the same. Called with dev->model_lock held.
+static void model_advance(struct ai_device *dev, u64 now){
+    struct ai_model *m = &dev->model;
+    u64 period_ns = AI_MODEL_PERIOD_MS * NSEC_PER_MSEC;
+    u64 periods, bytes, i;
+
+    if (now < m->last_ns + period_ns){
+        return;
+    }
+    periods = div64_u64(now - m->last_ns, period_ns);
+
+    bytes = atomic64_xchg(&m->pending, 0);
+    model_step(m, bytes);
+    for (i = 1; i < min_t(u64, periods, AI_MODEL_MAX_GAP); i++){
+        model_step(m, 0);
+    }
+    m->last_usage += bytes;
+    WRITE_ONCE(m->last_ns, m->last_ns + periods * period_ns);
+}
+
+// Called on every write; only the first write of a new period does any
+// work, and that work is O(1) whatever the number of CPUs
+static void model_sample(struct ai_device *dev, u64 now){
+    if (now < READ_ONCE(dev->model.last_ns) + AI_MODEL_PERIOD_MS * NSEC_PER_MSEC){
+        return;
+    }
+    // Another writer is already taking this sample
+    if (!spin_trylock(&dev->model_lock)){
+        return;
+    }
+    model_advance(dev, now);
+    spin_unlock(&dev->model_lock);
+}
+
+// Periods until usage plus the Holt forecast covers remaining bytes. After h
+// periods the forecast adds h*level + trend*h*(h+1)/2, so h is the positive
+// root of (trend/2)h^2 + a*h - remaining = 0 with a = level + trend/2. It is
+// computed as 2r / (a + sqrt(a^2 + 2*trend*r)), which stays exact as the
+// trend goes to zero. The root is scale invariant, so everything is shifted
+// down until the products fit in 63 bits. Only a rising trend is applied, so
+// noise around a steady rate can't push the estimate out to never.
+static u64 model_periods_to(s64 level_q16, s64 trend_q16, u64 remaining){
+    s64 b = max_t(s64, trend_q16, 0);
+    s64 a = level_q16 + b / 2;
+    s64 r, disc, den;
+
+    if (!remaining){
+        return 0;
+    }
+    r = min_t(u64, remaining, AI_MODEL_MAX_RATE) << AI_Q16_SHIFT;
+    while (abs(a) >= (1LL << 30) || abs(b) >= (1LL << 30) || r >= (1LL << 30)){
+        a /= 2;
+        b /= 2;
+        r /= 2;
+    }
+    // Less than one period's worth of forecast left
+    if (!r){
+        return 1;
+    }
+
+    disc = a * a + 2 * b * r;
+    if (disc < 0){
+        return AI_MODEL_NEVER;
+    }
+    den = a + (s64)int_sqrt64(disc);
+    if (den <= 0){
+        return AI_MODEL_NEVER;
+    }
+    return max_t(u64, DIV_ROUND_UP_ULL(2 * r, den), 1);
+}
+
+// Bring the model up to date and describe it, including the forecasts
+// against the current threshold
+static void get_model_state(struct ai_device *dev, struct ai_model_state *out){
+    struct ai_model *m = &dev->model;
+    s64 n, sx, sxx, num, den, q;
+    s64 forecast;
+    u64 periods;
+
+    memset(out, 0, sizeof(*out));
+    spin_lock(&dev->model_lock);
+    model_advance(dev, ktime_get_ns());
+
+    out->timestamp_ns = m->last_ns;
+    out->samples = m->samples;
+    out->period_ms = AI_MODEL_PERIOD_MS;
+    out->window = m->win_count;
+    out->alpha_q16 = AI_MODEL_ALPHA;
+    out->beta_q16 = AI_MODEL_BETA;
+    out->level_q16 = m->level;
+    out->trend_q16 = m->trend;
+    out->usage_count = m->last_usage;
+    out->threshold = READ_ONCE(dev->threshold);
+
+    // Least-squares fit of rate against x = 0..n-1
+    n = m->win_count;
+    if (n >= 2){
+        sx = n * (n - 1) / 2;
+        sxx = (n - 1) * n * (2 * n - 1) / 6;
+        num = n * m->sum_xy - sx * m->sum_y;
+        den = n * sxx - sx * sx;
+        q = div64_s64(num, den);
+        out->ols_slope_q16 = q * (1LL << AI_Q16_SHIFT) + div64_s64((num - q * den) * (1LL << AI_Q16_SHIFT), den);
+        out->ols_rate_q16 = div64_s64(m->sum_y << AI_Q16_SHIFT, n) + out->ols_slope_q16 * (n - 1) / 2;
+        out->ols_rate_q16 = max_t(s64, out->ols_rate_q16, 0);
+    } else if (n == 1){
+        out->ols_rate_q16 = m->sum_y << AI_Q16_SHIFT;
+    }
+    spin_unlock(&dev->model_lock);
+
+    // Holt forecast AI_MODEL_HORIZON periods ahead
+    forecast = AI_MODEL_HORIZON * out->level_q16 +
+               out->trend_q16 * (AI_MODEL_HORIZON * (AI_MODEL_HORIZON + 1) / 2);
+    out->forecast_usage = out->usage_count + (forecast > 0 ? forecast >> AI_Q16_SHIFT : 0);
+
+    if (out->usage_count >= out->threshold){
+        out->time_to_threshold_ms = 0;
+        return;
+    }
+    periods = model_periods_to(out->level_q16, out->trend_q16, out->threshold - out->usage_count);
+    out->time_to_threshold_ms = periods == AI_MODEL_NEVER ? AI_MODEL_NEVER : periods * AI_MODEL_PERIOD_MS;
+}
+
+// Loadable inference models
+
+// Counters and rates as model inputs: log2 in Q8, 0 for 0
+static inline s16 infer_log2(u64 x){
+    return log2_q16(max_t(u64, x, 1)) >> 8;
+}
+
+// Parse and check a model blob. Everything the evaluation relies on is
+// checked here (section sizes, indices and tree depths), so infer_eval()
+// runs without bounds checks and in bounded time.
+static struct ai_infer_model *parse_infer_model(const u8 *blob, size_t size){
+    static const u8 zero_crc[4];
+    struct ai_infer_hdr hdr;
+    struct ai_infer_model *m;
+    size_t need, off, len[6];
+    const u8 *p = blob + sizeof(hdr);
+    unsigned int i, nr_nodes;
+    u8 *depth;
+    u32 crc;
+
+    if (size < sizeof(hdr) || size > AI_INFER_MAX_SIZE){
+        return ERR_PTR(-EINVAL);
+    }
+    memcpy(&hdr, blob, sizeof(hdr));
+    hdr.magic = le32_to_cpu(hdr.magic);
+    hdr.version = le16_to_cpu(hdr.version);
+    hdr.type = le16_to_cpu(hdr.type);
+    hdr.size = le32_to_cpu(hdr.size);
+    hdr.crc32 = le32_to_cpu(hdr.crc32);
+    hdr.id = le32_to_cpu(hdr.id);
+    hdr.nr_inputs = le16_to_cpu(hdr.nr_inputs);
+    hdr.nr_outputs = le16_to_cpu(hdr.nr_outputs);
+    hdr.nr_units = le16_to_cpu(hdr.nr_units);
+    hdr.nr_nodes = le16_to_cpu(hdr.nr_nodes);
+
+    if (hdr.magic != AI_INFER_MAGIC || hdr.version != AI_INFER_VERSION || hdr.size != size){
+        return ERR_PTR(-EINVAL);
+    }
+    // CRC-32 as zlib computes it, over the blob with the crc32 field zeroed
+    crc = crc32_le(~0, blob, offsetof(struct ai_infer_hdr, crc32));
+    crc = crc32_le(crc, zero_crc, sizeof(zero_crc));
+    off = offsetof(struct ai_infer_hdr, crc32) + sizeof(hdr.crc32);
+    crc = crc32_le(crc, blob + off, size - off);
+    if ((crc ^ ~0U) != hdr.crc32){
+        return ERR_PTR(-EBADMSG);
+    }
+    if (!hdr.nr_inputs || hdr.nr_inputs > AI_INFER_INPUTS ||
+        !hdr.nr_outputs || hdr.nr_outputs > AI_INFER_OUTPUTS || !hdr.nr_units){
+        return ERR_PTR(-EINVAL);
+    }
+
+    // Section sizes in blob order
+    memset(len, 0, sizeof(len));
+    switch (hdr.type){
+        case AI_INFER_TREES:
+            if (hdr.nr_units > AI_INFER_MAX_TREES || !hdr.nr_nodes || hdr.nr_nodes > AI_INFER_MAX_NODES){
+                return ERR_PTR(-EINVAL);
+            }
+            len[0] = hdr.nr_units * sizeof(u16);
+            len[1] = hdr.nr_nodes * sizeof(struct ai_tree_node);
+            break;
+        case AI_INFER_MLP:
+            if (hdr.nr_units > AI_INFER_MAX_HIDDEN || hdr.nr_nodes || hdr.shift[0] > 31 || hdr.shift[1] > 31){
+                return ERR_PTR(-EINVAL);
+            }
+            len[2] = hdr.nr_units * hdr.nr_inputs;
+            len[3] = hdr.nr_units * sizeof(s32);
+            len[4] = hdr.nr_outputs * hdr.nr_units;
+            len[5] = hdr.nr_outputs * sizeof(s32);
+            break;
+        default:
+            return ERR_PTR(-EINVAL);
+    }
+    need = sizeof(hdr);
+    off = 0;
+    for (i = 0; i < ARRAY_SIZE(len); i++){
+        need += len[i];
+        off += ALIGN(len[i], 8);
+    }
+    if (need != size){
+        return ERR_PTR(-EINVAL);
+    }
+
+    m = kzalloc(sizeof(*m) + off, GFP_KERNEL);
+    if (!m){
+        return ERR_PTR(-ENOMEM);
+    }
+    m->id = hdr.id;
+    m->type = hdr.type;
+    m->nr_inputs = hdr.nr_inputs;
+    m->nr_outputs = hdr.nr_outputs;
+    m->nr_units = hdr.nr_units;
+    m->shift[0] = hdr.shift[0];
+    m->shift[1] = hdr.shift[1];
+
+    if (hdr.type == AI_INFER_MLP){
+        s8 *w1 = (s8 *)m->data;
+        s32 *b1 = (s32 *)(m->data + ALIGN(len[2], 8));
+        s8 *w2 = (s8 *)b1 + ALIGN(len[3], 8);
+        s32 *b2 = (s32 *)(w2 + ALIGN(len[4], 8));
+
+        memcpy(w1, p, len[2]);
+        p += len[2];
+        for (i = 0; i < hdr.nr_units; i++, p += sizeof(s32)){
+            b1[i] = get_unaligned_le32(p);
+        }
+        memcpy(w2, p, len[4]);
+        p += len[4];
+        for (i = 0; i < hdr.nr_outputs; i++, p += sizeof(s32)){
+            b2[i] = get_unaligned_le32(p);
+        }
+        m->w1 = w1;
+        m->b1 = b1;
+        m->w2 = w2;
+        m->b2 = b2;
+        return m;
+    }
+
+    {
+        u16 *roots = (u16 *)m->data;
+        struct ai_tree_node *nodes = (struct ai_tree_node *)(m->data + ALIGN(len[0], 8));
+
+        nr_nodes = hdr.nr_nodes;
+        for (i = 0; i < hdr.nr_units; i++, p += sizeof(u16)){
+            roots[i] = get_unaligned_le16(p);
+            if (roots[i] >= nr_nodes){
+                goto invalid;
+            }
+        }
+        for (i = 0; i < nr_nodes; i++, p += sizeof(struct ai_tree_node)){
+            struct ai_tree_node *n = &nodes[i];
+
+            n->feature = p[0];
+            n->leaf = p[1];
+            n->value = get_unaligned_le16(p + 2);
+            n->left = get_unaligned_le16(p + 4);
+            n->right = get_unaligned_le16(p + 6);
+            if (n->leaf > 1 || n->feature >= (n->leaf ? hdr.nr_outputs : hdr.nr_inputs)){
+                goto invalid;
+            }
+            if (!n->leaf && (n->left <= i || n->right <= i || n->left >= nr_nodes || n->right >= nr_nodes)){
+                goto invalid;
+            }
+        }
+
+        // Children come after their parents, so one backward sweep gives
+        // every subtree's depth
+        depth = kmalloc(nr_nodes, GFP_KERNEL);
+        if (!depth){
+            kfree(m);
+            return ERR_PTR(-ENOMEM);
+        }
+        for (i = nr_nodes; i-- > 0;){
+            depth[i] = nodes[i].leaf ? 1 :
+                       min(1 + max(depth[nodes[i].left], depth[nodes[i].right]), AI_INFER_MAX_DEPTH + 1);
+        }
+        for (i = 0; i < hdr.nr_units; i++){
+            if (depth[roots[i]] > AI_INFER_MAX_DEPTH){
+                kfree(depth);
+                goto invalid;
+            }
+        }
+        kfree(depth);
+        m->roots = roots;
+        m->nodes = nodes;
+    }
+    return m;
+
+invalid:
+    kfree(m);
+    return ERR_PTR(-EINVAL);
+}
+
+// Evaluate m over in[]. At most AI_INFER_MAX_TREES * AI_INFER_MAX_DEPTH
+// node visits, or AI_INFER_MAX_HIDDEN * (AI_INFER_INPUTS + AI_INFER_OUTPUTS)
+// multiply-adds.
+static void infer_eval(const struct ai_infer_model *m, const s16 *in, s32 *out){
+    s32 hidden[AI_INFER_MAX_HIDDEN];
+    unsigned int t, d, j, k;
+    s64 acc;
+
+    memset(out, 0, AI_INFER_OUTPUTS * sizeof(*out));
+    if (m->type == AI_INFER_TREES){
+        for (t = 0; t < m->nr_units; t++){
+            const struct ai_tree_node *n = &m->nodes[m->roots[t]];
+
+            for (d = 0; d < AI_INFER_MAX_DEPTH && !n->leaf; d++){
+                n = &m->nodes[in[n->feature] < n->value ? n->left : n->right];
+            }
+            out[n->feature] += n->value;
+        }
+        return;
+    }
+
+    for (j = 0; j < m->nr_units; j++){
+        const s8 *w = &m->w1[j * m->nr_inputs];
+
+        acc = m->b1[j];
+        for (k = 0; k < m->nr_inputs; k++){
+            acc += w[k] * in[k];
+        }
+        hidden[j] = clamp_t(s64, acc >> m->shift[0], 0, S16_MAX);
+    }
+    for (j = 0; j < m->nr_outputs; j++){
+        const s8 *w = &m->w2[j * m->nr_units];
+
+        acc = m->b2[j];
+        for (k = 0; k < m->nr_units; k++){
+            acc += w[k] * hidden[k];
+        }
+        out[j] = clamp_t(s64, acc >> m->shift[1], S32_MIN, S32_MAX);
+    }
+}
+
+// Build the input vector and evaluate the loaded model, if any. Called
+// from run_analytics() with dev->mutex_lock held, before the stages that
+// consume the verdicts. Loads never wait for this: the model is only
+// held under rcu_read_lock.
+static void run_inference(struct ai_device *dev, const struct ai_stats_snapshot *snap, u32 sensor){
+    struct ai_inference *inf = &dev->inference;
+    struct ai_infer_model *m;
+    struct ai_model_state state;
+    u32 score;
+    u64 start;
+
+    get_model_state(dev, &state);
+    spin_lock(&dev->anomaly_lock);
+    score = dev->anomaly_pass_max;
+    spin_unlock(&dev->anomaly_lock);
+
+    inf->inputs[AI_IN_USAGE] = infer_log2(snap->usage_count);
+    inf->inputs[AI_IN_ERRORS] = infer_log2(snap->error_count);
+    inf->inputs[AI_IN_SENSOR] = infer_log2(sensor);
+    inf->inputs[AI_IN_WRITE_RATE] = infer_log2(state.level_q16 > 0 ? state.level_q16 >> AI_Q16_SHIFT : 0);
+    inf->inputs[AI_IN_WRITE_SIZE] = infer_log2(dev->tuner.state.p50_extent);
+    inf->inputs[AI_IN_LOAD] = dev->gov.load;
+    inf->inputs[AI_IN_SCORE] = min_t(u32, score, S16_MAX);
+    inf->inputs[AI_IN_HEADROOM] = infer_log2(state.time_to_threshold_ms);
+
+    rcu_read_lock();
+    m = rcu_dereference(dev->infer);
+    if (!m){
+        rcu_read_unlock();
+        inf->model_id = 0;
+        inf->model_type = 0;
+        inf->nr_outputs = 0;
+        inf->loaded_ns = 0;
+        inf->runs = 0;
+        inf->eval_ns = 0;
+        memset(inf->outputs, 0, sizeof(inf->outputs));
+        return;
+    }
+    if (inf->loaded_ns != m->loaded_ns){
+        inf->model_id = m->id;
+        inf->model_type = m->type;
+        inf->nr_outputs = m->nr_outputs;
+        inf->loaded_ns = m->loaded_ns;
+        inf->runs = 0;
+    }
+    start = ktime_get_ns();
+    infer_eval(m, inf->inputs, inf->outputs);
+    inf->eval_ns = ktime_get_ns() - start;
+    rcu_read_unlock();
+    inf->runs++;
+}
+
+// Swap in the model in blob, or go back to the built-in rules when size
+// is 0. The old model is freed after a grace period, so an evaluation in
+// flight finishes on it.
+static int load_infer_model(struct ai_device *dev, const u8 *blob, size_t size){
+    struct ai_infer_model *m = NULL, *old;
+
+    if (size){
+        m = parse_infer_model(blob, size);
+        if (IS_ERR(m)){
+            pr_warn_ratelimited("Rejected inference model (%ld)\n", PTR_ERR(m));
+            return PTR_ERR(m);
+        }
+        m->loaded_ns = ktime_get_ns();
+    }
+
+    spin_lock(&dev->infer_lock);
+    old = rcu_replace_pointer(dev->infer, m, lockdep_is_held(&dev->infer_lock));
+    spin_unlock(&dev->infer_lock);
+    if (old){
+        kfree_rcu(old, rcu);
+    }
+
+    if (m){
+        pr_info_ratelimited("Loaded inference model %#x (%s, %u units) on device %u\n", m->id,
+                            m->type == AI_INFER_TREES ? "trees" : "mlp", m->nr_units, dev->index);
+    } else {
+        pr_info_ratelimited("Inference model removed from device %u\n", dev->index);
+    }
+    return 0;
+}
+
+static int load_infer_firmware(struct ai_device *dev, const char *name){
+    const struct firmware *fw;
+    int ret;
+
+    ret = request_firmware(&fw, name, dev->device);
+    if (ret){
+        pr_warn_ratelimited("Failed to load inference model %s (%d)\n", name, ret);
+        return ret;
+    }
+    ret = load_infer_model(dev, fw->data, fw->size);
+    release_firmware(fw);
+    return ret;
+}
+
+// AI_IOC_LOAD_INFER_MODEL: the whole blob in one call
+static long set_infer_model(struct ai_device *dev, struct ai_infer_load __user *uload){
+    struct ai_infer_load load;
+    u8 *blob;
+    int ret;
+
+    if (!capable(CAP_SYS_ADMIN)){
+        return -EPERM;
+    }
+    if (copy_from_user(&load, uload, sizeof(load))){
+        return -EFAULT;
+    }
+    if (!load.size){
+        return load_infer_model(dev, NULL, 0);
+    }
+    if (load.size > AI_INFER_MAX_SIZE){
+        return -EINVAL;
+    }
+    blob = memdup_user(u64_to_user_ptr(load.data), load.size);
+    if (IS_ERR(blob)){
+        return PTR_ERR(blob);
+    }
+    ret = load_infer_model(dev, blob, load.size);
+    kfree(blob);
+    return ret;
+}
+
+// Copy out the latest evaluation. Without the background engine the pass
+// runs here, on the caller.
+static void get_inference(struct ai_device *dev, struct ai_inference *out){
+    mutex_lock(&dev->mutex_lock);
+    if (!READ_ONCE(dev->analytics_interval_ms)){
+        run_analytics(dev);
+    }
+    *out = dev->inference;
+    mutex_unlock(&dev->mutex_lock);
+}
+
+// Returns whether it ran an analytics pass
+static bool optimize_performance(struct ai_file_ctx *ctx){
+    struct ai_device *dev = ctx->dev;
+    bool ran = false;
+    unsigned int size;
+
+    // The stream ring is already sized for throughput
+    if (READ_ONCE(ctx->channel) == AI_CHANNEL_STREAM){
+        pr_debug("Stream ring already optimized\n");
+        return false;
+    }
+
+    // Without the background engine the tuner runs here, like the analytics.
+    // Called with dev->mutex_lock held.
+    if (!READ_ONCE(dev->analytics_interval_ms)){
+        run_analytics(dev);
+        ran = true;
+    }
+
+    // Grow to the size the autotuner picked. Shrinking would drop data the
+    // caller wrote, so that is left to files opened later.
+    size = dev->buffer_size;
+    if (ctx->buffer_size < size){
+        if (resize_ctx_buffer(ctx, size)){
+            pr_err_ratelimited("Failed to resize buffer\n");
+            return ran;
+        }
+        pr_debug("Buffer size increased to %u bytes\n", ctx->buffer_size);
+    } else {
+        pr_debug("Buffer size already optimized\n");
+    }
+    return ran;
+}
+
+static int adapt_hardware(struct ai_file_ctx *ctx, struct hw_config *config){
+    struct ai_device *dev = ctx->dev;
+    int ret;
+
+    // On the stream channel the size applies to the shared ring
+    if (READ_ONCE(ctx->channel) == AI_CHANNEL_STREAM){
+        if (!config->buffer_size || config->buffer_size > stream_size_max){
+            pr_warn_ratelimited("Stream size %u outside 1..%u\n", config->buffer_size, stream_size_max);
+            return -EINVAL;
+        }
+        ret = resize_stream(dev, config->buffer_size);
+        if (ret){
+            pr_err_ratelimited("Failed to resize stream ring\n");
+            return ret;
+        }
+        pr_debug("Stream ring resized for %u bytes\n", config->buffer_size);
+        WRITE_ONCE(dev->threshold, config->threshold);
+        pr_debug("Threshold updated to %u\n", dev->threshold);
+        publish_status(dev);
+        return 0;
+    }
+
+    if (!config->buffer_size || config->buffer_size > buffer_size_max){
+        pr_warn_ratelimited("Buffer size %u outside 1..%u\n", config->buffer_size, buffer_size_max);
+        return -EINVAL;
+    }
+
+    // Adjust buffer size based on config; later opens inherit the new size
+    if (config->buffer_size != ctx->buffer_size){
+        ret = resize_ctx_buffer(ctx, config->buffer_size);
+        if (ret){
+            pr_err_ratelimited("Failed to resize buffer\n");
+            return ret;
+        }
+        pr_debug("Buffer size updated to %u bytes\n", ctx->buffer_size);
+    }
+    WRITE_ONCE(dev->buffer_size, config->buffer_size);
+    WRITE_ONCE(dev->threshold, config->threshold);
+    pr_debug("Threshold updated to %u\n", dev->threshold);
+    publish_status(dev);
+    return 0;
+}
+
+// Run up to AI_BATCH_MAX AI commands for ctx in one call. Every command is
+// checked before any runs, the device mutex is taken once for the whole
+// batch when a command needs it, and on-demand analytics run once, again
+// after an AI_OP_HW_ADAPT changed the threshold they judge against, and
+// not at all when AI_OP_PERF_OPT ran them itself. Each command is timed
+// into its own latency histogram. Returns the number of commands run.
+static long run_batch(struct ai_file_ctx *ctx, struct ai_batch __user *ubatch){
+    struct ai_device *dev = ctx->dev;
+    struct ai_batch_result results[AI_BATCH_MAX];
+    struct ai_batch batch;
+    struct ai_analytics res;
+    struct hw_config config;
+    bool on_demand = !READ_ONCE(dev->analytics_interval_ms);
+    bool locked = on_demand;
+    bool fresh = false;
+    u64 start, now;
+    unsigned int i;
+    s32 ret;
+
+    if (copy_from_user(&batch, ubatch, sizeof(batch))){
+        return -EFAULT;
+    }
+    if (!batch.nr || batch.nr > AI_BATCH_MAX || batch.flags){
+        return -EINVAL;
+    }
+    for (i = 0; i < batch.nr; i++){
+        u8 opcode = batch.cmds[i].opcode;
+
+        if (opcode != AI_OP_NOP && (opcode < AI_OP_PERF_OPT || opcode > AI_OP_HW_ADAPT)){
+            return -EINVAL;
+        }
+        if (opcode == AI_OP_PERF_OPT || opcode == AI_OP_HW_ADAPT){
+            locked = true;
+        }
+    }
+
+    if (locked){
+        mutex_lock(&dev->mutex_lock);
+    }
+    start = ktime_get_ns();
+    for (i = 0; i < batch.nr; i++){
+        const struct ai_batch_cmd *cmd = &batch.cmds[i];
 
-    switch(cmd){
-        case AI_IOC_PERF_OPT:
-            printk(KERN_INFO "AI_DRIVER: Performing performance optimization\n");
-            optimize_performance();
-            break;
-        case AI_IOC_PRED_MAINT:
-            printk(KERN_INFO "AI_DRIVER: Performing predictive maintenance\n");
-            perform_predictive_maintenance();
-            break;
-        case AI_IOC_SEC_ENHANCE:
-            printk(KERN_INFO "AI_DRIVER: Enhancing security\n");
-            enhance_security();
-            break;
-        case AI_IOC_PWR_MGMT:
-            printk(KERN_INFO "AI_DRIVER: Managing power consumption\n");
-            manage_power();
-            break;
-        case AI_IOC_HW_ADAPT:
-        {
-            struct hw_config config;
-            if (copy_from_user(&config, (struct hw_config __user *)arg, sizeof(struct hw_config))){
-                printk(KERN_WARNING "AI_DRIVER: Failed to copy hardware config from user\n");
-                ret = -EFAULT;
+        ret = 0;
+        switch (cmd->opcode){
+            case AI_OP_PERF_OPT:
+                if (optimize_performance(ctx)){
+                    fresh = true;
+                }
+                break;
+            case AI_OP_HW_ADAPT:
+                config.buffer_size = cmd->buffer_size;
+                config.threshold = cmd->threshold;
+                ret = adapt_hardware(ctx, &config);
+                if (!ret){
+                    fresh = false;
+                }
+                break;
+        }
+
+        if (on_demand && !fresh){
+            run_analytics(dev);
+            fresh = true;
+        }
+        spin_lock(&dev->analytics_lock);
+        res = dev->analytics;
+        spin_unlock(&dev->analytics_lock);
+
+        switch (cmd->opcode){
+            case AI_OP_PRED_MAINT:
+                ret = res.maintenance_due;
+                break;
+            case AI_OP_SEC_ENHANCE:
+                ret = res.anomaly_detected;
+                break;
+            case AI_OP_PWR_MGMT:
+                ret = res.low_power_mode;
+                break;
+        }
+        results[i].res = ret;
+        results[i].power_state = READ_ONCE(dev->gov.pstate);
+        results[i].predicted_usage = res.predicted_usage;
+        results[i].anomaly_score = res.anomaly_score;
+        results[i].buffer_size = READ_ONCE(ctx->buffer_size);
+
+        // The AI ops are numbered like their latency histograms
+        now = ktime_get_ns();
+        if (cmd->opcode != AI_OP_NOP){
+            account_latency(dev, cmd->opcode - AI_OP_PERF_OPT + AI_STAT_PERF_OPT, now - start);
+        }
+        start = now;
+    }
+    if (locked){
+        mutex_unlock(&dev->mutex_lock);
+    }
+
+    pr_debug("Ran a batch of %u commands\n", batch.nr);
+    if (copy_to_user(u64_to_user_ptr(batch.results), results, batch.nr * sizeof(results[0]))){
+        return -EFAULT;
+    }
+    return batch.nr;
+}
+
+// Stream channel implementation
+
+static struct ai_ring *ai_ring_alloc(unsigned int size, int node){
+    struct ai_ring *ring;
+
+    ring = kzalloc_node(sizeof(*ring), GFP_KERNEL, node);
+    if (!ring){
+        return NULL;
+    }
+    ring->size = roundup_pow_of_two(max_t(unsigned int, size, AI_STREAM_MIN_SIZE));
+    ring->data = vzalloc_node(ring->size, node);
+    if (!ring->data){
+        kfree(ring);
+        return NULL;
+    }
+    atomic_long_set(&ring->head, 0);
+    return ring;
+}
+
+static void ai_ring_free(struct ai_ring *ring){
+    if (!ring){
+        return;
+    }
+    vfree(ring->data);
+    kfree(ring);
+}
+
+static inline struct ai_rec_hdr *ring_hdr(struct ai_ring *ring, unsigned long pos){
+    return (struct ai_rec_hdr *)(ring->data + (pos & (ring->size - 1)));
+}
+
+// Largest payload a single record can carry in this ring
+static inline size_t ring_max_payload(struct ai_ring *ring){
+    return ring->size - sizeof(struct ai_rec_hdr);
+}
+
+static inline unsigned long ring_rec_size(size_t len){
+    return sizeof(struct ai_rec_hdr) + ALIGN(len, AI_REC_ALIGN);
+}
+
+static int ring_copy_from_iter(struct ai_ring *ring, unsigned long pos, struct iov_iter *from, size_t len){
+    unsigned long off = pos & (ring->size - 1);
+    size_t first = min_t(size_t, len, ring->size - off);
+
+    if (copy_from_iter(ring->data + off, first, from) != first){
+        return -EFAULT;
+    }
+    if (len > first && copy_from_iter(ring->data, len - first, from) != len - first){
+        return -EFAULT;
+    }
+    return 0;
+}
+
+static int ring_copy_to_iter(struct ai_ring *ring, unsigned long pos, struct iov_iter *to, size_t len){
+    unsigned long off = pos & (ring->size - 1);
+    size_t first = min_t(size_t, len, ring->size - off);
+
+    if (copy_to_iter(ring->data + off, first, to) != first){
+        return -EFAULT;
+    }
+    if (len > first && copy_to_iter(ring->data, len - first, to) != len - first){
+        return -EFAULT;
+    }
+    return 0;
+}
+
+static void ring_zero(struct ai_ring *ring, unsigned long pos, size_t len){
+    unsigned long off = pos & (ring->size - 1);
+    size_t first = min_t(size_t, len, ring->size - off);
+
+    memset(ring->data + off, 0, first);
+    if (len > first){
+        memset(ring->data, 0, len - first);
+    }
+}
+
+static inline bool ring_empty(struct ai_ring *ring){
+    return READ_ONCE(ring->tail) == atomic_long_read(&ring->head);
+}
+
+// Wait condition for readers; the retired ring is drained before the live one
+static bool stream_readable(struct ai_device *dev){
+    struct ai_ring *ring;
+    bool ready;
+    int idx;
+
+    idx = srcu_read_lock(&dev->stream_srcu);
+    ring = srcu_dereference(dev->stream_old, &dev->stream_srcu);
+    if (!ring || ring_empty(ring)){
+        ring = srcu_dereference(dev->stream, &dev->stream_srcu);
+    }
+    ready = smp_load_acquire(&ring_hdr(ring, READ_ONCE(ring->tail))->state) == AI_REC_READY;
+    srcu_read_unlock(&dev->stream_srcu, idx);
+    return ready;
+}
+
+// Wait condition for writers blocked on a full ring
+static bool stream_writable(struct ai_device *dev, size_t len){
+    struct ai_ring *ring;
+    bool ok;
+    int idx;
+
+    idx = srcu_read_lock(&dev->stream_srcu);
+    ring = srcu_dereference(dev->stream, &dev->stream_srcu);
+    len = min(len, ring_max_payload(ring));
+    ok = atomic_long_read(&ring->head) + ring_rec_size(len) - smp_load_acquire(&ring->tail) <= ring->size;
+    srcu_read_unlock(&dev->stream_srcu, idx);
+    return ok;
+}
+
+// Caller holds stream_read_lock
+static struct ai_ring *stream_consumer_ring(struct ai_device *dev){
+    struct ai_ring *old = rcu_dereference_protected(dev->stream_old,
+                                                    lockdep_is_held(&dev->stream_read_lock));
+
+    if (old){
+        // Producers left the retired ring before it was published here
+        if (!ring_empty(old)){
+            return old;
+        }
+        RCU_INIT_POINTER(dev->stream_old, NULL);
+        synchronize_srcu(&dev->stream_srcu);
+        ai_ring_free(old);
+    }
+    return rcu_dereference_protected(dev->stream, lockdep_is_held(&dev->stream_read_lock));
+}
+
+// Commit one record of up to the ring's largest payload from the iterator
+static ssize_t stream_write_rec(struct ai_file_ctx *ctx, struct iov_iter *from, bool nonblock, u64 *waited){
+    struct ai_device *dev = ctx->dev;
+    struct ai_ring *ring;
+    struct ai_rec_hdr *hdr;
+    unsigned long head;
+    u64 wait_start;
+    size_t len;
+    int idx, ret;
+
+    // Reserve space without any lock; retry if another producer got there first
+    for (;;){
+        idx = srcu_read_lock(&dev->stream_srcu);
+        ring = srcu_dereference(dev->stream, &dev->stream_srcu);
+        len = min(iov_iter_count(from), ring_max_payload(ring));
+        head = atomic_long_read(&ring->head);
+        if (head + ring_rec_size(len) - smp_load_acquire(&ring->tail) <= ring->size){
+            if (atomic_long_cmpxchg(&ring->head, head, head + ring_rec_size(len)) == head){
+                break;
+            }
+            srcu_read_unlock(&dev->stream_srcu, idx);
+            continue;
+        }
+        srcu_read_unlock(&dev->stream_srcu, idx);
+
+        if (nonblock){
+            return -EAGAIN;
+        }
+        wait_start = ktime_get_ns();
+        ret = wait_event_interruptible(dev->stream_writeq, stream_writable(dev, len));
+        *waited += ktime_get_ns() - wait_start;
+        if (ret){
+            return ret;
+        }
+    }
+
+    ret = ring_copy_from_iter(ring, head + sizeof(*hdr), from, len);
+
+    // Account the payload while it is still private to this producer
+    if (!ret){
+        unsigned long off = (head + sizeof(*hdr)) & (ring->size - 1);
+        size_t first = min_t(size_t, len, ring->size - off);
+
+        account_payload(ctx, ring->data + off, first, ring->data, len - first);
+    }
+
+    // Commit the record; a failed copy leaves an empty record readers skip
+    hdr = ring_hdr(ring, head);
+    hdr->len = ret ? 0 : len;
+    smp_store_release(&hdr->state, AI_REC_READY);
+    srcu_read_unlock(&dev->stream_srcu, idx);
+
+    if (wq_has_sleeper(&dev->stream_readq)){
+        wake_up_interruptible(&dev->stream_readq);
+    }
+    if (ret){
+        return ret;
+    }
+    return len;
+}
+
+// Writes larger than a record are split over several, which readers can't
+// tell apart from one. Like a pipe, a blocking write waits until all of it
+// is in, and an interrupted or non-blocking one returns what was written.
+// The time spent waiting for room is added to waited.
+static ssize_t stream_write(struct ai_file_ctx *ctx, struct iov_iter *from, bool nonblock, u64 *waited){
+    size_t done = 0;
+    ssize_t ret;
+
+    while (iov_iter_count(from)){
+        ret = stream_write_rec(ctx, from, nonblock, waited);
+        if (ret < 0){
+            return done ? done : ret;
+        }
+        done += ret;
+    }
+    return done;
+}
+
+// Copy out committed records; the time spent waiting for the first one is
+// added to waited
+static ssize_t stream_read(struct ai_file_ctx *ctx, struct iov_iter *to, bool nonblock, u64 *waited){
+    struct ai_device *dev = ctx->dev;
+    struct ai_ring *ring;
+    struct ai_rec_hdr *hdr;
+    size_t len = iov_iter_count(to);
+    size_t copied = 0;
+    u64 wait_start;
+    size_t n;
+    int ret = 0;
+
+    if (mutex_lock_interruptible(&dev->stream_read_lock)){
+        return -ERESTARTSYS;
+    }
+
+    while (copied < len){
+        ring = stream_consumer_ring(dev);
+        hdr = ring_hdr(ring, ring->tail);
+
+        if (smp_load_acquire(&hdr->state) != AI_REC_READY){
+            // Return what we have, otherwise block until a record is committed
+            if (copied){
                 break;
             }
-            printk(KERN_INFO "AI_DRIVER: Adapting hardware configurations\n");
-            adapt_hardware(&config);
+            mutex_unlock(&dev->stream_read_lock);
+            if (nonblock){
+                return -EAGAIN;
+            }
+            wait_start = ktime_get_ns();
+            ret = wait_event_interruptible(dev->stream_readq, stream_readable(dev));
+            *waited += ktime_get_ns() - wait_start;
+            if (ret){
+                return ret;
+            }
+            if (mutex_lock_interruptible(&dev->stream_read_lock)){
+                return -ERESTARTSYS;
+            }
+            continue;
+        }
+
+        n = min_t(size_t, hdr->len - ring->rec_off, len - copied);
+        if (n && ring_copy_to_iter(ring, ring->tail + sizeof(*hdr) + ring->rec_off, to, n)){
+            ret = -EFAULT;
             break;
         }
+        copied += n;
+        ring->rec_off += n;
+
+        if (ring->rec_off == hdr->len){
+            unsigned long size = ring_rec_size(hdr->len);
+
+            // Clear the whole record so stale bytes never look like a header
+            ring_zero(ring, ring->tail, size);
+            ring->rec_off = 0;
+            smp_store_release(&ring->tail, ring->tail + size);
+            if (wq_has_sleeper(&dev->stream_writeq)){
+                wake_up_interruptible(&dev->stream_writeq);
+            }
+        }
+    }
+    mutex_unlock(&dev->stream_read_lock);
+
+    if (!copied && ret){
+        return ret;
+    }
+    atomic64_add(copied, &ctx->bytes_read);
+    return copied;
+}
+
+// Swap in a new ring; readers drain the old one before moving on
+static int resize_stream(struct ai_device *dev, unsigned int size){
+    struct ai_ring *new_ring;
+    struct ai_ring *old;
+
+    new_ring = ai_ring_alloc(size, dev->node);
+    if (!new_ring){
+        return -ENOMEM;
+    }
+
+    mutex_lock(&dev->stream_read_lock);
+    old = stream_consumer_ring(dev);   // Also reaps a drained retired ring
+    if (old->size == new_ring->size){
+        mutex_unlock(&dev->stream_read_lock);
+        ai_ring_free(new_ring);
+        return 0;
+    }
+
+    // Only one retired ring at a time
+    if (rcu_access_pointer(dev->stream_old)){
+        mutex_unlock(&dev->stream_read_lock);
+        ai_ring_free(new_ring);
+        return -EBUSY;
+    }
+
+    rcu_assign_pointer(dev->stream, new_ring);
+
+    // Wait for producers still appending to the old ring
+    synchronize_srcu(&dev->stream_srcu);
+    rcu_assign_pointer(dev->stream_old, old);
+    mutex_unlock(&dev->stream_read_lock);
+
+    wake_up_interruptible(&dev->stream_writeq);
+    wake_up_interruptible(&dev->stream_readq);
+    return 0;
+}
+
+// Submission queue implementation
+
+static inline u32 queue_sq_pending(struct ai_queue *q){
+    return smp_load_acquire(&q->rings->sq_tail) - q->sq_head;
+}
+
+static inline u32 queue_cq_ready(struct ai_queue *q){
+    return READ_ONCE(q->cq_tail) - READ_ONCE(q->rings->cq_head);
+}
+
+// Run one SQE on behalf of the file that owns the queue
+static long queue_exec(struct ai_file_ctx *ctx, const struct ai_sqe *sqe){
+    struct ai_device *dev = ctx->dev;
+    void __user *ubuf = u64_to_user_ptr(sqe->addr);
+    size_t len = min_t(u32, sqe->len, INT_MAX);
+    loff_t pos = sqe->off;
+    struct iov_iter iter;
+    struct iovec iov;
+    struct hw_config config;
+    struct ai_analytics res;
+    u64 start, waited = 0;
+    long ret = 0;
+
+    // Data ops never block the worker; a full or empty stream completes with -EAGAIN
+    switch (sqe->opcode){
+        case AI_OP_NOP:
+            return 0;
+        case AI_OP_WRITE:
+            start = ktime_get_ns();
+            ret = import_single_range(WRITE, ubuf, len, &iov, &iter);
+            if (ret){
+                return ret;
+            }
+            if (READ_ONCE(ctx->channel) == AI_CHANNEL_STREAM){
+                ret = stream_write(ctx, &iter, true, &waited);
+            } else {
+                ret = buffer_write(ctx, &iter, &pos);
+            }
+            if (ret >= 0){
+                account_io(dev, AI_STAT_WRITE, ret, ktime_get_ns() - start);
+            }
+            return ret;
+        case AI_OP_READ:
+            start = ktime_get_ns();
+            ret = import_single_range(READ, ubuf, len, &iov, &iter);
+            if (ret){
+                return ret;
+            }
+            if (READ_ONCE(ctx->channel) == AI_CHANNEL_STREAM){
+                ret = stream_read(ctx, &iter, true, &waited);
+            } else {
+                ret = buffer_read(ctx, &iter, &pos);
+            }
+            if (ret >= 0){
+                account_io(dev, AI_STAT_READ, ret, ktime_get_ns() - start);
+            }
+            return ret;
+    }
+
+    // Analytics ops complete with the cached verdict (0 or 1)
+    switch (sqe->opcode){
+        case AI_OP_PRED_MAINT:
+            get_analytics(dev, &res);
+            return res.maintenance_due;
+        case AI_OP_SEC_ENHANCE:
+            get_analytics(dev, &res);
+            return res.anomaly_detected;
+        case AI_OP_PWR_MGMT:
+            get_analytics(dev, &res);
+            return res.low_power_mode;
+    }
+
+    // Configuration commands take the device mutex, exactly like their ioctls
+    mutex_lock(&dev->mutex_lock);
+    switch (sqe->opcode){
+        case AI_OP_PERF_OPT:
+            optimize_performance(ctx);
+            break;
+        case AI_OP_HW_ADAPT:
+            config.buffer_size = sqe->buffer_size;
+            config.threshold = sqe->threshold;
+            ret = adapt_hardware(ctx, &config);
+            break;
         default:
-            printk(KERN_WARNING "AI_DRIVER: Unknown IOCTL command %u\n", cmd);
             ret = -EINVAL;
     }
-
-    mutex_unlock(&ai_dev.mutex_lock);
+    mutex_unlock(&dev->mutex_lock);
     return ret;
 }
 
-// Release function
-static int dev_release(struct inode *inodep, struct file *filep){
-    mutex_unlock(&ai_dev.mutex_lock);
-    printk(KERN_INFO "AI_DRIVER: Device successfully closed\n");
+// Consume up to one batch of SQEs and publish their completions.
+// When the CQ is full the worker stops until user space reaps completions
+// and rings the doorbell again. Only the indices user space owns are read
+// from the rings; sq_head and cq_tail come from the worker's own copies, so
+// rewriting them in the mapping can't make it replay or skip entries.
+static unsigned int queue_drain(struct ai_file_ctx *ctx, struct ai_queue *q){
+    struct ai_queue_rings *rings = q->rings;
+    u32 head = q->sq_head;
+    u32 tail = smp_load_acquire(&rings->sq_tail);
+    u32 cq_tail = q->cq_tail;
+    unsigned int batch = READ_ONCE(ctx->dev->queue_batch) *
+                         ai_pstates[READ_ONCE(ctx->dev->gov.pstate)].queue_batch_mult;
+    unsigned int done = 0;
+    bool have_mm;
+
+    if (head == tail){
+        return 0;
+    }
+    // A tail further ahead than the ring is big is not believed
+    if (tail - head > q->sq_entries){
+        tail = head + q->sq_entries;
+    }
+
+    // SQE buffers live in the submitter's address space
+    have_mm = mmget_not_zero(q->mm);
+    if (have_mm){
+        kthread_use_mm(q->mm);
+    }
+
+    while (head != tail && done < batch){
+        struct ai_sqe sqe;
+        struct ai_cqe *cqe;
+
+        if (cq_tail - smp_load_acquire(&rings->cq_head) >= q->cq_entries){
+            break;
+        }
+
+        // Snapshot the entry; user space may rewrite the slot at any time
+        memcpy(&sqe, &q->sqes[head & (q->sq_entries - 1)], sizeof(sqe));
+        q->submitter = READ_ONCE(q->tgid);
+
+        cqe = &q->cqes[cq_tail & (q->cq_entries - 1)];
+        cqe->user_data = sqe.user_data;
+        cqe->res = have_mm ? queue_exec(ctx, &sqe) : -EFAULT;
+        cqe->flags = 0;
+
+        cq_tail++;
+        head++;
+        done++;
+    }
+
+    q->sq_head = head;
+    WRITE_ONCE(q->cq_tail, cq_tail);
+    smp_store_release(&rings->cq_tail, cq_tail);
+    smp_store_release(&rings->sq_head, head);
+
+    if (have_mm){
+        kthread_unuse_mm(q->mm);
+        mmput(q->mm);
+    }
+
+    if (done){
+        account_queue(ctx->dev, done, done == batch && head != tail);
+    }
+    if (done && wq_has_sleeper(&q->cq_wait)){
+        wake_up_interruptible(&q->cq_wait);
+    }
+    return done;
+}
+
+static int queue_worker(void *data){
+    struct ai_file_ctx *ctx = data;
+    struct ai_queue *q = ctx->queue;
+    unsigned long idle_end = jiffies + msecs_to_jiffies(q->idle_ms);
+
+    while (!kthread_should_stop()){
+        if (queue_drain(ctx, q)){
+            idle_end = jiffies + msecs_to_jiffies(q->idle_ms);
+            cond_resched();
+            continue;
+        }
+
+        // A polling worker keeps checking the SQ for a while after the last
+        // submission, unless the device is in low power
+        if (q->sqpoll && ai_pstates[READ_ONCE(ctx->dev->gov.pstate)].queue_spin &&
+            time_before(jiffies, idle_end)){
+            cond_resched();
+            continue;
+        }
+
+        if (q->sqpoll){
+            WRITE_ONCE(q->rings->sq_flags, READ_ONCE(q->rings->sq_flags) | AI_SQ_NEED_WAKEUP);
+            // Pairs with user space reading sq_flags after publishing sq_tail
+            smp_mb();
+        }
+        wait_event_interruptible(q->worker_wait,
+                                 atomic_xchg(&q->doorbell, 0) || kthread_should_stop() ||
+                                 (q->sqpoll && queue_sq_pending(q)));
+        if (q->sqpoll){
+            WRITE_ONCE(q->rings->sq_flags, READ_ONCE(q->rings->sq_flags) & ~AI_SQ_NEED_WAKEUP);
+        }
+        idle_end = jiffies + msecs_to_jiffies(q->idle_ms);
+    }
     return 0;
 }
 
-// Helper function implementations
+static long queue_setup(struct ai_file_ctx *ctx, struct ai_queue_params __user *uparams){
+    struct ai_queue_params params;
+    struct ai_queue *q;
+    size_t sqes_off, cqes_off;
+
+    if (copy_from_user(&params, uparams, sizeof(params))){
+        return -EFAULT;
+    }
+    if (!params.sq_entries || params.sq_entries > AI_QUEUE_MAX_ENTRIES || (params.flags & ~AI_QUEUE_SQPOLL)){
+        return -EINVAL;
+    }
+    params.sq_entries = roundup_pow_of_two(params.sq_entries);
+    if (!params.cq_entries){
+        params.cq_entries = 2 * params.sq_entries;
+    }
+    if (params.cq_entries < params.sq_entries || params.cq_entries > 2 * AI_QUEUE_MAX_ENTRIES){
+        return -EINVAL;
+    }
+    params.cq_entries = roundup_pow_of_two(params.cq_entries);
 
-static void perform_predictive_maintenance(void){
-    // Simple predictive maintenance using linear regression (simulated)
-    unsigned int predicted_usage = ai_dev.usage_count + (ai_dev.usage_count / 10); // Predicting 10% increase
-    printk(KERN_INFO "AI_DRIVER: Predicted future usage: %u\n", predicted_usage);
+    q = kzalloc(sizeof(*q), GFP_KERNEL);
+    if (!q){
+        return -ENOMEM;
+    }
 
-    if (predicted_usage > ai_dev.threshold){
-        printk(KERN_WARNING "AI_DRIVER: Maintenance required soon. Predicted usage exceeds threshold.\n");
-        // Take preemptive actions or notify user space
-    } else {
-        printk(KERN_INFO "AI_DRIVER: System operating within normal parameters.\n");
+    // Layout: ring indices, then SQEs, then CQEs, each cache-line aligned
+    sqes_off = ALIGN(sizeof(struct ai_queue_rings), SMP_CACHE_BYTES);
+    cqes_off = ALIGN(sqes_off + params.sq_entries * sizeof(struct ai_sqe), SMP_CACHE_BYTES);
+    q->region_size = PAGE_ALIGN(cqes_off + params.cq_entries * sizeof(struct ai_cqe));
+    q->rings = vmalloc_user(q->region_size);
+    if (!q->rings){
+        kfree(q);
+        return -ENOMEM;
+    }
+    q->sqes = (struct ai_sqe *)((char *)q->rings + sqes_off);
+    q->cqes = (struct ai_cqe *)((char *)q->rings + cqes_off);
+    q->sq_entries = params.sq_entries;
+    q->cq_entries = params.cq_entries;
+    q->sqpoll = params.flags & AI_QUEUE_SQPOLL;
+    q->idle_ms = params.sq_idle_ms ? min_t(u32, params.sq_idle_ms, 1000) : AI_QUEUE_DEFAULT_IDLE;
+    init_waitqueue_head(&q->worker_wait);
+    init_waitqueue_head(&q->cq_wait);
+    atomic_set(&q->doorbell, 0);
+
+    mutex_lock(&ctx->lock);
+    if (ctx->queue){
+        mutex_unlock(&ctx->lock);
+        vfree(q->rings);
+        kfree(q);
+        return -EBUSY;
     }
+    q->worker = kthread_create(queue_worker, ctx, "ai_queue/%d", task_pid_nr(current));
+    if (IS_ERR(q->worker)){
+        long ret = PTR_ERR(q->worker);
+
+        mutex_unlock(&ctx->lock);
+        vfree(q->rings);
+        kfree(q);
+        return ret;
+    }
+    q->mm = current->mm;
+    mmgrab(q->mm);
+    q->tgid = task_tgid_nr(current);
+    smp_store_release(&ctx->queue, q);
+    mutex_unlock(&ctx->lock);
+    wake_up_process(q->worker);
+
+    params.region_size = q->region_size;
+    params.sq_head_off = offsetof(struct ai_queue_rings, sq_head);
+    params.sq_tail_off = offsetof(struct ai_queue_rings, sq_tail);
+    params.sq_flags_off = offsetof(struct ai_queue_rings, sq_flags);
+    params.sqes_off = sqes_off;
+    params.cq_head_off = offsetof(struct ai_queue_rings, cq_head);
+    params.cq_tail_off = offsetof(struct ai_queue_rings, cq_tail);
+    params.cqes_off = cqes_off;
+    if (copy_to_user(uparams, &params, sizeof(params))){
+        return -EFAULT;
+    }
+
+    pr_debug("Submission queue ready (%u SQ / %u CQ entries%s)\n",
+             q->sq_entries, q->cq_entries, q->sqpoll ? ", polling" : "");
+    return 0;
 }
 
-static void enhance_security(void){
-    // Simple anomaly detection using threshold (simulated)
-    ai_dev.anomaly_score = ai_dev.error_count * ai_dev.sensor_data;
+// Doorbell: wake the worker once for everything queued so far. SQE buffers
+// are resolved in the address space that set up the queue, so a task in
+// another one (e.g. after the fd was passed over a socket) is refused.
+static long queue_enter(struct ai_file_ctx *ctx, struct ai_queue_enter __user *uenter){
+    struct ai_queue *q = smp_load_acquire(&ctx->queue);
+    struct ai_queue_enter enter;
+    u32 min_complete;
 
-    printk(KERN_INFO "AI_DRIVER: Calculated anomaly score: %u\n", ai_dev.anomaly_score);
+    if (!q){
+        return -EINVAL;
+    }
+    if (current->mm != q->mm){
+        return -EPERM;
+    }
+    if (copy_from_user(&enter, uenter, sizeof(enter))){
+        return -EFAULT;
+    }
 
-    if (ai_dev.anomaly_score > 5000){ // Arbitrary threshold
-        printk(KERN_WARNING "AI_DRIVER: Anomaly detected! Potential security threat.\n");
-        // Take security measures or alert system
-    } else {
-        printk(KERN_INFO "AI_DRIVER: No anomalies detected.\n");
+    WRITE_ONCE(q->tgid, task_tgid_nr(current));
+    atomic_set(&q->doorbell, 1);
+    wake_up_interruptible(&q->worker_wait);
+
+    if (!enter.min_complete){
+        return 0;
     }
+    min_complete = min(enter.min_complete, q->cq_entries);
+    return wait_event_interruptible(q->cq_wait, queue_cq_ready(q) >= min_complete);
 }
 
-static void manage_power(void){
-    // Simple power management based on usage count
-    if (ai_dev.usage_count < (ai_dev.threshold / 2) && !ai_dev.low_power_mode){
-        ai_dev.low_power_mode = true;
-        printk(KERN_INFO "AI_DRIVER: Switching to low power mode.\n");
-        // Implement low power mode operations
-    } else if (ai_dev.usage_count >= (ai_dev.threshold / 2) && ai_dev.low_power_mode){
-        ai_dev.low_power_mode = false;
-        printk(KERN_INFO "AI_DRIVER: Exiting low power mode.\n");
-        // Resume normal operations
-    } else {
-        printk(KERN_INFO "AI_DRIVER: Power mode unchanged.\n");
+static void queue_destroy(struct ai_queue *q){
+    kthread_stop(q->worker);
+    mmdrop(q->mm);
+    vfree(q->rings);
+    kfree(q);
+}
+
+// Event notification implementation
+
+static void emit_event(struct ai_device *dev, u32 type, u64 value, u64 threshold){
+    struct ai_file_ctx *ctx;
+    struct ai_event *ev;
+
+    spin_lock(&dev->event_lock);
+    ev = &dev->events[dev->event_seq % AI_EVENT_LOG_SIZE];
+    ev->seq = dev->event_seq++;
+    ev->timestamp_ns = ktime_get_ns();
+    ev->type = type;
+    ev->reserved = 0;
+    ev->value = value;
+    ev->threshold = threshold;
+
+    list_for_each_entry(ctx, &dev->eventfd_list, eventfd_node){
+        eventfd_signal(ctx->eventfd, 1);
     }
+    spin_unlock(&dev->event_lock);
+
+    wake_up_interruptible(&dev->event_wq);
 }
 
-static void optimize_performance(void){
-    // Simple performance optimization by adjusting buffer size
-    if (ai_dev.buffer_size < 2048){
-        char *new_buffer = krealloc(ai_dev.buffer, 2048, GFP_KERNEL);
-        if (!new_buffer){
-            printk(KERN_ERR "AI_DRIVER: Failed to reallocate buffer\n");
-            return;
+static bool events_pending(struct ai_file_ctx *ctx){
+    struct ai_device *dev = ctx->dev;
+    bool pending;
+
+    spin_lock(&dev->event_lock);
+    pending = ctx->event_cursor < dev->event_seq;
+    spin_unlock(&dev->event_lock);
+    return pending;
+}
+
+// Returns whole struct ai_event records; blocks until at least one is available
+static ssize_t event_read(struct ai_file_ctx *ctx, struct iov_iter *to, bool nonblock){
+    struct ai_device *dev = ctx->dev;
+    struct ai_event batch[8];
+    size_t max = min_t(size_t, iov_iter_count(to) / sizeof(struct ai_event), ARRAY_SIZE(batch));
+    size_t count = 0;
+    int ret;
+
+    if (!max){
+        return -EINVAL;
+    }
+
+    for (;;){
+        spin_lock(&dev->event_lock);
+
+        // Skip events that have already been overwritten
+        if (dev->event_seq - ctx->event_cursor > AI_EVENT_LOG_SIZE){
+            ctx->event_cursor = dev->event_seq - AI_EVENT_LOG_SIZE;
         }
-        ai_dev.buffer = new_buffer;
-        ai_dev.buffer_size = 2048;
-        printk(KERN_INFO "AI_DRIVER: Buffer size increased to %u bytes\n", ai_dev.buffer_size);
-    } else {
-        printk(KERN_INFO "AI_DRIVER: Buffer size already optimized\n");
+        while (count < max && ctx->event_cursor < dev->event_seq){
+            batch[count++] = dev->events[ctx->event_cursor % AI_EVENT_LOG_SIZE];
+            ctx->event_cursor++;
+        }
+        spin_unlock(&dev->event_lock);
+
+        if (count){
+            break;
+        }
+        if (nonblock){
+            return -EAGAIN;
+        }
+        ret = wait_event_interruptible(dev->event_wq, events_pending(ctx));
+        if (ret){
+            return ret;
+        }
+    }
+
+    if (copy_to_iter(batch, count * sizeof(struct ai_event), to) != count * sizeof(struct ai_event)){
+        return -EFAULT;
     }
+    return count * sizeof(struct ai_event);
 }
 
-static void adapt_hardware(struct hw_config *config){
-    // Adjust buffer size based on config
-    if (config->buffer_size != ai_dev.buffer_size){
-        char *new_buffer = krealloc(ai_dev.buffer, config->buffer_size, GFP_KERNEL);
-        if (!new_buffer){
-            printk(KERN_ERR "AI_DRIVER: Failed to reallocate buffer\n");
-            return;
+// Register an eventfd signalled on every event; a negative fd unregisters
+static long set_eventfd(struct ai_file_ctx *ctx, int fd){
+    struct ai_device *dev = ctx->dev;
+    struct eventfd_ctx *new_efd = NULL;
+    struct eventfd_ctx *old_efd;
+
+    if (fd >= 0){
+        new_efd = eventfd_ctx_fdget(fd);
+        if (IS_ERR(new_efd)){
+            return PTR_ERR(new_efd);
         }
-        ai_dev.buffer = new_buffer;
-        ai_dev.buffer_size = config->buffer_size;
-        printk(KERN_INFO "AI_DRIVER: Buffer size updated to %u bytes\n", ai_dev.buffer_size);
     }
-    ai_dev.threshold = config->threshold;
-    printk(KERN_INFO "AI_DRIVER: Threshold updated to %u\n", ai_dev.threshold);
+
+    spin_lock(&dev->event_lock);
+    old_efd = ctx->eventfd;
+    ctx->eventfd = new_efd;
+    if (new_efd && !old_efd){
+        list_add_tail(&ctx->eventfd_node, &dev->eventfd_list);
+    } else if (!new_efd && old_efd){
+        list_del_init(&ctx->eventfd_node);
+    }
+    spin_unlock(&dev->event_lock);
+
+    if (old_efd){
+        eventfd_ctx_put(old_efd);
+    }
+    return 0;
 }
 
 module_init(ai_driver_init);
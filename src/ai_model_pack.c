@@ -0,0 +1,252 @@
+// ai_model_pack.c
+//
+// Packs an inference model for the AI kernel driver from a text
+// description into the binary blob that AI_IOC_LOAD_INFER_MODEL, the
+// infer_model module parameter and the infer_model sysfs attribute take.
+//
+//   gcc -Wall -O2 -o ai_model_pack ai_model_pack.c
+//   ./ai_model_pack model.txt /lib/firmware/ai_model.bin
+//
+// The description is a list of lines, '#' starts a comment:
+//
+//   type trees | mlp
+//   id <n>                        reported back by AI_IOC_GET_INFERENCE
+//   inputs <n>                    first n driver inputs (AI_IN_*) used
+//   outputs <n>                   AI_OUT_MAINTENANCE, AI_OUT_ANOMALY, ...
+//
+// Tree ensembles (int16). Nodes are numbered in the order they appear and
+// children must come after their parent:
+//
+//   tree <root node>
+//   split <input> <threshold> <left> <right>    left when input < threshold
+//   leaf <output> <value>                       value added to output
+//
+// MLPs with one ReLU hidden layer (int8 weights, int32 biases):
+//
+//   hidden <n>
+//   shift <hidden shift> <output shift>
+//   w1 <inputs values>            one line per hidden unit
+//   b1 <hidden values>
+//   w2 <hidden values>            one line per output
+//   b2 <outputs values>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#define AI_INFER_MAGIC      0x4c444d41
+#define AI_INFER_VERSION    1
+#define AI_INFER_TREES      1
+#define AI_INFER_MLP        2
+#define AI_INFER_INPUTS     8
+#define AI_INFER_OUTPUTS    4
+#define AI_INFER_MAX_TREES  64
+#define AI_INFER_MAX_NODES  4096
+#define AI_INFER_MAX_HIDDEN 64
+#define HDR_SIZE            32
+
+static unsigned int type, id, nr_inputs, nr_outputs, nr_hidden, shift[2];
+static unsigned int nr_roots, nr_nodes, nr_w1, nr_w2, nr_b1, nr_b2;
+static uint16_t roots[AI_INFER_MAX_TREES];
+static uint8_t nodes[AI_INFER_MAX_NODES][8];
+static int8_t w1[AI_INFER_MAX_HIDDEN * AI_INFER_INPUTS];
+static int8_t w2[AI_INFER_OUTPUTS * AI_INFER_MAX_HIDDEN];
+static int32_t b1[AI_INFER_MAX_HIDDEN];
+static int32_t b2[AI_INFER_OUTPUTS];
+
+static unsigned char blob[HDR_SIZE + 2 * AI_INFER_MAX_TREES + 8 * AI_INFER_MAX_NODES];
+static size_t blob_len;
+
+static void die(int line, const char *msg){
+    fprintf(stderr, "ai_model_pack: line %d: %s\n", line, msg);
+    exit(1);
+}
+
+static void put16(unsigned char *p, uint16_t v){
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void put32(unsigned char *p, uint32_t v){
+    put16(p, v);
+    put16(p + 2, v >> 16);
+}
+
+static void emit(const void *p, size_t len){
+    memcpy(blob + blob_len, p, len);
+    blob_len += len;
+}
+
+static void emit32(uint32_t v){
+    put32(blob + blob_len, v);
+    blob_len += 4;
+}
+
+// Reflected CRC-32 as zlib computes it
+static uint32_t crc32(const unsigned char *p, size_t len){
+    uint32_t crc = ~0U;
+    int i;
+
+    while (len--){
+        crc ^= *p++;
+        for (i = 0; i < 8; i++){
+            crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+// Parse up to max integers after the keyword into out; returns the count
+static unsigned int parse_ints(char *s, long *out, unsigned int max){
+    unsigned int n = 0;
+    char *tok;
+
+    while ((tok = strtok(s, " \t\r\n")) && n < max){
+        out[n++] = strtol(tok, NULL, 0);
+        s = NULL;
+    }
+    return n;
+}
+
+static void parse_line(char *line, int lineno){
+    long v[AI_INFER_MAX_HIDDEN];
+    char *key, *rest;
+    unsigned int n, i;
+
+    if ((rest = strchr(line, '#'))){
+        *rest = '\0';
+    }
+    key = strtok(line, " \t\r\n");
+    if (!key){
+        return;
+    }
+    rest = strtok(NULL, "");
+    n = rest ? parse_ints(rest, v, AI_INFER_MAX_HIDDEN) : 0;
+
+    if (!strcmp(key, "type")){
+        type = rest && strstr(rest, "mlp") ? AI_INFER_MLP : rest && strstr(rest, "trees") ? AI_INFER_TREES : 0;
+        if (!type){
+            die(lineno, "type must be trees or mlp");
+        }
+    } else if (!strcmp(key, "id") && n == 1){
+        id = v[0];
+    } else if (!strcmp(key, "inputs") && n == 1 && v[0] >= 1 && v[0] <= AI_INFER_INPUTS){
+        nr_inputs = v[0];
+    } else if (!strcmp(key, "outputs") && n == 1 && v[0] >= 1 && v[0] <= AI_INFER_OUTPUTS){
+        nr_outputs = v[0];
+    } else if (!strcmp(key, "tree") && n == 1 && nr_roots < AI_INFER_MAX_TREES){
+        roots[nr_roots++] = v[0];
+    } else if (!strcmp(key, "split") && n == 4 && nr_nodes < AI_INFER_MAX_NODES){
+        nodes[nr_nodes][0] = v[0];
+        nodes[nr_nodes][1] = 0;
+        put16(nodes[nr_nodes] + 2, v[1]);
+        put16(nodes[nr_nodes] + 4, v[2]);
+        put16(nodes[nr_nodes] + 6, v[3]);
+        nr_nodes++;
+    } else if (!strcmp(key, "leaf") && n == 2 && nr_nodes < AI_INFER_MAX_NODES){
+        memset(nodes[nr_nodes], 0, 8);
+        nodes[nr_nodes][0] = v[0];
+        nodes[nr_nodes][1] = 1;
+        put16(nodes[nr_nodes] + 2, v[1]);
+        nr_nodes++;
+    } else if (!strcmp(key, "hidden") && n == 1 && v[0] >= 1 && v[0] <= AI_INFER_MAX_HIDDEN){
+        nr_hidden = v[0];
+    } else if (!strcmp(key, "shift") && n == 2){
+        shift[0] = v[0];
+        shift[1] = v[1];
+    } else if (!strcmp(key, "w1") && nr_inputs && n == nr_inputs && nr_w1 + n <= sizeof(w1)){
+        for (i = 0; i < n; i++){
+            w1[nr_w1++] = v[i];
+        }
+    } else if (!strcmp(key, "w2") && nr_hidden && n == nr_hidden && nr_w2 + n <= sizeof(w2)){
+        for (i = 0; i < n; i++){
+            w2[nr_w2++] = v[i];
+        }
+    } else if (!strcmp(key, "b1") && n == nr_hidden){
+        for (i = 0; i < n; i++){
+            b1[i] = v[i];
+        }
+        nr_b1 = n;
+    } else if (!strcmp(key, "b2") && n == nr_outputs){
+        for (i = 0; i < n; i++){
+            b2[i] = v[i];
+        }
+        nr_b2 = n;
+    } else {
+        die(lineno, "unknown keyword, wrong number of values or too many entries");
+    }
+}
+
+int main(int argc, char **argv){
+    char line[4096];
+    unsigned char *hdr = blob;
+    unsigned int i;
+    int lineno = 0;
+    FILE *in, *out;
+
+    if (argc != 3){
+        fprintf(stderr, "Usage: %s model.txt model.bin\n", argv[0]);
+        return 1;
+    }
+    in = fopen(argv[1], "r");
+    if (!in){
+        perror(argv[1]);
+        return 1;
+    }
+    while (fgets(line, sizeof(line), in)){
+        parse_line(line, ++lineno);
+    }
+    fclose(in);
+
+    if (!type || !nr_inputs || !nr_outputs){
+        die(lineno, "type, inputs and outputs are required");
+    }
+    blob_len = HDR_SIZE;
+    if (type == AI_INFER_TREES){
+        if (!nr_roots || !nr_nodes){
+            die(lineno, "a tree model needs tree and node lines");
+        }
+        for (i = 0; i < nr_roots; i++){
+            put16(blob + blob_len, roots[i]);
+            blob_len += 2;
+        }
+        emit(nodes, nr_nodes * 8);
+    } else {
+        if (!nr_hidden || nr_w1 != nr_hidden * nr_inputs || nr_w2 != nr_outputs * nr_hidden ||
+            nr_b1 != nr_hidden || nr_b2 != nr_outputs){
+            die(lineno, "an mlp needs hidden, w1 per unit, b1, w2 per output and b2");
+        }
+        emit(w1, nr_w1);
+        for (i = 0; i < nr_hidden; i++){
+            emit32(b1[i]);
+        }
+        emit(w2, nr_w2);
+        for (i = 0; i < nr_outputs; i++){
+            emit32(b2[i]);
+        }
+    }
+
+    // struct ai_infer_hdr, little-endian
+    put32(hdr + 0, AI_INFER_MAGIC);
+    put16(hdr + 4, AI_INFER_VERSION);
+    put16(hdr + 6, type);
+    put32(hdr + 8, blob_len);
+    put32(hdr + 12, 0);
+    put32(hdr + 16, id);
+    put16(hdr + 20, nr_inputs);
+    put16(hdr + 22, nr_outputs);
+    put16(hdr + 24, type == AI_INFER_TREES ? nr_roots : nr_hidden);
+    put16(hdr + 26, type == AI_INFER_TREES ? nr_nodes : 0);
+    hdr[28] = shift[0];
+    hdr[29] = shift[1];
+    put32(hdr + 12, crc32(blob, blob_len));
+
+    out = fopen(argv[2], "wb");
+    if (!out || fwrite(blob, 1, blob_len, out) != blob_len || fclose(out)){
+        perror(argv[2]);
+        return 1;
+    }
+    printf("%s: %s model, %zu bytes\n", argv[2], type == AI_INFER_TREES ? "trees" : "mlp", blob_len);
+    return 0;
+}
@@ -0,0 +1,1593 @@
+// ai_torture.c
+//
+// Concurrency torture test for the AI kernel driver. Several processes,
+// each with several threads, hammer the device nodes for a fixed time with
+// a random mix of open/close, read/write (plain, positioned, vectored and
+// spliced), lseek, every ioctl with valid and hostile arguments, buffer
+// resizes racing with I/O and mappings, channel switches, submission queues,
+// the status and history mappings and, optionally, sysfs writes.
+//
+// Every return value is checked: a transfer may not exceed its request, no
+// kernel-internal error code may leak out and valid pointers may not fault.
+// Each thread also keeps one private file whose contents it verifies after
+// every write. At the end the kernel log is scanned for lockdep, KASAN and
+// other splats. The exit status is non-zero on any failure or splat, so a
+// run under a debug kernel is a regression gate; see tests/README.md.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <getopt.h>
+#include <poll.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <sys/eventfd.h>
+
+// Define IOCTL commands, as in src/ai_kernel_driver.c
+#define AI_IOC_MAGIC 'a'
+#define AI_IOC_PERF_OPT _IO(AI_IOC_MAGIC, 1)
+#define AI_IOC_PRED_MAINT _IO(AI_IOC_MAGIC, 2)
+#define AI_IOC_SEC_ENHANCE _IO(AI_IOC_MAGIC, 3)
+#define AI_IOC_PWR_MGMT _IO(AI_IOC_MAGIC, 4)
+#define AI_IOC_HW_ADAPT _IOW(AI_IOC_MAGIC, 5, struct hw_config)
+#define AI_IOC_COMMIT _IOW(AI_IOC_MAGIC, 6, struct ai_range)
+#define AI_IOC_SET_CHANNEL _IO(AI_IOC_MAGIC, 7)
+#define AI_IOC_SETUP_QUEUE _IOWR(AI_IOC_MAGIC, 8, struct ai_queue_params)
+#define AI_IOC_QUEUE_ENTER _IOW(AI_IOC_MAGIC, 9, struct ai_queue_enter)
+#define AI_IOC_SET_EVENTFD _IO(AI_IOC_MAGIC, 10)
+#define AI_IOC_GET_ANALYTICS _IOR(AI_IOC_MAGIC, 11, char[72])
+#define AI_IOC_GET_MODEL _IOR(AI_IOC_MAGIC, 12, char[96])
+#define AI_IOC_GET_ANOMALIES _IOWR(AI_IOC_MAGIC, 13, struct ai_anomaly_query)
+#define AI_IOC_GET_FEATURES _IOR(AI_IOC_MAGIC, 14, char[2144])
+#define AI_IOC_GET_LIMITS _IOR(AI_IOC_MAGIC, 15, char[24])
+#define AI_IOC_GET_STATS _IOWR(AI_IOC_MAGIC, 16, char[AI_STATS_SIZE])
+#define AI_IOC_GET_TUNER _IOR(AI_IOC_MAGIC, 17, char[96])
+#define AI_IOC_GET_POWER _IOR(AI_IOC_MAGIC, 18, char[144])
+#define AI_IOC_LOAD_INFER_MODEL _IOW(AI_IOC_MAGIC, 19, struct ai_infer_load)
+#define AI_IOC_GET_INFERENCE _IOR(AI_IOC_MAGIC, 20, char[72])
+#define AI_IOC_BATCH _IOW(AI_IOC_MAGIC, 21, struct ai_batch)
+#define AI_IOC_GET_HISTORY _IOWR(AI_IOC_MAGIC, 22, struct ai_history_query)
+#define AI_IOC_GET_STATUS _IOR(AI_IOC_MAGIC, 23, struct ai_status)
+
+// Offsets of the mappable regions
+#define AI_MMAP_OFF_BUFFER 0
+#define AI_MMAP_OFF_QUEUE 0x100000000ULL
+#define AI_MMAP_OFF_HISTORY 0x200000000ULL
+#define AI_MMAP_OFF_STATUS 0x300000000ULL
+
+#define AI_CHANNEL_BUFFER 0
+#define AI_CHANNEL_STREAM 1
+#define AI_CHANNEL_EVENTS 2
+
+#define AI_OP_NOP 0
+#define AI_OP_WRITE 1
+#define AI_OP_READ 2
+#define AI_OP_HW_ADAPT 7
+#define AI_QUEUE_SQPOLL (1U << 0)
+#define AI_QUEUE_MAX_ENTRIES 4096
+#define AI_BATCH_MAX 8
+#define AI_STATS_SIZE 2088
+#define AI_HISTORY_LEVELS 3
+#define AI_HISTORY_VERSION 1
+#define AI_STATUS_VERSION 1
+
+// Structure for hardware configuration parameters
+struct hw_config {
+    unsigned int buffer_size;
+    unsigned int threshold;
+};
+
+struct ai_range {
+    unsigned long long offset;
+    unsigned long long length;
+};
+
+struct ai_sqe {
+    uint8_t opcode;
+    uint8_t flags;
+    uint16_t reserved;
+    uint32_t len;
+    uint64_t off;
+    uint64_t addr;
+    uint64_t user_data;
+    uint32_t buffer_size;
+    uint32_t threshold;
+};
+
+struct ai_cqe {
+    uint64_t user_data;
+    int32_t res;
+    uint32_t flags;
+};
+
+struct ai_queue_params {
+    uint32_t sq_entries;
+    uint32_t cq_entries;
+    uint32_t flags;
+    uint32_t sq_idle_ms;
+    uint32_t region_size;
+    uint32_t sq_head_off;
+    uint32_t sq_tail_off;
+    uint32_t sq_flags_off;
+    uint32_t sqes_off;
+    uint32_t cq_head_off;
+    uint32_t cq_tail_off;
+    uint32_t cqes_off;
+};
+
+struct ai_queue_enter {
+    uint32_t min_complete;
+    uint32_t flags;
+};
+
+// Records are 56 bytes; only the query itself is looked at
+struct ai_anomaly_query {
+    uint64_t seq;
+    uint64_t records;
+    uint32_t count;
+    uint32_t threshold;
+    uint64_t total;
+};
+#define AI_ANOMALY_SIZE 56
+
+struct ai_infer_load {
+    uint64_t data;
+    uint32_t size;
+    uint32_t reserved;
+};
+
+struct ai_batch_cmd {
+    uint8_t opcode;
+    uint8_t reserved[3];
+    uint32_t buffer_size;
+    uint32_t threshold;
+    uint32_t reserved2;
+};
+
+struct ai_batch_result {
+    int32_t res;
+    uint32_t power_state;
+    uint64_t predicted_usage;
+    uint32_t anomaly_score;
+    uint32_t buffer_size;
+};
+
+struct ai_batch {
+    uint32_t nr;
+    uint32_t flags;
+    uint64_t results;
+    struct ai_batch_cmd cmds[AI_BATCH_MAX];
+};
+
+struct ai_history_level {
+    uint32_t period_s;
+    uint32_t nr_entries;
+    uint32_t offset;
+    uint32_t reserved;
+    uint64_t newest_slot;
+    uint64_t usage_count;
+    uint64_t error_count;
+};
+
+struct ai_history_header {
+    uint32_t seq;
+    uint32_t version;
+    uint32_t nr_levels;
+    uint32_t sample_size;
+    struct ai_history_level levels[AI_HISTORY_LEVELS];
+};
+#define AI_HISTORY_SAMPLE_SIZE 24
+
+struct ai_history_query {
+    uint32_t level;
+    uint32_t nr_samples;
+    uint64_t samples;
+    struct ai_history_level info;
+};
+
+struct ai_status {
+    uint32_t seq;
+    uint32_t version;
+    uint64_t timestamp_ns;
+    uint64_t analytics_runs;
+    uint64_t usage_count;
+    uint64_t error_count;
+    uint64_t predicted_usage;
+    uint64_t time_to_threshold_ms;
+    uint64_t anomalies;
+    uint32_t threshold;
+    uint32_t anomaly_threshold;
+    uint32_t buffer_size;
+    uint32_t anomaly_score;
+    uint32_t sensor_data;
+    uint32_t pstate;
+    uint32_t load_permille;
+    uint32_t flags;
+};
+
+// The copies above must match the driver's layouts, or every call fails with ENOTTY
+_Static_assert(sizeof(struct ai_queue_params) == 48, "ai_queue_params");
+_Static_assert(sizeof(struct ai_sqe) == 40, "ai_sqe");
+_Static_assert(sizeof(struct ai_anomaly_query) == 32, "ai_anomaly_query");
+_Static_assert(sizeof(struct ai_batch) == 144, "ai_batch");
+_Static_assert(sizeof(struct ai_history_query) == 56, "ai_history_query");
+_Static_assert(sizeof(struct ai_status) == 96, "ai_status");
+
+#define ARRAY_LEN(a) (sizeof(a) / sizeof((a)[0]))
+
+#define MAX_DEVICES 8
+#define MAX_IO (64 * 1024)
+#define SLOTS 4                      // Files each thread opens and closes at random
+#define SHARED_FDS 4                 // Files shared by all threads of a process
+#define FLUSH_OPS 1024               // Operations between counter flushes
+#define MAX_REPORTS 50               // Failures printed in full
+#define HUNG_GRACE_S 30              // Seconds past the deadline before a child counts as hung
+
+// The kinds of operation in the mix, and their weights
+enum torture_op {
+    OP_OPEN,
+    OP_RW,
+    OP_SPLICE,
+    OP_VERIFY,
+    OP_SEEK,
+    OP_IOCTL,
+    OP_RESIZE,
+    OP_CHANNEL,
+    OP_MMAP,
+    OP_QUEUE,
+    OP_POLL,
+    OP_SYSFS,
+    NR_OPS,
+};
+
+static const struct {
+    const char *name;
+    unsigned int weight;
+} op_table[NR_OPS] = {
+    [OP_OPEN] = { "open", 4 },
+    [OP_RW] = { "rw", 30 },
+    [OP_SPLICE] = { "splice", 3 },
+    [OP_VERIFY] = { "verify", 10 },
+    [OP_SEEK] = { "seek", 5 },
+    [OP_IOCTL] = { "ioctl", 25 },
+    [OP_RESIZE] = { "resize", 6 },
+    [OP_CHANNEL] = { "channel", 3 },
+    [OP_MMAP] = { "mmap", 6 },
+    [OP_QUEUE] = { "queue", 5 },
+    [OP_POLL] = { "poll", 2 },
+    [OP_SYSFS] = { "sysfs", 2 },
+};
+
+// Every command the driver handles, plus one it must reject
+static const struct {
+    const char *name;
+    unsigned long cmd;
+} ioctl_table[] = {
+    { "PERF_OPT", AI_IOC_PERF_OPT },
+    { "PRED_MAINT", AI_IOC_PRED_MAINT },
+    { "SEC_ENHANCE", AI_IOC_SEC_ENHANCE },
+    { "PWR_MGMT", AI_IOC_PWR_MGMT },
+    { "HW_ADAPT", AI_IOC_HW_ADAPT },
+    { "COMMIT", AI_IOC_COMMIT },
+    { "SET_EVENTFD", AI_IOC_SET_EVENTFD },
+    { "GET_ANALYTICS", AI_IOC_GET_ANALYTICS },
+    { "GET_MODEL", AI_IOC_GET_MODEL },
+    { "GET_ANOMALIES", AI_IOC_GET_ANOMALIES },
+    { "GET_FEATURES", AI_IOC_GET_FEATURES },
+    { "GET_LIMITS", AI_IOC_GET_LIMITS },
+    { "GET_STATS", AI_IOC_GET_STATS },
+    { "GET_TUNER", AI_IOC_GET_TUNER },
+    { "GET_POWER", AI_IOC_GET_POWER },
+    { "LOAD_INFER_MODEL", AI_IOC_LOAD_INFER_MODEL },
+    { "GET_INFERENCE", AI_IOC_GET_INFERENCE },
+    { "BATCH", AI_IOC_BATCH },
+    { "GET_HISTORY", AI_IOC_GET_HISTORY },
+    { "GET_STATUS", AI_IOC_GET_STATUS },
+    { "unknown", _IO(AI_IOC_MAGIC, 99) },
+};
+
+// Writable attributes under /sys/class/ai/<device>/, saved and restored around the run
+static const char *const sysfs_attrs[] = {
+    "buffer_size", "threshold", "anomaly_threshold", "analytics_interval_ms", "autotune",
+};
+
+static const char *const debugfs_files[] = {
+    "counters", "histograms", "latency", "model", "analytics",
+    "tuner", "power", "inference", "history",
+};
+
+// Kernel log lines that mean the run found a bug
+static const char *const splat_patterns[] = {
+    "BUG:", "WARNING:", "Oops", "KASAN", "UBSAN", "KFENCE", "kernel BUG",
+    "general protection fault", "possible circular locking", "possible recursive locking",
+    "inconsistent lock state", "suspicious RCU usage", "lock held when returning",
+    "sleeping function called from invalid context", "blocked for more than",
+    "list_add corruption", "list_del corruption", "refcount_t:", "stack-protector",
+};
+
+// Torture configuration
+static struct {
+    const char *devices[MAX_DEVICES];
+    int nr_devices;
+    int procs;
+    int threads;
+    int seconds;
+    uint64_t seed;
+    int kill_interval;               // Seconds between SIGKILLs of a random child, 0 for none
+    int sysfs;                       // Also write sysfs attributes
+    int check_log;
+    unsigned int weights[NR_OPS];
+    const char *model;               // Inference model blob loaded now and then
+    void *model_data;
+    size_t model_size;
+} cfg = {
+    .procs = 2,
+    .threads = 4,
+    .seconds = 10,
+    .check_log = 1,
+};
+
+// Counters shared by every process, updated with atomic adds
+struct shared_stats {
+    uint64_t calls[NR_OPS];
+    uint64_t errors[NR_OPS];          // Calls that failed as they may
+    uint64_t failures[NR_OPS];        // Calls that broke a rule
+    uint64_t reports;
+    uint32_t threshold;               // Device threshold at the start, kept by HW_ADAPT
+};
+
+static struct shared_stats *stats;
+static uint64_t deadline_ns;
+static long page_size;
+
+// One open file of a thread, with its submission queue if it has one
+struct slot {
+    int fd;
+    int dev;
+    struct ai_queue_params qp;
+    unsigned char *ring;
+};
+
+// One torture thread
+struct worker {
+    pthread_t thread;
+    int proc;
+    int index;
+    uint64_t rng;
+    int *shared_fds;
+    struct slot slots[SLOTS];
+    int own_fd;                       // Buffer channel, used by this thread only
+    unsigned int own_size;
+    int efd;
+    int pipe[2];
+    uint64_t user_data;
+    uint64_t calls[NR_OPS];
+    uint64_t errors[NR_OPS];
+    uint64_t failures[NR_OPS];
+    unsigned long ops;
+    unsigned char buf[2 * MAX_IO];
+    unsigned char check[MAX_IO];
+    unsigned char qbuf[4096];         // SQE buffers, written by the queue worker at any time
+};
+
+// Flags for finish()
+#define F_BAD_PTR  (1U << 0)          // A pointer was invalid on purpose, EFAULT is fine
+#define F_KNOWN    (1U << 1)          // An ioctl the driver must recognize
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Per-thread xorshift, seeded from the run seed so a mix can be repeated
+static uint32_t next_rand(uint64_t *state) {
+    uint64_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return (uint32_t)(x >> 32);
+}
+
+static uint32_t rnd(struct worker *w) {
+    return next_rand(&w->rng);
+}
+
+static void failure(struct worker *w, enum torture_op op, const char *fmt, ...) {
+    va_list ap;
+    char msg[256];
+
+    w->failures[op]++;
+    if (__atomic_fetch_add(&stats->reports, 1, __ATOMIC_RELAXED) >= MAX_REPORTS) {
+        return;
+    }
+    va_start(ap, fmt);
+    vsnprintf(msg, sizeof(msg), fmt, ap);
+    va_end(ap);
+    fprintf(stderr, "FAIL [proc %d thread %d] %s: %s\n", w->proc, w->index, op_table[op].name, msg);
+}
+
+// Account one call that returned ret (-1 with errno on error) for a request
+// of max bytes. Returns 1 if it succeeded.
+static int finish(struct worker *w, enum torture_op op, long ret, size_t max, unsigned int flags, const char *what) {
+    int err = errno;
+
+    w->calls[op]++;
+    if (ret >= 0) {
+        if ((size_t)ret > max) {
+            failure(w, op, "%s returned %ld for a %zu-byte request", what, ret, max);
+            return 0;
+        }
+        return 1;
+    }
+    w->errors[op]++;
+    if (err >= 512) {
+        failure(w, op, "%s leaked kernel-internal error %d", what, err);
+    } else if (err == ENOTTY && (flags & F_KNOWN)) {
+        failure(w, op, "%s not recognized; the ioctl numbers here are out of date", what);
+    } else if (err == EFAULT && !(flags & F_BAD_PTR)) {
+        failure(w, op, "%s faulted on a valid pointer", what);
+    }
+    errno = err;
+    return 0;
+}
+
+// Move the thread's counters to the shared ones, so the work of a killed
+// child is still counted
+static void flush_stats(struct worker *w) {
+    int i;
+
+    for (i = 0; i < NR_OPS; i++) {
+        __atomic_fetch_add(&stats->calls[i], w->calls[i], __ATOMIC_RELAXED);
+        __atomic_fetch_add(&stats->errors[i], w->errors[i], __ATOMIC_RELAXED);
+        __atomic_fetch_add(&stats->failures[i], w->failures[i], __ATOMIC_RELAXED);
+        w->calls[i] = w->errors[i] = w->failures[i] = 0;
+    }
+}
+
+// Sizes for resizes: mostly valid, with the edges and a few out of range
+static unsigned int pick_size(struct worker *w) {
+    static const unsigned int edges[] = {
+        0, 1, 4095, 4096, 4097, 65536, 1024 * 1024, 1024 * 1024 + 1, 0x7fffffff, 0xffffffff,
+    };
+
+    if (rnd(w) % 4 == 0) {
+        return edges[rnd(w) % ARRAY_LEN(edges)];
+    }
+    return 1 + rnd(w) % (rnd(w) % 4 ? 65536 : 1024 * 1024);
+}
+
+static size_t pick_len(struct worker *w) {
+    switch (rnd(w) % 8) {
+        case 0: return 0;
+        case 1: return MAX_IO;
+        case 2: return rnd(w) % (MAX_IO + 1);
+        default: return rnd(w) % 4097;
+    }
+}
+
+static off_t pick_off(struct worker *w) {
+    switch (rnd(w) % 8) {
+        case 0: return 0;
+        case 1: return 4096 * (off_t)(rnd(w) % 257) - rnd(w) % 2;
+        case 2: return (off_t)1 << (20 + rnd(w) % 40);
+        default: return rnd(w) % 65536;
+    }
+}
+
+// A pointer no user copy may touch: NULL-ish or in the kernel half
+static void *bad_ptr(struct worker *w) {
+    return (void *)(uintptr_t)(rnd(w) % 2 ? 16 : 0xffff888000000000ULL);
+}
+
+static int pick_fd(struct worker *w) {
+    unsigned int i = rnd(w) % (SHARED_FDS + SLOTS);
+
+    if (i < SHARED_FDS) {
+        return w->shared_fds[i];
+    }
+    return w->slots[i - SHARED_FDS].fd;
+}
+
+static int open_device(struct worker *w, int dev, int flags) {
+    int fd = open(cfg.devices[dev], O_RDWR | O_CLOEXEC | flags);
+
+    finish(w, OP_OPEN, fd, ~0UL >> 1, 0, "open");
+    return fd;
+}
+
+static void close_slot(struct slot *s) {
+    if (s->ring) {
+        munmap(s->ring, s->qp.region_size);
+        s->ring = NULL;
+    }
+    if (s->fd >= 0) {
+        close(s->fd);
+        s->fd = -1;
+    }
+}
+
+static void do_open(struct worker *w) {
+    struct slot *s = &w->slots[rnd(w) % SLOTS];
+
+    if (s->fd >= 0) {
+        close_slot(s);
+        w->calls[OP_OPEN]++;
+        return;
+    }
+    s->dev = rnd(w) % cfg.nr_devices;
+    s->fd = open_device(w, s->dev, O_NONBLOCK);
+}
+
+// read/write, pread/pwrite or readv/writev of a random range of any file
+static void do_rw(struct worker *w) {
+    int fd = pick_fd(w);
+    size_t len = pick_len(w);
+    off_t off = pick_off(w);
+    unsigned int kind = rnd(w) % 6;
+    unsigned int flags = 0;
+    unsigned char *buf = w->buf;
+    struct iovec iov[4];
+    int nr_iov = 1 + rnd(w) % 4, i;
+    size_t left = len;
+    long ret;
+
+    if (fd < 0) {
+        return;
+    }
+    if (rnd(w) % 32 == 0) {
+        buf = bad_ptr(w);
+        flags |= F_BAD_PTR;
+    }
+    for (i = 0; i < nr_iov; i++) {
+        size_t seg = i == nr_iov - 1 ? left : rnd(w) % (left + 1);
+
+        iov[i].iov_base = buf + (len - left);
+        iov[i].iov_len = seg;
+        left -= seg;
+    }
+    switch (kind) {
+        case 0: ret = read(fd, buf, len); break;
+        case 1: ret = write(fd, buf, len); break;
+        case 2: ret = pread(fd, buf, len, off); break;
+        case 3: ret = pwrite(fd, buf, len, off); break;
+        case 4: ret = preadv(fd, iov, nr_iov, off); break;
+        default: ret = pwritev(fd, iov, nr_iov, off); break;
+    }
+    finish(w, OP_RW, ret, len, flags, kind % 2 ? "write" : "read");
+}
+
+// The splice paths, through the thread's pipe
+static void do_splice(struct worker *w) {
+    int fd = pick_fd(w);
+    size_t len = 1 + rnd(w) % 16384;
+    loff_t off = pick_off(w);
+    long ret;
+
+    if (fd < 0) {
+        return;
+    }
+    if (rnd(w) % 2) {
+        ret = splice(fd, &off, w->pipe[1], NULL, len, SPLICE_F_NONBLOCK);
+        finish(w, OP_SPLICE, ret, len, 0, "splice from device");
+    } else {
+        ret = write(w->pipe[1], w->buf, len);
+        if (ret > 0) {
+            len = ret;
+            ret = splice(w->pipe[0], NULL, fd, &off, len, SPLICE_F_NONBLOCK);
+            finish(w, OP_SPLICE, ret, len, 0, "splice to device");
+        }
+    }
+    // Drain whatever is left so the pipe never fills up
+    while (read(w->pipe[0], w->check, sizeof(w->check)) > 0) {
+    }
+}
+
+// Write a pattern to the private file and read it back, through read() and
+// now and then through a mapping; nothing else touches this file
+static void do_verify(struct worker *w) {
+    size_t max = w->own_size < MAX_IO ? w->own_size : MAX_IO;
+    size_t len, off, i;
+    long ret;
+
+    if (w->own_fd < 0 || !max) {
+        return;
+    }
+    len = 1 + rnd(w) % max;
+    off = rnd(w) % (w->own_size - len + 1);
+    for (i = 0; i < len; i++) {
+        w->buf[i] = rnd(w);
+    }
+
+    ret = pwrite(w->own_fd, w->buf, len, off);
+    if (!finish(w, OP_VERIFY, ret, len, 0, "pwrite")) {
+        return;
+    }
+    if ((size_t)ret != len) {
+        failure(w, OP_VERIFY, "short write of %ld/%zu at %zu in a %u-byte buffer", ret, len, off, w->own_size);
+        return;
+    }
+    memset(w->check, 0, len);
+    ret = pread(w->own_fd, w->check, len, off);
+    if (!finish(w, OP_VERIFY, ret, len, 0, "pread")) {
+        return;
+    }
+    if ((size_t)ret != len || memcmp(w->buf, w->check, len)) {
+        failure(w, OP_VERIFY, "read back %ld/%zu bytes at %zu differ from what was written", ret, len, off);
+        return;
+    }
+
+    if (rnd(w) % 8 == 0 && w->own_size >= (unsigned int)page_size) {
+        size_t map_len = w->own_size & ~(page_size - 1);
+        unsigned char *p = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, w->own_fd, AI_MMAP_OFF_BUFFER);
+        unsigned char c = rnd(w);
+
+        if (!finish(w, OP_VERIFY, p == MAP_FAILED ? -1 : 0, 0, 0, "mmap")) {
+            if (errno != ENOMEM) {
+                failure(w, OP_VERIFY, "mapping the whole %u-byte buffer failed: %s", w->own_size, strerror(errno));
+            }
+            return;
+        }
+        if (off + len <= map_len && memcmp(p + off, w->buf, len)) {
+            failure(w, OP_VERIFY, "mapped buffer differs from pread at %zu", off);
+        }
+        p[0] = c;
+        if (pread(w->own_fd, w->check, 1, 0) != 1 || w->check[0] != c) {
+            failure(w, OP_VERIFY, "store through the mapping not seen by pread");
+        }
+        munmap(p, map_len);
+    }
+
+    // Resize now and then; the contents past the new size are gone
+    if (rnd(w) % 16 == 0) {
+        struct hw_config config = { 4096 + rnd(w) % (256 * 1024), stats->threshold };
+
+        ret = ioctl(w->own_fd, AI_IOC_HW_ADAPT, &config);
+        if (finish(w, OP_VERIFY, ret, ~0UL >> 1, 0, "HW_ADAPT")) {
+            w->own_size = config.buffer_size;
+        }
+    }
+}
+
+static void do_seek(struct worker *w) {
+    int fd = pick_fd(w);
+    int whence = rnd(w) % 4;
+    off_t off = rnd(w) % 2 ? pick_off(w) : -(off_t)pick_off(w);
+    long ret;
+
+    if (fd < 0) {
+        return;
+    }
+    ret = lseek(fd, off, whence == 3 ? 42 : whence);
+    finish(w, OP_SEEK, ret, ~0UL >> 1, 0, "lseek");
+}
+
+static void fill_batch(struct worker *w, struct ai_batch *batch) {
+    unsigned int i;
+
+    memset(batch, 0, sizeof(*batch));
+    batch->nr = rnd(w) % (AI_BATCH_MAX + 2);
+    batch->flags = rnd(w) % 16 ? 0 : rnd(w);
+    for (i = 0; i < AI_BATCH_MAX; i++) {
+        batch->cmds[i].opcode = rnd(w) % 10;
+        batch->cmds[i].buffer_size = pick_size(w);
+        batch->cmds[i].threshold = rnd(w) % 4 ? stats->threshold : rnd(w);
+    }
+}
+
+static void do_ioctl(struct worker *w) {
+    unsigned int idx = rnd(w) % ARRAY_LEN(ioctl_table);
+    unsigned long cmd = ioctl_table[idx].cmd;
+    int fd = pick_fd(w);
+    unsigned int flags = idx == ARRAY_LEN(ioctl_table) - 1 ? 0 : F_KNOWN;
+    void *arg = w->buf;
+    long ret;
+
+    if (fd < 0) {
+        return;
+    }
+    memset(w->buf, 0, 4096);
+    switch (cmd) {
+        case AI_IOC_HW_ADAPT: {
+            struct hw_config *config = arg;
+
+            config->buffer_size = pick_size(w);
+            config->threshold = rnd(w) % 4 ? stats->threshold : rnd(w);
+            break;
+        }
+        case AI_IOC_COMMIT: {
+            struct ai_range *range = arg;
+
+            range->offset = pick_off(w);
+            range->length = rnd(w) % 4 ? pick_len(w) : ~0ULL - rnd(w) % 4096;
+            break;
+        }
+        case AI_IOC_SET_EVENTFD:
+            arg = (void *)(long)(rnd(w) % 4 ? w->efd : rnd(w) % 2 ? -1 : (int)rnd(w) % 1024);
+            break;
+        case AI_IOC_GET_ANOMALIES: {
+            struct ai_anomaly_query *query = arg;
+
+            query->seq = rnd(w) % 2 ? 0 : rnd(w);
+            query->count = rnd(w) % (MAX_IO / AI_ANOMALY_SIZE);
+            query->records = (uintptr_t)(w->buf + 4096);
+            break;
+        }
+        case AI_IOC_GET_STATS:
+            ((uint32_t *)arg)[1] = rnd(w) % 4 ? AI_STATS_SIZE : rnd(w) % (AI_STATS_SIZE + 64);
+            break;
+        case AI_IOC_LOAD_INFER_MODEL: {
+            struct ai_infer_load *load = arg;
+
+            // The given model, garbage the parser must refuse, or back to the built-in rules
+            switch (rnd(w) % 3) {
+                case 0:
+                    if (cfg.model_data) {
+                        load->data = (uintptr_t)cfg.model_data;
+                        load->size = cfg.model_size;
+                        break;
+                    }
+                    // Fall through
+                case 1:
+                    load->data = (uintptr_t)(w->buf + 4096);
+                    load->size = rnd(w) % 8192;
+                    for (size_t i = 0; i < load->size; i += 4) {
+                        *(uint32_t *)(w->buf + 4096 + i) = rnd(w);
+                    }
+                    break;
+                default:
+                    break;
+            }
+            break;
+        }
+        case AI_IOC_BATCH: {
+            struct ai_batch *batch = arg;
+
+            fill_batch(w, batch);
+            batch->results = (uintptr_t)(w->buf + 4096);
+            break;
+        }
+        case AI_IOC_GET_HISTORY: {
+            struct ai_history_query *query = arg;
+
+            query->level = rnd(w) % (AI_HISTORY_LEVELS + 1);
+            query->nr_samples = rnd(w) % 4 ? rnd(w) % 4097 : rnd(w);
+            query->samples = (uintptr_t)(w->buf + 4096);
+            if (query->nr_samples > (sizeof(w->buf) - 4096) / AI_HISTORY_SAMPLE_SIZE) {
+                // Larger than the buffer: must be clamped or refused, never overrun
+                query->samples = (uintptr_t)bad_ptr(w);
+                flags |= F_BAD_PTR;
+            }
+            break;
+        }
+        default:
+            if (_IOC_DIR(cmd) == _IOC_NONE) {
+                arg = NULL;
+            }
+            break;
+    }
+    if (_IOC_DIR(cmd) != _IOC_NONE && rnd(w) % 32 == 0) {
+        arg = bad_ptr(w);
+        flags |= F_BAD_PTR;
+    }
+
+    ret = ioctl(fd, cmd, arg);
+    if (!(flags & F_KNOWN)) {
+        w->calls[OP_IOCTL]++;
+        if (ret != -1 || errno != ENOTTY) {
+            failure(w, OP_IOCTL, "unknown command returned %ld (%s) instead of ENOTTY", ret, strerror(errno));
+        }
+        return;
+    }
+    if (finish(w, OP_IOCTL, ret, ~0UL >> 1, flags, ioctl_table[idx].name) && cmd == AI_IOC_GET_STATUS && !(flags & F_BAD_PTR)) {
+        struct ai_status *st = arg;
+
+        if (st->version != AI_STATUS_VERSION || st->seq & 1) {
+            failure(w, OP_IOCTL, "GET_STATUS returned version %u seq %u", st->version, st->seq);
+        }
+    }
+}
+
+// Resize a shared file while other threads read, write and map it
+static void do_resize(struct worker *w) {
+    int fd = w->shared_fds[rnd(w) % SHARED_FDS];
+    struct hw_config config = { pick_size(w), stats->threshold };
+    long ret;
+
+    if (fd < 0) {
+        return;
+    }
+    if (rnd(w) % 4 == 0) {
+        struct ai_batch batch;
+        struct ai_batch_result results[AI_BATCH_MAX];
+
+        fill_batch(w, &batch);
+        batch.nr = 1 + rnd(w) % AI_BATCH_MAX;
+        batch.flags = 0;
+        batch.results = (uintptr_t)results;
+        ret = ioctl(fd, AI_IOC_BATCH, &batch);
+        finish(w, OP_RESIZE, ret, ~0UL >> 1, F_KNOWN, "BATCH");
+        return;
+    }
+    ret = ioctl(fd, AI_IOC_HW_ADAPT, &config);
+    finish(w, OP_RESIZE, ret, ~0UL >> 1, F_KNOWN, "HW_ADAPT");
+}
+
+// Switch a file between the buffer, stream and events channels. Mostly
+// the thread's own files; the shared ones stay where they are most of the time.
+static void do_channel(struct worker *w) {
+    int fd = rnd(w) % 4 ? w->slots[rnd(w) % SLOTS].fd : w->shared_fds[rnd(w) % SHARED_FDS];
+    unsigned long channel = rnd(w) % 8 ? rnd(w) % 3 : rnd(w);
+    long ret;
+
+    if (fd < 0) {
+        return;
+    }
+    ret = ioctl(fd, AI_IOC_SET_CHANNEL, channel);
+    finish(w, OP_CHANNEL, ret, ~0UL >> 1, F_KNOWN, "SET_CHANNEL");
+}
+
+// Read the status page like a monitoring client: retry while it is being written
+static void read_status_page(struct worker *w, const volatile struct ai_status *st) {
+    uint32_t seq, version;
+    long tries = 0;
+
+    for (;;) {
+        seq = __atomic_load_n(&st->seq, __ATOMIC_ACQUIRE);
+        if (!(seq & 1)) {
+            version = st->version;
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&st->seq, __ATOMIC_RELAXED) == seq) {
+                break;
+            }
+        }
+        if (++tries > 1000000) {
+            failure(w, OP_MMAP, "status page seq stuck at %u", seq);
+            return;
+        }
+    }
+    if (version != AI_STATUS_VERSION) {
+        failure(w, OP_MMAP, "status page version %u", version);
+    }
+}
+
+static void check_history_page(struct worker *w, const volatile struct ai_history_header *hdr, size_t *size) {
+    unsigned int i;
+
+    *size = 0;
+    if (hdr->version != AI_HISTORY_VERSION || hdr->nr_levels != AI_HISTORY_LEVELS ||
+        hdr->sample_size != AI_HISTORY_SAMPLE_SIZE) {
+        failure(w, OP_MMAP, "history header version %u levels %u sample size %u",
+                hdr->version, hdr->nr_levels, hdr->sample_size);
+        return;
+    }
+    for (i = 0; i < AI_HISTORY_LEVELS; i++) {
+        size_t end = hdr->levels[i].offset + (size_t)hdr->levels[i].nr_entries * AI_HISTORY_SAMPLE_SIZE;
+
+        *size = end > *size ? end : *size;
+    }
+}
+
+// Map one of the regions of a file, touch it and unmap it
+static void do_mmap(struct worker *w) {
+    int fd = pick_fd(w);
+    unsigned int region = rnd(w) % 4;
+    size_t len = page_size * (1 + rnd(w) % 8);
+    off_t off = page_size * (rnd(w) % 4);
+    volatile unsigned char *p;
+    size_t i;
+
+    if (fd < 0) {
+        return;
+    }
+    switch (region) {
+        case 0:
+            // The buffer; private mappings must be refused
+            p = mmap(NULL, len, PROT_READ | PROT_WRITE, rnd(w) % 16 ? MAP_SHARED : MAP_PRIVATE, fd, AI_MMAP_OFF_BUFFER + off);
+            if (!finish(w, OP_MMAP, p == MAP_FAILED ? -1 : 0, 0, 0, "mmap buffer")) {
+                return;
+            }
+            for (i = 0; i < len; i += page_size) {
+                p[i] = p[i + page_size - 1] + 1;
+            }
+            munmap((void *)p, len);
+            break;
+        case 1: {
+            // The status page, which must never become writable
+            int writable = rnd(w) % 8 == 0;
+
+            p = mmap(NULL, page_size, PROT_READ | (writable ? PROT_WRITE : 0), MAP_SHARED, fd, AI_MMAP_OFF_STATUS);
+            if (!finish(w, OP_MMAP, p == MAP_FAILED ? -1 : 0, 0, 0, "mmap status")) {
+                return;
+            }
+            if (writable) {
+                failure(w, OP_MMAP, "status page mapped writable");
+            }
+            read_status_page(w, (const volatile struct ai_status *)p);
+            if (mprotect((void *)p, page_size, PROT_READ | PROT_WRITE) == 0) {
+                failure(w, OP_MMAP, "status page could be made writable");
+            }
+            munmap((void *)p, page_size);
+            break;
+        }
+        case 2: {
+            // The history region, sized from its header, and one page too many
+            size_t size;
+
+            p = mmap(NULL, page_size, PROT_READ, MAP_SHARED, fd, AI_MMAP_OFF_HISTORY);
+            if (!finish(w, OP_MMAP, p == MAP_FAILED ? -1 : 0, 0, 0, "mmap history")) {
+                return;
+            }
+            check_history_page(w, (const volatile struct ai_history_header *)p, &size);
+            munmap((void *)p, page_size);
+            if (!size) {
+                return;
+            }
+            size = (size + page_size - 1) & ~(page_size - 1);
+            p = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, AI_MMAP_OFF_HISTORY);
+            if (finish(w, OP_MMAP, p == MAP_FAILED ? -1 : 0, 0, 0, "mmap history")) {
+                for (i = 0; i < size; i += page_size) {
+                    (void)p[i];
+                }
+                munmap((void *)p, size);
+            }
+            p = mmap(NULL, size + page_size, PROT_READ, MAP_SHARED, fd, AI_MMAP_OFF_HISTORY);
+            if (p != MAP_FAILED) {
+                failure(w, OP_MMAP, "history mapped past its %zu bytes", size);
+                munmap((void *)p, size + page_size);
+            }
+            break;
+        }
+        default:
+            // The queue rings of a file without a queue, or at a bad offset
+            p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, AI_MMAP_OFF_QUEUE + off);
+            if (finish(w, OP_MMAP, p == MAP_FAILED ? -1 : 0, 0, 0, "mmap queue")) {
+                munmap((void *)p, len);
+            }
+            break;
+    }
+}
+
+// Set up a submission queue on one of the thread's files, or drain its
+// completions and submit a few more. QUEUE_ENTER never waits, so a lost
+// completion shows up as a stuck ring rather than a hung thread.
+static void do_queue(struct worker *w) {
+    struct slot *s = &w->slots[rnd(w) % SLOTS];
+    struct ai_queue_enter enter = { 0, 0 };
+    uint32_t *sq_head, *sq_tail, *cq_head, *cq_tail;
+    struct ai_sqe *sqes;
+    struct ai_cqe *cqes;
+    uint32_t head, tail, n;
+    long ret;
+
+    if (s->fd < 0) {
+        return;
+    }
+    if (!s->ring || rnd(w) % 32 == 0) {
+        struct ai_queue_params qp = {
+            .sq_entries = rnd(w) % 8 ? 1 + rnd(w) % 256 : rnd(w) % (2 * AI_QUEUE_MAX_ENTRIES),
+            .cq_entries = rnd(w) % 2 ? 0 : rnd(w) % 1024,
+            .flags = rnd(w) % 4 ? 0 : AI_QUEUE_SQPOLL,
+            .sq_idle_ms = rnd(w) % 20,
+        };
+
+        ret = ioctl(s->fd, AI_IOC_SETUP_QUEUE, &qp);
+        if (!finish(w, OP_QUEUE, ret, ~0UL >> 1, F_KNOWN, "SETUP_QUEUE")) {
+            return;
+        }
+        if (s->ring) {
+            failure(w, OP_QUEUE, "a second queue was set up on the same file");
+            return;
+        }
+        s->ring = mmap(NULL, qp.region_size, PROT_READ | PROT_WRITE, MAP_SHARED, s->fd, AI_MMAP_OFF_QUEUE);
+        if (!finish(w, OP_QUEUE, s->ring == MAP_FAILED ? -1 : 0, 0, 0, "mmap queue")) {
+            failure(w, OP_QUEUE, "mapping a %u-byte queue failed: %s", qp.region_size, strerror(errno));
+            s->ring = NULL;
+            return;
+        }
+        s->qp = qp;
+        return;
+    }
+
+    sq_head = (uint32_t *)(s->ring + s->qp.sq_head_off);
+    sq_tail = (uint32_t *)(s->ring + s->qp.sq_tail_off);
+    cq_head = (uint32_t *)(s->ring + s->qp.cq_head_off);
+    cq_tail = (uint32_t *)(s->ring + s->qp.cq_tail_off);
+    sqes = (struct ai_sqe *)(s->ring + s->qp.sqes_off);
+    cqes = (struct ai_cqe *)(s->ring + s->qp.cqes_off);
+
+    head = *cq_head;
+    tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    if (tail - head > s->qp.cq_entries) {
+        failure(w, OP_QUEUE, "CQ tail %u is more than %u entries past head %u", tail, s->qp.cq_entries, head);
+        return;
+    }
+    for (; head != tail; head++) {
+        const struct ai_cqe *cqe = &cqes[head & (s->qp.cq_entries - 1)];
+
+        if (cqe->res < -4095 || cqe->res > (int32_t)sizeof(w->qbuf) || cqe->res == -512 || cqe->res == -515) {
+            failure(w, OP_QUEUE, "completion %llu has res %d", (unsigned long long)cqe->user_data, cqe->res);
+        }
+    }
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+
+    head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    tail = *sq_tail;
+    for (n = rnd(w) % 8; n && tail - head < s->qp.sq_entries; n--, tail++) {
+        struct ai_sqe *sqe = &sqes[tail & (s->qp.sq_entries - 1)];
+
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = rnd(w) % 10;
+        sqe->user_data = ++w->user_data;
+        if (sqe->opcode == AI_OP_READ || sqe->opcode == AI_OP_WRITE) {
+            sqe->len = rnd(w) % (sizeof(w->qbuf) + 1);
+            sqe->off = pick_off(w);
+            sqe->addr = rnd(w) % 16 ? (uintptr_t)w->qbuf : (uintptr_t)bad_ptr(w);
+        } else if (sqe->opcode == AI_OP_HW_ADAPT) {
+            sqe->buffer_size = pick_size(w);
+            sqe->threshold = stats->threshold;
+        }
+    }
+    __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+
+    ret = ioctl(s->fd, AI_IOC_QUEUE_ENTER, &enter);
+    finish(w, OP_QUEUE, ret, ~0UL >> 1, F_KNOWN, "QUEUE_ENTER");
+}
+
+static void do_poll(struct worker *w) {
+    struct pollfd fds[SHARED_FDS + SLOTS];
+    int i, n = 0;
+    long ret;
+
+    for (i = 0; i < SHARED_FDS + SLOTS; i++) {
+        int fd = i < SHARED_FDS ? w->shared_fds[i] : w->slots[i - SHARED_FDS].fd;
+
+        if (fd >= 0) {
+            fds[n].fd = fd;
+            fds[n].events = POLLIN | POLLOUT | POLLPRI;
+            n++;
+        }
+    }
+    ret = poll(fds, n, 0);
+    finish(w, OP_POLL, ret, n, 0, "poll");
+}
+
+static int sysfs_path(char *path, size_t len, const char *dir, int dev, const char *file) {
+    const char *name = strrchr(cfg.devices[dev], '/');
+
+    return snprintf(path, len, "%s/%s/%s", dir, name ? name + 1 : cfg.devices[dev], file);
+}
+
+// Retune an instance through sysfs, or read its attributes and debugfs files
+static void do_sysfs(struct worker *w) {
+    int dev = rnd(w) % cfg.nr_devices;
+    char path[256], value[4096];
+    unsigned int i = rnd(w) % ARRAY_LEN(sysfs_attrs);
+    int fd, len;
+    long ret;
+
+    if (rnd(w) % 2) {
+        static const unsigned int intervals[] = { 0, 1, 10, 100, 1000 };
+
+        switch (i) {
+            case 0: len = snprintf(value, sizeof(value), "%u\n", pick_size(w)); break;
+            case 1: len = snprintf(value, sizeof(value), "%u\n", rnd(w) % 4 ? stats->threshold : rnd(w)); break;
+            case 2: len = snprintf(value, sizeof(value), "%u\n", rnd(w) % 20000); break;
+            case 3: len = snprintf(value, sizeof(value), "%u\n", intervals[rnd(w) % ARRAY_LEN(intervals)]); break;
+            default: len = snprintf(value, sizeof(value), "%u\n", rnd(w) % 3); break;
+        }
+        sysfs_path(path, sizeof(path), "/sys/class/ai", dev, sysfs_attrs[i]);
+        fd = open(path, O_WRONLY | O_CLOEXEC);
+        if (finish(w, OP_SYSFS, fd, ~0UL >> 1, 0, path)) {
+            ret = write(fd, value, len);
+            finish(w, OP_SYSFS, ret, len, 0, path);
+            close(fd);
+        }
+        return;
+    }
+
+    if (rnd(w) % 2) {
+        sysfs_path(path, sizeof(path), "/sys/class/ai", dev, sysfs_attrs[i]);
+    } else {
+        sysfs_path(path, sizeof(path), "/sys/kernel/debug/ai_driver", dev,
+                   debugfs_files[rnd(w) % ARRAY_LEN(debugfs_files)]);
+    }
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (finish(w, OP_SYSFS, fd, ~0UL >> 1, 0, path)) {
+        while ((ret = read(fd, value, sizeof(value))) > 0) {
+        }
+        finish(w, OP_SYSFS, ret, sizeof(value), 0, path);
+        close(fd);
+    }
+}
+
+static enum torture_op pick_op(struct worker *w, unsigned int total) {
+    unsigned int r = rnd(w) % total;
+    int i;
+
+    for (i = 0; i < NR_OPS - 1; i++) {
+        if (r < cfg.weights[i]) {
+            break;
+        }
+        r -= cfg.weights[i];
+    }
+    return i;
+}
+
+static void *worker_fn(void *arg) {
+    struct worker *w = arg;
+    unsigned int total = 0;
+    struct hw_config config = { 65536, stats->threshold };
+    int i;
+
+    for (i = 0; i < NR_OPS; i++) {
+        total += cfg.weights[i];
+    }
+    for (i = 0; i < SLOTS; i++) {
+        w->slots[i].fd = -1;
+    }
+    w->efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (pipe2(w->pipe, O_CLOEXEC | O_NONBLOCK) < 0) {
+        perror("pipe2");
+        return NULL;
+    }
+    w->own_fd = open_device(w, w->index % cfg.nr_devices, 0);
+    if (w->own_fd >= 0 && ioctl(w->own_fd, AI_IOC_HW_ADAPT, &config) == 0) {
+        w->own_size = config.buffer_size;
+    }
+
+    while (now_ns() < deadline_ns) {
+        switch (pick_op(w, total)) {
+            case OP_OPEN: do_open(w); break;
+            case OP_RW: do_rw(w); break;
+            case OP_SPLICE: do_splice(w); break;
+            case OP_VERIFY: do_verify(w); break;
+            case OP_SEEK: do_seek(w); break;
+            case OP_IOCTL: do_ioctl(w); break;
+            case OP_RESIZE: do_resize(w); break;
+            case OP_CHANNEL: do_channel(w); break;
+            case OP_MMAP: do_mmap(w); break;
+            case OP_QUEUE: do_queue(w); break;
+            case OP_POLL: do_poll(w); break;
+            case OP_SYSFS: do_sysfs(w); break;
+            default: break;
+        }
+        if (++w->ops % FLUSH_OPS == 0) {
+            flush_stats(w);
+        }
+    }
+
+    for (i = 0; i < SLOTS; i++) {
+        close_slot(&w->slots[i]);
+    }
+    if (w->own_fd >= 0) {
+        close(w->own_fd);
+    }
+    close(w->efd);
+    close(w->pipe[0]);
+    close(w->pipe[1]);
+    flush_stats(w);
+    return NULL;
+}
+
+// One torture process: shared files, then the threads
+static void run_child(int proc, uint64_t seed) {
+    int shared_fds[SHARED_FDS];
+    struct worker *workers = calloc(cfg.threads, sizeof(*workers));
+    int i;
+
+    if (!workers) {
+        _exit(2);
+    }
+    for (i = 0; i < SHARED_FDS; i++) {
+        shared_fds[i] = open(cfg.devices[i % cfg.nr_devices], O_RDWR | O_CLOEXEC | O_NONBLOCK);
+        __atomic_fetch_add(&stats->calls[OP_OPEN], 1, __ATOMIC_RELAXED);
+    }
+    for (i = 0; i < cfg.threads; i++) {
+        workers[i].proc = proc;
+        workers[i].index = i;
+        workers[i].rng = (seed ^ ((uint64_t)proc << 32 | i)) * 0x9e3779b97f4a7c15ULL | 1;
+        workers[i].shared_fds = shared_fds;
+        if (pthread_create(&workers[i].thread, NULL, worker_fn, &workers[i]) != 0) {
+            perror("pthread_create");
+            _exit(2);
+        }
+    }
+    for (i = 0; i < cfg.threads; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    for (i = 0; i < SHARED_FDS; i++) {
+        if (shared_fds[i] >= 0) {
+            close(shared_fds[i]);
+        }
+    }
+    _exit(0);
+}
+
+static pid_t spawn_child(int proc, uint64_t seed) {
+    pid_t pid = fork();
+
+    if (pid == 0) {
+        run_child(proc, seed);
+    }
+    if (pid < 0) {
+        perror("fork");
+    }
+    return pid;
+}
+
+// Print where the threads of a child that did not finish are stuck
+static void dump_hung(pid_t pid) {
+    char cmd[128];
+
+    fprintf(stderr, "FAIL child %d still running %d s after the deadline; kernel stacks:\n", (int)pid, HUNG_GRACE_S);
+    snprintf(cmd, sizeof(cmd), "for t in /proc/%d/task/*; do echo \"$t\"; cat \"$t/stack\" 2>/dev/null || cat \"$t/wchan\"; echo; done >&2", (int)pid);
+    if (system(cmd) != 0) {
+        fprintf(stderr, "  (could not read the stacks)\n");
+    }
+}
+
+// Start at the end of the kernel log, so only what this run causes is scanned
+static int open_kmsg(void) {
+    int fd = open("/dev/kmsg", O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+
+    if (fd < 0) {
+        fprintf(stderr, "Cannot read /dev/kmsg (%s); the kernel log will not be checked\n", strerror(errno));
+        return -1;
+    }
+    lseek(fd, 0, SEEK_END);
+    return fd;
+}
+
+static int scan_kmsg(int fd) {
+    char rec[8192];
+    int splats = 0;
+    ssize_t n;
+    size_t i;
+
+    if (fd < 0) {
+        return 0;
+    }
+    for (;;) {
+        n = read(fd, rec, sizeof(rec) - 1);
+        if (n < 0 && errno == EPIPE) {
+            // Records were overwritten before we got to them
+            fprintf(stderr, "Kernel log overflowed during the run; some records were not checked\n");
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        rec[n] = '\0';
+        for (i = 0; i < ARRAY_LEN(splat_patterns); i++) {
+            if (strstr(rec, splat_patterns[i])) {
+                char *msg = strchr(rec, ';');
+
+                if (splats++ < MAX_REPORTS) {
+                    fprintf(stderr, "SPLAT %s", msg ? msg + 1 : rec);
+                }
+                break;
+            }
+        }
+    }
+    close(fd);
+    return splats;
+}
+
+// Current values of the writable attributes, written back after the run
+static char saved_attrs[MAX_DEVICES][ARRAY_LEN(sysfs_attrs)][64];
+
+static void save_sysfs(int restore) {
+    char path[256];
+    int dev, fd;
+    size_t i;
+    ssize_t n;
+
+    for (dev = 0; dev < cfg.nr_devices; dev++) {
+        for (i = 0; i < ARRAY_LEN(sysfs_attrs); i++) {
+            sysfs_path(path, sizeof(path), "/sys/class/ai", dev, sysfs_attrs[i]);
+            fd = open(path, restore ? O_WRONLY : O_RDONLY);
+            if (fd < 0) {
+                continue;
+            }
+            if (restore && saved_attrs[dev][i][0]) {
+                n = write(fd, saved_attrs[dev][i], strlen(saved_attrs[dev][i]));
+                (void)n;
+            } else if (!restore) {
+                n = read(fd, saved_attrs[dev][i], sizeof(saved_attrs[dev][i]) - 1);
+                saved_attrs[dev][i][n > 0 ? n : 0] = '\0';
+            }
+            close(fd);
+        }
+    }
+}
+
+// Device threshold, kept by every HW_ADAPT so the model's setting survives the run
+static uint32_t read_threshold(void) {
+    struct ai_status status;
+    int fd = open(cfg.devices[0], O_RDONLY | O_CLOEXEC);
+    uint32_t threshold = 1000;
+
+    if (fd >= 0) {
+        if (ioctl(fd, AI_IOC_GET_STATUS, &status) == 0) {
+            threshold = status.threshold;
+        }
+        close(fd);
+    }
+    return threshold;
+}
+
+static void *load_file(const char *path, size_t *size) {
+    FILE *f = fopen(path, "rb");
+    void *data = NULL;
+    long len;
+
+    if (!f) {
+        return NULL;
+    }
+    if (fseek(f, 0, SEEK_END) == 0 && (len = ftell(f)) > 0 && fseek(f, 0, SEEK_SET) == 0) {
+        data = malloc(len);
+        if (data && fread(data, 1, len, f) != (size_t)len) {
+            free(data);
+            data = NULL;
+        }
+        *size = len;
+    }
+    fclose(f);
+    return data;
+}
+
+static int find_devices(void) {
+    static char names[MAX_DEVICES][32];
+    int i;
+
+    if (access("/dev/ai_driver", F_OK) == 0) {
+        cfg.devices[cfg.nr_devices++] = "/dev/ai_driver";
+        return 0;
+    }
+    for (i = 0; i < 64 && cfg.nr_devices < MAX_DEVICES; i++) {
+        snprintf(names[cfg.nr_devices], sizeof(names[0]), "/dev/ai_driver%d", i);
+        if (access(names[cfg.nr_devices], F_OK) == 0) {
+            cfg.devices[cfg.nr_devices] = names[cfg.nr_devices];
+            cfg.nr_devices++;
+        }
+    }
+    return cfg.nr_devices ? 0 : -1;
+}
+
+// "-o rw,ioctl=50,resize" keeps only the listed operations, with optional weights
+static int parse_ops(char *list) {
+    unsigned int weights[NR_OPS] = { 0 };
+    char *tok, *save = NULL;
+    int i;
+
+    for (tok = strtok_r(list, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        char *eq = strchr(tok, '=');
+
+        if (eq) {
+            *eq++ = '\0';
+        }
+        for (i = 0; i < NR_OPS; i++) {
+            if (strcmp(tok, op_table[i].name) == 0) {
+                weights[i] = eq ? (unsigned int)atoi(eq) : op_table[i].weight;
+                break;
+            }
+        }
+        if (i == NR_OPS) {
+            fprintf(stderr, "Unknown operation '%s'\n", tok);
+            return -1;
+        }
+    }
+    memcpy(cfg.weights, weights, sizeof(weights));
+    return 0;
+}
+
+static void usage(const char *prog) {
+    int i;
+
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -d, --device PATH     Device node, repeat for several instances\n"
+            "                        (default /dev/ai_driver or every /dev/ai_driverN)\n"
+            "  -p, --procs N         Processes (default 2)\n"
+            "  -t, --threads N       Threads per process (default 4)\n"
+            "  -s, --seconds N       Run time (default 10)\n"
+            "  -r, --seed N          Random seed (default from the clock, printed)\n"
+            "  -o, --ops LIST        Operations and optional weights, e.g. rw,ioctl=50\n"
+            "  -k, --kill N          SIGKILL and restart a random process every N seconds\n"
+            "  -S, --sysfs           Also retune the instances through sysfs (restored after)\n"
+            "  -m, --model FILE      Inference model blob to load with AI_IOC_LOAD_INFER_MODEL\n"
+            "  -n, --no-log          Do not scan the kernel log\n"
+            "Operations:",
+            prog);
+    for (i = 0; i < NR_OPS; i++) {
+        fprintf(stderr, " %s", op_table[i].name);
+    }
+    fprintf(stderr, "\n");
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    static const struct option longopts[] = {
+        { "device", required_argument, NULL, 'd' },
+        { "procs", required_argument, NULL, 'p' },
+        { "threads", required_argument, NULL, 't' },
+        { "seconds", required_argument, NULL, 's' },
+        { "seed", required_argument, NULL, 'r' },
+        { "ops", required_argument, NULL, 'o' },
+        { "kill", required_argument, NULL, 'k' },
+        { "sysfs", no_argument, NULL, 'S' },
+        { "model", required_argument, NULL, 'm' },
+        { "no-log", no_argument, NULL, 'n' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+    pid_t *pids;
+    uint64_t start, elapsed, total_calls = 0, total_errors = 0, total_failures = 0;
+    uint64_t kill_rng, next_kill;
+    int opt, i, kmsg, splats, running, killed = 0, crashed = 0, hung = 0;
+
+    for (i = 0; i < NR_OPS; i++) {
+        cfg.weights[i] = i == OP_SYSFS ? 0 : op_table[i].weight;
+    }
+    cfg.seed = now_ns();
+    while ((opt = getopt_long(argc, argv, "d:p:t:s:r:o:k:Sm:nh", longopts, NULL)) != -1) {
+        switch (opt) {
+            case 'd':
+                if (cfg.nr_devices < MAX_DEVICES) {
+                    cfg.devices[cfg.nr_devices++] = optarg;
+                }
+                break;
+            case 'p': cfg.procs = atoi(optarg); break;
+            case 't': cfg.threads = atoi(optarg); break;
+            case 's': cfg.seconds = atoi(optarg); break;
+            case 'r': cfg.seed = strtoull(optarg, NULL, 0); break;
+            case 'o':
+                if (parse_ops(optarg) < 0) {
+                    usage(argv[0]);
+                }
+                break;
+            case 'k': cfg.kill_interval = atoi(optarg); break;
+            case 'S': cfg.sysfs = 1; break;
+            case 'm': cfg.model = optarg; break;
+            case 'n': cfg.check_log = 0; break;
+            default: usage(argv[0]);
+        }
+    }
+    if (cfg.procs < 1 || cfg.threads < 1 || cfg.seconds < 1) {
+        usage(argv[0]);
+    }
+    if (cfg.sysfs && !cfg.weights[OP_SYSFS]) {
+        cfg.weights[OP_SYSFS] = op_table[OP_SYSFS].weight;
+    }
+    if (!cfg.sysfs) {
+        cfg.weights[OP_SYSFS] = 0;
+    }
+    if (!cfg.nr_devices && find_devices() < 0) {
+        fprintf(stderr, "No /dev/ai_driver device found; is the module loaded?\n");
+        return 2;
+    }
+    if (cfg.model && !(cfg.model_data = load_file(cfg.model, &cfg.model_size))) {
+        perror(cfg.model);
+        return 2;
+    }
+
+    stats = mmap(NULL, sizeof(*stats), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    pids = calloc(cfg.procs, sizeof(*pids));
+    if (stats == MAP_FAILED || !pids) {
+        perror("setup");
+        return 2;
+    }
+    page_size = sysconf(_SC_PAGESIZE);
+    stats->threshold = read_threshold();
+    if (cfg.sysfs) {
+        save_sysfs(0);
+    }
+    kmsg = cfg.check_log ? open_kmsg() : -1;
+
+    printf("Torture: %d device(s), %d process(es) x %d thread(s), %d s, seed %#llx%s%s\n",
+           cfg.nr_devices, cfg.procs, cfg.threads, cfg.seconds, (unsigned long long)cfg.seed,
+           cfg.kill_interval ? ", random kills" : "", cfg.sysfs ? ", sysfs" : "");
+    fflush(stdout);
+
+    start = now_ns();
+    deadline_ns = start + (uint64_t)cfg.seconds * 1000000000ULL;
+    for (i = 0; i < cfg.procs; i++) {
+        pids[i] = spawn_child(i, cfg.seed);
+    }
+
+    // Reap the children, killing and restarting one now and then with -k,
+    // and give up on any still running well past the deadline
+    kill_rng = cfg.seed | 1;
+    next_kill = start + (uint64_t)cfg.kill_interval * 1000000000ULL;
+    do {
+        uint64_t now = now_ns();
+
+        running = 0;
+        for (i = 0; i < cfg.procs; i++) {
+            int status;
+
+            if (pids[i] <= 0) {
+                continue;
+            }
+            if (waitpid(pids[i], &status, WNOHANG) == pids[i]) {
+                if (WIFSIGNALED(status) && WTERMSIG(status) != SIGKILL) {
+                    fprintf(stderr, "FAIL child %d killed by signal %d\n", (int)pids[i], WTERMSIG(status));
+                    crashed++;
+                } else if (WIFEXITED(status) && WEXITSTATUS(status)) {
+                    fprintf(stderr, "FAIL child %d exited with %d\n", (int)pids[i], WEXITSTATUS(status));
+                    crashed++;
+                }
+                pids[i] = 0;
+                continue;
+            }
+            if (now > deadline_ns + HUNG_GRACE_S * 1000000000ULL) {
+                dump_hung(pids[i]);
+                kill(pids[i], SIGKILL);
+                pids[i] = 0;
+                hung++;
+                continue;
+            }
+            running++;
+        }
+        if (cfg.kill_interval && now >= next_kill && now + 1000000000ULL < deadline_ns) {
+            i = next_rand(&kill_rng) % cfg.procs;
+            if (pids[i] > 0) {
+                kill(pids[i], SIGKILL);
+                waitpid(pids[i], NULL, 0);
+                killed++;
+                pids[i] = spawn_child(i, cfg.seed + killed);
+                running++;
+            }
+            next_kill = now + (uint64_t)cfg.kill_interval * 1000000000ULL;
+        }
+        if (running) {
+            usleep(50000);
+        }
+    } while (running);
+    elapsed = now_ns() - start;
+
+    if (cfg.sysfs) {
+        save_sysfs(1);
+    }
+    splats = scan_kmsg(kmsg);
+
+    printf("\n%-10s %12s %12s %10s %12s\n", "op", "calls", "errors", "failures", "calls/s");
+    for (i = 0; i < NR_OPS; i++) {
+        if (!stats->calls[i]) {
+            continue;
+        }
+        printf("%-10s %12llu %12llu %10llu %12.0f\n", op_table[i].name,
+               (unsigned long long)stats->calls[i], (unsigned long long)stats->errors[i],
+               (unsigned long long)stats->failures[i], stats->calls[i] * 1e9 / elapsed);
+        total_calls += stats->calls[i];
+        total_errors += stats->errors[i];
+        total_failures += stats->failures[i];
+    }
+    printf("%-10s %12llu %12llu %10llu %12.0f\n", "total", (unsigned long long)total_calls,
+           (unsigned long long)total_errors, (unsigned long long)total_failures, total_calls * 1e9 / elapsed);
+    printf("\n%.1f s, %d kill(s), %d crashed, %d hung, %d kernel log splat(s)%s\n",
+           elapsed / 1e9, killed, crashed, hung, splats, kmsg < 0 ? " (log not checked)" : "");
+
+    free(pids);
+    if (total_failures || crashed || hung || splats) {
+        printf("FAILED (seed %#llx)\n", (unsigned long long)cfg.seed);
+        return 1;
+    }
+    printf("PASSED\n");
+    return 0;
+}
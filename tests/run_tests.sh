@@ -1,14 +1,224 @@
 #!/bin/bash
 
-echo "Compiling ai_driver_test.c..."
-gcc -Wall -pthread -o ai_driver_test ai_driver_test.c -lm
+# run_tests.sh
+# Regression gate for the AI kernel driver. It can:
+# - sim:  build the user-space simulation with ASan/UBSan and run its fuzz
+#         driver and regression tests.
+# - host: build the module for the running kernel, load it with each
+#         configuration in CONFIGS, run ai_torture against it, unload it and
+#         check the kernel log (root needed).
+# - vm:   build a lockdep/KASAN kernel from KDIR with virtme-ng, boot it
+#         in QEMU and run the host stage inside it.
+# - all:  sim, then host (the default).
+#
+# Usage: ./run_tests.sh [sim|host|vm|all] [-s SECONDS] [-o OUT_DIR] [--bench] [-- ai_torture options]
+#
+# Environment:
+#   KDIR          kernel build directory (host, default the running kernel's)
+#                 or kernel source tree (vm, required; v6.1 to v6.3)
+#   FRAGMENT      kernel config fragment for vm (default tests/debug.config)
+#   VM_CPUS       CPUs of the VM (default 4)
+#   VM_MEMORY     memory of the VM (default 4G)
+#   FUZZ_RUNS     sim fuzz inputs (default 20000)
+#
+# The exit status is non-zero if any stage failed. Logs are kept in OUT_DIR.
 
-if [ $? -ne 0 ]; then
-    echo "Compilation failed."
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+REPO_DIR="$(dirname "${SCRIPT_DIR}")"
+MODE="${1:-all}"
+[ $# -gt 0 ] && shift
+OUT_DIR="${SCRIPT_DIR}/out"
+SECONDS_PER_RUN=30
+BENCH=0
+TORTURE_ARGS=()
+FRAGMENT="${FRAGMENT:-${SCRIPT_DIR}/debug.config}"
+VM_CPUS="${VM_CPUS:-4}"
+VM_MEMORY="${VM_MEMORY:-4G}"
+FUZZ_RUNS="${FUZZ_RUNS:-20000}"
+
+# Module parameters of each host run: defaults, several on-demand instances
+# with feature extraction, and small buffers with the autotuner off
+CONFIGS=(
+    ""
+    "num_devices=3 analytics_interval_ms=0 feature_extraction=1"
+    "buffer_size_max=65536 chunk_reserve=0 anomaly_threshold=1000 autotune=0"
+)
+
+# Kernel log lines that fail a run, as in ai_torture.c
+SPLATS='BUG:|WARNING:|Oops|KASAN|UBSAN|KFENCE|kernel BUG|general protection fault|possible circular locking|possible recursive locking|inconsistent lock state|suspicious RCU usage|lock held when returning|sleeping function called from invalid context|blocked for more than|list_add corruption|list_del corruption|refcount_t:|stack-protector|unreferenced object'
+
+usage() {
+    sed -n '3,25p' "$0" | sed 's/^# \{0,1\}//'
     exit 1
-fi
+}
+
+while [ $# -gt 0 ]; do
+    case "$1" in
+        -s) SECONDS_PER_RUN="$2"; shift 2 ;;
+        -o) OUT_DIR="$2"; shift 2 ;;
+        --bench) BENCH=1; shift ;;
+        --) shift; TORTURE_ARGS=("$@"); break ;;
+        *) usage ;;
+    esac
+done
+mkdir -p "${OUT_DIR}" || exit 1
+
+# Step 1: the simulation, under sanitizers
+run_sim() {
+    echo "=== sim: fuzzing the driver under ASan/UBSan (${FUZZ_RUNS} inputs)"
+    make -C "${REPO_DIR}/sim" -s clean &&
+        make -C "${REPO_DIR}/sim" -s SANITIZE=1 &&
+        "${REPO_DIR}/sim/ai_sim_fuzz" -r "${FUZZ_RUNS}" -o "${OUT_DIR}/fuzz_last_input.bin" &&
+        "${REPO_DIR}/sim/ai_sim_test"
+    local ret=$?
+    make -C "${REPO_DIR}/sim" -s clean
+    [ ${ret} -eq 0 ] && echo "sim: PASSED" || echo "sim: FAILED (input in ${OUT_DIR}/fuzz_last_input.bin)"
+    return ${ret}
+}
+
+build_torture() {
+    gcc -Wall -O2 -pthread -o "${OUT_DIR}/ai_torture" "${SCRIPT_DIR}/ai_torture.c"
+}
+
+# Out of tree, so the source directory stays clean
+build_module() {
+    local kdir="$1"
+
+    mkdir -p "${OUT_DIR}/module" &&
+        cp "${REPO_DIR}/src/ai_kernel_driver.c" "${REPO_DIR}/src/ai_driver_trace.h" "${REPO_DIR}/src/Makefile" "${OUT_DIR}/module/" &&
+        make -C "${OUT_DIR}/module" KDIR="${kdir}" > "${OUT_DIR}/module_build.log" 2>&1 ||
+        { cat "${OUT_DIR}/module_build.log"; return 1; }
+}
+
+wait_for_devices() {
+    local i
+
+    for i in $(seq 50); do
+        ls /dev/ai_driver* > /dev/null 2>&1 && return 0
+        sleep 0.1
+    done
+    echo "No /dev/ai_driver node appeared"
+    return 1
+}
+
+# Step 2: one torture run per configuration on the running kernel
+run_configs() {
+    local failed=0 n=0 params log status marker
+
+    if [ -e /sys/kernel/debug/kmemleak ]; then
+        echo clear > /sys/kernel/debug/kmemleak
+    fi
+    printf "%-6s %-70s %-8s %12s\n" "run" "parameters" "result" "ops/s" > "${OUT_DIR}/summary.txt"
+    for params in "${CONFIGS[@]}"; do
+        n=$((n + 1))
+        log="${OUT_DIR}/torture_${n}.log"
+        marker="ai_torture: run ${n} start"
+        echo "=== run ${n}: insmod ai_kernel_driver.ko ${params}"
+        echo "${marker}" > /dev/kmsg
+
+        # shellcheck disable=SC2086
+        if ! insmod "${OUT_DIR}/module/ai_kernel_driver.ko" ${params} || ! wait_for_devices; then
+            status="LOADFAIL"
+        else
+            "${OUT_DIR}/ai_torture" -p 4 -t 4 -s "${SECONDS_PER_RUN}" -k 5 -S "${TORTURE_ARGS[@]}" 2>&1 | tee "${log}"
+            status=$([ "${PIPESTATUS[0]}" -eq 0 ] && echo PASSED || echo FAILED)
+            rmmod ai_kernel_driver || status="RMMODFAIL"
+        fi
+
+        # Anything the unload or the background work logged after the tool stopped looking
+        if [ -e /sys/kernel/debug/kmemleak ]; then
+            echo scan > /sys/kernel/debug/kmemleak
+            grep -B2 -A12 "ai_kernel_driver" /sys/kernel/debug/kmemleak >> "${log}" && status="LEAK"
+        fi
+        if dmesg | sed -n "/${marker}/,\$p" | grep -E "${SPLATS}" >> "${log}"; then
+            [ "${status}" = "PASSED" ] && status="SPLAT"
+        fi
+
+        [ "${status}" = "PASSED" ] || failed=1
+        printf "%-6s %-70s %-8s %12s\n" "${n}" "${params:-defaults}" "${status}" \
+            "$(awk '$1 == "total" { print $5 }' "${log}" 2>/dev/null)" >> "${OUT_DIR}/summary.txt"
+    done
+    echo
+    cat "${OUT_DIR}/summary.txt"
+    return ${failed}
+}
+
+run_host() {
+    local ret
+
+    if [ "$(id -u)" -ne 0 ]; then
+        echo "host: needs root to load the module"
+        return 1
+    fi
+    if lsmod | grep -q "^ai_kernel_driver "; then
+        echo "host: ai_kernel_driver is already loaded; unload it first"
+        return 1
+    fi
+    echo "=== host: building the module and ai_torture"
+    build_module "${KDIR:-/lib/modules/$(uname -r)/build}" && build_torture || return 1
+    run_configs
+    ret=$?
+
+    # Step 3: the benchmark baseline comparison, on a normal kernel only
+    if [ ${BENCH} -eq 1 ]; then
+        echo "=== host: Max_test benchmark"
+        insmod "${OUT_DIR}/module/ai_kernel_driver.ko" && wait_for_devices &&
+            (cd "${REPO_DIR}/Max_test" && ./automated_testing.sh) || ret=1
+        rmmod ai_kernel_driver
+    fi
+    return ${ret}
+}
+
+# Inside the VM: everything was built on the host
+run_guest() {
+    echo 20 > /proc/sys/kernel/hung_task_timeout_secs 2>/dev/null
+    mount -t debugfs none /sys/kernel/debug 2>/dev/null
+    run_configs
+    echo $? > "${OUT_DIR}/guest_status"
+}
+
+# Step 4: the same runs on a debug kernel in a virtme-ng VM
+run_vm() {
+    local version
+
+    if ! command -v vng > /dev/null; then
+        echo "vm: virtme-ng (vng) not found; see tests/README.md"
+        return 1
+    fi
+    if [ -z "${KDIR}" ] || [ ! -f "${KDIR}/Makefile" ]; then
+        echo "vm: set KDIR to a kernel source tree"
+        return 1
+    fi
+    version=$(make -s -C "${KDIR}" kernelversion)
+    case "${version}" in
+        6.[0-3].*|6.[0-3]|5.*) ;;
+        *) echo "vm: warning: the driver targets kernels before 6.4, KDIR is ${version}" ;;
+    esac
+
+    echo "=== vm: building ${version} with ${FRAGMENT}"
+    (cd "${KDIR}" &&
+        vng --kconfig &&
+        ./scripts/kconfig/merge_config.sh -m .config "${FRAGMENT}" &&
+        make olddefconfig &&
+        make -j"$(nproc)") > "${OUT_DIR}/kernel_build.log" 2>&1 ||
+        { tail -n 40 "${OUT_DIR}/kernel_build.log"; return 1; }
+    build_module "${KDIR}" && build_torture || return 1
 
-echo "Running the stress test..."
-sudo ./ai_driver_test > ../logs/test_output.txt
+    echo "=== vm: booting with ${VM_CPUS} CPUs and ${VM_MEMORY}"
+    rm -f "${OUT_DIR}/guest_status"
+    vng --run "${KDIR}" --user root --cpus "${VM_CPUS}" --memory "${VM_MEMORY}" --rwdir "${OUT_DIR}" \
+        -- "${SCRIPT_DIR}/run_tests.sh" guest -s "${SECONDS_PER_RUN}" -o "${OUT_DIR}" -- "${TORTURE_ARGS[@]}"
+    [ "$(cat "${OUT_DIR}/guest_status" 2>/dev/null)" = "0" ]
+}
 
-echo "Stress test completed. Output saved to ../logs/test_output.txt"
+case "${MODE}" in
+    sim) run_sim ;;
+    host) run_host ;;
+    vm) run_vm ;;
+    guest) run_guest ;;
+    all) run_sim && run_host ;;
+    *) usage ;;
+esac
+ret=$?
+[ ${ret} -eq 0 ] && echo "Regression gate PASSED" || echo "Regression gate FAILED (logs in ${OUT_DIR})"
+exit ${ret}